@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/robot-pathfinder-bench.dir/robot-pathfinder-bench.cpp.o"
+  "CMakeFiles/robot-pathfinder-bench.dir/robot-pathfinder-bench.cpp.o.d"
+  "robot-pathfinder-bench"
+  "robot-pathfinder-bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/robot-pathfinder-bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,44 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/robot-anytimeplanner.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-anytimeplanner.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-anytimeplanner.cpp.o.d"
+  "/root/repo/robot-collision.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-collision.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-collision.cpp.o.d"
+  "/root/repo/robot-costmap.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-costmap.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-costmap.cpp.o.d"
+  "/root/repo/robot-curvechain.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-curvechain.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-curvechain.cpp.o.d"
+  "/root/repo/robot-exploration.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-exploration.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-exploration.cpp.o.d"
+  "/root/repo/robot-geometry.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-geometry.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-geometry.cpp.o.d"
+  "/root/repo/robot-hierarchicalplanner.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-hierarchicalplanner.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-hierarchicalplanner.cpp.o.d"
+  "/root/repo/robot-map.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-map.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-map.cpp.o.d"
+  "/root/repo/robot-mapbuilder.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapbuilder.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapbuilder.cpp.o.d"
+  "/root/repo/robot-mapfile.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapfile.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapfile.cpp.o.d"
+  "/root/repo/robot-mapgen.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapgen.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapgen.cpp.o.d"
+  "/root/repo/robot-mapindex.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapindex.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapindex.cpp.o.d"
+  "/root/repo/robot-mapjournal.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapjournal.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapjournal.cpp.o.d"
+  "/root/repo/robot-mapmerge.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mapmerge.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mapmerge.cpp.o.d"
+  "/root/repo/robot-mappipeline.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-mappipeline.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-mappipeline.cpp.o.d"
+  "/root/repo/robot-memory.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-memory.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-memory.cpp.o.d"
+  "/root/repo/robot-parallel.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-parallel.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-parallel.cpp.o.d"
+  "/root/repo/robot-pathsmoother.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-pathsmoother.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-pathsmoother.cpp.o.d"
+  "/root/repo/robot-pipeline.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-pipeline.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-pipeline.cpp.o.d"
+  "/root/repo/robot-polygonindex.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-polygonindex.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-polygonindex.cpp.o.d"
+  "/root/repo/robot-posegraph.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-posegraph.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-posegraph.cpp.o.d"
+  "/root/repo/robot-sensorlog.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-sensorlog.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-sensorlog.cpp.o.d"
+  "/root/repo/robot-simulator.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-simulator.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-simulator.cpp.o.d"
+  "/root/repo/robot-sweep.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-sweep.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-sweep.cpp.o.d"
+  "/root/repo/robot-tiledmap.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-tiledmap.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-tiledmap.cpp.o.d"
+  "/root/repo/robot-trace.cpp" "CMakeFiles/robot-pathfinder-core.dir/robot-trace.cpp.o" "gcc" "CMakeFiles/robot-pathfinder-core.dir/robot-trace.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
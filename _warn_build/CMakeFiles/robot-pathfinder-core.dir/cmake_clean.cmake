@@ -0,0 +1,61 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/robot-pathfinder-core.dir/robot-anytimeplanner.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-anytimeplanner.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-collision.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-collision.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-costmap.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-costmap.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-curvechain.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-curvechain.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-exploration.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-exploration.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-geometry.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-geometry.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-hierarchicalplanner.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-hierarchicalplanner.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-map.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-map.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapbuilder.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapbuilder.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapfile.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapfile.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapgen.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapgen.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapindex.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapindex.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapjournal.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapjournal.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapmerge.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mapmerge.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mappipeline.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-mappipeline.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-memory.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-memory.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-parallel.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-parallel.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-pathsmoother.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-pathsmoother.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-pipeline.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-pipeline.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-polygonindex.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-polygonindex.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-posegraph.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-posegraph.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-sensorlog.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-sensorlog.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-simulator.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-simulator.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-sweep.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-sweep.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-tiledmap.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-tiledmap.cpp.o.d"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-trace.cpp.o"
+  "CMakeFiles/robot-pathfinder-core.dir/robot-trace.cpp.o.d"
+  "librobot-pathfinder-core.a"
+  "librobot-pathfinder-core.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/robot-pathfinder-core.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/robot-pathfinder-replay.dir/robot-pathfinder-replay.cpp.o"
+  "CMakeFiles/robot-pathfinder-replay.dir/robot-pathfinder-replay.cpp.o.d"
+  "robot-pathfinder-replay"
+  "robot-pathfinder-replay.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/robot-pathfinder-replay.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
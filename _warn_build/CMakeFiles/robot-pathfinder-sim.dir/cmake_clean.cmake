@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/robot-pathfinder-sim.dir/robot-pathfinder-sim.cpp.o"
+  "CMakeFiles/robot-pathfinder-sim.dir/robot-pathfinder-sim.cpp.o.d"
+  "robot-pathfinder-sim"
+  "robot-pathfinder-sim.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/robot-pathfinder-sim.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
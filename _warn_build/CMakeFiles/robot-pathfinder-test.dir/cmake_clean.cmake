@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/robot-pathfinder-test.dir/robot-pathfinder-test.cpp.o"
+  "CMakeFiles/robot-pathfinder-test.dir/robot-pathfinder-test.cpp.o.d"
+  "robot-pathfinder-test"
+  "robot-pathfinder-test.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/robot-pathfinder-test.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
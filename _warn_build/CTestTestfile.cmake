@@ -0,0 +1,48 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_warn_build
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(compact "/root/repo/_warn_build/robot-pathfinder-test" "compact")
+set_tests_properties(compact PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;80;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(sensorlog "/root/repo/_warn_build/robot-pathfinder-test" "sensorlog")
+set_tests_properties(sensorlog PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;81;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(collision "/root/repo/_warn_build/robot-pathfinder-test" "collision")
+set_tests_properties(collision PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;82;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(sweep "/root/repo/_warn_build/robot-pathfinder-test" "sweep")
+set_tests_properties(sweep PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;83;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(classify "/root/repo/_warn_build/robot-pathfinder-test" "classify")
+set_tests_properties(classify PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;84;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(anytime "/root/repo/_warn_build/robot-pathfinder-test" "anytime")
+set_tests_properties(anytime PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;85;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(hierarchical "/root/repo/_warn_build/robot-pathfinder-test" "hierarchical")
+set_tests_properties(hierarchical PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;86;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(costmap "/root/repo/_warn_build/robot-pathfinder-test" "costmap")
+set_tests_properties(costmap PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;87;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(journal "/root/repo/_warn_build/robot-pathfinder-test" "journal")
+set_tests_properties(journal PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;88;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(posegraph "/root/repo/_warn_build/robot-pathfinder-test" "posegraph")
+set_tests_properties(posegraph PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;89;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(parallel "/root/repo/_warn_build/robot-pathfinder-test" "parallel")
+set_tests_properties(parallel PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;90;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(mapfile "/root/repo/_warn_build/robot-pathfinder-test" "mapfile")
+set_tests_properties(mapfile PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;91;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(budget "/root/repo/_warn_build/robot-pathfinder-test" "budget")
+set_tests_properties(budget PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;92;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(curves "/root/repo/_warn_build/robot-pathfinder-test" "curves")
+set_tests_properties(curves PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;93;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(mapfile-curves "/root/repo/_warn_build/robot-pathfinder-test" "mapfile-curves")
+set_tests_properties(mapfile-curves PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;94;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(anytime-no-path "/root/repo/_warn_build/robot-pathfinder-test" "anytime-no-path")
+set_tests_properties(anytime-no-path PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;95;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(join-history "/root/repo/_warn_build/robot-pathfinder-test" "join-history")
+set_tests_properties(join-history PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;96;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(compact-crossings "/root/repo/_warn_build/robot-pathfinder-test" "compact-crossings")
+set_tests_properties(compact-crossings PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;97;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(hierarchical-update "/root/repo/_warn_build/robot-pathfinder-test" "hierarchical-update")
+set_tests_properties(hierarchical-update PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;98;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(mapfile-damaged "/root/repo/_warn_build/robot-pathfinder-test" "mapfile-damaged")
+set_tests_properties(mapfile-damaged PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;99;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(sensorlog-failed "/root/repo/_warn_build/robot-pathfinder-test" "sensorlog-failed")
+set_tests_properties(sensorlog-failed PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;100;add_test;/root/repo/CMakeLists.txt;0;")
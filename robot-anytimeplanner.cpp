@@ -0,0 +1,407 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "robot-anytimeplanner.h"
+
+namespace Pathfinder
+{
+  static uint64_t anytimePlannerKey (int32_t x, int32_t y)
+  {
+    return (uint64_t (uint32_t (x)) << 32) | uint32_t (y);
+  }
+
+  static int32_t anytimePlannerX (uint64_t key)
+  {
+    return int32_t (uint32_t (key >> 32));
+  }
+
+  static int32_t anytimePlannerY (uint64_t key)
+  {
+    return int32_t (uint32_t (key));
+  }
+
+  AnytimePlanner::Parameters::Parameters ()
+  : resolution (0.1),
+    clearance (0.3),
+    initial_epsilon (3.0),
+    epsilon_step (0.5),
+    margin (1.0),
+    check_interval (64)
+  {
+  }
+
+  AnytimePlanner::AnytimePlanner (const Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _index (1.0),
+    _box (),
+    _status (STATUS_IDLE),
+    _cancel (false),
+    _from (0, 0),
+    _to (0, 0),
+    _start (0),
+    _goal (0),
+    _min_x (0),
+    _min_y (0),
+    _max_x (0),
+    _max_y (0),
+    _epsilon (parameters.initial_epsilon),
+    _bound (std::numeric_limits<double>::infinity ()),
+    _search (0),
+    _expansions (0),
+    _nodes (),
+    _open (),
+    _incons (),
+    _path (),
+    _path_cost (std::numeric_limits<double>::infinity ())
+  {
+    update ();
+  }
+
+  /* Rebuild the index from the map. A running query is started again.
+   */
+  void AnytimePlanner::update ()
+  {
+    PATHFINDER_TRACE_SCOPE ("AnytimePlanner::update");
+
+    _index.clear ();
+    _box.setEmpty ();
+    for (const MapObject & obj: _map.getObjects ())
+      {
+        _index.insert (obj);
+        _box.extend (obj.getBoundingBox ());
+      }
+    for (const MapObject & obj: _map.getDynamicObjects ())
+      {
+        _index.insert (obj);
+        _box.extend (obj.getBoundingBox ());
+      }
+
+    if (_status == STATUS_SEARCHING || _status == STATUS_IMPROVING)
+      start (_from, _to);
+    else
+      _nodes.clear ();
+  }
+
+  /* Start a query, the search itself is done by plan. Returns STATUS_NO_PATH if from or to is
+   * too close to an object.
+   */
+  AnytimePlanner::Status AnytimePlanner::start (const Position & from, const Position & to)
+  {
+    _cancel = false;
+    _from = from;
+    _to = to;
+    _start = anytimePlannerKey (cell (from.x ()), cell (from.y ()));
+    _goal = anytimePlannerKey (cell (to.x ()), cell (to.y ()));
+
+    Eigen::AlignedBox2d box (_box);
+    box.extend (from);
+    box.extend (to);
+    _min_x = cell (box.min ().x () - _parameters.margin);
+    _min_y = cell (box.min ().y () - _parameters.margin);
+    _max_x = cell (box.max ().x () + _parameters.margin);
+    _max_y = cell (box.max ().y () + _parameters.margin);
+
+    _epsilon = std::max (1.0, _parameters.initial_epsilon);
+    _bound = std::numeric_limits<double>::infinity ();
+    _search = 1;
+    _expansions = 0;
+    _nodes.clear ();
+    _open.clear ();
+    _incons.clear ();
+    _path.clear ();
+    _path_cost = std::numeric_limits<double>::infinity ();
+
+    if (blocked (anytimePlannerX (_start), anytimePlannerY (_start))
+        || blocked (anytimePlannerX (_goal), anytimePlannerY (_goal)))
+      {
+        _status = STATUS_NO_PATH;
+        return _status;
+      }
+
+    node (_start).g = 0.0;
+    push (_start, 0.0);
+    _status = STATUS_SEARCHING;
+    return _status;
+  }
+
+  /* Search until the deadline, the path is optimal or the query is cancelled. Each search
+   * finished publishes its path.
+   */
+  AnytimePlanner::Status AnytimePlanner::plan (std::chrono::steady_clock::time_point deadline)
+  {
+    PATHFINDER_TRACE_SCOPE ("AnytimePlanner::plan");
+
+    while (_status == STATUS_SEARCHING || _status == STATUS_IMPROVING)
+      {
+        bool done = improvePath (deadline);
+        if (_cancel)
+          _status = STATUS_CANCELLED;
+        if (!done || _status == STATUS_CANCELLED)
+          break;
+
+        if (std::isinf (node (_goal).g))
+          {
+            _status = STATUS_NO_PATH;
+            break;
+          }
+
+        // The bound of ARA*: No path can be cheaper than the smallest g + h of the states not
+        // expanded yet (with the current g values).
+        double min_f = std::numeric_limits<double>::infinity ();
+        for (const Entry & e: _open)
+          {
+            const Node & n = node (e.key);
+            if (n.open && n.g == e.g)
+              min_f = std::min (min_f, n.g + heuristic (e.key));
+          }
+        for (uint64_t key: _incons)
+          min_f = std::min (min_f, node (key).g + heuristic (key));
+
+        publishPath ();
+        _bound = std::max (1.0, std::min (_epsilon, _path_cost / min_f));
+        if (_epsilon <= 1.0 || _bound <= 1.0)
+          {
+            _bound = 1.0;
+            _status = STATUS_OPTIMAL;
+            break;
+          }
+
+        _status = STATUS_IMPROVING;
+        nextSearch ();
+        if (std::chrono::steady_clock::now () >= deadline)
+          break;
+      }
+
+    return _status;
+  }
+
+  /* Stop the query at the next check, the path found so far is kept.
+   */
+  void AnytimePlanner::cancel ()
+  {
+    _cancel = true;
+  }
+
+  AnytimePlanner::Status AnytimePlanner::getStatus () const
+  {
+    return _status;
+  }
+
+  /* The cost of the current path is at most this factor times the optimal cost (infinite
+   * without a path).
+   */
+  double AnytimePlanner::getBound () const
+  {
+    return _bound;
+  }
+
+  double AnytimePlanner::getEpsilon () const
+  {
+    return _epsilon;
+  }
+
+  /* The best path found, from the start to the goal position. The positions in between are
+   * cell centers.
+   */
+  const PositionVector & AnytimePlanner::getPath () const
+  {
+    return _path;
+  }
+
+  /* Cost (length) of the path on the grid, from the cell of the start to the cell of the goal.
+   */
+  double AnytimePlanner::getPathCost () const
+  {
+    return _path_cost;
+  }
+
+  uint64_t AnytimePlanner::getExpansions () const
+  {
+    return _expansions;
+  }
+
+  const AnytimePlanner::Parameters & AnytimePlanner::getParameters () const
+  {
+    return _parameters;
+  }
+
+  /* The node of a cell, created on first use. Elements of an unordered_map keep their address,
+   * so references stay valid while other nodes are added. Cells beyond the grid are blocked.
+   */
+  AnytimePlanner::Node & AnytimePlanner::node (uint64_t key)
+  {
+    auto found = _nodes.find (key);
+    if (found != _nodes.end ())
+      return found->second;
+
+    Node n;
+    n.g = std::numeric_limits<double>::infinity ();
+    n.parent = key;
+    n.closed = 0;
+    int32_t x = anytimePlannerX (key);
+    int32_t y = anytimePlannerY (key);
+    n.blocked = x < _min_x || x > _max_x || y < _min_y || y > _max_y
+                || _index.isNear (Position ((x + 0.5) * _parameters.resolution, (y + 0.5) * _parameters.resolution),
+                                  _parameters.clearance);
+    n.open = false;
+    n.incons = false;
+    return _nodes.emplace (key, n).first->second;
+  }
+
+  bool AnytimePlanner::blocked (int32_t x, int32_t y)
+  {
+    return node (anytimePlannerKey (x, y)).blocked;
+  }
+
+  /* Octile distance to the goal, the length of the shortest 8-connected path without obstacles.
+   */
+  double AnytimePlanner::heuristic (uint64_t key) const
+  {
+    double dx = std::abs (anytimePlannerX (key) - anytimePlannerX (_goal));
+    double dy = std::abs (anytimePlannerY (key) - anytimePlannerY (_goal));
+    return (std::max (dx, dy) + (M_SQRT2 - 1.0) * std::min (dx, dy)) * _parameters.resolution;
+  }
+
+  void AnytimePlanner::push (uint64_t key, double g)
+  {
+    node (key).open = true;
+    Entry e;
+    e.f = g + _epsilon * heuristic (key);
+    e.g = g;
+    e.key = key;
+    _open.push_back (e);
+    std::push_heap (_open.begin (), _open.end ());
+  }
+
+  /* One search of ARA*: Expand the open states until the goal has the smallest f value. A state
+   * is expanded at most once per search, states improved after that are collected in _incons
+   * for the next search.
+   *
+   * Returns false if stopped by the deadline or cancel before the search was done.
+   */
+  bool AnytimePlanner::improvePath (std::chrono::steady_clock::time_point deadline)
+  {
+    static const int32_t dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+    static const int32_t dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+    double res = _parameters.resolution;
+    const Node & goal = node (_goal);
+    uint32_t since_check = 0;
+
+    while (!_open.empty ())
+      {
+        if (++since_check >= _parameters.check_interval)
+          {
+            since_check = 0;
+            if (_cancel || std::chrono::steady_clock::now () >= deadline)
+              return false;
+          }
+
+        Entry top = _open.front ();
+        if (goal.g <= top.f)
+          return true;
+
+        std::pop_heap (_open.begin (), _open.end ());
+        _open.pop_back ();
+        Node & n = node (top.key);
+        if (!n.open || n.g != top.g)
+          continue;
+
+        n.open = false;
+        n.closed = _search;
+        ++_expansions;
+
+        int32_t x = anytimePlannerX (top.key);
+        int32_t y = anytimePlannerY (top.key);
+        for (int k=0; k < 8; ++k)
+          {
+            int32_t nx = x + dx[k];
+            int32_t ny = y + dy[k];
+            if (blocked (nx, ny) || (k >= 4 && (blocked (nx, y) || blocked (x, ny))))
+              continue;
+
+            uint64_t key = anytimePlannerKey (nx, ny);
+            Node & m = node (key);
+            double g = n.g + (k < 4 ? res : M_SQRT2 * res);
+            if (g >= m.g)
+              continue;
+
+            m.g = g;
+            m.parent = top.key;
+            if (m.closed != _search)
+              push (key, g);
+            else if (!m.incons)
+              {
+                m.incons = true;
+                _incons.push_back (key);
+              }
+          }
+      }
+
+    return true;
+  }
+
+  /* Lower the inflation and start the next search with the open and inconsistent states.
+   */
+  void AnytimePlanner::nextSearch ()
+  {
+    _epsilon = std::max (1.0, _epsilon - _parameters.epsilon_step);
+    ++_search;
+
+    std::vector<Entry> entries;
+    entries.swap (_open);
+    for (const Entry & e: entries)
+      {
+        Node & n = node (e.key);
+        if (n.open && n.g == e.g)
+          {
+            Entry updated = e;
+            updated.f = n.g + _epsilon * heuristic (e.key);
+            _open.push_back (updated);
+          }
+      }
+
+    for (uint64_t key: _incons)
+      {
+        Node & n = node (key);
+        n.incons = false;
+        if (!n.open)
+          {
+            n.open = true;
+            Entry e;
+            e.f = n.g + _epsilon * heuristic (key);
+            e.g = n.g;
+            e.key = key;
+            _open.push_back (e);
+          }
+      }
+    _incons.clear ();
+
+    std::make_heap (_open.begin (), _open.end ());
+  }
+
+  void AnytimePlanner::publishPath ()
+  {
+    _path.clear ();
+    _path_cost = node (_goal).g;
+
+    _path.push_back (_to);
+    if (_goal != _start)
+      for (uint64_t key = node (_goal).parent; key != _start; key = node (key).parent)
+        _path.push_back (Position ((anytimePlannerX (key) + 0.5) * _parameters.resolution,
+                                   (anytimePlannerY (key) + 0.5) * _parameters.resolution));
+    _path.push_back (_from);
+
+    std::reverse (_path.begin (), _path.end ());
+  }
+
+  int32_t AnytimePlanner::cell (double v) const
+  {
+    return static_cast<int32_t> (std::floor (v / _parameters.resolution));
+  }
+}
@@ -0,0 +1,137 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_ANYTIMEPLANNER_H
+#define ROBOT_ANYTIMEPLANNER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-mapindex.h"
+
+namespace Pathfinder
+{
+  /* Path planning within a fixed time slice: Anytime Repairing A* (ARA*) on an 8-connected grid
+   * over the map.
+   *
+   * The first search is a weighted A* with the heuristic inflated by initial_epsilon, which
+   * finds a path quickly. Each following search lowers the inflation by epsilon_step and reuses
+   * the states of the previous ones, until the path is optimal (on the grid). The cost of the
+   * current path is at most getBound () times the optimal cost.
+   *
+   * plan works until the deadline and returns, the search is resumed by the next call, e.g. in
+   * the next control cycle. The deadline is checked every check_interval expansions, which caps
+   * the time plan overshoots it. cancel may be called from any thread.
+   *
+   * A cell is free if no object is closer than clearance to its center; the cells are checked
+   * when the search first reaches them, so the costs depend on the area searched, not on the
+   * size of the map. Diagonal steps must not cut the corner of a blocked cell. The grid covers
+   * the bounding box of the map, start and goal, grown by margin; the cells beyond are blocked,
+   * so the search runs out of states and ends with STATUS_NO_PATH if the goal can't be reached.
+   * The planner keeps its own index of the map (both layers), update () has to be called after
+   * the map changed and restarts the search.
+   */
+  class AnytimePlanner
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double resolution;            // grid cell size
+          double clearance;             // min. distance of the path to any object
+          double initial_epsilon;       // heuristic inflation of the first search
+          double epsilon_step;          // decrease of the inflation per search
+          double margin;                // added around the bounding box of the map, start and goal
+          uint32_t check_interval;      // expansions between checks of deadline and cancel
+      };
+
+      enum Status
+      {
+        STATUS_IDLE,                    // no query
+        STATUS_SEARCHING,               // no path found yet
+        STATUS_IMPROVING,               // a path was found, it may still get shorter
+        STATUS_OPTIMAL,
+        STATUS_NO_PATH,
+        STATUS_CANCELLED
+      };
+
+      AnytimePlanner (const Map & map, const Parameters & parameters);
+
+      void update ();
+      Status start (const Position & from, const Position & to);
+      Status plan (std::chrono::steady_clock::time_point deadline);
+      void cancel ();
+
+      Status getStatus () const;
+      double getBound () const;
+      double getEpsilon () const;
+      const PositionVector & getPath () const;
+      double getPathCost () const;
+      uint64_t getExpansions () const;
+      const Parameters & getParameters () const;
+
+    private:
+      struct Node
+      {
+          double g;
+          uint64_t parent;
+          uint32_t closed;              // search which expanded the node, 0: none
+          bool blocked;
+          bool open;
+          bool incons;                  // improved after it was expanded in the current search
+      };
+
+      struct Entry
+      {
+          double f;
+          double g;
+          uint64_t key;
+
+          bool operator< (const Entry & other) const { return f > other.f || (f == other.f && g < other.g); }
+      };
+
+      Node & node (uint64_t key);
+      bool blocked (int32_t x, int32_t y);
+      double heuristic (uint64_t key) const;
+      void push (uint64_t key, double g);
+      bool improvePath (std::chrono::steady_clock::time_point deadline);
+      void nextSearch ();
+      void publishPath ();
+      int32_t cell (double v) const;
+
+      const Map & _map;
+      Parameters _parameters;
+      MapIndex _index;
+      Eigen::AlignedBox2d _box;                 // of the map, when the index was built
+
+      Status _status;
+      std::atomic<bool> _cancel;
+      Position _from;
+      Position _to;
+      uint64_t _start;
+      uint64_t _goal;
+      int32_t _min_x;                           // cells of the grid, inclusive
+      int32_t _min_y;
+      int32_t _max_x;
+      int32_t _max_y;
+      double _epsilon;
+      double _bound;
+      uint32_t _search;
+      uint64_t _expansions;
+
+      std::unordered_map<uint64_t, Node> _nodes;
+      std::vector<Entry> _open;                 // binary heap, with outdated entries
+      std::vector<uint64_t> _incons;
+
+      PositionVector _path;
+      double _path_cost;
+  };
+}
+
+#endif
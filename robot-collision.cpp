@@ -0,0 +1,328 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "robot-collision.h"
+#include "robot-parallel.h"
+
+namespace Pathfinder
+{
+  /* Pose at fraction f between from and to, moving and turning uniformly.
+   */
+  static Transformation collisionInterpolate (const Transformation & from, const Transformation & to, double f)
+  {
+    double r0 = from.getRotation ();
+    double dr = std::remainder (to.getRotation () - r0, 2.0 * M_PI);
+    Position t (from.getTranslation () + (to.getTranslation () - from.getTranslation ()) * f);
+    return Transformation (t, r0 + dr * f, 1.0);
+  }
+
+  /* The shapes are convex polygons given by their vertices (without repeating the first one),
+   * one vertex is a point, two are a segment.
+   */
+  static uint32_t collisionEdgeCount (const PositionVector & shape)
+  {
+    return shape.size () < 3 ? std::min<uint32_t> (shape.size (), 1) : shape.size ();
+  }
+
+  static LineSegment collisionEdge (const PositionVector & shape, uint32_t i)
+  {
+    return LineSegment (shape[i], shape[(i + 1) % shape.size ()]);
+  }
+
+  static bool collisionContains (const PositionVector & shape, const Position & pos)
+  {
+    if (shape.size () < 3)
+      return false;
+
+    bool positive = false;
+    bool negative = false;
+    for (uint32_t i=0; i < shape.size (); ++i)
+      {
+        const Position & a = shape[i];
+        const Position & b = shape[(i + 1) % shape.size ()];
+        double cross = (b.x () - a.x ()) * (pos.y () - a.y ()) - (b.y () - a.y ()) * (pos.x () - a.x ());
+        positive |= cross > 0;
+        negative |= cross < 0;
+      }
+
+    return !(positive && negative);
+  }
+
+  static double collisionSegmentDistance (const PositionVector & shape, const LineSegment & segment)
+  {
+    if (collisionContains (shape, segment.getPosition1 ()))
+      return 0.0;
+
+    double best = std::numeric_limits<double>::infinity ();
+    for (uint32_t i=0; i < collisionEdgeCount (shape); ++i)
+      best = std::min (best, collisionEdge (shape, i).distance (segment));
+
+    return best;
+  }
+
+  static double collisionShapeDistance (const PositionVector & a, const PositionVector & b)
+  {
+    if (collisionContains (a, b[0]) || collisionContains (b, a[0]))
+      return 0.0;
+
+    double best = std::numeric_limits<double>::infinity ();
+    for (uint32_t i=0; i < collisionEdgeCount (b); ++i)
+      best = std::min (best, collisionSegmentDistance (a, collisionEdge (b, i)));
+
+    return best;
+  }
+
+  Footprint::Footprint ()
+  : _radius (0.0),
+    _polygon ()
+  {
+  }
+
+  Footprint Footprint::circle (double radius)
+  {
+    Footprint footprint;
+    footprint._radius = radius;
+    return footprint;
+  }
+
+  /* A convex polygon, e.g. the points of the robot outline after MapObject::convexHull.
+   */
+  Footprint Footprint::polygon (const MapObject & hull)
+  {
+    Footprint footprint;
+    footprint._polygon.assign (hull.getPolygon ().begin (), hull.getPolygon ().end ());
+    if (footprint._polygon.size () > 1 && footprint._polygon.front () == footprint._polygon.back ())
+      footprint._polygon.pop_back ();
+
+    for (const Position & p: footprint._polygon)
+      footprint._radius = std::max (footprint._radius, p.norm ());
+
+    return footprint;
+  }
+
+  bool Footprint::isCircle () const
+  {
+    return _polygon.empty ();
+  }
+
+  double Footprint::getRadius () const
+  {
+    return _radius;
+  }
+
+  const PositionVector & Footprint::getPolygon () const
+  {
+    return _polygon;
+  }
+
+  CollisionChecker::Parameters::Parameters ()
+  : cell_size (0.5),
+    max_clearance (1.0),
+    max_rotation_step (0.1),
+    threads (0)
+  {
+  }
+
+  CollisionChecker::CollisionChecker (const Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _index (parameters.cell_size),
+    _obstacles ()
+  {
+    update ();
+  }
+
+  const CollisionChecker::Parameters & CollisionChecker::getParameters () const
+  {
+    return _parameters;
+  }
+
+  /* Rebuild the index and the hulls of the objects from the map.
+   */
+  void CollisionChecker::update ()
+  {
+    PATHFINDER_TRACE_SCOPE ("CollisionChecker::update");
+
+    _index.clear ();
+    _obstacles.clear ();
+
+    for (const MapObject & obj: _map.getObjects ())
+      addObstacle (obj, _obstacles.size ());
+    for (const MapObject & obj: _map.getDynamicObjects ())
+      addObstacle (obj, _obstacles.size ());
+  }
+
+  void CollisionChecker::addObstacle (const MapObject & obj, uint32_t id)
+  {
+    Obstacle obstacle;
+    obstacle.box = obj.getBoundingBox ();
+
+    MapObject hull = obj;
+    hull.convexHull ();
+    obstacle.hull.assign (hull.getPolygon ().begin (), hull.getPolygon ().end ());
+    if (obstacle.hull.size () > 1 && obstacle.hull.front () == obstacle.hull.back ())
+      obstacle.hull.pop_back ();
+
+    _obstacles.push_back (obstacle);
+    _index.insert (obj, id);
+  }
+
+  /* Check the trajectory until the first collision.
+   */
+  CollisionChecker::Result CollisionChecker::check (const Footprint & footprint, const Trajectory & trajectory) const
+  {
+    PATHFINDER_TRACE_SCOPE ("CollisionChecker::check");
+
+    Result result;
+    result.collision = false;
+    result.time = std::numeric_limits<double>::infinity ();
+    result.clearance = _parameters.max_clearance;
+    result.object = 0xffffffff;
+
+    PositionVector area;
+    std::vector<uint32_t> segments;
+    uint32_t steps = trajectory.poses.size () > 1 ? trajectory.poses.size () - 1 : trajectory.poses.size ();
+
+    for (uint32_t i=0; i < steps; ++i)
+      {
+        const Transformation & from = trajectory.poses[i];
+        const Transformation & to = trajectory.poses[std::min<uint32_t> (i + 1, trajectory.poses.size () - 1)];
+        double t0 = trajectory.times[i];
+        double t1 = trajectory.times[std::min<uint32_t> (i + 1, trajectory.times.size () - 1)];
+
+        double turn = std::fabs (std::remainder (to.getRotation () - from.getRotation (), 2.0 * M_PI));
+        uint32_t parts = std::max (1.0, std::ceil (turn / _parameters.max_rotation_step));
+
+        for (uint32_t j=0; j < parts; ++j)
+          {
+            Transformation a = parts > 1 ? collisionInterpolate (from, to, double (j) / parts) : from;
+            Transformation b = parts > 1 ? collisionInterpolate (from, to, double (j + 1) / parts) : to;
+            sweep (footprint, a, b, area);
+
+            uint32_t object;
+            double d = distance (area, footprint.isCircle () ? footprint.getRadius () : 0.0,
+                                 result.clearance, segments, &object);
+            if (d >= result.clearance)
+              continue;
+
+            result.clearance = d;
+            result.object = object;
+            if (d > 0.0)
+              continue;
+
+            // Bisect the time of the first contact: Sweeping up to it touches the object.
+            // The limit has to be positive, distance returns it if nothing is closer.
+            double lo = 0.0;
+            double hi = 1.0;
+            for (uint32_t k=0; k < 10; ++k)
+              {
+                double mid = (lo + hi) / 2.0;
+                sweep (footprint, a, collisionInterpolate (a, b, mid), area);
+                if (distance (area, footprint.isCircle () ? footprint.getRadius () : 0.0, 1e-9, segments, &object) <= 0.0)
+                  hi = mid;
+                else
+                  lo = mid;
+              }
+
+            double f = (j + hi) / parts;
+            result.collision = true;
+            result.time = t0 + (t1 - t0) * f;
+            return result;
+          }
+      }
+
+    return result;
+  }
+
+  /* Check many trajectories in parallel, results[i] is the result of trajectories[i].
+   */
+  void CollisionChecker::checkBatch (const Footprint & footprint, const std::vector<Trajectory> & trajectories,
+                                     std::vector<Result> & results) const
+  {
+    PATHFINDER_TRACE_SCOPE ("CollisionChecker::checkBatch");
+
+    results.resize (trajectories.size ());
+    parallelFor (trajectories.size (), _parameters.threads > 0 ? _parameters.threads : defaultThreadCount (),
+                 [&] (uint32_t i)
+                 {
+                   results[i] = check (footprint, trajectories[i]);
+                 });
+  }
+
+  /* The area swept by the footprint from one pose to the other (without rotation in between):
+   * The convex hull of the polygon at both poses, or the segment between the centers of a circle.
+   */
+  void CollisionChecker::sweep (const Footprint & footprint, const Transformation & from, const Transformation & to,
+                                PositionVector & area) const
+  {
+    area.clear ();
+    if (footprint.isCircle ())
+      {
+        area.push_back (from.getTranslation ());
+        if (to.getTranslation () != from.getTranslation ())
+          area.push_back (to.getTranslation ());
+        return;
+      }
+
+    MapObject hull (0.0);
+    PositionVector points;
+    for (const Position & p: footprint.getPolygon ())
+      {
+        points.push_back (from.transformPosition (p));
+        points.push_back (to.transformPosition (p));
+      }
+    hull.setPolygon (points);
+    hull.convexHull ();
+
+    area.assign (hull.getPolygon ().begin (), hull.getPolygon ().end ());
+    if (area.size () > 1 && area.front () == area.back ())
+      area.pop_back ();
+  }
+
+  /* Distance of the area, widened by radius, to the closest object, if closer than limit.
+   * Otherwise limit is returned.
+   */
+  double CollisionChecker::distance (const PositionVector & area, double radius, double limit,
+                                     std::vector<uint32_t> & segments, uint32_t * object) const
+  {
+    Eigen::AlignedBox2d box;
+    for (const Position & p: area)
+      box.extend (p);
+
+    Eigen::AlignedBox2d search (box.min () - Eigen::Vector2d::Constant (radius + limit),
+                                box.max () + Eigen::Vector2d::Constant (radius + limit));
+    _index.findSegments (search, segments);
+
+    double best = limit + radius;
+    for (uint32_t i=0; i < segments.size () && best > 0.0;)
+      {
+        // The segments of an object are in a row in the index.
+        uint32_t id = _index.getSegmentObject (segments[i]);
+        uint32_t end = i;
+        while (end < segments.size () && _index.getSegmentObject (segments[end]) == id)
+          ++end;
+
+        const Obstacle & obstacle = _obstacles[id];
+        if (obstacle.box.exteriorDistance (box) < best
+            && (obstacle.hull.size () < 3 || collisionShapeDistance (area, obstacle.hull) < best))
+          for (uint32_t k=i; k < end; ++k)
+            {
+              double d = collisionSegmentDistance (area, _index.getSegment (segments[k]));
+              if (d < best)
+                {
+                  best = d;
+                  *object = id;
+                }
+            }
+
+        i = end;
+      }
+
+    return std::max (0.0, best - radius);
+  }
+}
@@ -0,0 +1,105 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_COLLISION_H
+#define ROBOT_COLLISION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-mapindex.h"
+
+namespace Pathfinder
+{
+  /* The shape of the robot in robot coordinates: A circle around the origin or a convex polygon.
+   */
+  class Footprint
+  {
+    public:
+      static Footprint circle (double radius);
+      static Footprint polygon (const MapObject & hull);
+
+      bool isCircle () const;
+      double getRadius () const;
+      const PositionVector & getPolygon () const;
+
+    private:
+      Footprint ();
+
+      double _radius;             // of the circle, or of the bounding circle of the polygon
+      PositionVector _polygon;    // without repeating the first point, empty for a circle
+  };
+
+  /* Poses of the robot in map coordinates at increasing times. Between two poses, the robot
+   * moves and turns uniformly.
+   */
+  struct Trajectory
+  {
+      std::vector<double> times;
+      std::vector<Transformation> poses;
+  };
+
+  /* Checks trajectories of a footprint against the objects of a map (both layers).
+   *
+   * Each step between two poses is checked with the area swept by the footprint: the convex
+   * hull of the footprint at both poses, steps turning more than max_rotation_step are split.
+   * Broad phase: only the segments of the index cells touched by the swept area are looked at,
+   * and only of the objects whose bounding box and convex hull are close enough. Narrow phase:
+   * the exact distance of the swept area to these segments.
+   *
+   * The checker keeps its own index of the map, update () has to be called after the map
+   * changed. check and checkBatch may be called from several threads.
+   */
+  class CollisionChecker
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double cell_size;           // of the spatial index
+          double max_clearance;       // clearances are only determined up to this distance
+          double max_rotation_step;   // radian
+          uint32_t threads;           // for checkBatch, 0: number of cores
+      };
+
+      struct Result
+      {
+          bool collision;
+          double time;                // of the first collision, if any
+          double clearance;           // min. distance to any object until then, up to max_clearance
+          uint32_t object;            // closest object: static index, or object count + dynamic index
+      };
+
+      CollisionChecker (const Map & map, const Parameters & parameters);
+
+      void update ();
+      Result check (const Footprint & footprint, const Trajectory & trajectory) const;
+      void checkBatch (const Footprint & footprint, const std::vector<Trajectory> & trajectories,
+                       std::vector<Result> & results) const;
+
+      const Parameters & getParameters () const;
+
+    private:
+      struct Obstacle
+      {
+          Eigen::AlignedBox2d box;
+          PositionVector hull;        // closed convex polygon, or the points of small objects
+      };
+
+      void addObstacle (const MapObject & obj, uint32_t id);
+      void sweep (const Footprint & footprint, const Transformation & from, const Transformation & to,
+                  PositionVector & area) const;
+      double distance (const PositionVector & area, double radius, double limit,
+                       std::vector<uint32_t> & segments, uint32_t * object) const;
+
+      const Map & _map;
+      Parameters _parameters;
+      MapIndex _index;
+      std::vector<Obstacle,Eigen::aligned_allocator<Obstacle>> _obstacles;
+  };
+}
+
+#endif
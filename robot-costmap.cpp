@@ -0,0 +1,405 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "robot-costmap.h"
+#include "robot-trace.h"
+
+namespace Pathfinder
+{
+  static const uint32_t costmapAlignment = 64;
+
+  static uint64_t costmapNow ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  /* The first byte of storage at a multiple of costmapAlignment.
+   */
+  static size_t costmapOffset (const std::vector<uint8_t> & storage)
+  {
+    return (costmapAlignment - reinterpret_cast<uintptr_t> (storage.data ()) % costmapAlignment) % costmapAlignment;
+  }
+
+  const uint8_t Costmap::COST_FREE;
+  const uint8_t Costmap::COST_INSCRIBED;
+  const uint8_t Costmap::COST_LETHAL;
+
+  Costmap::Parameters::Parameters ()
+  : resolution (0.05),
+    inscribed_radius (0.3),
+    inflation_radius (1.0),
+    cost_scaling (3.0),
+    margin (1.0),
+    dynamic_layer (true)
+  {
+  }
+
+  Costmap::Costmap (const Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _stats (),
+    _version (0),
+    _origin_x (0.0),
+    _origin_y (0.0),
+    _width (0),
+    _height (0),
+    _stride (0),
+    _radius (0),
+    _cost_table (),
+    _costs (),
+    _static_layer (),
+    _dynamic_layer (),
+    _buckets (),
+    _seen ()
+  {
+    rebuild ();
+  }
+
+  /* Fit the raster to the map and compute everything.
+   */
+  void Costmap::rebuild ()
+  {
+    PATHFINDER_TRACE_SCOPE ("Costmap::rebuild");
+
+    uint64_t t0 = costmapNow ();
+    _version = _map.getVersion ();
+
+    Eigen::AlignedBox2d box;
+    for (uint32_t i=0; i < _map.getObjectCount (); ++i)
+      box.extend (_map.getObjectBox (i));
+    for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+      box.extend (_map.getDynamicObjectBox (i));
+    if (box.isEmpty ())
+      box = Eigen::AlignedBox2d (Position (0, 0), Position (0, 0));
+
+    // aligned to the resolution, so the cells stay the same when the map grows
+    double res = _parameters.resolution;
+    _origin_x = std::floor ((box.min ().x () - _parameters.margin) / res) * res;
+    _origin_y = std::floor ((box.min ().y () - _parameters.margin) / res) * res;
+    _width = std::ceil ((box.max ().x () + _parameters.margin - _origin_x) / res);
+    _height = std::ceil ((box.max ().y () + _parameters.margin - _origin_y) / res);
+    _stride = (_width + costmapAlignment - 1) / costmapAlignment * costmapAlignment;
+
+    size_t size = size_t (_stride) * _height + costmapAlignment;
+    _costs.assign (size, COST_FREE);
+    _static_layer.assign (size, 0);
+    _dynamic_layer.assign (size, 0);
+
+    _radius = std::ceil (_parameters.inflation_radius / res);
+    _cost_table.resize (_radius * _radius + 1);
+    for (int32_t d2=0; d2 <= _radius * _radius; ++d2)
+      {
+        double d = std::sqrt (double (d2)) * res;
+        if (d2 == 0)
+          _cost_table[d2] = COST_LETHAL;
+        else if (d <= _parameters.inscribed_radius)
+          _cost_table[d2] = COST_INSCRIBED;
+        else if (d > _parameters.inflation_radius)
+          _cost_table[d2] = COST_FREE;
+        else
+          _cost_table[d2] = (COST_INSCRIBED - 1) * std::exp (-_parameters.cost_scaling * (d - _parameters.inscribed_radius));
+      }
+    _buckets.resize (_cost_table.size ());
+
+    Window all;
+    all.x0 = 0;
+    all.y0 = 0;
+    all.x1 = _width;
+    all.y1 = _height;
+    rasterize (all);
+    inflate (all);
+
+    ++_stats.rebuilds;
+    _stats.cells += uint64_t (_width) * _height;
+    _stats.update_us += (costmapNow () - t0) / 1000.0;
+  }
+
+  /* Catch up with the changes of the map since the last update.
+   */
+  void Costmap::update ()
+  {
+    PATHFINDER_TRACE_SCOPE ("Costmap::update");
+
+    ++_stats.updates;
+    Map::RegionVector regions;
+    if (!_map.getChangedRegions (_version, regions))
+      {
+        rebuild ();
+        return;
+      }
+
+    for (const Eigen::AlignedBox2d & region: regions)
+      if (!covers (region))
+        {
+          rebuild ();
+          return;
+        }
+
+    uint64_t t0 = costmapNow ();
+    _version = _map.getVersion ();
+    for (const Eigen::AlignedBox2d & region: regions)
+      {
+        // the occupied cells within the region changed, the costs within inflation_radius of it
+        Window w = window (region);
+        rasterize (w);
+        Window affected;
+        affected.x0 = std::max (0, w.x0 - _radius);
+        affected.y0 = std::max (0, w.y0 - _radius);
+        affected.x1 = std::min (_width, w.x1 + _radius);
+        affected.y1 = std::min (_height, w.y1 + _radius);
+        inflate (affected);
+        ++_stats.regions;
+        _stats.cells += uint64_t (affected.x1 - affected.x0) * (affected.y1 - affected.y0);
+      }
+    _stats.update_us += (costmapNow () - t0) / 1000.0;
+  }
+
+  /* Costs of the cell (x, y) at getCosts ()[y * getStride () + x].
+   */
+  const uint8_t * Costmap::getCosts () const
+  {
+    return row (_costs, 0);
+  }
+
+  /* Occupied cells (1) of a layer, in the same layout as the costs.
+   */
+  const uint8_t * Costmap::getLayer (Layer layer) const
+  {
+    return row (layer == LAYER_STATIC ? _static_layer : _dynamic_layer, 0);
+  }
+
+  uint32_t Costmap::getStride () const
+  {
+    return _stride;
+  }
+
+  uint32_t Costmap::getWidth () const
+  {
+    return _width;
+  }
+
+  uint32_t Costmap::getHeight () const
+  {
+    return _height;
+  }
+
+  /* Position of the corner of the cell (0, 0).
+   */
+  Position Costmap::getOrigin () const
+  {
+    return Position (_origin_x, _origin_y);
+  }
+
+  /* Positions outside of the raster are lethal.
+   */
+  uint8_t Costmap::getCost (const Position & pos) const
+  {
+    int32_t x = std::floor ((pos.x () - _origin_x) / _parameters.resolution);
+    int32_t y = std::floor ((pos.y () - _origin_y) / _parameters.resolution);
+    if (x < 0 || y < 0 || x >= _width || y >= _height)
+      return COST_LETHAL;
+
+    return row (_costs, y)[x];
+  }
+
+  /* The version of the map the costs are up to date with.
+   */
+  uint64_t Costmap::getVersion () const
+  {
+    return _version;
+  }
+
+  const Costmap::Parameters & Costmap::getParameters () const
+  {
+    return _parameters;
+  }
+
+  const Costmap::Stats & Costmap::getStats () const
+  {
+    return _stats;
+  }
+
+  uint8_t * Costmap::row (std::vector<uint8_t> & storage, int32_t y)
+  {
+    return storage.data () + costmapOffset (storage) + size_t (y) * _stride;
+  }
+
+  const uint8_t * Costmap::row (const std::vector<uint8_t> & storage, int32_t y) const
+  {
+    return storage.data () + costmapOffset (storage) + size_t (y) * _stride;
+  }
+
+  /* The cells overlapping region, clipped to the raster.
+   */
+  Costmap::Window Costmap::window (const Eigen::AlignedBox2d & region) const
+  {
+    double res = _parameters.resolution;
+    Window w;
+    w.x0 = std::max (0.0, std::floor ((region.min ().x () - _origin_x) / res));
+    w.y0 = std::max (0.0, std::floor ((region.min ().y () - _origin_y) / res));
+    w.x1 = std::min (double (_width), std::floor ((region.max ().x () - _origin_x) / res) + 1.0);
+    w.y1 = std::min (double (_height), std::floor ((region.max ().y () - _origin_y) / res) + 1.0);
+    w.x1 = std::max (w.x0, w.x1);
+    w.y1 = std::max (w.y0, w.y1);
+    return w;
+  }
+
+  bool Costmap::covers (const Eigen::AlignedBox2d & region) const
+  {
+    return region.min ().x () >= _origin_x && region.min ().y () >= _origin_y
+      && region.max ().x () < _origin_x + _width * _parameters.resolution
+      && region.max ().y () < _origin_y + _height * _parameters.resolution;
+  }
+
+  /* Mark the occupied cells within the window, in both layers.
+   */
+  void Costmap::rasterize (const Window & w)
+  {
+    for (int32_t y=w.y0; y < w.y1; ++y)
+      {
+        std::fill (row (_static_layer, y) + w.x0, row (_static_layer, y) + w.x1, 0);
+        std::fill (row (_dynamic_layer, y) + w.x0, row (_dynamic_layer, y) + w.x1, 0);
+      }
+
+    double res = _parameters.resolution;
+    Eigen::AlignedBox2d box (Position (_origin_x + w.x0 * res, _origin_y + w.y0 * res),
+                             Position (_origin_x + w.x1 * res, _origin_y + w.y1 * res));
+    for (uint32_t i=0; i < _map.getObjectCount (); ++i)
+      if (box.intersects (_map.getObjectBox (i)))
+        rasterize (_map.getObjects ()[i], w, _static_layer);
+    for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+      if (box.intersects (_map.getDynamicObjectBox (i)))
+        rasterize (_map.getDynamicObjects ()[i], w, _dynamic_layer);
+  }
+
+  /* Mark the cells the segments of obj pass through: Per row of cells, the part of the segment
+   * within the row covers a range of columns.
+   */
+  void Costmap::rasterize (const MapObject & obj, const Window & w, std::vector<uint8_t> & layer)
+  {
+    double res = _parameters.resolution;
+    uint32_t count = obj.getPointCount ();
+    if (count == 1)
+      {
+        int32_t x = std::floor ((obj.getPoint (0).x () - _origin_x) / res);
+        int32_t y = std::floor ((obj.getPoint (0).y () - _origin_y) / res);
+        if (x >= w.x0 && x < w.x1 && y >= w.y0 && y < w.y1)
+          row (layer, y)[x] = 1;
+        return;
+      }
+
+    for (uint32_t i=0; i + 1 < count; ++i)
+      {
+        // in cells
+        Position a = (obj.getPoint (i) - Position (_origin_x, _origin_y)) / res;
+        Position b = (obj.getPoint (i + 1) - Position (_origin_x, _origin_y)) / res;
+        int32_t y0 = std::max<double> (w.y0, std::floor (std::min (a.y (), b.y ())));
+        int32_t y1 = std::min<double> (w.y1 - 1, std::floor (std::max (a.y (), b.y ())));
+        double dy = b.y () - a.y ();
+
+        for (int32_t y=y0; y <= y1; ++y)
+          {
+            double t0 = 0.0;
+            double t1 = 1.0;
+            if (dy != 0.0)
+              {
+                double ta = (y - a.y ()) / dy;
+                double tb = (y + 1 - a.y ()) / dy;
+                t0 = std::max (0.0, std::min (ta, tb));
+                t1 = std::min (1.0, std::max (ta, tb));
+                if (t0 > t1)
+                  continue;
+              }
+
+            double xa = a.x () + t0 * (b.x () - a.x ());
+            double xb = a.x () + t1 * (b.x () - a.x ());
+            int32_t x0 = std::max<double> (w.x0, std::floor (std::min (xa, xb)));
+            int32_t x1 = std::min<double> (w.x1 - 1, std::floor (std::max (xa, xb)));
+            uint8_t * r = row (layer, y);
+            for (int32_t x=x0; x <= x1; ++x)
+              r[x] = 1;
+          }
+      }
+  }
+
+  /* Recompute the costs within the window: A wavefront from the occupied cells within
+   * inflation_radius around it, in buckets by the squared distance to the cell it started
+   * from. Each cell is reached first from (about) its closest occupied cell.
+   */
+  void Costmap::inflate (const Window & w)
+  {
+    Window outer;
+    outer.x0 = std::max (0, w.x0 - _radius);
+    outer.y0 = std::max (0, w.y0 - _radius);
+    outer.x1 = std::min (_width, w.x1 + _radius);
+    outer.y1 = std::min (_height, w.y1 + _radius);
+    int32_t width = outer.x1 - outer.x0;
+    int32_t height = outer.y1 - outer.y0;
+
+    for (int32_t y=w.y0; y < w.y1; ++y)
+      std::fill (row (_costs, y) + w.x0, row (_costs, y) + w.x1, COST_FREE);
+    if (width <= 0 || height <= 0)
+      return;
+
+    _seen.assign (size_t (width) * height, 0);
+    for (int32_t y=outer.y0; y < outer.y1; ++y)
+      {
+        const uint8_t * s = row (_static_layer, y);
+        const uint8_t * d = row (_dynamic_layer, y);
+        for (int32_t x=outer.x0; x < outer.x1; ++x)
+          if (s[x] || (_parameters.dynamic_layer && d[x]))
+            {
+              Wave wave;
+              wave.cell = (y - outer.y0) * width + x - outer.x0;
+              wave.source = wave.cell;
+              _buckets[0].push_back (wave);
+            }
+      }
+
+    static const int32_t dx[4] = { 1, -1, 0, 0 };
+    static const int32_t dy[4] = { 0, 0, 1, -1 };
+    int32_t max_d2 = _radius * _radius;
+    for (int32_t d2=0; d2 <= max_d2; ++d2)
+      {
+        std::vector<Wave> & bucket = _buckets[d2];
+        for (size_t i=0; i < bucket.size (); ++i)
+          {
+            Wave wave = bucket[i];
+            if (_seen[wave.cell])
+              continue;
+            _seen[wave.cell] = 1;
+
+            int32_t x = wave.cell % width;
+            int32_t y = wave.cell / width;
+            int32_t sx = wave.source % width;
+            int32_t sy = wave.source / width;
+            if (x + outer.x0 >= w.x0 && x + outer.x0 < w.x1 && y + outer.y0 >= w.y0 && y + outer.y0 < w.y1)
+              row (_costs, y + outer.y0)[x + outer.x0] = _cost_table[(x - sx) * (x - sx) + (y - sy) * (y - sy)];
+
+            for (int k=0; k < 4; ++k)
+              {
+                int32_t nx = x + dx[k];
+                int32_t ny = y + dy[k];
+                if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+                  continue;
+
+                uint32_t cell = ny * width + nx;
+                int32_t nd2 = (nx - sx) * (nx - sx) + (ny - sy) * (ny - sy);
+                if (_seen[cell] || nd2 > max_d2)
+                  continue;
+
+                Wave next;
+                next.cell = cell;
+                next.source = wave.source;
+                _buckets[std::max (nd2, d2)].push_back (next);
+              }
+          }
+        bucket.clear ();
+      }
+  }
+}
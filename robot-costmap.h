@@ -0,0 +1,133 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_COSTMAP_H
+#define ROBOT_COSTMAP_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* Obstacle costs inflated by the size of the robot, for planners and controllers.
+   *
+   * The objects of both layers of the map are rasterized into an obstacle layer each (a cell is
+   * occupied if a segment passes through it). The costs combine the layers (the dynamic one
+   * only if dynamic_layer is set): COST_LETHAL in occupied cells, COST_INSCRIBED within
+   * inscribed_radius of one (the robot collides there for sure), then decaying exponentially
+   * with cost_scaling down to 0 at inflation_radius.
+   *
+   * update () catches up with the changes of the map: Only the regions changed since the last
+   * update (see Map::getVersion) are rasterized again, and the costs within them are
+   * recomputed by a wavefront from the occupied cells within inflation_radius around them, in
+   * order of the distance. The costs depend on the changed area, not on the size of the map.
+   * The raster covers the bounding box of the map plus margin; a change outside of it, or
+   * older than the history of the map, rebuilds everything.
+   *
+   * The costs are stored row-major, rows of getStride () bytes, each row starting at a
+   * multiple of 64 bytes (a cache line), so planners may read them directly. Not copyable, as
+   * the rows are aligned within the storage.
+   */
+  class Costmap
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double resolution;            // cell size
+          double inscribed_radius;      // of the robot
+          double inflation_radius;      // costs are 0 beyond
+          double cost_scaling;          // decay of the costs beyond inscribed_radius, per m
+          double margin;                // added around the bounding box of the map
+          bool dynamic_layer;           // include the dynamic objects
+      };
+
+      static const uint8_t COST_FREE = 0;
+      static const uint8_t COST_INSCRIBED = 253;
+      static const uint8_t COST_LETHAL = 254;
+
+      enum Layer
+      {
+        LAYER_STATIC,
+        LAYER_DYNAMIC
+      };
+
+      struct Stats
+      {
+          uint64_t updates;
+          uint64_t rebuilds;            // updates of everything
+          uint64_t regions;             // changed regions updated
+          uint64_t cells;               // cells of which the costs were recomputed
+          double update_us;             // total time spent updating
+      };
+
+      Costmap (const Map & map, const Parameters & parameters);
+      Costmap (const Costmap & other) = delete;
+      Costmap & operator= (const Costmap & other) = delete;
+
+      void rebuild ();
+      void update ();
+
+      const uint8_t * getCosts () const;
+      const uint8_t * getLayer (Layer layer) const;
+      uint32_t getStride () const;
+      uint32_t getWidth () const;
+      uint32_t getHeight () const;
+      Position getOrigin () const;
+      uint8_t getCost (const Position & pos) const;
+      uint64_t getVersion () const;
+
+      const Parameters & getParameters () const;
+      const Stats & getStats () const;
+
+    private:
+      struct Wave
+      {
+          uint32_t cell;                // within the window
+          uint32_t source;              // occupied cell the distance is measured to
+      };
+
+      struct Window
+      {
+          int32_t x0;
+          int32_t y0;
+          int32_t x1;                   // exclusive
+          int32_t y1;
+      };
+
+      uint8_t * row (std::vector<uint8_t> & storage, int32_t y);
+      const uint8_t * row (const std::vector<uint8_t> & storage, int32_t y) const;
+      Window window (const Eigen::AlignedBox2d & region) const;
+      bool covers (const Eigen::AlignedBox2d & region) const;
+      void rasterize (const Window & w);
+      void rasterize (const MapObject & obj, const Window & w, std::vector<uint8_t> & layer);
+      void inflate (const Window & w);
+
+      const Map & _map;
+      Parameters _parameters;
+      Stats _stats;
+      uint64_t _version;
+
+      double _origin_x;
+      double _origin_y;
+      int32_t _width;
+      int32_t _height;
+      uint32_t _stride;
+      int32_t _radius;                  // inflation_radius in cells
+      std::vector<uint8_t> _cost_table; // by squared distance in cells
+
+      // Each with _height rows of _stride bytes, plus the alignment
+      std::vector<uint8_t> _costs;
+      std::vector<uint8_t> _static_layer;
+      std::vector<uint8_t> _dynamic_layer;
+
+      std::vector<std::vector<Wave>> _buckets;    // by squared distance, reused
+      std::vector<uint8_t> _seen;
+  };
+}
+
+#endif
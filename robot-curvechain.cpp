@@ -0,0 +1,281 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "robot-curvechain.h"
+
+namespace Pathfinder
+{
+  CurveChain::CurveChain ()
+  : _curves (),
+    _first_points (),
+    _max_deviation (0.0),
+    _closed (false)
+  {
+  }
+
+  /* Approximate the polyline of count points by curves, as few as the greedy search finds:
+   * Each curve is extended over the following points (doubling, then bisecting) as long as
+   * the points are within max_deviation of it and it is within max_deviation of the
+   * segments between them.
+   *
+   * Returns false and stays empty, if there are less than two distinct points.
+   */
+  bool CurveChain::fit (const Position * points, uint32_t count, double max_deviation)
+  {
+    PATHFINDER_TRACE_SCOPE ("CurveChain::fit");
+
+    clear ();
+    if (count < 2 || !(max_deviation > 0.0))
+      return false;
+
+    _max_deviation = max_deviation;
+    _first_points.push_back (0);
+
+    uint32_t a = 0;
+    Curve curve;
+    Curve candidate;
+    while (a + 1 < count)
+      {
+        // A repeated point is dropped, the next curve starts at the same position
+        if (!fitCurve (points + a, 2, curve))
+          {
+            ++a;
+            continue;
+          }
+
+        uint32_t good = a + 1;
+        uint32_t bad = count;
+        for (uint32_t step=2; good + 1 < count; step *= 2)
+          {
+            uint32_t b = std::min (a + step, count - 1);
+            if (!fitCurve (points + a, b - a + 1, candidate))
+              {
+                bad = b;
+                break;
+              }
+
+            curve = candidate;
+            good = b;
+          }
+
+        while (bad - good > 1)
+          {
+            uint32_t b = (good + bad) / 2;
+            if (fitCurve (points + a, b - a + 1, candidate))
+              {
+                curve = candidate;
+                good = b;
+              }
+            else
+              bad = b;
+          }
+
+        // Samples for chords within max_deviation: the chord over a step h of t is at most
+        // |c2| * h^2 / 4 away from the curve.
+        double bend = curve.getCoefficient (2).norm ();
+        uint32_t samples = std::max (1.0, std::ceil (std::sqrt (bend / max_deviation)));
+        _curves.push_back (curve);
+        _first_points.push_back (_first_points.back () + samples);
+        a = good;
+      }
+
+    if (_curves.empty ())
+      {
+        clear ();
+        return false;
+      }
+
+    _closed = points[0] == points[count-1];
+    return true;
+  }
+
+  /* Set the chain from its parts, e.g. stored by a map file: count curves, curve k read as
+   * samples[k] points (getSampleCount).
+   *
+   * Returns false and stays empty, if a curve has no samples or max_deviation isn't positive.
+   */
+  bool CurveChain::assign (const Curve * curves, const uint32_t * samples, uint32_t count, double max_deviation,
+                           bool closed)
+  {
+    clear ();
+    if (count == 0 || !(max_deviation > 0.0))
+      return false;
+
+    _first_points.push_back (0);
+    for (uint32_t k=0; k < count; ++k)
+      {
+        if (samples[k] == 0)
+          {
+            clear ();
+            return false;
+          }
+
+        _curves.push_back (curves[k]);
+        _first_points.push_back (_first_points.back () + samples[k]);
+      }
+
+    _max_deviation = max_deviation;
+    _closed = closed;
+    return true;
+  }
+
+  void CurveChain::clear ()
+  {
+    decltype (_curves) ().swap (_curves);
+    decltype (_first_points) ().swap (_first_points);
+    _max_deviation = 0.0;
+    _closed = false;
+  }
+
+  bool CurveChain::isEmpty () const
+  {
+    return _curves.empty ();
+  }
+
+  /* Was the polyline closed. Then the last point of the chain is the first one.
+   */
+  bool CurveChain::isClosed () const
+  {
+    return _closed;
+  }
+
+  double CurveChain::getMaxDeviation () const
+  {
+    return _max_deviation;
+  }
+
+  uint32_t CurveChain::getCurveCount () const
+  {
+    return _curves.size ();
+  }
+
+  const CurveChain::Curve & CurveChain::getCurve (uint32_t idx) const
+  {
+    return _curves[idx];
+  }
+
+  /* Number of points the curve is read as, from its start up to the start of the next one.
+   */
+  uint32_t CurveChain::getSampleCount (uint32_t idx) const
+  {
+    return _first_points[idx+1] - _first_points[idx];
+  }
+
+  /* The curve as quadratic Bezier curve, e.g. for drawing it.
+   */
+  void CurveChain::getBezier (uint32_t idx, Position & start, Position & control, Position & end) const
+  {
+    const Curve & curve = _curves[idx];
+    start = curve.get (-1.0);
+    end = curve.get (1.0);
+    control = curve.getCoefficient (0) * 2.0 - (start + end) / 2.0;
+  }
+
+  uint32_t CurveChain::getPointCount () const
+  {
+    if (_curves.empty ())
+      return 0;
+
+    return _first_points.back () + 1;
+  }
+
+  /* Point idx of the polyline read from the curves.
+   */
+  Position CurveChain::getPoint (uint32_t idx) const
+  {
+    if (_closed && idx == _first_points.back ())
+      idx = 0;
+
+    uint32_t k = std::upper_bound (_first_points.begin (), _first_points.end () - 1, idx) - _first_points.begin () - 1;
+    uint32_t samples = _first_points[k+1] - _first_points[k];
+    return _curves[k].get (-1.0 + 2.0 * (idx - _first_points[k]) / samples);
+  }
+
+  /* Find the position of the curves closest to pos. Curves whose control points are further
+   * away than the closest position found so far are skipped.
+   */
+  std::optional<CurveChain::FindResult> CurveChain::findClosest (const Position & pos) const
+  {
+    PATHFINDER_TRACE_SCOPE ("CurveChain::findClosest");
+
+    std::optional<FindResult> found;
+    double best_dist = std::numeric_limits<double>::infinity ();
+    uint32_t best_curve = 0;
+    double best_t = -1.0;
+    for (uint32_t k=0; k < _curves.size (); ++k)
+      {
+        Position start;
+        Position control;
+        Position end;
+        getBezier (k, start, control, end);
+        Eigen::AlignedBox2d box (start);
+        box.extend (control);
+        box.extend (end);
+        if (box.exteriorDistance (pos) >= best_dist)
+          continue;
+
+        double t = _curves[k].closestParameter (pos, -1.0, 1.0, 8);
+        double dist = _curves[k].get (t).distance (pos);
+        if (dist < best_dist)
+          {
+            best_dist = dist;
+            best_curve = k;
+            best_t = t;
+          }
+      }
+
+    if (_curves.empty ())
+      return found;
+
+    uint32_t samples = _first_points[best_curve+1] - _first_points[best_curve];
+    double u = (best_t + 1.0) / 2.0 * samples;
+    uint32_t i = std::min (static_cast<uint32_t> (u), samples - 1);
+
+    found.emplace ();
+    found->distance = best_dist;
+    found->point_index = _first_points[best_curve] + i;
+    found->fraction_to_next_point = std::min (1.0, u - i);
+    return found;
+  }
+
+  size_t CurveChain::getMemoryUsage () const
+  {
+    return _curves.capacity () * sizeof (Curve) + _first_points.capacity () * sizeof (uint32_t);
+  }
+
+  /* Fit curve to the points, keeping the ends. Fails if a point is further than max_deviation
+   * from its part of the curve, or the curve from a segment between the points (checked in
+   * the middle).
+   */
+  bool CurveChain::fitCurve (const Position * points, uint32_t count, Curve & curve) const
+  {
+    if (!curve.adjust (points, count, true).has_value ())
+      return false;
+
+    // The parameters of the points, as adjust assigns them
+    std::vector<double> t (count);
+    t[0] = 0.0;
+    for (uint32_t i=1; i < count; ++i)
+      t[i] = t[i-1] + points[i].distance (points[i-1]);
+    for (double & ti: t)
+      ti = 2.0 * ti / t.back () - 1.0;
+
+    for (uint32_t i=1; i + 1 < count; ++i)
+      {
+        double ti = curve.closestParameter (points[i], t[i-1], t[i+1], 4);
+        if (curve.get (ti).distance (points[i]) > _max_deviation)
+          return false;
+      }
+
+    for (uint32_t i=0; i + 1 < count; ++i)
+      if (LineSegment (points[i], points[i+1]).distance (curve.get ((t[i] + t[i+1]) / 2.0)) > _max_deviation)
+        return false;
+
+    return true;
+  }
+}
@@ -0,0 +1,68 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_CURVECHAIN_H
+#define ROBOT_CURVECHAIN_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-geometry.h"
+#include "robot-memory.h"
+
+namespace Pathfinder
+{
+  /* A polyline approximated by a chain of quadratic curves (PolynomCurve<2>, t from -1 to 1),
+   * each starting at the end of the one before, so a closed polyline stays closed. All points
+   * of the polyline are within max_deviation of the curves.
+   *
+   * The chain is read as a polyline again by sampling each curve at equal steps of t, just
+   * fine enough that the chords stay within max_deviation of the curve. These points are
+   * evaluated on the fly (like those of a compact MapObject), while distances are measured
+   * to the curves themselves.
+   */
+  class CurveChain
+  {
+    public:
+      typedef PolynomCurve<2> Curve;
+
+      CurveChain ();
+
+      bool fit (const Position * points, uint32_t count, double max_deviation);
+      bool assign (const Curve * curves, const uint32_t * samples, uint32_t count, double max_deviation,
+                   bool closed);
+      void clear ();
+      bool isEmpty () const;
+      bool isClosed () const;
+      double getMaxDeviation () const;
+
+      uint32_t getCurveCount () const;
+      const Curve & getCurve (uint32_t idx) const;
+      uint32_t getSampleCount (uint32_t idx) const;
+      void getBezier (uint32_t idx, Position & start, Position & control, Position & end) const;
+
+      uint32_t getPointCount () const;
+      Position getPoint (uint32_t idx) const;
+
+      struct FindResult
+      {
+          double distance;              // to the curve
+          uint32_t point_index;         // of the polyline segment next to the closest position
+          double fraction_to_next_point;
+      };
+      std::optional<FindResult> findClosest (const Position & pos) const;
+
+      size_t getMemoryUsage () const;
+
+    private:
+      bool fitCurve (const Position * points, uint32_t count, Curve & curve) const;
+
+      std::vector<Curve,TrackingAllocator<Curve,MEMORY_CURVES,Eigen::aligned_allocator<Curve>>> _curves;
+      std::vector<uint32_t,TrackingAllocator<uint32_t,MEMORY_CURVES>> _first_points;   // of the curves in the polyline, then the last point
+      double _max_deviation;
+      bool _closed;
+  };
+}
+
+#endif
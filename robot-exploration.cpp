@@ -0,0 +1,555 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include "robot-exploration.h"
+#include "robot-trace.h"
+
+namespace Pathfinder
+{
+  static const int8_t explorationUnknown = -128;
+  static const uint32_t explorationNone = 0xffffffff;      // not a frontier cell
+  static const uint32_t explorationPending = 0xfffffffe;   // frontier cell without a cluster yet
+
+  static uint64_t explorationNow ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  static uint64_t explorationKey (int32_t x, int32_t y)
+  {
+    return (uint64_t (uint32_t (x)) << 32) | uint32_t (y);
+  }
+
+  static int32_t explorationKeyX (uint64_t key)
+  {
+    return int32_t (uint32_t (key >> 32));
+  }
+
+  static int32_t explorationKeyY (uint64_t key)
+  {
+    return int32_t (uint32_t (key));
+  }
+
+  static ExplorationGrid::CellState explorationState (int8_t odds)
+  {
+    if (odds == explorationUnknown)
+      return ExplorationGrid::CELL_UNKNOWN;
+    return odds > 0 ? ExplorationGrid::CELL_OCCUPIED : ExplorationGrid::CELL_FREE;
+  }
+
+  ExplorationGrid::Parameters::Parameters ()
+  : resolution (0.05),
+    max_free_range (4.0),
+    hit_odds (3),
+    miss_odds (1),
+    max_odds (20),
+    min_frontier_cells (5),
+    gain_radius (2.0),
+    cost_weight (1.0),
+    max_path_cost (100.0)
+  {
+  }
+
+  ExplorationGrid::Tile::Tile ()
+  {
+    std::memset (odds, explorationUnknown, sizeof (odds));
+    std::fill (cluster, cluster + TILE_SIZE * TILE_SIZE, explorationNone);
+    std::fill (stamp, stamp + TILE_SIZE * TILE_SIZE, 0);
+  }
+
+  ExplorationGrid::ExplorationGrid (const Parameters & parameters)
+  : _parameters (parameters),
+    _pose (),
+    _has_pose (false),
+    _stats (),
+    _tiles (),
+    _last_tile_key (0),
+    _last_tile (nullptr),
+    _clusters (),
+    _free_clusters (),
+    _cluster_count (0),
+    _dirty (),
+    _seeds ()
+  {
+    _pose.setIdentity ();
+  }
+
+  ExplorationGrid::~ExplorationGrid ()
+  {
+  }
+
+  void ExplorationGrid::pushPose (double, const Transformation & pose)
+  {
+    _pose = pose;
+    _has_pose = true;
+  }
+
+  void ExplorationGrid::pushScan (double, const RangeScan & scan)
+  {
+    if (_has_pose)
+      integrateScan (scan, _pose);
+  }
+
+  /* Update the cells passed by the beams of scan, taken at pose, and the frontiers around the
+   * cells which changed.
+   */
+  void ExplorationGrid::integrateScan (const RangeScan & scan, const Transformation & pose)
+  {
+    PATHFINDER_TRACE_SCOPE ("ExplorationGrid::integrateScan");
+
+    uint64_t t0 = explorationNow ();
+    ++_stats.scans;
+    _dirty.clear ();
+
+    double res = _parameters.resolution;
+    Position origin = pose.getTranslation ();
+    double ox = origin.x () / res;
+    double oy = origin.y () / res;
+
+    // Hits first, so beams passing a hit cell of another beam don't clear it
+    for (int pass=0; pass < 2; ++pass)
+      for (uint32_t i=0; i < scan.ranges.size (); ++i)
+        {
+          float r = scan.ranges[i];
+          bool hit = std::isfinite (r) && r > 0.0f && r < scan.max_range;
+          double range = hit ? r : std::min<double> (scan.max_range, _parameters.max_free_range);
+          double a = scan.angle_min + i * double (scan.angle_increment);
+          Position end = pose.transformPosition (Position (std::cos (a) * range, std::sin (a) * range));
+
+          if (pass == 0 && hit)
+            observeCell (cell (end.x ()), cell (end.y ()), true);
+          else if (pass == 1)
+            traceRay (ox, oy, end.x () / res, end.y () / res, !hit);
+        }
+
+    uint64_t t1 = explorationNow ();
+    updateFrontiers ();
+    uint64_t t2 = explorationNow ();
+
+    _stats.changed_cells += _dirty.size ();
+    _stats.raycast_us += (t1 - t0) / 1000.0;
+    _stats.frontier_us += (t2 - t1) / 1000.0;
+    _stats.max_frontier_us = std::max (_stats.max_frontier_us, (t2 - t1) / 1000.0);
+  }
+
+  ExplorationGrid::CellState ExplorationGrid::getState (const Position & pos) const
+  {
+    return explorationState (oddsAt (cell (pos.x ()), cell (pos.y ())));
+  }
+
+  bool ExplorationGrid::isFrontier (const Position & pos) const
+  {
+    uint32_t c = clusterAt (cell (pos.x ()), cell (pos.y ()));
+    return c != explorationNone;
+  }
+
+  uint32_t ExplorationGrid::getFrontierCellCount () const
+  {
+    uint32_t count = 0;
+    for (const Cluster & cluster: _clusters)
+      count += cluster.cells.size ();
+    return count;
+  }
+
+  uint32_t ExplorationGrid::getClusterCount () const
+  {
+    return _cluster_count;
+  }
+
+  const ExplorationGrid::Parameters & ExplorationGrid::getParameters () const
+  {
+    return _parameters;
+  }
+
+  const ExplorationGrid::Stats & ExplorationGrid::getStats () const
+  {
+    return _stats;
+  }
+
+  /* The reachable frontier clusters with at least min_frontier_cells cells, best first.
+   *
+   * The path costs are found by one Dijkstra search from the robot over the free cells, which
+   * stops when all clusters are reached or max_path_cost is exceeded.
+   */
+  void ExplorationGrid::rankFrontiers (const Position & robot, FrontierVector & frontiers) const
+  {
+    PATHFINDER_TRACE_SCOPE ("ExplorationGrid::rankFrontiers");
+
+    frontiers.clear ();
+
+    double res = _parameters.resolution;
+    std::vector<uint32_t> ranked (_clusters.size (), explorationNone);   // index in frontiers
+    for (uint32_t c=0; c < _clusters.size (); ++c)
+      {
+        const Cluster & cluster = _clusters[c];
+        if (cluster.cells.empty () || cluster.cells.size () < _parameters.min_frontier_cells)
+          continue;
+
+        double mx = cluster.sum_x / cluster.cells.size ();
+        double my = cluster.sum_y / cluster.cells.size ();
+        uint64_t goal = cluster.cells[0];
+        double best = std::numeric_limits<double>::infinity ();
+        for (uint64_t key: cluster.cells)
+          {
+            double dx = explorationKeyX (key) - mx;
+            double dy = explorationKeyY (key) - my;
+            if (dx * dx + dy * dy < best)
+              {
+                best = dx * dx + dy * dy;
+                goal = key;
+              }
+          }
+
+        Frontier f;
+        f.goal = Position ((explorationKeyX (goal) + 0.5) * res, (explorationKeyY (goal) + 0.5) * res);
+        f.cells = cluster.cells.size ();
+        f.gain = countUnknown (explorationKeyX (goal), explorationKeyY (goal),
+                               std::ceil (_parameters.gain_radius / res)) * res * res;
+        f.cost = std::numeric_limits<double>::infinity ();
+        f.utility = 0.0;
+        ranked[c] = frontiers.size ();
+        frontiers.push_back (f);
+      }
+
+    // Dijkstra over the free cells, in cells; diagonal steps must not cut a corner
+    typedef std::pair<double, uint64_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    std::unordered_map<uint64_t, double> dist;
+    uint64_t start = explorationKey (cell (robot.x ()), cell (robot.y ()));
+    open.push (Entry (0.0, start));
+    dist[start] = 0.0;
+
+    uint32_t unreached = frontiers.size ();
+    double max_cost = _parameters.max_path_cost / res;
+    static const int32_t dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+    static const int32_t dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+    while (!open.empty () && unreached > 0)
+      {
+        Entry e = open.top ();
+        open.pop ();
+        if (e.first > dist[e.second])
+          continue;
+        if (e.first > max_cost)
+          break;
+
+        int32_t x = explorationKeyX (e.second);
+        int32_t y = explorationKeyY (e.second);
+        uint32_t c = clusterAt (x, y);
+        if (c < ranked.size () && ranked[c] != explorationNone && std::isinf (frontiers[ranked[c]].cost))
+          {
+            frontiers[ranked[c]].cost = e.first * res;
+            --unreached;
+          }
+
+        for (int k=0; k < 8; ++k)
+          {
+            int32_t nx = x + dx[k];
+            int32_t ny = y + dy[k];
+            if (explorationState (oddsAt (nx, ny)) != CELL_FREE)
+              continue;
+            if (k >= 4 && (explorationState (oddsAt (nx, y)) != CELL_FREE
+                           || explorationState (oddsAt (x, ny)) != CELL_FREE))
+              continue;
+
+            double d = e.first + (k < 4 ? 1.0 : M_SQRT2);
+            uint64_t key = explorationKey (nx, ny);
+            auto found = dist.find (key);
+            if (found != dist.end () && found->second <= d)
+              continue;
+
+            dist[key] = d;
+            open.push (Entry (d, key));
+          }
+      }
+
+    frontiers.erase (std::remove_if (frontiers.begin (), frontiers.end (),
+                                     [] (const Frontier & f) { return std::isinf (f.cost); }),
+                     frontiers.end ());
+    for (Frontier & f: frontiers)
+      f.utility = f.gain - _parameters.cost_weight * f.cost;
+    std::sort (frontiers.begin (), frontiers.end (),
+               [] (const Frontier & a, const Frontier & b) { return a.utility > b.utility; });
+  }
+
+  ExplorationGrid::Tile & ExplorationGrid::tileAt (int32_t x, int32_t y)
+  {
+    uint64_t key = explorationKey (x >> TILE_BITS, y >> TILE_BITS);
+    if (_last_tile && key == _last_tile_key)
+      return *_last_tile;
+
+    // Elements of an unordered_map keep their address on rehashing
+    _last_tile = &_tiles[key];
+    _last_tile_key = key;
+    return *_last_tile;
+  }
+
+  const ExplorationGrid::Tile * ExplorationGrid::findTile (int32_t x, int32_t y) const
+  {
+    auto found = _tiles.find (explorationKey (x >> TILE_BITS, y >> TILE_BITS));
+    return found != _tiles.end () ? &found->second : nullptr;
+  }
+
+  int8_t ExplorationGrid::oddsAt (int32_t x, int32_t y) const
+  {
+    const Tile * tile = findTile (x, y);
+    return tile ? tile->odds[((y & (TILE_SIZE - 1)) << TILE_BITS) | (x & (TILE_SIZE - 1))] : explorationUnknown;
+  }
+
+  uint32_t ExplorationGrid::clusterAt (int32_t x, int32_t y) const
+  {
+    const Tile * tile = findTile (x, y);
+    return tile ? tile->cluster[((y & (TILE_SIZE - 1)) << TILE_BITS) | (x & (TILE_SIZE - 1))] : explorationNone;
+  }
+
+  void ExplorationGrid::setCluster (int32_t x, int32_t y, uint32_t cluster)
+  {
+    tileAt (x, y).cluster[((y & (TILE_SIZE - 1)) << TILE_BITS) | (x & (TILE_SIZE - 1))] = cluster;
+  }
+
+  bool ExplorationGrid::frontierAt (int32_t x, int32_t y) const
+  {
+    const Tile * tile = findTile (x, y);
+    if (!tile)
+      return false;
+
+    int32_t tx = x & (TILE_SIZE - 1);
+    int32_t ty = y & (TILE_SIZE - 1);
+    const int8_t * odds = tile->odds + ((ty << TILE_BITS) | tx);
+    if (explorationState (*odds) != CELL_FREE)
+      return false;
+
+    // The neighbors are in the same tile, unless the cell is at its border
+    if (tx > 0 && tx < TILE_SIZE - 1 && ty > 0 && ty < TILE_SIZE - 1)
+      return odds[1] == explorationUnknown || odds[-1] == explorationUnknown
+             || odds[TILE_SIZE] == explorationUnknown || odds[-TILE_SIZE] == explorationUnknown;
+
+    return oddsAt (x + 1, y) == explorationUnknown || oddsAt (x - 1, y) == explorationUnknown
+           || oddsAt (x, y + 1) == explorationUnknown || oddsAt (x, y - 1) == explorationUnknown;
+  }
+
+  /* Update a cell by a hit or a miss, at most once per scan. Cells changing their state are
+   * recorded in _dirty.
+   */
+  void ExplorationGrid::observeCell (int32_t x, int32_t y, bool hit)
+  {
+    Tile & tile = tileAt (x, y);
+    uint32_t idx = ((y & (TILE_SIZE - 1)) << TILE_BITS) | (x & (TILE_SIZE - 1));
+    if (tile.stamp[idx] == _stats.scans)
+      return;
+    tile.stamp[idx] = _stats.scans;
+
+    int8_t & odds = tile.odds[idx];
+    CellState before = explorationState (odds);
+    int32_t value = odds == explorationUnknown ? 0 : odds;
+    value += hit ? _parameters.hit_odds : -_parameters.miss_odds;
+    odds = std::max (-_parameters.max_odds, std::min (_parameters.max_odds, value));
+
+    if (explorationState (odds) != before)
+      _dirty.push_back (explorationKey (x, y));
+  }
+
+  /* Clear the cells from (fx, fy) to (tx, ty), in cells, by a grid traversal (Amanatides and
+   * Woo). The end cell is only cleared if include_end is set.
+   */
+  void ExplorationGrid::traceRay (double fx, double fy, double tx, double ty, bool include_end)
+  {
+    int32_t x = std::floor (fx);
+    int32_t y = std::floor (fy);
+    int32_t end_x = std::floor (tx);
+    int32_t end_y = std::floor (ty);
+
+    double dx = tx - fx;
+    double dy = ty - fy;
+    int32_t step_x = dx > 0 ? 1 : -1;
+    int32_t step_y = dy > 0 ? 1 : -1;
+    double delta_x = dx != 0.0 ? std::fabs (1.0 / dx) : std::numeric_limits<double>::infinity ();
+    double delta_y = dy != 0.0 ? std::fabs (1.0 / dy) : std::numeric_limits<double>::infinity ();
+    double next_x = dx != 0.0 ? (dx > 0 ? x + 1 - fx : fx - x) * delta_x : delta_x;
+    double next_y = dy != 0.0 ? (dy > 0 ? y + 1 - fy : fy - y) * delta_y : delta_y;
+
+    // The number of steps is fixed, so rounding can't make it miss the end cell
+    uint32_t steps = std::abs (end_x - x) + std::abs (end_y - y);
+    for (uint32_t i=0; i < steps; ++i)
+      {
+        observeCell (x, y, false);
+        if (next_x < next_y)
+          {
+            next_x += delta_x;
+            x += step_x;
+          }
+        else
+          {
+            next_y += delta_y;
+            y += step_y;
+          }
+      }
+
+    if (include_end)
+      observeCell (x, y, false);
+  }
+
+  /* Update the frontier clusters around the cells in _dirty.
+   */
+  void ExplorationGrid::updateFrontiers ()
+  {
+    PATHFINDER_TRACE_SCOPE ("ExplorationGrid::updateFrontiers");
+
+    // Only the changed cells and their 4-neighbors can change their frontier state. Cells may
+    // be listed twice, evaluating them again doesn't change anything.
+    std::vector<uint64_t> candidates;
+    candidates.reserve (_dirty.size () * 5);
+    for (uint64_t key: _dirty)
+      {
+        int32_t x = explorationKeyX (key);
+        int32_t y = explorationKeyY (key);
+        candidates.push_back (key);
+        candidates.push_back (explorationKey (x + 1, y));
+        candidates.push_back (explorationKey (x - 1, y));
+        candidates.push_back (explorationKey (x, y + 1));
+        candidates.push_back (explorationKey (x, y - 1));
+      }
+
+    // Dissolve the clusters losing a cell, their other cells are clustered again
+    _seeds.clear ();
+    std::vector<bool> frontier (candidates.size ());
+    for (uint32_t i=0; i < candidates.size (); ++i)
+      {
+        int32_t x = explorationKeyX (candidates[i]);
+        int32_t y = explorationKeyY (candidates[i]);
+        frontier[i] = frontierAt (x, y);
+        uint32_t c = clusterAt (x, y);
+        if (!frontier[i] && c != explorationNone && c != explorationPending)
+          dissolve (c, _seeds);
+      }
+
+    for (uint32_t i=0; i < candidates.size (); ++i)
+      {
+        int32_t x = explorationKeyX (candidates[i]);
+        int32_t y = explorationKeyY (candidates[i]);
+        if (!frontier[i])
+          {
+            if (findTile (x, y))
+              setCluster (x, y, explorationNone);
+          }
+        else if (clusterAt (x, y) == explorationNone)
+          {
+            setCluster (x, y, explorationPending);
+            _seeds.push_back (candidates[i]);
+          }
+      }
+
+    // Flood fill from the seeds, merging the clusters met on the way
+    static const int32_t dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+    static const int32_t dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+    std::vector<uint64_t> stack;
+    for (uint32_t s=0; s < _seeds.size (); ++s)     // dissolve adds seeds
+      {
+        uint64_t seed = _seeds[s];
+        if (clusterAt (explorationKeyX (seed), explorationKeyY (seed)) != explorationPending)
+          continue;
+
+        uint32_t id;
+        if (!_free_clusters.empty ())
+          {
+            id = _free_clusters.back ();
+            _free_clusters.pop_back ();
+          }
+        else
+          {
+            id = _clusters.size ();
+            _clusters.push_back (Cluster ());
+          }
+        ++_cluster_count;
+
+        _clusters[id].sum_x = 0.0;
+        _clusters[id].sum_y = 0.0;
+
+        setCluster (explorationKeyX (seed), explorationKeyY (seed), id);
+        stack.push_back (seed);
+        while (!stack.empty ())
+          {
+            uint64_t key = stack.back ();
+            stack.pop_back ();
+            int32_t x = explorationKeyX (key);
+            int32_t y = explorationKeyY (key);
+            _clusters[id].cells.push_back (key);
+            _clusters[id].sum_x += x;
+            _clusters[id].sum_y += y;
+
+            for (int k=0; k < 8; ++k)
+              {
+                int32_t nx = x + dx[k];
+                int32_t ny = y + dy[k];
+                uint32_t c = clusterAt (nx, ny);
+                if (c == explorationNone || c == id)
+                  continue;
+                if (c != explorationPending)
+                  dissolve (c, _seeds);
+
+                setCluster (nx, ny, id);
+                stack.push_back (explorationKey (nx, ny));
+              }
+          }
+      }
+  }
+
+  /* Remove a cluster, its cells become pending seeds.
+   */
+  void ExplorationGrid::dissolve (uint32_t cluster, std::vector<uint64_t> & seeds)
+  {
+    Cluster & c = _clusters[cluster];
+    for (uint64_t key: c.cells)
+      {
+        setCluster (explorationKeyX (key), explorationKeyY (key), explorationPending);
+        seeds.push_back (key);
+      }
+
+    c.cells.clear ();
+    c.cells.shrink_to_fit ();
+    _free_clusters.push_back (cluster);
+    --_cluster_count;
+  }
+
+  /* Number of unknown cells within radius (in cells) of the cell (cx, cy).
+   */
+  uint32_t ExplorationGrid::countUnknown (int32_t cx, int32_t cy, int32_t radius) const
+  {
+    uint32_t count = 0;
+    for (int32_t y=cy - radius; y <= cy + radius; ++y)
+      {
+        int32_t half = std::sqrt (double (radius) * radius - double (y - cy) * (y - cy));
+        const Tile * tile = nullptr;
+        int32_t tile_x = 0;
+        bool have_tile = false;
+        for (int32_t x=cx - half; x <= cx + half; ++x)
+          {
+            if (!have_tile || (x >> TILE_BITS) != tile_x)
+              {
+                tile = findTile (x, y);
+                tile_x = x >> TILE_BITS;
+                have_tile = true;
+              }
+            if (!tile || tile->odds[((y & (TILE_SIZE - 1)) << TILE_BITS) | (x & (TILE_SIZE - 1))] == explorationUnknown)
+              ++count;
+          }
+      }
+
+    return count;
+  }
+
+  int32_t ExplorationGrid::cell (double v) const
+  {
+    return static_cast<int32_t> (std::floor (v / _parameters.resolution));
+  }
+}
@@ -0,0 +1,148 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_EXPLORATION_H
+#define ROBOT_EXPLORATION_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "robot-geometry.h"
+#include "robot-sensorlog.h"
+
+namespace Pathfinder
+{
+  /* Known and unknown space for exploration: An occupancy grid built from range scans, and
+   * the frontiers between free and unknown space.
+   *
+   * Every beam clears the cells it passes and marks the cell it ends in as occupied (log odds,
+   * each cell is updated once per scan, hits first). Beams without a hit clear space up to
+   * max_free_range. The grid is stored in tiles of 64 x 64 cells (hashed, so it may grow in any
+   * direction), which are created when first observed.
+   *
+   * A frontier cell is a free cell with an unknown 4-neighbor; frontier cells touching each other
+   * (8-neighbors) form a cluster. The frontiers are maintained with every scan, but only around
+   * the cells which changed between unknown, free and occupied: The clusters losing a cell are
+   * dissolved, their remaining cells and the new frontier cells are clustered again by a flood
+   * fill, which also merges the clusters it runs into. The costs depend on the changed cells and
+   * the clusters around them, not on the size of the grid.
+   *
+   * rankFrontiers orders the clusters by information gain (the unknown area within gain_radius
+   * of the cluster) minus the weighted path cost (8-connected over free cells, the size of the
+   * robot is not taken into account).
+   */
+  class ExplorationGrid : public ObservationSink
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double resolution;            // cell size
+          double max_free_range;        // beams without a hit clear space up to this range
+          int32_t hit_odds;             // log odds added for a hit
+          int32_t miss_odds;            // log odds subtracted for a cell passed by a beam
+          int32_t max_odds;             // log odds are limited to -max_odds .. max_odds
+          uint32_t min_frontier_cells;  // smaller clusters are not ranked
+          double gain_radius;           // unknown area within this distance of a frontier counts as gain
+          double cost_weight;           // of the path cost (m) against the gain (m^2)
+          double max_path_cost;         // frontiers further away are not ranked
+      };
+
+      enum CellState
+      {
+        CELL_UNKNOWN,
+        CELL_FREE,
+        CELL_OCCUPIED
+      };
+
+      struct Frontier
+      {
+          Position goal;                // the frontier cell closest to the center of the cluster
+          uint32_t cells;
+          double gain;
+          double cost;
+          double utility;
+      };
+      typedef std::vector<Frontier, Eigen::aligned_allocator<Frontier>> FrontierVector;
+
+      struct Stats
+      {
+          uint64_t scans;
+          uint64_t changed_cells;       // cells which changed their state
+          double raycast_us;            // total time spent updating the cells
+          double frontier_us;           // total time spent maintaining the frontiers
+          double max_frontier_us;
+      };
+
+      ExplorationGrid (const Parameters & parameters);
+      virtual ~ExplorationGrid ();
+
+      virtual void pushPose (double time, const Transformation & pose);
+      virtual void pushScan (double time, const RangeScan & scan);
+      void integrateScan (const RangeScan & scan, const Transformation & pose);
+
+      CellState getState (const Position & pos) const;
+      bool isFrontier (const Position & pos) const;
+      uint32_t getFrontierCellCount () const;
+      uint32_t getClusterCount () const;
+      void rankFrontiers (const Position & robot, FrontierVector & frontiers) const;
+
+      const Parameters & getParameters () const;
+      const Stats & getStats () const;
+
+    private:
+      static const int32_t TILE_BITS = 6;
+      static const int32_t TILE_SIZE = 1 << TILE_BITS;
+
+      struct Tile
+      {
+          Tile ();
+
+          int8_t odds[TILE_SIZE * TILE_SIZE];         // -128: unknown
+          uint32_t cluster[TILE_SIZE * TILE_SIZE];    // of frontier cells
+          uint32_t stamp[TILE_SIZE * TILE_SIZE];      // scan which updated the cell last
+      };
+
+      struct Cluster
+      {
+          std::vector<uint64_t> cells;
+          double sum_x;                 // of the cell coordinates
+          double sum_y;
+      };
+
+      Tile & tileAt (int32_t x, int32_t y);
+      const Tile * findTile (int32_t x, int32_t y) const;
+      int8_t oddsAt (int32_t x, int32_t y) const;
+      uint32_t clusterAt (int32_t x, int32_t y) const;
+      void setCluster (int32_t x, int32_t y, uint32_t cluster);
+      bool frontierAt (int32_t x, int32_t y) const;
+      void observeCell (int32_t x, int32_t y, bool hit);
+      void traceRay (double fx, double fy, double tx, double ty, bool include_end);
+      void updateFrontiers ();
+      void dissolve (uint32_t cluster, std::vector<uint64_t> & seeds);
+      uint32_t countUnknown (int32_t cx, int32_t cy, int32_t radius) const;
+      int32_t cell (double v) const;
+
+      Parameters _parameters;
+      Transformation _pose;
+      bool _has_pose;
+      Stats _stats;
+
+      std::unordered_map<uint64_t, Tile> _tiles;
+      uint64_t _last_tile_key;
+      Tile * _last_tile;
+
+      std::vector<Cluster> _clusters;
+      std::vector<uint32_t> _free_clusters;
+      uint32_t _cluster_count;
+
+      // Buffers reused for every scan
+      std::vector<uint64_t> _dirty;           // cells which changed their state
+      std::vector<uint64_t> _seeds;
+  };
+}
+
+#endif
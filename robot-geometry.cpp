@@ -2,6 +2,7 @@
  *
  */
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 
@@ -9,162 +10,377 @@
 
 namespace Pathfinder
 {
-  Position::Position ()
-  : Eigen::Vector2d ()
+  template<class Scalar>
+  BasicPosition<Scalar>::BasicPosition ()
+  : Vector ()
   {
   }
 
-  Position::Position (double x, double y)
-  : Eigen::Vector2d (x, y)
+  template<class Scalar>
+  BasicPosition<Scalar>::BasicPosition (Scalar x, Scalar y)
+  : Vector (x, y)
   {
   }
 
-  double Position::distance (const Position & other) const
+  template<class Scalar>
+  Scalar BasicPosition<Scalar>::distance (const BasicPosition & other) const
   {
-    Eigen::Vector2d diff = other - *this;
+    Vector diff = other - *this;
     return diff.norm ();
   }
 
 
-  Line::Line (const Position & p1, const Position & p2)
+  template<class Scalar>
+  BasicLine<Scalar>::BasicLine (const BasicPosition<Scalar> & p1, const BasicPosition<Scalar> & p2)
   : _p1 (p1),
     _p2 (p2)
   {
   }
 
-  Line::~Line ()
+  template<class Scalar>
+  BasicLine<Scalar>::~BasicLine ()
   {
   }
 
-  Position Line::perpend (const Position & pos, double *t) const
+  template<class Scalar>
+  BasicPosition<Scalar> BasicLine<Scalar>::perpend (const BasicPosition<Scalar> & pos, Scalar *t) const
   {
-    Eigen::Vector2d dir = _p2 - _p1;
-    Eigen::Vector2d r = pos - _p1;
+    typename BasicPosition<Scalar>::Vector dir = _p2 - _p1;
+    typename BasicPosition<Scalar>::Vector r = pos - _p1;
 
     *t = (r.dot (dir)) / dir.squaredNorm ();
 
-    return Position (_p1 + dir * *t);
+    return BasicPosition<Scalar> (_p1 + dir * *t);
   }
 
-  double Line::distance (const Position & pos) const
+  template<class Scalar>
+  Scalar BasicLine<Scalar>::distance (const BasicPosition<Scalar> & pos) const
   {
-    double t;
-    Position p = perpend (pos, &t);
+    Scalar t;
+    BasicPosition<Scalar> p = perpend (pos, &t);
     return p.distance (pos);
   }
 
-  double Line::distance (const Position & pos, double *t) const
+  template<class Scalar>
+  Scalar BasicLine<Scalar>::distance (const BasicPosition<Scalar> & pos, Scalar *t) const
   {
-    Position p = perpend (pos, t);
+    BasicPosition<Scalar> p = perpend (pos, t);
     return p.distance (pos);
   }
 
-  const Position & Line::getPosition1 () const
+  template<class Scalar>
+  const BasicPosition<Scalar> & BasicLine<Scalar>::getPosition1 () const
   {
     return _p1;
   }
 
-  const Position & Line::getPosition2 () const
+  template<class Scalar>
+  const BasicPosition<Scalar> & BasicLine<Scalar>::getPosition2 () const
   {
     return _p2;
   }
 
-  Position Line::getDirection () const
+  template<class Scalar>
+  BasicPosition<Scalar> BasicLine<Scalar>::getDirection () const
   {
-    return Position (_p2 - _p1);
+    return BasicPosition<Scalar> (_p2 - _p1);
   }
 
-  LineSegment::LineSegment (const Position & p1, const Position & p2)
-  : Line (p1, p2)
+  template<class Scalar>
+  BasicLineSegment<Scalar>::BasicLineSegment (const BasicPosition<Scalar> & p1, const BasicPosition<Scalar> & p2)
+  : BasicLine<Scalar> (p1, p2)
   {
   }
 
-  LineSegment::~LineSegment ()
+  template<class Scalar>
+  BasicLineSegment<Scalar>::~BasicLineSegment ()
   {
   }
 
-  Position LineSegment::perpend (const Position & pos, double *t) const
+  template<class Scalar>
+  BasicPosition<Scalar> BasicLineSegment<Scalar>::perpend (const BasicPosition<Scalar> & pos, Scalar *t) const
   {
-    Position result = Line::perpend (pos, t);
+    BasicPosition<Scalar> result = BasicLine<Scalar>::perpend (pos, t);
 
     if (*t < 0)
       {
         *t = 0;
-        result = getPosition1 ();
+        result = this->getPosition1 ();
         return result;
       }
 
     if (*t > 1)
       {
         *t = 1;
-        result = getPosition2 ();
+        result = this->getPosition2 ();
         return result;
       }
 
     return result;
   }
 
-  Transformation::Transformation ()
-  : Eigen::Affine2d ()
+  /* Intersect the ray origin + s * direction (s >= 0) with this segment.
+   *
+   * Returns false if they don't intersect (or are parallel), otherwise s is set.
+   * With a normalized direction, s is the distance from origin.
+   */
+  template<class Scalar>
+  bool BasicLineSegment<Scalar>::intersectRay (const BasicPosition<Scalar> & origin,
+                                               const BasicPosition<Scalar> & direction, Scalar *s) const
   {
+    typename BasicPosition<Scalar>::Vector e = this->getPosition2 () - this->getPosition1 ();
+    typename BasicPosition<Scalar>::Vector w = this->getPosition1 () - origin;
+
+    Scalar denom = direction.x () * e.y () - direction.y () * e.x ();
+    if (denom == 0)
+      return false;
+
+    Scalar t = (w.x () * e.y () - w.y () * e.x ()) / denom;
+    Scalar u = (w.x () * direction.y () - w.y () * direction.x ()) / denom;
+    if (t < 0 || u < 0 || u > 1)
+      return false;
+
+    *s = t;
+    return true;
+  }
+
+  /* Do the segments intersect or touch.
+   */
+  template<class Scalar>
+  bool BasicLineSegment<Scalar>::intersects (const BasicLineSegment & other) const
+  {
+    return distance (other) == 0;
+  }
+
+  /* Distance of a point to the segment p1, p2, also for p1 == p2.
+   */
+  template<class Scalar>
+  static Scalar segmentPointDistance (const BasicPosition<Scalar> & p1, const BasicPosition<Scalar> & p2,
+                                      const BasicPosition<Scalar> & pos)
+  {
+    typename BasicPosition<Scalar>::Vector dir = p2 - p1;
+    typename BasicPosition<Scalar>::Vector r = pos - p1;
+    Scalar len2 = dir.squaredNorm ();
+    Scalar t = len2 > 0 ? std::min (Scalar (1), std::max (Scalar (0), r.dot (dir) / len2)) : Scalar (0);
+    return (r - dir * t).norm ();
+  }
+
+  /* Minimum distance between two segments, 0 if they intersect.
+   */
+  template<class Scalar>
+  Scalar BasicLineSegment<Scalar>::distance (const BasicLineSegment & other) const
+  {
+    const BasicPosition<Scalar> & a1 = this->getPosition1 ();
+    const BasicPosition<Scalar> & a2 = this->getPosition2 ();
+    const BasicPosition<Scalar> & b1 = other.getPosition1 ();
+    const BasicPosition<Scalar> & b2 = other.getPosition2 ();
+
+    // Proper intersection: The end points of each segment are on different sides of the other.
+    typename BasicPosition<Scalar>::Vector da = a2 - a1;
+    typename BasicPosition<Scalar>::Vector db = b2 - b1;
+    Scalar s1 = da.x () * (b1.y () - a1.y ()) - da.y () * (b1.x () - a1.x ());
+    Scalar s2 = da.x () * (b2.y () - a1.y ()) - da.y () * (b2.x () - a1.x ());
+    Scalar s3 = db.x () * (a1.y () - b1.y ()) - db.y () * (a1.x () - b1.x ());
+    Scalar s4 = db.x () * (a2.y () - b1.y ()) - db.y () * (a2.x () - b1.x ());
+    if (((s1 < 0 && s2 > 0) || (s1 > 0 && s2 < 0)) && ((s3 < 0 && s4 > 0) || (s3 > 0 && s4 < 0)))
+      return 0;
+
+    // Otherwise the closest points include an end point (touching gives 0 here).
+    return std::min (std::min (segmentPointDistance (a1, a2, b1), segmentPointDistance (a1, a2, b2)),
+                     std::min (segmentPointDistance (b1, b2, a1), segmentPointDistance (b1, b2, a2)));
+  }
+
+  /* The identity, unlike a default constructed Eigen transformation, so the cache is never
+   * computed from an uninitialized matrix.
+   */
+  template<class Scalar>
+  BasicTransformation<Scalar>::BasicTransformation ()
+  : Affine (Affine::Identity ())
+  {
+    update ();
   }
 
-  Transformation::Transformation (const Eigen::Affine2d & trafo)
-  : Eigen::Affine2d (trafo)
+  template<class Scalar>
+  BasicTransformation<Scalar>::BasicTransformation (const Affine & trafo)
+  : Affine (trafo)
   {
+    update ();
   }
 
-  Transformation::Transformation (const Position & translation, double rotation, double scale)
-  : Eigen::Affine2d ()
+  template<class Scalar>
+  BasicTransformation<Scalar>::BasicTransformation (const BasicPosition<Scalar> & translation, Scalar rotation, Scalar scale)
+  : Affine ()
   {
     set (translation, rotation, scale);
   }
 
-  void Transformation::set (const Position & translation, double rotation, double scale)
+  /* Same as Scaling (scale) * Translation (translation) * Rotation2D (rotation), but without
+   * composing the matrices.
+   */
+  template<class Scalar>
+  void BasicTransformation<Scalar>::set (const BasicPosition<Scalar> & translation, Scalar rotation, Scalar scale)
   {
-    *this = Eigen::Scaling (scale) * Eigen::Translation2d (translation) * Eigen::Rotation2Dd (rotation);
+    Scalar c = std::cos (rotation) * scale;
+    Scalar s = std::sin (rotation) * scale;
+
+    this->matrix () << c, -s, scale * translation.x (),
+                       s,  c, scale * translation.y (),
+                       0,  0, 1;
+    update ();
   }
 
-  Position Transformation::getTranslation () const
+  /* Recompute the cached rotation and scale, needed after the matrix was changed through the
+   * Eigen interface to get the fast getters back.
+   */
+  template<class Scalar>
+  void BasicTransformation<Scalar>::update ()
   {
-    Position result;
+    const Scalar a = (*this)(0, 0);
+    const Scalar b = (*this)(0, 1);
+    const Scalar c = (*this)(1, 0);
+    const Scalar d = (*this)(1, 1);
+    _cache_linear[0] = a;
+    _cache_linear[1] = c;
+    _cache_linear[2] = b;
+    _cache_linear[3] = d;
+
+    // A similarity has the linear part scale * [cos -sin; sin cos]
+    const Scalar scale = std::sqrt (a * a + c * c);
+    const Scalar tolerance = std::numeric_limits<Scalar>::epsilon () * 16 * scale;
+    _cache_similarity = scale > 0 && std::abs (a - d) <= tolerance && std::abs (b + c) <= tolerance;
+
+    if (_cache_similarity)
+      {
+        _cache_rotation = std::atan2 (c, a);
+        _cache_scale = scale;
+      }
+    else
+      decompose (&_cache_rotation, &_cache_scale);
+  }
+
+  template<class Scalar>
+  bool BasicTransformation<Scalar>::isCached () const
+  {
+    return _cache_linear[0] == (*this)(0, 0) && _cache_linear[1] == (*this)(1, 0)
+      && _cache_linear[2] == (*this)(0, 1) && _cache_linear[3] == (*this)(1, 1);
+  }
+
+  /* Polar decomposition of the linear part, the scale is the mean of the scaling factors.
+   */
+  template<class Scalar>
+  void BasicTransformation<Scalar>::decompose (Scalar * rotation, Scalar * scale) const
+  {
+    Eigen::Matrix<Scalar, 2, 2> rot;
+    Eigen::Matrix<Scalar, 2, 2> scaling;
+    this->template computeScalingRotation<Eigen::Matrix<Scalar, 2, 2>, Eigen::Matrix<Scalar, 2, 2>>
+      (&scaling, &rot);
+
+    Eigen::Rotation2D<Scalar> rot2 (0);
+    rot2.fromRotationMatrix (rot);
+    *rotation = rot2.angle ();
+    *scale = (scaling.diagonal ().operator() (0) + scaling.diagonal ().operator() (1)) / Scalar (2.0);
+  }
+
+  template<class Scalar>
+  BasicPosition<Scalar> BasicTransformation<Scalar>::getTranslation () const
+  {
+    BasicPosition<Scalar> result;
     result.x () = (*this)(0, 2);
     result.y () = (*this)(1, 2);
     return result;
   }
 
-  double Transformation::getRotation () const
+  template<class Scalar>
+  Scalar BasicTransformation<Scalar>::getRotation () const
   {
-    Eigen::Matrix2d rotation;
-    computeScalingRotation<Eigen::Matrix2d, Eigen::Matrix2d>
-      (nullptr /*scaling*/, &rotation);
+    if (isCached ())
+      return _cache_rotation;
 
-    Eigen::Rotation2Dd rot2 (0);
-    rot2.fromRotationMatrix (rotation);
-    return rot2.angle ();
+    Scalar rotation, scale;
+    decompose (&rotation, &scale);
+    return rotation;
   }
 
-  double Transformation::getScale () const
+  template<class Scalar>
+  Scalar BasicTransformation<Scalar>::getScale () const
   {
-    Eigen::Matrix2d scaling;
-    computeScalingRotation<Eigen::Matrix2d, Eigen::Matrix2d>
-      (&scaling, nullptr /*rotation*/);
-    return (scaling.diagonal ().operator() (0) + scaling.diagonal ().operator() (1)) / 2.0;
+    if (isCached ())
+      return _cache_scale;
+
+    Scalar rotation, scale;
+    decompose (&rotation, &scale);
+    return scale;
   }
 
-  Position Transformation::transformPosition (const Position & pos) const
+  /* Whether the transformation is a similarity, i.e. only translates, rotates and scales
+   * uniformly. Only known for the cached linear part, false otherwise.
+   */
+  template<class Scalar>
+  bool BasicTransformation<Scalar>::isSimilarity () const
   {
-    Position result;
-    result.x () = ((*this)(0, 0) * pos.x () + (*this)(0, 1) * pos.y () + (*this)(0, 2)) / (*this)(2, 2);
-    result.y () = ((*this)(1, 0) * pos.x () + (*this)(1, 1) * pos.y () + (*this)(1, 2)) / (*this)(2, 2);
+    return isCached () && _cache_similarity;
+  }
+
+  template<class Scalar>
+  BasicPosition<Scalar> BasicTransformation<Scalar>::transformPosition (const BasicPosition<Scalar> & pos) const
+  {
+    BasicPosition<Scalar> result;
+    result.x () = (*this)(0, 0) * pos.x () + (*this)(0, 1) * pos.y () + (*this)(0, 2);
+    result.y () = (*this)(1, 0) * pos.x () + (*this)(1, 1) * pos.y () + (*this)(1, 2);
+
+    // The projective term is 1 for everything set up as affine transformation
+    if ((*this)(2, 2) != Scalar (1))
+      result /= (*this)(2, 2);
     return result;
   }
 
-  Position Transformation::rotatePosition (const Position & pos) const
+  template<class Scalar>
+  BasicPosition<Scalar> BasicTransformation<Scalar>::rotatePosition (const BasicPosition<Scalar> & pos) const
   {
-    Position result;
+    BasicPosition<Scalar> result;
     result.x () = (*this)(0, 0) * pos.x () + (*this)(0, 1) * pos.y ();
     result.y () = (*this)(1, 0) * pos.x () + (*this)(1, 1) * pos.y ();
     return result;
   }
+
+  /* Transform count positions from src to dst, which may be the same array.
+   *
+   * Every position is a packet of Eigen (for double), transformed as
+   * column0 * x + column1 * y + translation.
+   */
+  template<class Scalar>
+  void BasicTransformation<Scalar>::transformBatch (const BasicPosition<Scalar> * src, BasicPosition<Scalar> * dst,
+                                                    size_t count) const
+  {
+    PATHFINDER_TRACE_SCOPE ("Transformation::transformBatch");
+
+    typedef Eigen::Matrix<Scalar, 2, 1> Column;
+    const Scalar w = (*this)(2, 2);
+    const Column col0 = this->matrix ().template block<2, 1> (0, 0) / w;
+    const Column col1 = this->matrix ().template block<2, 1> (0, 1) / w;
+    const Column offset = this->matrix ().template block<2, 1> (0, 2) / w;
+
+    for (size_t i=0; i < count; ++i)
+      {
+        const Scalar x = src[i].x ();
+        const Scalar y = src[i].y ();
+        dst[i] = col0 * x + col1 * y + offset;
+      }
+  }
+
+  template<class Scalar>
+  void BasicTransformation<Scalar>::transformBatch (BasicPositionVector<Scalar> & positions) const
+  {
+    transformBatch (positions.data (), positions.data (), positions.size ());
+  }
+
+  // The geometry is only used with these scalar types, so the implementation can stay here.
+  template class BasicPosition<double>;
+  template class BasicPosition<float>;
+  template class BasicLine<double>;
+  template class BasicLine<float>;
+  template class BasicLineSegment<double>;
+  template class BasicLineSegment<float>;
+  template class BasicTransformation<double>;
+  template class BasicTransformation<float>;
 }
@@ -2,6 +2,9 @@
  *
  */
 
+#ifndef ROBOT_GEOMETRY_H
+#define ROBOT_GEOMETRY_H
+
 #include <vector>
 #include <map>
 #include <cstdint>
@@ -10,6 +13,8 @@
 #include <Eigen/Dense>
 #include <Eigen/StdVector>
 
+#include "robot-trace.h"
+
 #if __cplusplus >= 201700L
 #  include <optional>
 #else
@@ -20,6 +25,7 @@ namespace std
   {
     public:
       optional () : _d (0) {};
+      optional (const optional & o) : _d (o._d != 0 ? new T (*o._d) : 0) {};
       ~optional () { reset (); };
 
       void reset () { if (_d != 0) { delete _d; _d = 0;} };
@@ -38,6 +44,18 @@ namespace std
         return *_d;
       }
 
+      optional & operator= (const optional & o)
+      {
+        if (this == &o)
+          return *this;
+
+        if (o._d == 0)
+          reset ();
+        else
+          *this = *o._d;
+        return *this;
+      }
+
     private:
       T * _d;
   };
@@ -46,84 +64,162 @@ namespace std
 
 namespace Pathfinder
 {
-  class Position : public Eigen::Vector2d
+  // Scalar type of the hot kernels (distance queries, ray casting, scan transformations).
+  // Can be switched to float at compile time, where the precision budget allows it,
+  // to get twice the number of SIMD lanes.
+#ifndef PATHFINDER_KERNEL_SCALAR
+#  define PATHFINDER_KERNEL_SCALAR double
+#endif
+  typedef PATHFINDER_KERNEL_SCALAR KernelScalar;
+
+  template<class Scalar>
+  class BasicPosition : public Eigen::Matrix<Scalar, 2, 1>
   {
     public:
-      Position ();
-      Position (double x, double y);
+      typedef Eigen::Matrix<Scalar, 2, 1> Vector;
+
+      BasicPosition ();
+      BasicPosition (Scalar x, Scalar y);
 
       template<class T>
-      Position (const T & p) : Eigen::Vector2d (p) {}
+      BasicPosition (const T & p) : Vector (p) {}
 
-      double & x ()             { return operator[] (0); }
-      const double & x () const { return operator[] (0); }
+      Scalar & x ()             { return this->operator[] (0); }
+      const Scalar & x () const { return this->operator[] (0); }
 
-      double & y ()             { return operator[] (1); }
-      const double & y () const { return operator[] (1); }
+      Scalar & y ()             { return this->operator[] (1); }
+      const Scalar & y () const { return this->operator[] (1); }
 
-      double distance (const Position & other) const;
+      Scalar distance (const BasicPosition & other) const;
   };
 
-  class Line
+  template<class Scalar>
+  using BasicPositionVector = std::vector<BasicPosition<Scalar>,Eigen::aligned_allocator<BasicPosition<Scalar>>>;
+
+  template<class Scalar>
+  class BasicLine
   {
     public:
-      Line (const Position & p1, const Position & p2);
-      virtual ~Line ();
+      BasicLine (const BasicPosition<Scalar> & p1, const BasicPosition<Scalar> & p2);
+      virtual ~BasicLine ();
 
-      virtual Position perpend (const Position & pos, double *t) const;
-      virtual double distance (const Position & pos) const;
-      virtual double distance (const Position & pos, double *t) const;
+      virtual BasicPosition<Scalar> perpend (const BasicPosition<Scalar> & pos, Scalar *t) const;
+      virtual Scalar distance (const BasicPosition<Scalar> & pos) const;
+      virtual Scalar distance (const BasicPosition<Scalar> & pos, Scalar *t) const;
 
-      const Position & getPosition1 () const;
-      const Position & getPosition2 () const;
-      Position getDirection () const;
+      const BasicPosition<Scalar> & getPosition1 () const;
+      const BasicPosition<Scalar> & getPosition2 () const;
+      BasicPosition<Scalar> getDirection () const;
 
     private:
-      Position _p1;
-      Position _p2;
+      BasicPosition<Scalar> _p1;
+      BasicPosition<Scalar> _p2;
   };
 
-  class LineSegment : public Line
+  template<class Scalar>
+  class BasicLineSegment : public BasicLine<Scalar>
   {
     public:
-      LineSegment (const Position & p1, const Position & p2);
-      virtual ~LineSegment ();
+      BasicLineSegment (const BasicPosition<Scalar> & p1, const BasicPosition<Scalar> & p2);
+      virtual ~BasicLineSegment ();
+
+      using BasicLine<Scalar>::distance;
 
-      virtual Position perpend (const Position & pos, double *t) const;
+      virtual BasicPosition<Scalar> perpend (const BasicPosition<Scalar> & pos, Scalar *t) const;
+      bool intersectRay (const BasicPosition<Scalar> & origin, const BasicPosition<Scalar> & direction, Scalar *s) const;
+      bool intersects (const BasicLineSegment & other) const;
+      Scalar distance (const BasicLineSegment & other) const;
   };
 
-  template<uint32_t degree>
+  template<uint32_t degree, class Scalar = double>
   class PolynomCurve
   {
     public:
+      typedef BasicPosition<Scalar> Pos;
+
       PolynomCurve ();
 
-      Position get (double t) const;
-      std::optional<double> adjust (const std::vector<Position,Eigen::aligned_allocator<Position>> & positions);
-      Position projectOnCurve (const Position & pos, double t_min = -1.0, double t_max = 1.0) const;
+      Pos get (Scalar t) const;
+      Pos getDerivative (Scalar t) const;
+      const Pos & getCoefficient (uint32_t i) const;
+      void setCoefficient (uint32_t i, const Pos & coefficient);
+      std::optional<Scalar> adjust (const BasicPositionVector<Scalar> & positions);
+      std::optional<Scalar> adjust (const Pos * positions, uint32_t count, bool keep_ends = false);
+      Scalar closestParameter (const Pos & pos, Scalar t_min = -1.0, Scalar t_max = 1.0, uint32_t probes = 32) const;
+      Pos projectOnCurve (const Pos & pos, Scalar t_min = -1.0, Scalar t_max = 1.0) const;
 
       static void test ();
 
     private:
-      Eigen::Matrix<Position, degree+1, 1> _coeff;
+      Eigen::Matrix<Pos, degree+1, 1> _coeff;
   };
 
-  class Transformation : public Eigen::Affine2d
+  /* Affine transformation, usually a similarity (translation, rotation and uniform scale).
+   *
+   * Rotation and scale are cached for the linear part they were computed from. After changing
+   * the matrix through the Eigen interface, the getters notice the change and fall back to the
+   * (slower) decomposition until update () is called.
+   */
+  template<class Scalar>
+  class BasicTransformation : public Eigen::Transform<Scalar, 2, Eigen::Affine>
   {
     public:
-      Transformation ();
-      Transformation (const Eigen::Affine2d & trafo);
-      Transformation (const Position & translation, double rotation, double scale);
+      typedef Eigen::Transform<Scalar, 2, Eigen::Affine> Affine;
+
+      BasicTransformation ();
+      BasicTransformation (const Affine & trafo);
+      BasicTransformation (const BasicPosition<Scalar> & translation, Scalar rotation, Scalar scale);
 
-      void set (const Position & translation, double rotation, double scale);
-      Position getTranslation () const;
-      double getRotation () const;
-      double getScale () const;
+      void set (const BasicPosition<Scalar> & translation, Scalar rotation, Scalar scale);
+      void update ();
+      BasicPosition<Scalar> getTranslation () const;
+      Scalar getRotation () const;
+      Scalar getScale () const;
+      bool isSimilarity () const;
+
+      BasicPosition<Scalar> transformPosition (const BasicPosition<Scalar> & pos) const;
+      BasicPosition<Scalar> rotatePosition (const BasicPosition<Scalar> & pos) const;
+      void transformBatch (const BasicPosition<Scalar> * src, BasicPosition<Scalar> * dst, size_t count) const;
+      void transformBatch (BasicPositionVector<Scalar> & positions) const;
+
+    private:
+      bool isCached () const;
+      void decompose (Scalar * rotation, Scalar * scale) const;
 
-      Position transformPosition (const Position & pos) const;
-      Position rotatePosition (const Position & pos) const;
+      Scalar _cache_linear[4];    // Linear part the cache was computed for, column major
+      Scalar _cache_rotation;
+      Scalar _cache_scale;
+      bool _cache_similarity;
   };
 
+  // The double precision types are the default for everything that is stored.
+  typedef BasicPosition<double> Position;
+  typedef BasicPositionVector<double> PositionVector;
+  typedef BasicLine<double> Line;
+  typedef BasicLineSegment<double> LineSegment;
+  typedef BasicTransformation<double> Transformation;
+
+  // Single precision types for kernels, which can live with the reduced precision.
+  typedef BasicPosition<float> Positionf;
+  typedef BasicPositionVector<float> PositionVectorf;
+  typedef BasicLine<float> Linef;
+  typedef BasicLineSegment<float> LineSegmentf;
+  typedef BasicTransformation<float> Transformationf;
+
+  // The precision selected for the hot kernels.
+  typedef BasicPosition<KernelScalar> KernelPosition;
+  typedef BasicLineSegment<KernelScalar> KernelLineSegment;
+  typedef BasicTransformation<KernelScalar> KernelTransformation;
+
+  extern template class BasicPosition<double>;
+  extern template class BasicPosition<float>;
+  extern template class BasicLine<double>;
+  extern template class BasicLine<float>;
+  extern template class BasicLineSegment<double>;
+  extern template class BasicLineSegment<float>;
+  extern template class BasicTransformation<double>;
+  extern template class BasicTransformation<float>;
+
 
 
   //====================================================================
@@ -131,97 +227,186 @@ namespace Pathfinder
   // Implementation of template classes
   //
 
-  template<uint32_t degree>
-  PolynomCurve<degree>::PolynomCurve ()
+  template<uint32_t degree, class Scalar>
+  PolynomCurve<degree, Scalar>::PolynomCurve ()
   : _coeff ()
   {
   }
 
-  template<uint32_t degree>
-  Position PolynomCurve<degree>::get (double t) const
+  template<uint32_t degree, class Scalar>
+  typename PolynomCurve<degree, Scalar>::Pos PolynomCurve<degree, Scalar>::get (Scalar t) const
   {
-    Position result (0, 0);
-    for (uint32_t i=0; i <= degree; ++i)
-      result += _coeff[i] * std::pow (t, i);
+    Pos result (_coeff[degree]);
+    for (uint32_t i=degree; i-- > 0;)
+      result = result * t + _coeff[i];
 
     return result;
   }
 
-  template<uint32_t degree>
-  std::optional<double> PolynomCurve<degree>::adjust
-  (const std::vector<Position,Eigen::aligned_allocator<Position>> & positions)
+  template<uint32_t degree, class Scalar>
+  typename PolynomCurve<degree, Scalar>::Pos PolynomCurve<degree, Scalar>::getDerivative (Scalar t) const
   {
-    std::optional<double> residual;
-    if (positions.size () <= degree)
-      return residual;
+    Pos result (0, 0);
+    for (uint32_t i=degree; i > 0; --i)
+      result = result * t + _coeff[i] * Scalar (i);
 
-    Eigen::Matrix<double, Eigen::Dynamic, degree+1> a;
-    a.resize (positions.size (), degree+1);
-    Eigen::VectorXd vx (positions.size ());
-    Eigen::VectorXd vy (positions.size ());
+    return result;
+  }
 
-    std::vector<double> t (positions.size ());
+  /* Coefficient i, of t to the power of i.
+   */
+  template<uint32_t degree, class Scalar>
+  const typename PolynomCurve<degree, Scalar>::Pos & PolynomCurve<degree, Scalar>::getCoefficient (uint32_t i) const
+  {
+    return _coeff[i];
+  }
+
+  template<uint32_t degree, class Scalar>
+  void PolynomCurve<degree, Scalar>::setCoefficient (uint32_t i, const Pos & coefficient)
+  {
+    _coeff[i] = coefficient;
+  }
+
+  template<uint32_t degree, class Scalar>
+  std::optional<Scalar> PolynomCurve<degree, Scalar>::adjust
+  (const BasicPositionVector<Scalar> & positions)
+  {
+    return adjust (positions.data (), positions.size ());
+  }
+
+  /* Fit the curve to count positions, t from -1 at the first to 1 at the last one, spaced by
+   * the distances of the positions. With keep_ends, the curve goes exactly through the first
+   * and last position (up to rounding), e.g. to chain curves.
+   *
+   * Returns the mean absolute residual of the coordinates.
+   */
+  template<uint32_t degree, class Scalar>
+  std::optional<Scalar> PolynomCurve<degree, Scalar>::adjust
+  (const Pos * positions, uint32_t count, bool keep_ends)
+  {
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> VectorX;
+
+    PATHFINDER_TRACE_SCOPE ("PolynomCurve::adjust");
+    PATHFINDER_TRACE_COUNT ("PolynomCurve::adjust.points", count);
+
+    std::optional<Scalar> residual;
+    if (count <= (keep_ends ? 1 : degree))
+      return residual;
+
+    std::vector<Scalar> t (count);
     t[0] = 0;
-    for (uint32_t i=1; i < positions.size (); ++i)
+    for (uint32_t i=1; i < count; ++i)
       t[i] = t[i-1] + positions[i].distance (positions[i-1]);
 
     if (t.back() <= 0.0)
       return residual;
 
-    for (double& ti: t)
-      ti = 2.0 * ti / t.back () - 1.0;
-
-    for (uint32_t i=0; i < t.size (); ++i)
-      std::cerr << "t[" << i << "] = " << t[i] << std::endl;
+    for (Scalar& ti: t)
+      ti = Scalar (2.0) * ti / t.back () - Scalar (1.0);
 
-    for (uint32_t i=0; i < positions.size (); ++i)
+    if (!keep_ends)
       {
-        double ti = t[i];
+        Eigen::Matrix<Scalar, Eigen::Dynamic, degree+1> a;
+        a.resize (count, degree+1);
+        VectorX vx (count);
+        VectorX vy (count);
 
-        for (uint32_t j=0; j <= degree; ++j)
-          a (i, j) = ::pow (ti, j);
+        for (uint32_t i=0; i < count; ++i)
+          {
+            Scalar ti = t[i];
 
-        vx[i] = positions[i].x ();
-        vy[i] = positions[i].y ();
-      }
+            for (uint32_t j=0; j <= degree; ++j)
+              a (i, j) = std::pow (ti, Scalar (j));
 
-    Eigen::Matrix<double, degree+1, degree+1> n = a.transpose () * a;
-    Eigen::Matrix<double, degree+1, 1> lx = a.transpose () * vx;
-    Eigen::Matrix<double, degree+1, 1> ly = a.transpose () * vy;
+            vx[i] = positions[i].x ();
+            vy[i] = positions[i].y ();
+          }
 
-    Eigen::LDLT<Eigen::Matrix<double, degree+1, degree+1>> cholesky (n);
-    Eigen::Matrix<double, degree+1, 1> xx = cholesky.solve (lx);
-    Eigen::Matrix<double, degree+1, 1> xy = cholesky.solve (ly);
+        Eigen::Matrix<Scalar, degree+1, degree+1> n = a.transpose () * a;
+        Eigen::Matrix<Scalar, degree+1, 1> lx = a.transpose () * vx;
+        Eigen::Matrix<Scalar, degree+1, 1> ly = a.transpose () * vy;
 
-    for (uint32_t i=0; i <= degree; ++i)
-      _coeff[i] = Position (xx[i], xy[i]);
+        Eigen::LDLT<Eigen::Matrix<Scalar, degree+1, degree+1>> cholesky (n);
+        Eigen::Matrix<Scalar, degree+1, 1> xx = cholesky.solve (lx);
+        Eigen::Matrix<Scalar, degree+1, 1> xy = cholesky.solve (ly);
+
+        for (uint32_t i=0; i <= degree; ++i)
+          _coeff[i] = Pos (xx[i], xy[i]);
+      }
+    else
+      {
+        // The line through the ends plus (t^2 - 1) * q(t), which is 0 at both ends. Only q,
+        // of degree - 2, is fitted to what the line leaves.
+        const Pos & first = positions[0];
+        const Pos & last = positions[count-1];
+        for (uint32_t i=0; i <= degree; ++i)
+          _coeff[i] = Pos (0, 0);
+        _coeff[0] = (first + last) / Scalar (2.0);
+        if (degree >= 1)
+          _coeff[1] = (last - first) / Scalar (2.0);
+
+        const uint32_t free = degree >= 2 ? degree - 1 : 0;
+        if (free > 0 && count > 2)
+          {
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> a (count - 2, free);
+            VectorX vx (count - 2);
+            VectorX vy (count - 2);
+            for (uint32_t i=1; i + 1 < count; ++i)
+              {
+                Scalar ti = t[i];
+                for (uint32_t j=0; j < free; ++j)
+                  a (i-1, j) = (ti * ti - Scalar (1.0)) * std::pow (ti, Scalar (j));
+
+                Pos r = positions[i] - get (ti);
+                vx[i-1] = r.x ();
+                vy[i-1] = r.y ();
+              }
+
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> n = a.transpose () * a;
+            Eigen::LDLT<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>> cholesky (n);
+            VectorX qx = cholesky.solve (a.transpose () * vx);
+            VectorX qy = cholesky.solve (a.transpose () * vy);
+
+            // (t^2 - 1) * sum q_j t^j
+            for (uint32_t j=0; j < free; ++j)
+              if (std::isfinite (qx[j]) && std::isfinite (qy[j]))
+                {
+                  Pos q (qx[j], qy[j]);
+                  _coeff[j+2] += q;
+                  _coeff[j] -= q;
+                }
+          }
+      }
 
     residual = 0;
 
-    for (uint32_t i=0; i < positions.size (); ++i)
+    for (uint32_t i=0; i < count; ++i)
       {
-        Position p = get (t[i]);
-        *residual += fabs (p.x () - positions[i].x ()) + fabs (p.y () - positions[i].y ());
+        Pos p = get (t[i]);
+        *residual += std::fabs (p.x () - positions[i].x ()) + std::fabs (p.y () - positions[i].y ());
       }
 
-    *residual /= positions.size () * 2;
+    *residual /= count * 2;
 
     return residual;
   }
 
-  template<uint32_t degree>
-  Position PolynomCurve<degree>::projectOnCurve (const Position & pos, double t_min, double t_max) const
+  /* The t from t_min to t_max of the position of the curve closest to pos: the closest of
+   * probes + 1 evenly spaced ones, refined with Newton steps.
+   */
+  template<uint32_t degree, class Scalar>
+  Scalar PolynomCurve<degree, Scalar>::closestParameter
+  (const Pos & pos, Scalar t_min, Scalar t_max, uint32_t probes) const
   {
     // First, try to find a good starting point for the adjustment.
-    // Probe n positions from t_min to t_max (n==32):
-    double step = (t_max - t_min) / 32;
-    double best_t = t_min;
-    double best_dist = get (t_min).distance (pos);
+    Scalar step = (t_max - t_min) / probes;
+    Scalar best_t = t_min;
+    Scalar best_dist = (get (t_min) - pos).squaredNorm ();
 
-    for (uint32_t i=1; i <= 32; ++i)
+    for (uint32_t i=1; i <= probes; ++i)
       {
-        double t = t_min + i * step;
-        double dist = get (t).distance (pos);
+        Scalar t = t_min + i * step;
+        Scalar dist = (get (t) - pos).squaredNorm ();
 
         if (dist < best_dist)
           {
@@ -230,52 +415,54 @@ namespace Pathfinder
           }
       }
 
-    // Now try to iteratively minimize the error
-    uint32_t iter = 0;
-    double x;
-    do
+    // Now minimize the squared distance: Newton steps on its derivative
+    Scalar t = best_t;
+    for (uint32_t iter=0; iter < 20; ++iter)
       {
-        Position deriv (0, 0);
-        for (uint32_t i=1; i <= degree; ++i)
-          deriv += _coeff[i] * pow (best_t, i-1) * i;
-        Position dist = get (best_t) - pos;
-
-        double n = deriv.norm ();
-        double l = deriv.transpose () * dist;
-        x = l/n;
-        best_t += x;
-        if (best_t > t_max)
-          {
-            best_t = t_max;
-            break;
-          }
-        else if (best_t < t_min)
-          {
-            best_t = t_min;
-            break;
-          }
-
-        ++iter;
+        Pos d1 = getDerivative (t);
+        Pos d2 (0, 0);
+        for (uint32_t i=degree; i > 1; --i)
+          d2 = d2 * t + _coeff[i] * Scalar (i * (i-1));
+        Pos diff = get (t) - pos;
+
+        Scalar f1 = d1.dot (diff);
+        Scalar f2 = d1.squaredNorm () + d2.dot (diff);
+        if (!(f2 > 0))
+          break;
+
+        Scalar x = f1 / f2;
+        t = std::min (t_max, std::max (t_min, t - x));
+        if (std::fabs (x) <= Scalar (1e-12))
+          break;
       }
-    while (x > 1e-12 && iter < 20);
 
-    return get (best_t);
+    if ((get (t) - pos).squaredNorm () <= best_dist)
+      best_t = t;
+
+    return best_t;
   }
 
-  template<uint32_t degree>
-  void PolynomCurve<degree>::test ()
+  template<uint32_t degree, class Scalar>
+  typename PolynomCurve<degree, Scalar>::Pos PolynomCurve<degree, Scalar>::projectOnCurve
+  (const Pos & pos, Scalar t_min, Scalar t_max) const
+  {
+    return get (closestParameter (pos, t_min, t_max));
+  }
+
+  template<uint32_t degree, class Scalar>
+  void PolynomCurve<degree, Scalar>::test ()
   {
     if (degree > 3)
       return;
 
-    std::vector<Position,Eigen::aligned_allocator<Position>> pos;
-    pos.push_back (Position (0, 0));
-    pos.push_back (Position (1, 0.5));
-    pos.push_back (Position (2, 0.75));
-    pos.push_back (Position (3, 1.5));
+    BasicPositionVector<Scalar> pos;
+    pos.push_back (Pos (0, 0));
+    pos.push_back (Pos (1, 0.5));
+    pos.push_back (Pos (2, 0.75));
+    pos.push_back (Pos (3, 1.5));
 
     PolynomCurve p;
-    std::optional<double> residual = p.adjust (pos);
+    std::optional<Scalar> residual = p.adjust (pos);
     if (!residual.has_value ())
       {
         std::cerr << "Adjust of PolynomCurve degree " << degree << " failed" << std::endl;
@@ -290,10 +477,12 @@ namespace Pathfinder
         std::cerr << "(" << p._coeff[i].x () << ", " << p._coeff[i].y () << ")";
       }
     std::cerr << std::endl;
-    for (double t=-1.0; t <= 1.0; t += 0.125)
+    for (Scalar t=-1.0; t <= 1.0; t += 0.125)
       {
-        Position pt = p.get (t);
+        Pos pt = p.get (t);
         std::cerr << t << ": " << pt.x () << ", " << pt.y () << std::endl;
       }
   }
 }
+
+#endif
@@ -0,0 +1,606 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+#include "robot-hierarchicalplanner.h"
+#include "robot-parallel.h"
+
+namespace Pathfinder
+{
+  static const uint32_t hierarchicalPlannerNone = 0xffffffff;
+
+  /* Distance of pos to the segment a, b.
+   */
+  static double hierarchicalPlannerDistance (const Position & a, const Position & b, const Position & pos)
+  {
+    Eigen::Vector2d dir = b - a;
+    Eigen::Vector2d r = pos - a;
+    double len2 = dir.squaredNorm ();
+    double t = len2 > 0.0 ? std::min (1.0, std::max (0.0, r.dot (dir) / len2)) : 0.0;
+    return (r - dir * t).norm ();
+  }
+
+  HierarchicalPlanner::Parameters::Parameters ()
+  : resolution (0.1),
+    clearance (0.3),
+    cluster_size (32),
+    transition_spacing (16),
+    margin (1.0),
+    threads (0)
+  {
+  }
+
+  HierarchicalPlanner::HierarchicalPlanner (const Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _index (1.0),
+    _origin_x (0.0),
+    _origin_y (0.0),
+    _width (0),
+    _height (0),
+    _clusters_x (0),
+    _clusters_y (0),
+    _blocked (),
+    _clusters (),
+    _right_transitions (),
+    _top_transitions ()
+  {
+    update ();
+  }
+
+  /* Rebuild everything: The raster covers the bounding box of the map (both layers).
+   */
+  void HierarchicalPlanner::update ()
+  {
+    PATHFINDER_TRACE_SCOPE ("HierarchicalPlanner::update");
+
+    _index.clear ();
+    Eigen::AlignedBox2d box;
+    for (const MapObject & obj: _map.getObjects ())
+      {
+        _index.insert (obj);
+        box.extend (obj.getBoundingBox ());
+      }
+    for (const MapObject & obj: _map.getDynamicObjects ())
+      {
+        _index.insert (obj);
+        box.extend (obj.getBoundingBox ());
+      }
+
+    double res = _parameters.resolution;
+    uint32_t k = _parameters.cluster_size;
+    if (box.isEmpty ())
+      box = Eigen::AlignedBox2d (Position (0, 0), Position (0, 0));
+    // aligned to the resolution, the cells are the same as those of the AnytimePlanner
+    _origin_x = std::floor ((box.min ().x () - _parameters.margin) / res) * res;
+    _origin_y = std::floor ((box.min ().y () - _parameters.margin) / res) * res;
+    _width = std::ceil ((box.max ().x () + _parameters.margin - _origin_x) / res);
+    _height = std::ceil ((box.max ().y () + _parameters.margin - _origin_y) / res);
+    _clusters_x = (_width + k - 1) / k;
+    _clusters_y = (_height + k - 1) / k;
+
+    _blocked.assign (size_t (_width) * _height, 0);
+    _clusters.assign (_clusters_x * _clusters_y, Cluster ());
+    _right_transitions.assign (_clusters.size (), std::vector<uint32_t> ());
+    _top_transitions.assign (_clusters.size (), std::vector<uint32_t> ());
+
+    std::vector<uint32_t> all (_clusters.size ());
+    for (uint32_t c=0; c < all.size (); ++c)
+      all[c] = c;
+    rebuild (all);
+  }
+
+  /* The objects within region changed (e.g. the union of the old and new bounding box of an
+   * object): Only the clusters overlapping it are rasterized again, and only the objects near
+   * them (by the boxes the map keeps of its objects) are indexed for that.
+   */
+  void HierarchicalPlanner::update (const Eigen::AlignedBox2d & region)
+  {
+    PATHFINDER_TRACE_SCOPE ("HierarchicalPlanner::update/region");
+
+    if (region.isEmpty () || _clusters.empty ())
+      return;
+
+    double size = _parameters.cluster_size * _parameters.resolution;
+    double grow = _parameters.clearance + _parameters.resolution;
+    int32_t cx0 = std::max (0.0, std::floor ((region.min ().x () - grow - _origin_x) / size));
+    int32_t cy0 = std::max (0.0, std::floor ((region.min ().y () - grow - _origin_y) / size));
+    int32_t cx1 = std::min (_clusters_x - 1.0, std::floor ((region.max ().x () + grow - _origin_x) / size));
+    int32_t cy1 = std::min (_clusters_y - 1.0, std::floor ((region.max ().y () + grow - _origin_y) / size));
+
+    std::vector<uint32_t> dirty;
+    for (int32_t cy=cy0; cy <= cy1; ++cy)
+      for (int32_t cx=cx0; cx <= cx1; ++cx)
+        dirty.push_back (cy * _clusters_x + cx);
+    if (dirty.empty ())
+      return;
+
+    // The area rasterize reads: the dirty clusters, grown by the clearance
+    double res = _parameters.resolution;
+    int32_t k = _parameters.cluster_size;
+    Eigen::AlignedBox2d area (Position (_origin_x + cx0 * k * res - _parameters.clearance,
+                                        _origin_y + cy0 * k * res - _parameters.clearance),
+                              Position (_origin_x + std::min (_width, (cx1 + 1) * k) * res + _parameters.clearance,
+                                        _origin_y + std::min (_height, (cy1 + 1) * k) * res + _parameters.clearance));
+    _index.clear ();
+    for (uint32_t i=0; i < _map.getObjectCount (); ++i)
+      if (area.intersects (_map.getObjectBox (i)))
+        _index.insert (_map.getObjects ()[i]);
+    for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+      if (area.intersects (_map.getDynamicObjectBox (i)))
+        _index.insert (_map.getDynamicObjects ()[i]);
+
+    rebuild (dirty);
+  }
+
+  /* Rasterize the dirty clusters, then find the transitions on their borders and connect the
+   * entrances of all clusters touching these borders.
+   */
+  void HierarchicalPlanner::rebuild (const std::vector<uint32_t> & dirty)
+  {
+    uint32_t threads = _parameters.threads > 0 ? _parameters.threads : defaultThreadCount ();
+    std::vector<bool> borders (_clusters.size (), false);
+    std::vector<bool> connect_clusters (_clusters.size (), false);
+    for (uint32_t c: dirty)
+      {
+        int32_t cx = c % _clusters_x;
+        int32_t cy = c / _clusters_x;
+        borders[c] = true;
+        connect_clusters[c] = true;
+        if (cx > 0)
+          borders[c - 1] = connect_clusters[c - 1] = true;
+        if (cy > 0)
+          borders[c - _clusters_x] = connect_clusters[c - _clusters_x] = true;
+        if (cx + 1 < _clusters_x)
+          connect_clusters[c + 1] = true;
+        if (cy + 1 < _clusters_y)
+          connect_clusters[c + _clusters_x] = true;
+      }
+
+    std::vector<uint32_t> border_list;
+    std::vector<uint32_t> connect_list;
+    for (uint32_t c=0; c < _clusters.size (); ++c)
+      {
+        if (borders[c])
+          border_list.push_back (c);
+        if (connect_clusters[c])
+          connect_list.push_back (c);
+      }
+
+    parallelFor (dirty.size (), threads, [&] (uint32_t i) { rasterize (dirty[i]); });
+    parallelFor (border_list.size (), threads, [&] (uint32_t i) { findTransitions (border_list[i]); });
+    parallelFor (connect_list.size (), threads, [&] (uint32_t i) { connect (connect_list[i]); });
+  }
+
+  /* Mark the cells of a cluster closer than clearance to a segment.
+   */
+  void HierarchicalPlanner::rasterize (uint32_t cluster)
+  {
+    double res = _parameters.resolution;
+    double clearance = _parameters.clearance;
+    int32_t k = _parameters.cluster_size;
+    int32_t x0 = (cluster % _clusters_x) * k;
+    int32_t y0 = (cluster / _clusters_x) * k;
+    int32_t x1 = std::min (_width, x0 + k);
+    int32_t y1 = std::min (_height, y0 + k);
+
+    for (int32_t y=y0; y < y1; ++y)
+      std::fill (_blocked.begin () + size_t (y) * _width + x0, _blocked.begin () + size_t (y) * _width + x1, 0);
+
+    Eigen::AlignedBox2d box (Position (_origin_x + x0 * res - clearance, _origin_y + y0 * res - clearance),
+                             Position (_origin_x + x1 * res + clearance, _origin_y + y1 * res + clearance));
+    std::vector<uint32_t> segments;
+    _index.findSegments (box, segments);
+
+    for (uint32_t s: segments)
+      {
+        const LineSegment & segment = _index.getSegment (s);
+        const Position & a = segment.getPosition1 ();
+        const Position & b = segment.getPosition2 ();
+        int32_t sx0 = std::max<double> (x0, std::floor ((std::min (a.x (), b.x ()) - clearance - _origin_x) / res));
+        int32_t sy0 = std::max<double> (y0, std::floor ((std::min (a.y (), b.y ()) - clearance - _origin_y) / res));
+        int32_t sx1 = std::min<double> (x1 - 1, std::floor ((std::max (a.x (), b.x ()) + clearance - _origin_x) / res));
+        int32_t sy1 = std::min<double> (y1 - 1, std::floor ((std::max (a.y (), b.y ()) + clearance - _origin_y) / res));
+
+        for (int32_t y=sy0; y <= sy1; ++y)
+          for (int32_t x=sx0; x <= sx1; ++x)
+            {
+              uint8_t & cell = _blocked[size_t (y) * _width + x];
+              if (!cell && hierarchicalPlannerDistance (a, b, Position (_origin_x + (x + 0.5) * res,
+                                                                        _origin_y + (y + 0.5) * res)) <= clearance)
+                cell = 1;
+            }
+      }
+  }
+
+  /* The transitions to the right and upper neighbor of a cluster: Runs of cells free on both
+   * sides of the border get one transition in the middle, runs of 6 cells or more transitions
+   * at both ends and in between, at most transition_spacing cells apart.
+   */
+  void HierarchicalPlanner::findTransitions (uint32_t cluster)
+  {
+    int32_t k = _parameters.cluster_size;
+    int32_t cx = cluster % _clusters_x;
+    int32_t cy = cluster / _clusters_x;
+    int32_t x0 = cx * k;
+    int32_t y0 = cy * k;
+    int32_t x1 = std::min (_width, x0 + k);
+    int32_t y1 = std::min (_height, y0 + k);
+
+    int32_t spacing = std::max<uint32_t> (1, _parameters.transition_spacing);
+    auto runs = [spacing] (int32_t from, int32_t to, const std::function<bool (int32_t)> & open,
+                    std::vector<uint32_t> & transitions)
+      {
+        transitions.clear ();
+        int32_t start = -1;
+        for (int32_t i=from; i <= to; ++i)
+          {
+            bool o = i < to && open (i);
+            if (o && start < 0)
+              start = i;
+            else if (!o && start >= 0)
+              {
+                int32_t length = i - start;
+                if (length < 6)
+                  transitions.push_back (start + (length - 1) / 2);
+                else
+                  {
+                    int32_t steps = (length - 2) / spacing + 1;
+                    for (int32_t j=0; j <= steps; ++j)
+                      transitions.push_back (start + j * (length - 1) / steps);
+                  }
+                start = -1;
+              }
+          }
+      };
+
+    if (cx + 1 < _clusters_x)
+      runs (y0, y1, [&] (int32_t y) { return free (x1 - 1, y) && free (x1, y); }, _right_transitions[cluster]);
+    else
+      _right_transitions[cluster].clear ();
+
+    if (cy + 1 < _clusters_y)
+      runs (x0, x1, [&] (int32_t x) { return free (x, y1 - 1) && free (x, y1); }, _top_transitions[cluster]);
+    else
+      _top_transitions[cluster].clear ();
+  }
+
+  /* Collect the entrances of a cluster from the transitions on its four borders and find the
+   * distances between them.
+   */
+  void HierarchicalPlanner::connect (uint32_t cluster)
+  {
+    int32_t k = _parameters.cluster_size;
+    int32_t cx = cluster % _clusters_x;
+    int32_t cy = cluster / _clusters_x;
+    int32_t x0 = cx * k;
+    int32_t y0 = cy * k;
+    int32_t x1 = std::min (_width, x0 + k);
+    int32_t y1 = std::min (_height, y0 + k);
+
+    Cluster & c = _clusters[cluster];
+    c.entrances.clear ();
+    auto add = [&] (int32_t x, int32_t y, int32_t px, int32_t py)
+      {
+        uint32_t cell = y * _width + x;
+        uint32_t partner = py * _width + px;
+        for (Entrance & e: c.entrances)
+          if (e.cell == cell)
+            {
+              e.partners[1] = partner;
+              return;
+            }
+
+        Entrance e;
+        e.cell = cell;
+        e.partners[0] = partner;
+        e.partners[1] = hierarchicalPlannerNone;
+        c.entrances.push_back (e);
+      };
+
+    for (uint32_t y: _right_transitions[cluster])
+      add (x1 - 1, y, x1, y);
+    if (cx > 0)
+      for (uint32_t y: _right_transitions[cluster - 1])
+        add (x0, y, x0 - 1, y);
+    for (uint32_t x: _top_transitions[cluster])
+      add (x, y1 - 1, x, y1);
+    if (cy > 0)
+      for (uint32_t x: _top_transitions[cluster - _clusters_x])
+        add (x, y0, x, y0 - 1);
+
+    uint32_t n = c.entrances.size ();
+    c.distances.assign (n * n, std::numeric_limits<float>::infinity ());
+    std::vector<float> dist;
+    for (uint32_t i=0; i < n; ++i)
+      {
+        search (cluster, c.entrances[i].cell, hierarchicalPlannerNone, dist, nullptr);
+        for (uint32_t j=0; j < n; ++j)
+          {
+            uint32_t cell = c.entrances[j].cell;
+            c.distances[i * n + j] = dist[((cell / _width) - y0) * k + (cell % _width) - x0];
+          }
+      }
+  }
+
+  /* Dijkstra within a cluster from the cell from, until the cell to is reached (all cells if
+   * to is none). dist is indexed by the cell relative to the cluster (cluster_size per row).
+   * Returns the number of expansions.
+   */
+  uint64_t HierarchicalPlanner::search (uint32_t cluster, uint32_t from, uint32_t to, std::vector<float> & dist,
+                                        std::vector<uint32_t> * parents) const
+  {
+    static const int32_t dx[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+    static const int32_t dy[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+    int32_t k = _parameters.cluster_size;
+    int32_t x0 = (cluster % _clusters_x) * k;
+    int32_t y0 = (cluster / _clusters_x) * k;
+    int32_t x1 = std::min (_width, x0 + k);
+    int32_t y1 = std::min (_height, y0 + k);
+    float res = _parameters.resolution;
+
+    dist.assign (k * k, std::numeric_limits<float>::infinity ());
+    if (parents)
+      parents->assign (k * k, hierarchicalPlannerNone);
+
+    typedef std::pair<float, uint32_t> Entry;      // distance, local index
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    uint32_t start = ((from / _width) - y0) * k + (from % _width) - x0;
+    uint32_t target = to != hierarchicalPlannerNone ? ((to / _width) - y0) * k + (to % _width) - x0 : hierarchicalPlannerNone;
+    dist[start] = 0.0f;
+    open.push (Entry (0.0f, start));
+
+    uint64_t expansions = 0;
+    while (!open.empty ())
+      {
+        Entry e = open.top ();
+        open.pop ();
+        if (e.first > dist[e.second])
+          continue;
+        ++expansions;
+        if (e.second == target)
+          break;
+
+        int32_t x = x0 + e.second % k;
+        int32_t y = y0 + e.second / k;
+        for (int i=0; i < 8; ++i)
+          {
+            int32_t nx = x + dx[i];
+            int32_t ny = y + dy[i];
+            if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1 || !free (nx, ny))
+              continue;
+            if (i >= 4 && (!free (nx, y) || !free (x, ny)))
+              continue;
+
+            uint32_t local = (ny - y0) * k + nx - x0;
+            float d = e.first + (i < 4 ? res : float (M_SQRT2) * res);
+            if (d < dist[local])
+              {
+                dist[local] = d;
+                if (parents)
+                  (*parents)[local] = e.second;
+                open.push (Entry (d, local));
+              }
+          }
+      }
+
+    return expansions;
+  }
+
+  /* Path from from to to: The abstract graph is searched with A*, start and goal are connected
+   * to the entrances of their clusters by a search within them.
+   */
+  HierarchicalPlanner::Result HierarchicalPlanner::findPath (const Position & from, const Position & to,
+                                                             PositionVector & path) const
+  {
+    PATHFINDER_TRACE_SCOPE ("HierarchicalPlanner::findPath");
+
+    Result result;
+    result.found = false;
+    result.cost = std::numeric_limits<double>::infinity ();
+    result.expansions = 0;
+    path.clear ();
+
+    double res = _parameters.resolution;
+    int32_t sx = std::floor ((from.x () - _origin_x) / res);
+    int32_t sy = std::floor ((from.y () - _origin_y) / res);
+    int32_t gx = std::floor ((to.x () - _origin_x) / res);
+    int32_t gy = std::floor ((to.y () - _origin_y) / res);
+    if (!free (sx, sy) || !free (gx, gy))
+      return result;
+
+    uint32_t start = sy * _width + sx;
+    uint32_t goal = gy * _width + gx;
+    if (start == goal)
+      {
+        path.push_back (from);
+        path.push_back (to);
+        result.found = true;
+        result.cost = 0.0;
+        return result;
+      }
+
+    int32_t k = _parameters.cluster_size;
+    auto local = [&] (uint32_t cell)
+      {
+        uint32_t c = clusterOf (cell);
+        return ((cell / _width) - (c / _clusters_x) * k) * k + (cell % _width) - (c % _clusters_x) * k;
+      };
+
+    uint32_t start_cluster = clusterOf (start);
+    uint32_t goal_cluster = clusterOf (goal);
+    std::vector<float> start_dist;
+    std::vector<float> goal_dist;
+    result.expansions += search (start_cluster, start, hierarchicalPlannerNone, start_dist, nullptr);
+    result.expansions += search (goal_cluster, goal, hierarchicalPlannerNone, goal_dist, nullptr);
+
+    // A* on the entrances, with start and goal as extra nodes
+    struct State
+    {
+        double g;
+        uint32_t parent;
+        bool closed;
+    };
+    std::unordered_map<uint32_t, State> states;
+    typedef std::pair<double, uint32_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+    auto relax = [&] (uint32_t parent, uint32_t cell, double g)
+      {
+        auto found = states.find (cell);
+        if (found != states.end () && (found->second.closed || found->second.g <= g))
+          return;
+        State s;
+        s.g = g;
+        s.parent = parent;
+        s.closed = false;
+        states[cell] = s;
+        open.push (Entry (g + heuristic (cell, goal), cell));
+      };
+
+    relax (hierarchicalPlannerNone, start, 0.0);
+    while (!open.empty ())
+      {
+        uint32_t cell = open.top ().second;
+        open.pop ();
+        State & state = states[cell];
+        if (state.closed)
+          continue;
+        state.closed = true;
+        ++result.expansions;
+        if (cell == goal)
+          break;
+
+        double g = state.g;
+        uint32_t c = clusterOf (cell);
+        if (cell == start)
+          {
+            for (const Entrance & e: _clusters[c].entrances)
+              if (!std::isinf (start_dist[local (e.cell)]))
+                relax (cell, e.cell, start_dist[local (e.cell)]);
+            if (c == goal_cluster && !std::isinf (start_dist[local (goal)]))
+              relax (cell, goal, start_dist[local (goal)]);
+          }
+
+        int32_t i = findEntrance (c, cell);
+        if (i < 0)
+          continue;
+
+        const Cluster & cluster = _clusters[c];
+        uint32_t n = cluster.entrances.size ();
+        for (uint32_t j=0; j < n; ++j)
+          if (j != uint32_t (i) && !std::isinf (cluster.distances[i * n + j]))
+            relax (cell, cluster.entrances[j].cell, g + cluster.distances[i * n + j]);
+        for (uint32_t partner: cluster.entrances[i].partners)
+          if (partner != hierarchicalPlannerNone)
+            relax (cell, partner, g + res);
+        if (c == goal_cluster && !std::isinf (goal_dist[local (cell)]))
+          relax (cell, goal, g + goal_dist[local (cell)]);
+      }
+
+    auto reached = states.find (goal);
+    if (reached == states.end () || !reached->second.closed)
+      return result;
+
+    std::vector<uint32_t> abstract;
+    for (uint32_t cell=goal; cell != hierarchicalPlannerNone; cell = states[cell].parent)
+      abstract.push_back (cell);
+    std::reverse (abstract.begin (), abstract.end ());
+
+    // Refine: Steps within a cluster by a search, steps between clusters are neighbor cells
+    std::vector<uint32_t> cells (1, start);
+    std::vector<float> dist;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> piece;
+    for (uint32_t i=1; i < abstract.size (); ++i)
+      {
+        uint32_t a = abstract[i-1];
+        uint32_t b = abstract[i];
+        uint32_t c = clusterOf (a);
+        if (c != clusterOf (b))
+          {
+            cells.push_back (b);
+            continue;
+          }
+
+        result.expansions += search (c, a, b, dist, &parents);
+        int32_t x0 = (c % _clusters_x) * k;
+        int32_t y0 = (c / _clusters_x) * k;
+        piece.clear ();
+        for (uint32_t l=local (b); l != local (a); l = parents[l])
+          piece.push_back ((y0 + l / k) * _width + x0 + l % k);
+        cells.insert (cells.end (), piece.rbegin (), piece.rend ());
+      }
+
+    path.push_back (from);
+    for (uint32_t i=1; i + 1 < cells.size (); ++i)
+      path.push_back (Position (_origin_x + (cells[i] % _width + 0.5) * res,
+                                _origin_y + (cells[i] / _width + 0.5) * res));
+    path.push_back (to);
+
+    result.found = true;
+    result.cost = reached->second.g;
+    return result;
+  }
+
+  bool HierarchicalPlanner::isBlocked (const Position & pos) const
+  {
+    return !free (std::floor ((pos.x () - _origin_x) / _parameters.resolution),
+                  std::floor ((pos.y () - _origin_y) / _parameters.resolution));
+  }
+
+  uint32_t HierarchicalPlanner::getClusterCount () const
+  {
+    return _clusters.size ();
+  }
+
+  uint32_t HierarchicalPlanner::getEntranceCount () const
+  {
+    uint32_t count = 0;
+    for (const Cluster & cluster: _clusters)
+      count += cluster.entrances.size ();
+    return count;
+  }
+
+  const HierarchicalPlanner::Parameters & HierarchicalPlanner::getParameters () const
+  {
+    return _parameters;
+  }
+
+  int32_t HierarchicalPlanner::findEntrance (uint32_t cluster, uint32_t cell) const
+  {
+    const std::vector<Entrance> & entrances = _clusters[cluster].entrances;
+    for (uint32_t i=0; i < entrances.size (); ++i)
+      if (entrances[i].cell == cell)
+        return i;
+    return -1;
+  }
+
+  uint32_t HierarchicalPlanner::clusterOf (uint32_t cell) const
+  {
+    uint32_t k = _parameters.cluster_size;
+    return ((cell / _width) / k) * _clusters_x + (cell % _width) / k;
+  }
+
+  /* Cells outside of the raster are blocked.
+   */
+  bool HierarchicalPlanner::free (int32_t x, int32_t y) const
+  {
+    return x >= 0 && y >= 0 && x < _width && y < _height && !_blocked[size_t (y) * _width + x];
+  }
+
+  /* Octile distance between two cells.
+   */
+  double HierarchicalPlanner::heuristic (uint32_t from, uint32_t to) const
+  {
+    double dx = std::abs (int32_t (from % _width) - int32_t (to % _width));
+    double dy = std::abs (int32_t (from / _width) - int32_t (to / _width));
+    return (std::max (dx, dy) + (M_SQRT2 - 1.0) * std::min (dx, dy)) * _parameters.resolution;
+  }
+}
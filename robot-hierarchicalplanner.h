@@ -0,0 +1,111 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_HIERARCHICALPLANNER_H
+#define ROBOT_HIERARCHICALPLANNER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-mapindex.h"
+
+namespace Pathfinder
+{
+  /* Long range path planning with a hierarchy of the map (HPA*).
+   *
+   * The map is rasterized into cells (blocked: closer than clearance to an object, like the
+   * AnytimePlanner), the raster is partitioned into square clusters of cluster_size cells. Where
+   * free cells on both sides of the border between two clusters form a run, one transition (in
+   * the middle of short runs) or several (at both ends of long runs and every transition_spacing
+   * cells in between) connect the clusters; the cells of the transitions are the entrances of the
+   * clusters. The distances between the entrances
+   * of a cluster within the cluster are precomputed, the clusters in parallel.
+   *
+   * findPath connects start and goal to the entrances of their clusters, searches the abstract
+   * graph of the entrances with A* and refines each step of the abstract path by a search
+   * within its cluster. The path is optimal on the abstract graph, which is usually 2-7
+   * percent longer than the shortest path on the raster.
+   *
+   * The raster covers the bounding box of the map when built (update ()). After objects
+   * changed, update (region) re-rasterizes only the clusters overlapping the region and
+   * recomputes the entrances and distances of them and their neighbors. findPath may be called
+   * from several threads, but not during an update.
+   */
+  class HierarchicalPlanner
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double resolution;            // raster cell size
+          double clearance;             // min. distance of the path to any object
+          uint32_t cluster_size;        // cells per side of a cluster
+          uint32_t transition_spacing;  // max. cells between transitions along a border
+          double margin;                // added around the bounding box of the map
+          uint32_t threads;             // for building the clusters, 0: number of cores
+      };
+
+      struct Result
+      {
+          bool found;
+          double cost;                  // length of the path on the raster
+          uint64_t expansions;          // of the abstract search and all searches within clusters
+      };
+
+      HierarchicalPlanner (const Map & map, const Parameters & parameters);
+
+      void update ();
+      void update (const Eigen::AlignedBox2d & region);
+      Result findPath (const Position & from, const Position & to, PositionVector & path) const;
+
+      bool isBlocked (const Position & pos) const;
+      uint32_t getClusterCount () const;
+      uint32_t getEntranceCount () const;
+      const Parameters & getParameters () const;
+
+    private:
+      struct Entrance
+      {
+          uint32_t cell;
+          uint32_t partners[2];         // cells of the transitions in the neighbor clusters
+      };
+
+      struct Cluster
+      {
+          std::vector<Entrance> entrances;
+          std::vector<float> distances;   // entrances x entrances, within the cluster
+      };
+
+      void rebuild (const std::vector<uint32_t> & clusters);
+      void rasterize (uint32_t cluster);
+      void findTransitions (uint32_t cluster);
+      void connect (uint32_t cluster);
+      uint64_t search (uint32_t cluster, uint32_t from, uint32_t to, std::vector<float> & dist,
+                       std::vector<uint32_t> * parents) const;
+      int32_t findEntrance (uint32_t cluster, uint32_t cell) const;
+      uint32_t clusterOf (uint32_t cell) const;
+      bool free (int32_t x, int32_t y) const;
+      double heuristic (uint32_t from, uint32_t to) const;
+
+      const Map & _map;
+      Parameters _parameters;
+      MapIndex _index;              // objects near the clusters rasterized last
+
+      double _origin_x;
+      double _origin_y;
+      int32_t _width;               // in cells
+      int32_t _height;
+      int32_t _clusters_x;
+      int32_t _clusters_y;
+      std::vector<uint8_t> _blocked;
+
+      std::vector<Cluster> _clusters;
+      std::vector<std::vector<uint32_t>> _right_transitions;    // rows y of transitions to the right neighbor
+      std::vector<std::vector<uint32_t>> _top_transitions;      // columns x of transitions to the upper neighbor
+  };
+}
+
+#endif
@@ -2,28 +2,121 @@
  *
  */
 
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #include <limits>
+#include <mutex>
+#include <type_traits>
 
 #include "robot-map.h"
+#include "robot-parallel.h"
 
 namespace Pathfinder
 {
+  // Guards the decoding of compact and curved objects by the const getPolygon
+  static std::mutex map_object_decode_mutex;
+
   /* Creating an empty object where two distinct points should be at least min_point_distance appart.
    */
   MapObject::MapObject (double min_point_distance)
   : _min_point_distance (min_point_distance),
-    _poly ()
+    _poly (),
+    _compact_resolution (0.0),
+    _compact_origin_x (0.0),
+    _compact_origin_y (0.0),
+    _compact_closed (false),
+    _compact (),
+    _curves (),
+    _decoded (),
+    _observation (),
+    _motion (MOTION_UNKNOWN),
+    _frozen (false),
+    _has_reference (false),
+    _reference_min_x (0.0),
+    _reference_min_y (0.0),
+    _reference_max_x (0.0),
+    _reference_max_y (0.0),
+    _revision (0)
   {
+    _observation.scans = 0;
+    _observation.hits = 0;
+    _observation.misses = 0;
+    _observation.first_seen = 0.0;
+    _observation.last_seen = 0.0;
+    _observation.drift = 0.0;
+    _observation.recent_miss_ratio = 0.0;
   }
 
   /* Get the points of the object.
    *
    * If closed, the last point is at the same position as the first point.
+   *
+   * If the object is compact or curved, the points are decoded into a cache, which costs
+   * the memory saved by that storage. Use getPointCount and getPoint to avoid that.
+   * The cache is filled once under a lock, so concurrent readers may call this; it is
+   * dropped by the modifying methods and releaseCaches.
+   */
+  const MapObject::PointVector & MapObject::getPolygon () const
+  {
+    if (!isCompact () && !isCurved ())
+      return _poly;
+
+    std::lock_guard<std::mutex> lock (map_object_decode_mutex);
+    if (_decoded.empty ())
+      {
+        _decoded.resize (getPointCount ());
+        for (uint32_t i=0; i < _decoded.size (); ++i)
+          _decoded[i] = getPoint (i);
+      }
+
+    return _decoded;
+  }
+
+  /* Get the number of points, independent of the storage mode.
+   */
+  uint32_t MapObject::getPointCount () const
+  {
+    if (isCompact ())
+      return _compact.size () / 2;
+
+    if (isCurved ())
+      return _curves.getPointCount ();
+
+    return _poly.size ();
+  }
+
+  double MapObject::getMinPointDistance () const
+  {
+    return _min_point_distance;
+  }
+
+  /* Get the axis aligned bounding box of all points, empty if the object is empty.
+   */
+  Eigen::AlignedBox2d MapObject::getBoundingBox () const
+  {
+    Eigen::AlignedBox2d box;
+    uint32_t count = getPointCount ();
+    for (uint32_t i=0; i < count; ++i)
+      box.extend (getPoint (i));
+
+    return box;
+  }
+
+  /* Get a single point, independent of the storage mode.
+   *
+   * Compact points are decoded, those of curves evaluated on the fly.
    */
-  const std::vector<Position,Eigen::aligned_allocator<Position>>& MapObject::getPolygon () const
+  Position MapObject::getPoint (uint32_t idx) const
   {
-    return _poly;
+    if (isCompact ())
+      return Position (_compact_origin_x + _compact[2*idx] * _compact_resolution,
+                       _compact_origin_y + _compact[2*idx+1] * _compact_resolution);
+
+    if (isCurved ())
+      return _curves.getPoint (idx);
+
+    return _poly[idx];
   }
 
   /* Is the object closed and is not empty.
@@ -33,6 +126,12 @@ namespace Pathfinder
    */
   bool MapObject::isClosed () const
   {
+    if (isCompact ())
+      return _compact_closed;
+
+    if (isCurved ())
+      return _curves.isClosed ();
+
     if (_poly.size () < 2)
       return false;
 
@@ -42,6 +141,12 @@ namespace Pathfinder
   /* Is the object empty (has not a single point) */
   bool MapObject::isEmpty () const
   {
+    if (isCompact ())
+      return _compact.empty ();
+
+    if (isCurved ())
+      return false;
+
     return _poly.empty ();
   }
 
@@ -51,6 +156,9 @@ namespace Pathfinder
    */
   void MapObject::appendPoint (const Position & point)
   {
+    ensureExpanded ();
+    ++_revision;
+
     if (isClosed ())
       {
 	_poly.back () = point;
@@ -60,6 +168,16 @@ namespace Pathfinder
       _poly.push_back (point);
   }
 
+  /* Replace all points of the object.
+   *
+   * The object is closed, if the last point equals the first one.
+   */
+  void MapObject::setPolygon (const std::vector<Position,Eigen::aligned_allocator<Position>> & poly)
+  {
+    clear ();
+    _poly.assign (poly.begin (), poly.end ());
+  }
+
   /* Make the object closed or open.
    *
    * Making this object closed will copy the first point at the end, makeing it open, will remove
@@ -70,6 +188,9 @@ namespace Pathfinder
     if (isClosed () == closed)
       return;
 
+    ensureExpanded ();
+    ++_revision;
+
     if (closed)
       _poly.push_back (_poly[0]);
     else
@@ -80,6 +201,11 @@ namespace Pathfinder
    */
   void MapObject::clear ()
   {
+    ++_revision;
+    _compact_resolution = 0.0;
+    decltype (_compact) ().swap (_compact);
+    _curves.clear ();
+    PointVector ().swap (_decoded);
     _poly.clear ();
   }
 
@@ -95,10 +221,29 @@ namespace Pathfinder
    */
   bool MapObject::join (const MapObject & other, double max_dist)
   {
+    PATHFINDER_TRACE_SCOPE ("MapObject::join");
+
     if (other.isEmpty ())
       // other is empty, nothing to do
       return false;
 
+    if (other.isCompact () || other.isCurved ())
+      {
+        MapObject o2 = other;
+        o2.expand ();
+        return join (o2, max_dist);
+      }
+
+    return addExpanded ([&] (MapObject & obj)
+                        {
+                          return obj.joinExpanded (other, max_dist);
+                        });
+  }
+
+  /* Join for both objects in the normal storage mode and other not empty.
+   */
+  bool MapObject::joinExpanded (const MapObject & other, double max_dist)
+  {
     if (isEmpty ())
       {
         // this is empty, copy other...
@@ -125,10 +270,12 @@ namespace Pathfinder
       {
         // Special case: This objects contains only a single point
         // use addPoint
+        // Only the points are taken, the history of this object is kept (the revision is
+        // counted by addExpanded)
         MapObject o2 = other;
         if (!o2.addPoint (_poly[0], max_dist))
           return false;
-        *this = o2;
+        _poly = o2._poly;
         return true;
       }
 
@@ -191,7 +338,7 @@ namespace Pathfinder
 
     // Check if the next three points after the last found point are closest to the same
     // point on this.
-    for (uint32_t i=idx; i < other._poly.size () && i < idx+3; --i)
+    for (uint32_t i=idx; i < other._poly.size () && i < idx+3; ++i)
       {
         std::optional<MapObject::FindResult> dist2
         = findClosestPosition (other._poly[i]);
@@ -286,6 +433,18 @@ namespace Pathfinder
    * Returns if the point was close enough to the curve.
    */
   bool MapObject::addPoint (const Position & point, double max_dist)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapObject::addPoint");
+
+    return addExpanded ([&] (MapObject & obj)
+                        {
+                          return obj.addPointExpanded (point, max_dist);
+                        });
+  }
+
+  /* addPoint in the normal storage mode.
+   */
+  bool MapObject::addPointExpanded (const Position & point, double max_dist)
   {
     if (_poly.empty ())
       {
@@ -347,6 +506,10 @@ namespace Pathfinder
    */
   void MapObject::smooth (double max_deviation, uint32_t filter_size)
   {
+    PATHFINDER_TRACE_SCOPE ("MapObject::smooth");
+
+    ensureExpanded ();
+
     bool closed = isClosed ();
 
     if (filter_size < 2)
@@ -360,7 +523,7 @@ namespace Pathfinder
       return;
 
     std::vector<Position,Eigen::aligned_allocator<Position>> filter_array (filter_size * 2 + 1);
-    std::vector<Position,Eigen::aligned_allocator<Position>> new_poly (_poly.size ());
+    PointVector new_poly (_poly.size ());
     PolynomCurve<2> poly_curve;
     std::optional<double> residual;
 
@@ -433,7 +596,11 @@ namespace Pathfinder
     if (closed)
       new_poly[0] = new_poly.back ();
 
-    _poly.swap (new_poly);
+    if (new_poly != _poly)
+      {
+        ++_revision;
+        _poly.swap (new_poly);
+      }
   }
 
   /* Change the number of points, so that at least min_points points exist and these points
@@ -444,7 +611,77 @@ namespace Pathfinder
    */
   void MapObject::makeEquidistant (double max_dist, uint32_t min_points, double max_deviation)
   {
-    // ToDo: Implementation missing
+    PATHFINDER_TRACE_SCOPE ("MapObject::makeEquidistant");
+
+    ensureExpanded ();
+
+    if (_poly.size () < 2 || !(max_dist > 0.0))
+      return;
+
+    PointVector new_poly;
+    new_poly.reserve (_poly.size ());
+    new_poly.push_back (_poly[0]);
+
+    // From each kept point a, drop the following points as long as the next kept one is not
+    // further than max_dist away and the dropped ones stay within max_deviation. The first
+    // and last point are always kept, so a closed object stays closed.
+    uint32_t a = 0;
+    while (a + 1 < _poly.size ())
+      {
+        uint32_t b = a + 1;
+        while (b + 1 < _poly.size ())
+          {
+            uint32_t c = b + 1;
+            if (_poly[c] == _poly[a] || _poly[a].distance (_poly[c]) > max_dist)
+              break;
+
+            LineSegment segment (_poly[a], _poly[c]);
+            bool keep = false;
+            for (uint32_t i=a+1; i < c && !keep; ++i)
+              keep = segment.distance (_poly[i]) > max_deviation;
+            if (keep)
+              break;
+
+            b = c;
+          }
+
+        // Split segments which are too long
+        double length = _poly[a].distance (_poly[b]);
+        uint32_t parts = static_cast<uint32_t> (std::ceil (length / max_dist));
+        for (uint32_t k=1; k < parts; ++k)
+          new_poly.push_back (_poly[a] + (_poly[b] - _poly[a]) * (double (k) / parts));
+        new_poly.push_back (_poly[b]);
+
+        a = b;
+      }
+
+    // Halve the longest segments until there are enough points
+    while (new_poly.size () < min_points)
+      {
+        uint32_t longest = 0;
+        double longest_length = 0.0;
+        for (uint32_t i=0; i + 1 < new_poly.size (); ++i)
+          {
+            double length = new_poly[i].distance (new_poly[i+1]);
+            if (length > longest_length)
+              {
+                longest = i;
+                longest_length = length;
+              }
+          }
+
+        if (longest_length == 0.0)
+          break;
+
+        Position middle = (new_poly[longest] + new_poly[longest+1]) / 2.0;
+        new_poly.insert (new_poly.begin () + longest + 1, middle);
+      }
+
+    if (new_poly != _poly)
+      {
+        ++_revision;
+        _poly.swap (new_poly);
+      }
   }
 
   /* Change this MapObject to its convex hull.
@@ -456,15 +693,23 @@ namespace Pathfinder
    */
   void MapObject::convexHull ()
   {
+    PATHFINDER_TRACE_SCOPE ("MapObject::convexHull");
+
+    ensureExpanded ();
+
     // less than four points are always convex (triangle).
     if (_poly.size () < 4)
       {
         if (_poly.size () == 3)
-          _poly.push_back (_poly[0]); // Close the triangle
+          {
+            _poly.push_back (_poly[0]); // Close the triangle
+            ++_revision;
+          }
         return;
       }
 
-    if (isClosed ())
+    bool closed = isClosed ();
+    if (closed)
       {
         // Closed: four points are three points...
         if (_poly.size () == 4)
@@ -487,10 +732,9 @@ namespace Pathfinder
 
     uint32_t first_idx = prev_idx;
 
-    std::vector<Position,Eigen::aligned_allocator<Position>> hull;
+    PointVector hull;
     hull.push_back (prev);
 
-    static double pi = std::acos (-1);
     uint32_t next_idx;
 
     do
@@ -498,25 +742,27 @@ namespace Pathfinder
         next_idx = prev_idx==0 ? 1 : 0;
         Position next = _poly[next_idx];
         Eigen::Vector2d next_dir = next - prev;
-        double next_a = std::atan2 (next_dir.y (), next_dir.x ());
 
+        // Take the point with the most counterclockwise direction, the hull is built clockwise.
+        // Use the cross product instead of angles, so nearly collinear points don't lead to
+        // an endless loop. Of collinear points, the farthest one is used.
         for (uint32_t i=0; i < _poly.size (); ++i)
           {
             if (i == prev_idx)
               continue;
 
             Eigen::Vector2d dir = _poly[i] - prev;
-            double a = std::atan2 (dir.y (), dir.x ());
-            double da = a - next_a;
-            if (da < -pi)
-              da += 2*pi;
+            if (dir.squaredNorm () == 0.0)
+              continue;
 
-            if (da > 0)
+            double cross = next_dir.x () * dir.y () - next_dir.y () * dir.x ();
+            if (next_dir.squaredNorm () == 0.0
+                || cross > 0
+                || (cross == 0 && dir.squaredNorm () > next_dir.squaredNorm ()))
               {
                 next_idx = i;
                 next = _poly[i];
                 next_dir = dir;
-                next_a = a;
               }
           }
 
@@ -526,34 +772,247 @@ namespace Pathfinder
       }
     while (next_idx != first_idx);
 
-    _poly.swap (hull);
+    // Unchanged, if this was closed and already its own hull
+    if (closed)
+      _poly.push_back (_poly[0]);
+    if (hull != _poly)
+      {
+        ++_revision;
+        _poly.swap (hull);
+      }
+  }
+
+  /* Is pos inside the closed object (crossing number, even odd rule). Open objects contain
+   * nothing. Use Map::classifyPoints for many points.
+   */
+  bool MapObject::contains (const Position & pos) const
+  {
+    uint32_t count = getPointCount ();
+    if (!isClosed () || count < 3)
+      return false;
+
+    bool inside = false;
+    Position prev = getPoint (count - 1);
+    for (uint32_t i=0; i < count; ++i)
+      {
+        Position p = getPoint (i);
+        if ((p.y () > pos.y ()) != (prev.y () > pos.y ())
+            && pos.x () < p.x () + (pos.y () - p.y ()) * (prev.x () - p.x ()) / (prev.y () - p.y ()))
+          inside = !inside;
+        prev = p;
+      }
+
+    return inside;
+  }
+
+  /* Self-crossings: Segments (segment i goes from point i to point i+1) touching or crossing
+   * each other. Neighbor segments meeting in their common point don't count, unless they fold
+   * back onto each other. Zero length segments are ignored.
+   */
+  void MapObject::findCrossings (SegmentSweep::CrossingVector & crossings) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapObject::findCrossings");
+
+    crossings.clear ();
+    // Compact or curved points are decoded for this call only, getPolygon would keep them
+    PointVector decoded;
+    if (isCompact () || isCurved ())
+      {
+        decoded.resize (getPointCount ());
+        for (uint32_t i=0; i < decoded.size (); ++i)
+          decoded[i] = getPoint (i);
+      }
+    const PointVector & poly = isCompact () || isCurved () ? decoded : _poly;
+    if (poly.size () < 3)
+      return;
+
+    SegmentSweep sweep;
+    std::vector<uint32_t> segments;
+    for (uint32_t i=0; i + 1 < poly.size (); ++i)
+      if (poly[i] != poly[i+1])
+        {
+          sweep.addSegment (poly[i], poly[i+1]);
+          segments.push_back (i);
+        }
+
+    SegmentSweep::CrossingVector found;
+    sweep.findCrossings (found);
+
+    uint32_t last = segments.size () - 1;
+    bool closed = isClosed ();
+    for (SegmentSweep::Crossing & crossing: found)
+      {
+        uint32_t first = crossing.segment1;
+        uint32_t second = crossing.segment2;
+        if (second == first + 1 || (closed && first == 0 && second == last && last > 1))
+          {
+            // a -> p -> b
+            const Position & a = second == first + 1 ? poly[segments[first]] : poly[segments[last]];
+            const Position & p = second == first + 1 ? poly[segments[second]] : poly[segments[0]];
+            const Position & b = second == first + 1 ? poly[segments[second] + 1] : poly[segments[0] + 1];
+            if (orientation (a, p, b) != 0 || (a - p).dot (b - p) <= 0.0)
+              continue;
+          }
+
+        crossing.segment1 = segments[first];
+        crossing.segment2 = segments[second];
+        crossings.push_back (crossing);
+      }
+  }
+
+  /* Repair self-crossings: The loop between two crossing segments is cut out, if it is not
+   * longer than max_loop_length. Otherwise the points of the loop are reversed, which untangles
+   * the crossing without dropping points.
+   * Returns the number of repaired crossings.
+   */
+  uint32_t MapObject::removeCrossings (double max_loop_length)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapObject::removeCrossings");
+
+    SegmentSweep::CrossingVector crossings;
+    findCrossings (crossings);
+    if (crossings.empty ())
+      return 0;
+
+    // At least one crossing gets repaired
+    ensureExpanded ();
+    ++_revision;
+
+    uint32_t repaired = 0;
+    SegmentSweep::CrossingVector accepted;
+    for (uint32_t round=0; round < 32 && !crossings.empty (); ++round)
+      {
+        bool closed = isClosed ();
+
+        // Innermost loops first, the loops repaired in one round must not overlap. A closed
+        // object might lose the loop around its start, so only one crossing per round.
+        std::sort (crossings.begin (), crossings.end (),
+                   [] (const SegmentSweep::Crossing & a, const SegmentSweep::Crossing & b)
+                   {
+                     return a.segment2 - a.segment1 < b.segment2 - b.segment1;
+                   });
+        accepted.clear ();
+        for (const SegmentSweep::Crossing & c: crossings)
+          {
+            bool overlaps = false;
+            for (const SegmentSweep::Crossing & a: accepted)
+              overlaps |= c.segment1 <= a.segment2 && a.segment1 <= c.segment2;
+            if (!overlaps)
+              accepted.push_back (c);
+            if (closed)
+              break;
+          }
+        std::sort (accepted.begin (), accepted.end (),
+                   [] (const SegmentSweep::Crossing & a, const SegmentSweep::Crossing & b)
+                   {
+                     return a.segment1 > b.segment1;
+                   });
+
+        for (const SegmentSweep::Crossing & c: accepted)
+          {
+            uint32_t i = c.segment1;
+            uint32_t j = c.segment2;
+            const Position x = c.position;
+
+            double inner = x.distance (_poly[i+1]) + _poly[j].distance (x);
+            for (uint32_t k=i+1; k < j; ++k)
+              inner += _poly[k].distance (_poly[k+1]);
+
+            double outer = std::numeric_limits<double>::infinity ();
+            if (closed)
+              {
+                outer = _poly[i].distance (x) + x.distance (_poly[j+1]);
+                for (uint32_t k=0; k < i; ++k)
+                  outer += _poly[k].distance (_poly[k+1]);
+                for (uint32_t k=j+1; k + 1 < _poly.size (); ++k)
+                  outer += _poly[k].distance (_poly[k+1]);
+              }
+
+            if (inner <= max_loop_length && inner <= outer)
+              {
+                _poly.erase (_poly.begin () + i + 1, _poly.begin () + j + 1);
+                if (x != _poly[i] && x != _poly[i+1])
+                  _poly.insert (_poly.begin () + i + 1, x);
+              }
+            else if (outer <= max_loop_length)
+              {
+                PointVector loop;
+                loop.push_back (x);
+                for (uint32_t k=i+1; k <= j; ++k)
+                  if (_poly[k] != loop.back ())
+                    loop.push_back (_poly[k]);
+                if (loop.back () != x)
+                  loop.push_back (x);
+                _poly.swap (loop);
+              }
+            else
+              std::reverse (_poly.begin () + i + 1, _poly.begin () + j + 1);
+
+            ++repaired;
+          }
+
+        findCrossings (crossings);
+      }
+
+    return repaired;
   }
 
   std::optional<MapObject::FindResult>
   MapObject::findClosestPosition (const Position & pos) const
   {
-    std::cerr << "size: " << _poly.size () << std::endl;
+    PATHFINDER_TRACE_SCOPE ("MapObject::findClosestPosition");
+
     std::optional<MapObject::FindResult> found;
-    if (_poly.empty ())
+
+    // Measured to the curves, not to the polyline read from them
+    if (isCurved ())
+      {
+        std::optional<CurveChain::FindResult> closest = _curves.findClosest (pos);
+        found.emplace ();
+        found->distance = closest->distance;
+        found->point_index = closest->point_index;
+        found->fraction_to_next_point = closest->fraction_to_next_point;
+        return found;
+      }
+
+    uint32_t count = getPointCount ();
+    PATHFINDER_TRACE_COUNT ("MapObject::findClosestPosition.points", count);
+    if (count == 0)
       return found;
 
-    if (_poly.size () == 1)
+    if (count == 1)
       {
         found.emplace ();
-        found->distance = _poly[0].distance (pos);
+        found->distance = getPoint (0).distance (pos);
         found->point_index = 0;
         found->fraction_to_next_point = 0.0;
         return found;
       }
 
+    // The segments are evaluated in KernelScalar precision, relative to a local origin, so
+    // single precision kernels don't lose the precision in the absolute coordinates.
+    Position origin (0, 0);
+    if (isCompact ())
+      origin = Position (_compact_origin_x, _compact_origin_y);
+    else if (!std::is_same<KernelScalar, double>::value)
+      origin = getPoint (0);
+
+    KernelPosition kpos ((pos - origin).cast<KernelScalar> ());
+    KernelPosition prev ((getPoint (0) - origin).cast<KernelScalar> ());
+    KernelPosition cur ((getPoint (1) - origin).cast<KernelScalar> ());
+    KernelScalar fraction = 0;
+
     found.emplace ();
-    found->distance = LineSegment (_poly[0], _poly[1]).distance (pos, &found->fraction_to_next_point);
+    found->distance = KernelLineSegment (prev, cur).distance (kpos, &fraction);
+    found->fraction_to_next_point = fraction;
     found->point_index = 0;
-    for (uint32_t i=2; i < _poly.size (); ++i)
+    for (uint32_t i=2; i < count; ++i)
       {
-        LineSegment lseg (_poly[i-1], _poly[i]);
-        double fraction_to_next_point = 0.0;
-        double dist = lseg.distance (pos, &fraction_to_next_point);
+        prev = cur;
+        cur = (getPoint (i) - origin).cast<KernelScalar> ();
+        KernelLineSegment lseg (prev, cur);
+        KernelScalar fraction_to_next_point = 0.0;
+        double dist = lseg.distance (kpos, &fraction_to_next_point);
 
         if (dist < found->distance)
           {
@@ -572,23 +1031,976 @@ namespace Pathfinder
     return found;
   }
 
+  /* Switch to the compact storage mode.
+   *
+   * The vertices are stored as 32 bit fixed point offsets to the center of the bounding box
+   * of this object, with a step size of resolution. Each decoded coordinate is at most
+   * resolution/2 away from the original one, so every point moves by at most
+   * resolution*sqrt(2)/2 and distances computed by findClosestPosition are off by at
+   * most that amount. This halves the memory needed for the vertices.
+   *
+   * Modifying methods switch back to the normal mode automatically (without restoring the
+   * lost precision).
+   *
+   * Returns false and keeps the normal mode if the extent of the object cannot be
+   * represented with 32 bit at that resolution.
+   */
+  bool MapObject::compact (double resolution)
+  {
+    if (resolution <= 0.0)
+      return false;
+
+    if (isCompact ())
+      {
+        if (resolution == _compact_resolution)
+          return true;
+        expand ();
+      }
+    else if (isCurved ())
+      expand ();
+
+    if (_poly.empty ())
+      return false;
+
+    Eigen::Vector2d min_p = _poly[0];
+    Eigen::Vector2d max_p = _poly[0];
+    for (const Position & p: _poly)
+      {
+        min_p = min_p.cwiseMin (p);
+        max_p = max_p.cwiseMax (p);
+      }
+
+    Eigen::Vector2d origin = (min_p + max_p) / 2.0;
+    double max_offset = (max_p - origin).maxCoeff () / resolution;
+    if (max_offset >= std::numeric_limits<int32_t>::max () - 1)
+      return false;
+
+    _compact_closed = isClosed ();
+    _compact_origin_x = origin.x ();
+    _compact_origin_y = origin.y ();
+    _compact.resize (_poly.size () * 2);
+    for (uint32_t i=0; i < _poly.size (); ++i)
+      {
+        _compact[2*i] = static_cast<int32_t> (std::lround ((_poly[i].x () - origin.x ()) / resolution));
+        _compact[2*i+1] = static_cast<int32_t> (std::lround ((_poly[i].y () - origin.y ()) / resolution));
+      }
+    _compact_resolution = resolution;
+    ++_revision;
+
+    PointVector ().swap (_poly);
+    PointVector ().swap (_decoded);
+    return true;
+  }
+
+  /* Switch back from the compact or curve storage mode to the normal mode. Curves are
+   * replaced by the polyline read from them.
+   */
+  void MapObject::expand ()
+  {
+    if (!isCompact () && !isCurved ())
+      return;
+
+    uint32_t count = getPointCount ();
+    bool closed = isClosed ();
+    _poly.resize (count);
+    for (uint32_t i=0; i < count; ++i)
+      _poly[i] = getPoint (i);
+
+    // Keep the closed state exact, even if quantization moved the first and last point.
+    if (closed && count >= 2)
+      _poly.back () = _poly[0];
+
+    _compact_resolution = 0.0;
+    decltype (_compact) ().swap (_compact);
+    _curves.clear ();
+    PointVector ().swap (_decoded);
+  }
+
+  bool MapObject::isCompact () const
+  {
+    return _compact_resolution > 0.0;
+  }
+
+  /* Get the quantization step of the compact mode, 0.0 if not compact.
+   */
+  double MapObject::getCompactResolution () const
+  {
+    return _compact_resolution;
+  }
+
+  /* Counts the changes of the points (and the compaction, which may move them by up to half
+   * the resolution). Methods which leave the points as they are don't count.
+   */
+  uint32_t MapObject::getRevision () const
+  {
+    return _revision;
+  }
+
+  /* Memory allocated for the points of the object, in the current storage mode.
+   */
+  MapObject::MemoryUsage MapObject::getMemoryUsage () const
+  {
+    MemoryUsage usage;
+    usage.points = _poly.capacity () * sizeof (Position);
+    usage.compact_points = _compact.capacity () * sizeof (int32_t);
+    usage.curves = _curves.getMemoryUsage ();
+    usage.decoded_points = _decoded.capacity () * sizeof (Position);
+    return usage;
+  }
+
+  /* Free the points decoded by getPolygon for a compact or curved object. References
+   * returned by getPolygon become invalid.
+   */
+  void MapObject::releaseCaches () const
+  {
+    std::lock_guard<std::mutex> lock (map_object_decode_mutex);
+    PointVector ().swap (_decoded);
+  }
+
+  /* Free the memory reserved for more points than there are, e.g. after the object stopped
+   * growing. Doesn't change the points.
+   */
+  void MapObject::shrinkToFit ()
+  {
+    _poly.shrink_to_fit ();
+    _compact.shrink_to_fit ();
+  }
+
+  /* Store the points as chain of curves (see CurveChain), within max_deviation of them, for
+   * curved objects like round walls: Distances are measured to the curves directly, the
+   * points are evaluated on the fly. Like the compact mode, modifying methods switch back to
+   * the normal mode automatically.
+   *
+   * Returns false and keeps the current mode if the curves wouldn't take less memory than
+   * the points.
+   */
+  bool MapObject::fitCurves (double max_deviation)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapObject::fitCurves");
+
+    if (isCurved () && _curves.getMaxDeviation () == max_deviation)
+      return true;
+
+    const PointVector & poly = getPolygon ();
+    CurveChain curves;
+    if (!curves.fit (poly.data (), poly.size (), max_deviation)
+        || curves.getMemoryUsage () >= poly.size () * sizeof (Position))
+      {
+        releaseCaches ();
+        return false;
+      }
+
+    ++_revision;
+    _compact_resolution = 0.0;
+    decltype (_compact) ().swap (_compact);
+    PointVector ().swap (_poly);
+    PointVector ().swap (_decoded);
+    _curves = std::move (curves);
+    return true;
+  }
+
+  /* Replace all points of the object by curves, e.g. fitted before by fitCurves.
+   */
+  void MapObject::setCurves (const CurveChain & curves)
+  {
+    clear ();
+    _curves = curves;
+  }
+
+  bool MapObject::isCurved () const
+  {
+    return !_curves.isEmpty ();
+  }
+
+  const CurveChain & MapObject::getCurves () const
+  {
+    return _curves;
+  }
+
+  /* Called by all methods changing the points, before they do. Expanding keeps the points,
+   * so the methods count the revision themselves, once they changed them.
+   */
+  void MapObject::ensureExpanded ()
+  {
+    if (isCompact () || isCurved ())
+      expand ();
+  }
+
+  /* Run add, which only adds points (join, addPoint), in the normal storage mode. A compact
+   * or curved object is expanded only if points were added, and only then the revision is
+   * counted.
+   */
+  template <typename Add>
+  bool MapObject::addExpanded (Add add)
+  {
+    if (isCompact () || isCurved ())
+      {
+        MapObject expanded = *this;
+        expanded.expand ();
+        if (!expanded.addExpanded (add))
+          return false;
+
+        if (expanded._revision != _revision)
+          *this = std::move (expanded);
+        return true;
+      }
+
+    uint32_t revision = _revision;
+    size_t count = _poly.size ();
+    bool added = add (*this);
+    _revision = _poly.size () != count ? revision + 1 : revision;
+    return added;
+  }
+
+  /* Add the result of checking the points of this object against one scan: hits points were
+   * confirmed by a beam, through misses points a beam passed without being reflected.
+   */
+  void MapObject::observe (double time, uint32_t hits, uint32_t misses)
+  {
+    static const double recent_weight = 0.2;
+
+    if (hits + misses == 0)
+      return;
+
+    double miss_ratio = double (misses) / (hits + misses);
+    if (_observation.scans == 0)
+      {
+        _observation.first_seen = time;
+        _observation.recent_miss_ratio = miss_ratio;
+      }
+    else
+      {
+        // Scans seeing only a few points of the object count less
+        double weight = recent_weight * std::min (1.0, (hits + misses) / 16.0);
+        _observation.recent_miss_ratio += weight * (miss_ratio - _observation.recent_miss_ratio);
+      }
+
+    ++_observation.scans;
+    _observation.hits += hits;
+    _observation.misses += misses;
+    if (hits > 0)
+      _observation.last_seen = time;
+
+    if (!_has_reference)
+      {
+        Eigen::AlignedBox2d box = getBoundingBox ();
+        _reference_min_x = box.min ().x ();
+        _reference_min_y = box.min ().y ();
+        _reference_max_x = box.max ().x ();
+        _reference_max_y = box.max ().y ();
+        _has_reference = true;
+      }
+  }
+
+  /* Update the drift, after the points of the object changed.
+   *
+   * Objects grow (or shrink) while more of them is seen, which moves only one side of the
+   * bounding box. Only where both sides moved in the same direction, the object moved.
+   */
+  void MapObject::updateDrift ()
+  {
+    if (!_has_reference || isEmpty ())
+      return;
+
+    Eigen::AlignedBox2d box = getBoundingBox ();
+    Eigen::Vector2d min_moved = box.min () - Eigen::Vector2d (_reference_min_x, _reference_min_y);
+    Eigen::Vector2d max_moved = box.max () - Eigen::Vector2d (_reference_max_x, _reference_max_y);
+
+    Eigen::Vector2d shift (0.0, 0.0);
+    for (uint32_t i=0; i < 2; ++i)
+      if (min_moved[i] * max_moved[i] > 0.0)
+        shift[i] = std::min (std::fabs (min_moved[i]), std::fabs (max_moved[i]));
+
+    _observation.drift = shift.norm ();
+  }
+
+  const MapObject::Observation & MapObject::getObservation () const
+  {
+    return _observation;
+  }
+
+  /* Ratio of points, a beam passed through, to all observed points.
+   */
+  double MapObject::getMissRatio () const
+  {
+    uint64_t total = _observation.hits + _observation.misses;
+    if (total == 0)
+      return 0.0;
+
+    return double (_observation.misses) / total;
+  }
+
+  MapObject::Motion MapObject::getMotion () const
+  {
+    return _motion;
+  }
+
+  void MapObject::setMotion (Motion motion)
+  {
+    _motion = motion;
+  }
+
+  bool MapObject::isFrozen () const
+  {
+    return _frozen;
+  }
+
+  /* Mark the object as not changing anymore. Use Map::freezeObject for objects of a map,
+   * which also adds it to the static index.
+   */
+  void MapObject::freeze ()
+  {
+    _frozen = true;
+    _motion = MOTION_STATIC;
+  }
+
+  /* Allow changes again, e.g. after a frozen object was found to be gone.
+   */
+  void MapObject::thaw ()
+  {
+    _frozen = false;
+  }
+
   Map::Map ()
-  : _objects ()
+  : _objects (),
+    _dynamic (),
+    _static_index (1.0),
+    _static_index_pending (),
+    _closed_index (1.0),
+    _closed_index_valid (false),
+    _closed_index_pending (),
+    _tracked (),
+    _tracked_dynamic (),
+    _touched (),
+    _changes (),
+    _version (0),
+    _next_id (0),
+    _locations (),
+    _memory_budget ()
   {
   }
 
   void Map::addObject (const MapObject & obj)
   {
+    checkTouched ();
     _objects.push_back (obj);
+    _tracked.push_back (track (obj, _next_id++));
+    _locations[_tracked.back ().id] = std::make_pair (false, _objects.size () - 1);
+    _closed_index_valid = false;
+    recordChange (_tracked.back ().id, CHANGE_ADDED, _tracked.back ().box);
   }
 
   void Map::addObject (MapObject && obj)
   {
+    checkTouched ();
     _objects.push_back (obj);
+    _tracked.push_back (track (_objects.back (), _next_id++));
+    _locations[_tracked.back ().id] = std::make_pair (false, _objects.size () - 1);
+    _closed_index_valid = false;
+    recordChange (_tracked.back ().id, CHANGE_ADDED, _tracked.back ().box);
   }
 
   const std::vector<MapObject> & Map::getObjects () const
   {
     return _objects;
   }
+
+  uint32_t Map::getObjectCount () const
+  {
+    return _objects.size ();
+  }
+
+  /* Get an object for modification.
+   */
+  MapObject & Map::getObject (uint32_t idx)
+  {
+    _closed_index_valid = false;
+    touch (false, idx);
+    return _objects[idx];
+  }
+
+  /* Freeze a static object: It is added to the static index and must not be changed anymore.
+   */
+  void Map::freezeObject (uint32_t idx)
+  {
+    MapObject & obj = _objects[idx];
+    if (obj.isFrozen ())
+      return;
+
+    obj.freeze ();
+    finishStaticIndex ();
+    _static_index.insert (obj);
+  }
+
+  /* Index of all frozen objects.
+   */
+  const MapIndex & Map::getStaticIndex () const
+  {
+    finishStaticIndex ();
+    return _static_index;
+  }
+
+  /* Move an object of the static layer into the dynamic layer.
+   *
+   * The indices of the following static objects decrease by one. Moving a frozen object
+   * rebuilds the static index, which should be rare.
+   */
+  void Map::moveToDynamic (uint32_t idx)
+  {
+    checkTouched ();
+    MapObject & obj = _objects[idx];
+    bool was_frozen = obj.isFrozen ();
+    _closed_index_valid = false;
+    obj.thaw ();
+    obj.setMotion (MapObject::MOTION_DYNAMIC);
+    _dynamic.push_back (std::move (obj));
+    _objects.erase (_objects.begin () + idx);
+    _tracked_dynamic.push_back (_tracked[idx]);
+    _tracked.erase (_tracked.begin () + idx);
+    _locations[_tracked_dynamic.back ().id] = std::make_pair (true, _dynamic.size () - 1);
+    for (uint32_t i=idx; i < _tracked.size (); ++i)
+      _locations[_tracked[i].id].second = i;
+    recordChange (_tracked_dynamic.back ().id, CHANGE_MODIFIED, _tracked_dynamic.back ().box);
+
+    if (was_frozen)
+      rebuildStaticIndex ();
+  }
+
+  /* Rebuild the index of the frozen objects, after they were changed anyway (e.g. moved by a
+   * loop closure).
+   */
+  void Map::rebuildStaticIndex ()
+  {
+    finishStaticIndex ();
+    _static_index.clear ();
+    for (const MapObject & o: _objects)
+      if (o.isFrozen ())
+        _static_index.insert (o);
+  }
+
+  /* Rebuild the index of the frozen objects on a background thread, from a copy of them.
+   */
+  void Map::rebuildStaticIndexAsync ()
+  {
+    finishStaticIndex ();
+    std::vector<MapObject> frozen;
+    for (const MapObject & o: _objects)
+      if (o.isFrozen ())
+        frozen.push_back (o);
+
+    double cell_size = _static_index.getCellSize ();
+    _static_index.clear ();
+    _static_index_pending = std::async (std::launch::async, [cell_size, frozen = std::move (frozen)] ()
+      {
+        MapIndex index (cell_size);
+        for (const MapObject & o: frozen)
+          index.insert (o);
+        return index;
+      });
+  }
+
+  /* Use an image of the index of the frozen objects (MapIndex::writeImage), which must have
+   * been written with the same objects frozen.
+   */
+  bool Map::attachStaticIndex (const char * data, size_t size, const std::shared_ptr<const void> & owner)
+  {
+    finishStaticIndex ();
+    return _static_index.attachImage (data, size, owner);
+  }
+
+  void Map::finishStaticIndex () const
+  {
+    if (_static_index_pending.valid ())
+      {
+        _static_index = _static_index_pending.get ();
+        _static_index_pending = std::shared_future<MapIndex> ();
+      }
+  }
+
+  void Map::addDynamicObject (MapObject && obj)
+  {
+    checkTouched ();
+    obj.setMotion (MapObject::MOTION_DYNAMIC);
+    _dynamic.push_back (std::move (obj));
+    _tracked_dynamic.push_back (track (_dynamic.back (), _next_id++));
+    _locations[_tracked_dynamic.back ().id] = std::make_pair (true, _dynamic.size () - 1);
+    _closed_index_valid = false;
+    recordChange (_tracked_dynamic.back ().id, CHANGE_ADDED, _tracked_dynamic.back ().box);
+  }
+
+  const std::vector<MapObject> & Map::getDynamicObjects () const
+  {
+    return _dynamic;
+  }
+
+  uint32_t Map::getDynamicObjectCount () const
+  {
+    return _dynamic.size ();
+  }
+
+  MapObject & Map::getDynamicObject (uint32_t idx)
+  {
+    _closed_index_valid = false;
+    touch (true, idx);
+    return _dynamic[idx];
+  }
+
+  /* Remove a dynamic object, the last one takes its index.
+   */
+  void Map::removeDynamicObject (uint32_t idx)
+  {
+    checkTouched ();
+    Tracked removed = _tracked_dynamic[idx];
+    _locations.erase (removed.id);
+    if (idx + 1 < _dynamic.size ())
+      {
+        _dynamic[idx] = std::move (_dynamic.back ());
+        _tracked_dynamic[idx] = _tracked_dynamic.back ();
+        _locations[_tracked_dynamic[idx].id].second = idx;
+      }
+    _dynamic.pop_back ();
+    _tracked_dynamic.pop_back ();
+    _closed_index_valid = false;
+    recordChange (removed.id, CHANGE_REMOVED, removed.box);
+  }
+
+  /* The version of the geometry, increased by each change.
+   */
+  uint64_t Map::getVersion () const
+  {
+    checkTouched ();
+    return _version;
+  }
+
+  /* The changes after version since, in order. Returns false if the changes are not known that
+   * far back anymore, everything has to be considered changed.
+   */
+  bool Map::getChanges (uint64_t since, ChangeVector & changes) const
+  {
+    checkTouched ();
+    changes.clear ();
+    if (since >= _version)
+      return true;
+    if (_changes.empty () || _changes.front ().version > since + 1)
+      return false;
+
+    changes.assign (_changes.begin () + (since + 1 - _changes.front ().version), _changes.end ());
+    return true;
+  }
+
+  /* The regions changed after version since (one per change, they may overlap, changes of
+   * empty objects are left out). Returns false as getChanges.
+   */
+  bool Map::getChangedRegions (uint64_t since, RegionVector & regions) const
+  {
+    checkTouched ();
+    regions.clear ();
+    if (since >= _version)
+      return true;
+    if (_changes.empty () || _changes.front ().version > since + 1)
+      return false;
+
+    for (auto it=_changes.begin () + (since + 1 - _changes.front ().version); it != _changes.end (); ++it)
+      if (!it->region.isEmpty ())
+        regions.push_back (it->region);
+    return true;
+  }
+
+  /* Bounding boxes of the objects, kept with the change tracking (no need to go through the
+   * points).
+   */
+  const Eigen::AlignedBox2d & Map::getObjectBox (uint32_t idx) const
+  {
+    checkTouched ();
+    return _tracked[idx].box;
+  }
+
+  const Eigen::AlignedBox2d & Map::getDynamicObjectBox (uint32_t idx) const
+  {
+    checkTouched ();
+    return _tracked_dynamic[idx].box;
+  }
+
+  uint32_t Map::getObjectId (uint32_t idx) const
+  {
+    return _tracked[idx].id;
+  }
+
+  uint32_t Map::getDynamicObjectId (uint32_t idx) const
+  {
+    return _tracked_dynamic[idx].id;
+  }
+
+  /* The object with an id, nullptr if it doesn't exist (anymore). dynamic tells its layer.
+   */
+  const MapObject * Map::findObject (uint32_t id, bool * dynamic) const
+  {
+    auto found = _locations.find (id);
+    if (found == _locations.end ())
+      return nullptr;
+
+    if (dynamic)
+      *dynamic = found->second.first;
+    return found->second.first ? &_dynamic[found->second.second] : &_objects[found->second.second];
+  }
+
+  Map::Tracked Map::track (const MapObject & obj, uint32_t id)
+  {
+    Tracked t;
+    t.box = obj.getBoundingBox ();
+    t.revision = obj.getRevision ();
+    t.id = id;
+    t.touched = false;
+    return t;
+  }
+
+  void Map::touch (bool dynamic, uint32_t idx)
+  {
+    Tracked & t = dynamic ? _tracked_dynamic[idx] : _tracked[idx];
+    if (t.touched)
+      return;
+
+    t.touched = true;
+    _touched.push_back (std::make_pair (dynamic, idx));
+  }
+
+  /* Record the changes of the objects taken for modification. Must be called before the
+   * layers change, so the indices of _touched are still valid.
+   */
+  void Map::checkTouched () const
+  {
+    for (const std::pair<bool, uint32_t> & touched: _touched)
+      {
+        const MapObject & obj = touched.first ? _dynamic[touched.second] : _objects[touched.second];
+        Tracked & t = touched.first ? _tracked_dynamic[touched.second] : _tracked[touched.second];
+        t.touched = false;
+        if (t.revision == obj.getRevision ())
+          continue;
+
+        Tracked now = track (obj, t.id);
+        Eigen::AlignedBox2d region = t.box;
+        region.extend (now.box);
+        t = now;
+        recordChange (t.id, CHANGE_MODIFIED, region);
+      }
+    _touched.clear ();
+  }
+
+  void Map::recordChange (uint32_t id, ChangeKind kind, const Eigen::AlignedBox2d & region) const
+  {
+    Change change;
+    change.version = ++_version;
+    change.object_id = id;
+    change.kind = kind;
+    change.region = region;
+    _changes.push_back (change);
+    if (_changes.size () > max_changes)
+      _changes.pop_front ();
+  }
+
+  /* Crossings between different objects of the static layer, found with one sweep over the
+   * segments of all objects.
+   */
+  void Map::findCrossings (CrossingVector & crossings) const
+  {
+    PATHFINDER_TRACE_SCOPE ("Map::findCrossings");
+
+    crossings.clear ();
+    SegmentSweep sweep;
+    std::vector<std::pair<uint32_t, uint32_t>> owner;
+    for (uint32_t i=0; i < _objects.size (); ++i)
+      {
+        // Point by point, so compact or curved objects aren't decoded into their caches
+        const MapObject & obj = _objects[i];
+        uint32_t count = obj.getPointCount ();
+        Position p = count > 0 ? obj.getPoint (0) : Position (0, 0);
+        for (uint32_t j=0; j + 1 < count; ++j)
+          {
+            Position q = obj.getPoint (j + 1);
+            sweep.addSegment (p, q);
+            owner.push_back (std::make_pair (i, j));
+            p = q;
+          }
+      }
+
+    SegmentSweep::CrossingVector found;
+    sweep.findCrossings (found);
+    for (const SegmentSweep::Crossing & c: found)
+      {
+        const std::pair<uint32_t, uint32_t> & a = owner[c.segment1];
+        const std::pair<uint32_t, uint32_t> & b = owner[c.segment2];
+        if (a.first == b.first)
+          continue;
+
+        Crossing crossing;
+        crossing.object1 = a.first;
+        crossing.segment1 = a.second;
+        crossing.object2 = b.first;
+        crossing.segment2 = b.second;
+        crossing.position = c.position;
+        crossings.push_back (crossing);
+      }
+  }
+
+  /* The closed objects containing each point: Those of points[i] are
+   * objects[offsets[i]] .. objects[offsets[i+1]-1], ascending. Static objects are numbered
+   * by their index, dynamic ones by getObjectCount () + their index.
+   *
+   * The points are classified in blocks on threads threads (0: defaultThreadCount ()).
+   */
+  void Map::classifyPoints (const Position * points, uint32_t count,
+                            std::vector<uint32_t> & offsets, std::vector<uint32_t> & objects,
+                            uint32_t threads) const
+  {
+    PATHFINDER_TRACE_SCOPE ("Map::classifyPoints");
+
+    updateClosedIndex ();
+
+    const uint32_t block = 16384;
+    uint32_t blocks = (count + block - 1) / block;
+    if (blocks <= 1)
+      {
+        _closed_index.classify (points, count, offsets, objects);
+        return;
+      }
+
+    std::vector<std::vector<uint32_t>> block_offsets (blocks);
+    std::vector<std::vector<uint32_t>> block_objects (blocks);
+    parallelFor (blocks, threads > 0 ? threads : defaultThreadCount (),
+                 [&] (uint32_t b)
+                 {
+                   uint32_t first = b * block;
+                   _closed_index.classify (points + first, std::min (block, count - first),
+                                           block_offsets[b], block_objects[b]);
+                 });
+
+    offsets.resize (count + 1);
+    offsets[0] = 0;
+    objects.clear ();
+    for (uint32_t b=0; b < blocks; ++b)
+      {
+        uint32_t base = objects.size ();
+        for (uint32_t i=1; i < block_offsets[b].size (); ++i)
+          offsets[b * block + i] = base + block_offsets[b][i];
+        objects.insert (objects.end (), block_objects[b].begin (), block_objects[b].end ());
+      }
+  }
+
+  /* Index of the closed objects of both layers, numbered as by classifyPoints. Brings it up to
+   * date like classifyPoints.
+   */
+  const PolygonIndex & Map::getClosedIndex () const
+  {
+    updateClosedIndex ();
+    return _closed_index;
+  }
+
+  /* Rebuild the index of the closed objects on a background thread, from a copy of them. It is
+   * dropped if the objects change before it is used.
+   */
+  void Map::rebuildClosedIndexAsync ()
+  {
+    _closed_index_pending = std::shared_future<PolygonIndex> ();
+    std::vector<std::pair<uint32_t, MapObject>> closed;
+    for (uint32_t i=0; i < _objects.size (); ++i)
+      if (_objects[i].isClosed ())
+        closed.emplace_back (i, _objects[i]);
+    for (uint32_t i=0; i < _dynamic.size (); ++i)
+      if (_dynamic[i].isClosed ())
+        closed.emplace_back (_objects.size () + i, _dynamic[i]);
+
+    double cell_size = _closed_index.getCellSize ();
+    _closed_index.clear ();
+    _closed_index_valid = true;
+    _closed_index_pending = std::async (std::launch::async, [cell_size, closed = std::move (closed)] ()
+      {
+        PolygonIndex index (cell_size);
+        for (const auto & c: closed)
+          index.insert (c.second, c.first);
+        return index;
+      });
+  }
+
+  /* Use an image of the index of the closed objects (PolygonIndex::writeImage), which must
+   * have been written for the same objects.
+   */
+  bool Map::attachClosedIndex (const char * data, size_t size, const std::shared_ptr<const void> & owner)
+  {
+    _closed_index_pending = std::shared_future<PolygonIndex> ();
+    if (!_closed_index.attachImage (data, size, owner))
+      return false;
+
+    _closed_index_valid = true;
+    return true;
+  }
+
+  /* Take the index being rebuilt, or rebuild it now, if the objects were changed since.
+   */
+  void Map::updateClosedIndex () const
+  {
+    if (_closed_index_pending.valid ())
+      {
+        if (_closed_index_valid)
+          _closed_index = _closed_index_pending.get ();
+        _closed_index_pending = std::shared_future<PolygonIndex> ();
+      }
+
+    if (!_closed_index_valid)
+      {
+        _closed_index.clear ();
+        for (uint32_t i=0; i < _objects.size (); ++i)
+          _closed_index.insert (_objects[i], i);
+        for (uint32_t i=0; i < _dynamic.size (); ++i)
+          _closed_index.insert (_dynamic[i], _objects.size () + i);
+        _closed_index_valid = true;
+      }
+  }
+
+  Map::MemoryBudget::MemoryBudget ()
+  : max_bytes (0),
+    compact_resolution (0.001),
+    simplify_max_dist (1.0),
+    simplify_max_deviation (0.02),
+    simplify_min_points (3)
+  {
+  }
+
+  /* Memory used by the map and its indexes. Estimated for the hash tables.
+   */
+  Map::MemoryStats Map::getMemoryStats () const
+  {
+    MemoryStats stats;
+    stats.objects = (_objects.capacity () + _dynamic.capacity ()) * sizeof (MapObject);
+    stats.points = 0;
+    stats.compact_points = 0;
+    stats.curves = 0;
+    stats.decoded_points = 0;
+    for (const std::vector<MapObject> * layer: { &_objects, &_dynamic })
+      for (const MapObject & obj: *layer)
+        {
+          MapObject::MemoryUsage usage = obj.getMemoryUsage ();
+          stats.points += usage.points;
+          stats.compact_points += usage.compact_points;
+          stats.curves += usage.curves;
+          stats.decoded_points += usage.decoded_points;
+        }
+
+    // A pending index is counted when it is taken over
+    MapIndex::MemoryUsage static_usage = _static_index.getMemoryUsage ();
+    PolygonIndex::MemoryUsage closed_usage = _closed_index.getMemoryUsage ();
+    stats.static_index = static_usage.heap;
+    stats.closed_index = closed_usage.heap;
+    stats.mapped = static_usage.mapped + closed_usage.mapped;
+
+    stats.change_tracking = (_tracked.capacity () + _tracked_dynamic.capacity ()) * sizeof (Tracked)
+                            + _touched.capacity () * sizeof (_touched[0])
+                            + _changes.size () * sizeof (Change)
+                            + _locations.bucket_count () * sizeof (void *)
+                            + _locations.size () * (sizeof (decltype (_locations)::value_type) + 2 * sizeof (void *));
+
+    stats.total = stats.objects + stats.points + stats.compact_points + stats.curves + stats.decoded_points
+                  + stats.static_index + stats.closed_index + stats.change_tracking;
+    return stats;
+  }
+
+  void Map::setMemoryBudget (const MemoryBudget & budget)
+  {
+    _memory_budget = budget;
+  }
+
+  const Map::MemoryBudget & Map::getMemoryBudget () const
+  {
+    return _memory_budget;
+  }
+
+  /* Free memory until the map fits into the budget, if it doesn't (see above). The static
+   * index is rebuilt if frozen objects were changed, the closed index when it is used next.
+   */
+  Map::BudgetResult Map::enforceMemoryBudget ()
+  {
+    PATHFINDER_TRACE_SCOPE ("Map::enforceMemoryBudget");
+
+    BudgetResult result;
+    result.bytes_before = getMemoryStats ().total;
+    result.bytes_after = result.bytes_before;
+    result.compacted = 0;
+    result.simplified = 0;
+    result.within_budget = true;
+
+    size_t max_bytes = _memory_budget.max_bytes;
+    if (max_bytes == 0 || result.bytes_before <= max_bytes)
+      return result;
+
+    // Caches and reserves, nothing changes
+    for (const std::vector<MapObject> * layer: { &_objects, &_dynamic })
+      for (const MapObject & obj: *layer)
+        obj.releaseCaches ();
+    for (MapObject & obj: _objects)
+      if (obj.isFrozen ())
+        obj.shrinkToFit ();
+    finishStaticIndex ();
+    _closed_index_pending = std::shared_future<PolygonIndex> ();
+    _closed_index.clear ();
+    _closed_index_valid = false;
+
+    size_t bytes = getMemoryStats ().total;
+
+    // The frozen objects, largest first. Curved ones are small already.
+    std::vector<std::pair<size_t, uint32_t>> frozen;
+    for (uint32_t i=0; i < _objects.size (); ++i)
+      if (_objects[i].isFrozen () && !_objects[i].isCurved ())
+        frozen.emplace_back (objectBytes (_objects[i]), i);
+    std::sort (frozen.begin (), frozen.end (), std::greater<std::pair<size_t, uint32_t>> ());
+
+    double resolution = _memory_budget.compact_resolution;
+    if (resolution > 0.0)
+      for (uint32_t k=0; k < frozen.size () && bytes > max_bytes; ++k)
+        {
+          if (_objects[frozen[k].second].isCompact ())
+            continue;
+
+          MapObject & obj = getObject (frozen[k].second);
+          size_t before = objectBytes (obj);
+          if (!obj.compact (resolution))
+            continue;
+
+          obj.shrinkToFit ();
+          bytes -= std::min (bytes, before - std::min (before, objectBytes (obj)));
+          ++result.compacted;
+        }
+
+    if (_memory_budget.simplify_max_dist > 0.0)
+      for (uint32_t k=0; k < frozen.size () && bytes > max_bytes; ++k)
+        {
+          const MapObject & current = _objects[frozen[k].second];
+          MapObject simplified (current);
+          simplified.makeEquidistant (_memory_budget.simplify_max_dist, _memory_budget.simplify_min_points,
+                                      _memory_budget.simplify_max_deviation);
+          if (simplified.getPointCount () >= current.getPointCount ())
+            continue;
+
+          if (current.isCompact ())
+            simplified.compact (current.getCompactResolution ());
+          simplified.shrinkToFit ();
+
+          MapObject & obj = getObject (frozen[k].second);
+          size_t before = objectBytes (obj);
+          obj = std::move (simplified);
+          bytes -= std::min (bytes, before - std::min (before, objectBytes (obj)));
+          ++result.simplified;
+        }
+
+    if (result.compacted + result.simplified > 0)
+      rebuildStaticIndex ();
+
+    result.bytes_after = getMemoryStats ().total;
+    result.within_budget = result.bytes_after <= max_bytes;
+    return result;
+  }
+
+  size_t Map::objectBytes (const MapObject & obj)
+  {
+    MapObject::MemoryUsage usage = obj.getMemoryUsage ();
+    return usage.points + usage.compact_points + usage.curves + usage.decoded_points;
+  }
 }
@@ -2,22 +2,42 @@
  *
  */
 
+#ifndef ROBOT_MAP_H
+#define ROBOT_MAP_H
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include <cstdint>
 
+#include "robot-curvechain.h"
 #include "robot-geometry.h"
+#include "robot-mapindex.h"
+#include "robot-memory.h"
+#include "robot-polygonindex.h"
+#include "robot-sweep.h"
 
 namespace Pathfinder
 {
   class MapObject
   {
     public:
+      // The vertices, counted by the MemoryTracker
+      typedef std::vector<Position,TrackingAllocator<Position,MEMORY_POINTS,Eigen::aligned_allocator<Position>>> PointVector;
+
       MapObject (double min_point_distance);
 
-      const std::vector<Position,Eigen::aligned_allocator<Position>>& getPolygon () const;
+      const PointVector & getPolygon () const;
+      uint32_t getPointCount () const;
+      double getMinPointDistance () const;
+      Eigen::AlignedBox2d getBoundingBox () const;
+      Position getPoint (uint32_t idx) const;
       bool isClosed () const;
       bool isEmpty () const;
       void appendPoint (const Position & point);
+      void setPolygon (const std::vector<Position,Eigen::aligned_allocator<Position>> & poly);
       void setClosed (bool closed);
       void clear ();
       bool join (const MapObject & other, double max_dist);
@@ -25,6 +45,9 @@ namespace Pathfinder
       void smooth (double max_deviation, uint32_t filter_size);
       void makeEquidistant (double max_dist, uint32_t min_points, double max_deviation);
       void convexHull ();
+      bool contains (const Position & pos) const;
+      void findCrossings (SegmentSweep::CrossingVector & crossings) const;
+      uint32_t removeCrossings (double max_loop_length);
 
       struct FindResult
       {
@@ -34,11 +57,125 @@ namespace Pathfinder
       };
       std::optional<FindResult> findClosestPosition (const Position & pos) const;
 
+      bool compact (double resolution);
+      void expand ();
+      bool isCompact () const;
+      double getCompactResolution () const;
+      uint32_t getRevision () const;
+
+      bool fitCurves (double max_deviation);
+      void setCurves (const CurveChain & curves);
+      bool isCurved () const;
+      const CurveChain & getCurves () const;
+
+      struct MemoryUsage
+      {
+          size_t points;                // allocated for the vertices
+          size_t compact_points;
+          size_t curves;
+          size_t decoded_points;        // cache of the vertices of a compact or curved object
+      };
+
+      MemoryUsage getMemoryUsage () const;
+      void releaseCaches () const;
+      void shrinkToFit ();
+
+      // Observation history, to tell static objects from dynamic ones
+      enum Motion
+      {
+        MOTION_UNKNOWN,
+        MOTION_STATIC,
+        MOTION_DYNAMIC
+      };
+
+      struct Observation
+      {
+          uint32_t scans;         // scans which observed at least one point of the object
+          uint64_t hits;          // points confirmed by a beam ending at them
+          uint64_t misses;        // points a beam passed through
+          double first_seen;
+          double last_seen;       // last scan with hits
+          double drift;           // movement of the bounding box since first seen, not explained by growth
+          double recent_miss_ratio;  // miss ratio, averaged exponentially over the last scans
+      };
+
+      void observe (double time, uint32_t hits, uint32_t misses);
+      void updateDrift ();
+      const Observation & getObservation () const;
+      double getMissRatio () const;
+      Motion getMotion () const;
+      void setMotion (Motion motion);
+      bool isFrozen () const;
+      void freeze ();
+      void thaw ();
+
     private:
+      void ensureExpanded ();
+      template <typename Add> bool addExpanded (Add add);
+      bool joinExpanded (const MapObject & other, double max_dist);
+      bool addPointExpanded (const Position & point, double max_dist);
+
       double _min_point_distance;
-      std::vector<Position,Eigen::aligned_allocator<Position>> _poly;
+      PointVector _poly;
+
+      // Compact storage: Vertices as 32 bit fixed point offsets (x, y interleaved) to an
+      // origin of this object. _compact_resolution == 0.0 means: not compact, use _poly.
+      double _compact_resolution;
+      double _compact_origin_x;
+      double _compact_origin_y;
+      bool _compact_closed;
+      std::vector<int32_t,TrackingAllocator<int32_t,MEMORY_COMPACT_POINTS>> _compact;
+
+      // Curve storage: The vertices approximated by curves, used if not empty (instead of
+      // _poly, never together with the compact storage).
+      CurveChain _curves;
+      mutable PointVector _decoded;
+
+      Observation _observation;
+      Motion _motion;
+      bool _frozen;
+      bool _has_reference;          // reference box, taken when first observed
+      double _reference_min_x;
+      double _reference_min_y;
+      double _reference_max_x;
+      double _reference_max_y;
+      uint32_t _revision;
   };
 
+  /* The objects of the map, in two layers:
+   *
+   * The static layer (getObjects) holds everything not known to move. Static objects, which
+   * don't change anymore, can be frozen: They are added to the static index once and are not
+   * modified afterwards.
+   * The dynamic layer holds objects known to move, which change with every scan and are
+   * dropped when they are not seen anymore.
+   *
+   * classifyPoints tells which closed objects of both layers contain each of many points.
+   * Dynamic objects are numbered after the static ones, as for CollisionChecker. The index
+   * for it is rebuilt on the first call after any object may have been changed (non-const
+   * access), so that call must not run concurrently with others.
+   *
+   * Changes of the geometry are tracked: Each object taken for modification (getObject,
+   * getDynamicObject) is checked for changed points at the next getVersion, getChangedRegions
+   * or change of the layers, so the references must not be kept beyond that. Each change
+   * increases the version by one and records the region it affected (bounding box before and
+   * after), so that derived structures (e.g. a Costmap) can catch up by updating only these
+   * regions. The last max_changes changes are kept.
+   *
+   * Each object has an id, which stays the same while it exists (also when moved into the
+   * dynamic layer), unlike its index. The changes name the object and tell whether it was
+   * added, modified (points or layer) or removed, e.g. for the MapJournal.
+   *
+   * Both indexes can be attached to images (see MapFile), or rebuilt on a background thread
+   * from a copy of the objects. The first use of an index being rebuilt waits for it.
+   *
+   * getMemoryStats breaks down the memory used by the map (the points per object with
+   * MapObject::getMemoryUsage, process wide per category with the MemoryTracker). With a
+   * memory budget, enforceMemoryBudget frees memory until the map fits: first the caches (the
+   * decoded points of compact objects, the closed index, reserves of frozen objects), then
+   * by compacting the frozen objects and last by simplifying them (makeEquidistant), the
+   * largest first. Only frozen objects are changed, the changes are recorded as usual.
+   */
   class Map
   {
     public:
@@ -47,8 +184,146 @@ namespace Pathfinder
       void addObject (const MapObject & obj);
       void addObject (MapObject && obj);
       const std::vector<MapObject> & getObjects () const;
+      uint32_t getObjectCount () const;
+      MapObject & getObject (uint32_t idx);
+
+      void freezeObject (uint32_t idx);
+      const MapIndex & getStaticIndex () const;
+      void rebuildStaticIndex ();
+      void rebuildStaticIndexAsync ();
+      bool attachStaticIndex (const char * data, size_t size, const std::shared_ptr<const void> & owner);
+
+      void moveToDynamic (uint32_t idx);
+      void addDynamicObject (MapObject && obj);
+      const std::vector<MapObject> & getDynamicObjects () const;
+      uint32_t getDynamicObjectCount () const;
+      MapObject & getDynamicObject (uint32_t idx);
+      void removeDynamicObject (uint32_t idx);
+
+      struct Crossing
+      {
+          uint32_t object1;         // object1 < object2, static layer
+          uint32_t segment1;        // segment i goes from point i to point i+1
+          uint32_t object2;
+          uint32_t segment2;
+          Position position;
+      };
+      typedef std::vector<Crossing, Eigen::aligned_allocator<Crossing>> CrossingVector;
+
+      void findCrossings (CrossingVector & crossings) const;
+
+      void classifyPoints (const Position * points, uint32_t count,
+                           std::vector<uint32_t> & offsets, std::vector<uint32_t> & objects,
+                           uint32_t threads = 0) const;
+      const PolygonIndex & getClosedIndex () const;
+      void rebuildClosedIndexAsync ();
+      bool attachClosedIndex (const char * data, size_t size, const std::shared_ptr<const void> & owner);
+
+      enum ChangeKind
+      {
+        CHANGE_ADDED,
+        CHANGE_MODIFIED,
+        CHANGE_REMOVED
+      };
+
+      struct Change
+      {
+          uint64_t version;
+          uint32_t object_id;
+          ChangeKind kind;
+          Eigen::AlignedBox2d region;   // bounding box before and after, empty for empty objects
+      };
+      typedef std::vector<Change,Eigen::aligned_allocator<Change>> ChangeVector;
+      typedef std::vector<Eigen::AlignedBox2d,Eigen::aligned_allocator<Eigen::AlignedBox2d>> RegionVector;
+      static const uint32_t max_changes = 4096;
+
+      uint64_t getVersion () const;
+      bool getChanges (uint64_t since, ChangeVector & changes) const;
+      bool getChangedRegions (uint64_t since, RegionVector & regions) const;
+      const Eigen::AlignedBox2d & getObjectBox (uint32_t idx) const;
+      const Eigen::AlignedBox2d & getDynamicObjectBox (uint32_t idx) const;
+      uint32_t getObjectId (uint32_t idx) const;
+      uint32_t getDynamicObjectId (uint32_t idx) const;
+      const MapObject * findObject (uint32_t id, bool * dynamic = nullptr) const;
+
+      struct MemoryStats
+      {
+          size_t objects;               // the MapObjects, without their points
+          size_t points;
+          size_t compact_points;
+          size_t curves;
+          size_t decoded_points;        // caches of compact or curved objects (getPolygon)
+          size_t static_index;
+          size_t closed_index;
+          size_t change_tracking;
+          size_t mapped;                // index images attached, not in total
+          size_t total;                 // on the heap
+      };
+
+      struct MemoryBudget
+      {
+          MemoryBudget ();
+
+          size_t max_bytes;             // of MemoryStats::total, 0: unlimited
+          double compact_resolution;    // for frozen objects, 0: don't compact
+          double simplify_max_dist;     // makeEquidistant of frozen objects, 0: don't simplify
+          double simplify_max_deviation;
+          uint32_t simplify_min_points;
+      };
+
+      struct BudgetResult
+      {
+          size_t bytes_before;
+          size_t bytes_after;
+          uint32_t compacted;           // objects
+          uint32_t simplified;
+          bool within_budget;
+      };
+
+      MemoryStats getMemoryStats () const;
+      void setMemoryBudget (const MemoryBudget & budget);
+      const MemoryBudget & getMemoryBudget () const;
+      BudgetResult enforceMemoryBudget ();
 
     private:
+      struct Tracked
+      {
+          Eigen::AlignedBox2d box;      // at the last check
+          uint32_t revision;
+          uint32_t id;
+          bool touched;                 // taken for modification since the last check
+      };
+      typedef std::vector<Tracked,Eigen::aligned_allocator<Tracked>> TrackedVector;
+
+      static Tracked track (const MapObject & obj, uint32_t id);
+      void touch (bool dynamic, uint32_t idx);
+      void checkTouched () const;
+      void recordChange (uint32_t id, ChangeKind kind, const Eigen::AlignedBox2d & region) const;
+      void finishStaticIndex () const;
+      void updateClosedIndex () const;
+      static size_t objectBytes (const MapObject & obj);
+
       std::vector<MapObject> _objects;
+      std::vector<MapObject> _dynamic;
+      mutable MapIndex _static_index;
+      mutable std::shared_future<MapIndex> _static_index_pending;       // by rebuildStaticIndexAsync
+
+      // Closed objects of both layers, built by classifyPoints after a change
+      mutable PolygonIndex _closed_index;
+      mutable bool _closed_index_valid;
+      mutable std::shared_future<PolygonIndex> _closed_index_pending;   // used if still valid when done
+
+      // Change tracking, parallel to _objects and _dynamic
+      mutable TrackedVector _tracked;
+      mutable TrackedVector _tracked_dynamic;
+      mutable std::vector<std::pair<bool, uint32_t>> _touched;     // dynamic, index
+      mutable std::deque<Change,Eigen::aligned_allocator<Change>> _changes;
+      mutable uint64_t _version;
+      uint32_t _next_id;
+      std::unordered_map<uint32_t, std::pair<bool, uint32_t>> _locations;    // id: dynamic, index
+
+      MemoryBudget _memory_budget;
   };
 }
+
+#endif
@@ -0,0 +1,767 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+
+#include "robot-mapbuilder.h"
+#include "robot-parallel.h"
+
+namespace Pathfinder
+{
+  // Durations kept per stage for its percentiles
+  static const uint32_t map_builder_stage_window = 4096;
+
+  static uint64_t mapBuilderNow ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  /* The square of the shards (squares of size, their corners at offset) containing box, false if
+   * it is in more than one.
+   */
+  static bool mapBuilderShard (const Eigen::AlignedBox2d & box, double size, double offset, uint64_t & key)
+  {
+    int64_t x = std::floor ((box.min ().x () - offset) / size);
+    int64_t y = std::floor ((box.min ().y () - offset) / size);
+    if (int64_t (std::floor ((box.max ().x () - offset) / size)) != x
+        || int64_t (std::floor ((box.max ().y () - offset) / size)) != y)
+      return false;
+
+    key = (uint64_t (uint32_t (x)) << 32) | uint32_t (y);
+    return true;
+  }
+
+  MapBuilder::Parameters::Parameters ()
+  : min_point_distance (0.05),
+    max_dist (0.2),
+    max_gap (0.5),
+    min_points (3),
+    smooth_deviation (0.05),
+    smooth_filter_size (3),
+    max_loop_length (1.0),
+    hit_tolerance (0.1),
+    classify_min_scans (10),
+    dynamic_miss_ratio (0.5),
+    static_miss_ratio (0.1),
+    max_drift (0.3),
+    freeze_min_scans (30),
+    dynamic_timeout (2.0),
+    batch_scans (1),
+    shard_size (10.0),
+    threads (0),
+    memory_check_scans (16)
+  {
+  }
+
+  /* Create a builder adding to map.
+   *
+   * Objects added to the map by others are taken into account, but objects changed by others
+   * keep the bounding box the builder saw last.
+   */
+  MapBuilder::MapBuilder (Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _pose (),
+    _has_pose (false),
+    _scans (0),
+    _poses (0),
+    _points (0),
+    _memory_check (0),
+    _boxes (),
+    _scan_points (),
+    _chains (),
+    _changed (),
+    _changed_dynamic (),
+    _pending (),
+    _batch_points (),
+    _batch_chains (),
+    _shards ()
+  {
+    _pose.setIdentity ();
+    for (StageTimes & times: _stage_times)
+      {
+        times.calls = 0;
+        times.total_ns = 0;
+        times.max_ns = 0;
+      }
+  }
+
+  MapBuilder::~MapBuilder ()
+  {
+  }
+
+  /* The pose is used for all following scans.
+   */
+  void MapBuilder::pushPose (double, const Transformation & pose)
+  {
+    _pose = pose;
+    _has_pose = true;
+    ++_poses;
+  }
+
+  void MapBuilder::pushScan (double time, const RangeScan & scan)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::pushScan");
+
+    // Without a pose, the scan cannot be placed in the map.
+    if (!_has_pose)
+      return;
+
+    if (_parameters.batch_scans > 1)
+      {
+        PendingScan pending;
+        pending.time = time;
+        pending.pose = _pose;
+        pending.scan = scan;
+        _pending.push_back (std::move (pending));
+        if (_pending.size () >= _parameters.batch_scans)
+          processBatch ();
+        return;
+      }
+
+    uint64_t t0 = mapBuilderNow ();
+    scanToPoints (scan, _pose, _scan_points);
+    addStageTime (STAGE_TRANSFORM, mapBuilderNow () - t0);
+
+    pushPoints (time, scan, _pose, _scan_points);
+  }
+
+  /* The stages after transform, for the points of scan taken at pose, transformed already
+   * (scanToPoints). points is changed.
+   */
+  void MapBuilder::pushPoints (double time, const RangeScan & scan, const Transformation & pose,
+                               std::vector<Position,Eigen::aligned_allocator<Position>> & points)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::pushPoints");
+
+    // After the scans before
+    processBatch ();
+
+    ++_scans;
+    _points += points.size ();
+
+    uint64_t t1 = mapBuilderNow ();
+    observe (time, scan, pose);
+
+    uint64_t t2 = mapBuilderNow ();
+    // Points on frozen objects add nothing new
+    const MapIndex & index = _map.getStaticIndex ();
+    if (!index.isEmpty ())
+      points.erase (std::remove_if (points.begin (), points.end (),
+                                    [&] (const Position & p) { return index.isNear (p, _parameters.max_dist); }),
+                    points.end ());
+    segment (points, _chains);
+
+    uint64_t t3 = mapBuilderNow ();
+    associate (_chains, _changed, _changed_dynamic);
+
+    uint64_t t4 = mapBuilderNow ();
+    for (uint32_t idx: _changed)
+      {
+        MapObject & obj = _map.getObject (idx);
+        smoothObject (obj);
+        _boxes[idx] = obj.getBoundingBox ();
+      }
+    for (uint32_t idx: _changed_dynamic)
+      smoothObject (_map.getDynamicObject (idx));
+
+    uint64_t t5 = mapBuilderNow ();
+    classify (time);
+
+    uint64_t t6 = mapBuilderNow ();
+    addStageTime (STAGE_OBSERVE, t2 - t1);
+    addStageTime (STAGE_SEGMENT, t3 - t2);
+    addStageTime (STAGE_ASSOCIATE, t4 - t3);
+    addStageTime (STAGE_SMOOTH, t5 - t4);
+    addStageTime (STAGE_CLASSIFY, t6 - t5);
+  }
+
+  /* Process the scans kept for the next batch (parallel mode).
+   */
+  void MapBuilder::flush ()
+  {
+    processBatch ();
+  }
+
+  void MapBuilder::smoothObject (MapObject & obj) const
+  {
+    obj.smooth (_parameters.smooth_deviation, _parameters.smooth_filter_size);
+    obj.removeCrossings (_parameters.max_loop_length);
+    obj.updateDrift ();
+  }
+
+  uint32_t MapBuilder::getThreadCount () const
+  {
+    if (_parameters.threads > 0)
+      return _parameters.threads;
+
+    return defaultThreadCount ();
+  }
+
+  /* The stages of pushScan for all pending scans, see the parallel mode.
+   */
+  void MapBuilder::processBatch ()
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::processBatch");
+
+    if (_pending.empty ())
+      return;
+
+    uint32_t count = _pending.size ();
+    uint32_t threads = getThreadCount ();
+    _scans += count;
+    _batch_points.resize (count);
+    _batch_chains.resize (count);
+
+    uint64_t t0 = mapBuilderNow ();
+    parallelFor (count, threads,
+                 [&] (uint32_t k) { scanToPoints (_pending[k].scan, _pending[k].pose, _batch_points[k]); });
+    for (uint32_t k=0; k < count; ++k)
+      _points += _batch_points[k].size ();
+
+    uint64_t t1 = mapBuilderNow ();
+    observeBatch ();
+
+    uint64_t t2 = mapBuilderNow ();
+    const MapIndex & index = _map.getStaticIndex ();
+    parallelFor (count, threads,
+                 [&] (uint32_t k)
+                 {
+                   std::vector<Position,Eigen::aligned_allocator<Position>> & points = _batch_points[k];
+                   if (!index.isEmpty ())
+                     points.erase (std::remove_if (points.begin (), points.end (),
+                                                   [&] (const Position & p) { return index.isNear (p, _parameters.max_dist); }),
+                                   points.end ());
+                   segment (points, _batch_chains[k]);
+                 });
+
+    uint64_t t3 = mapBuilderNow ();
+    associateBatch ();
+
+    // Every object changed by the batch is smoothed once
+    uint64_t t4 = mapBuilderNow ();
+    std::sort (_changed.begin (), _changed.end ());
+    _changed.erase (std::unique (_changed.begin (), _changed.end ()), _changed.end ());
+    std::vector<MapObject *> smoothed;
+    for (uint32_t idx: _changed)
+      smoothed.push_back (&_map.getObject (idx));
+    for (uint32_t idx: _changed_dynamic)
+      smoothed.push_back (&_map.getDynamicObject (idx));
+    parallelFor (smoothed.size (), threads,
+                 [&] (uint32_t i)
+                 {
+                   smoothObject (*smoothed[i]);
+                   if (i < _changed.size ())
+                     _boxes[_changed[i]] = smoothed[i]->getBoundingBox ();
+                 });
+
+    uint64_t t5 = mapBuilderNow ();
+    classify (_pending.back ().time);
+
+    uint64_t t6 = mapBuilderNow ();
+    addStageTime (STAGE_TRANSFORM, t1 - t0);
+    addStageTime (STAGE_OBSERVE, t2 - t1);
+    addStageTime (STAGE_SEGMENT, t3 - t2);
+    addStageTime (STAGE_ASSOCIATE, t4 - t3);
+    addStageTime (STAGE_SMOOTH, t5 - t4);
+    addStageTime (STAGE_CLASSIFY, t6 - t5);
+
+    _pending.clear ();
+  }
+
+  /* Check the objects against the beams of all pending scans, each object by the scans in
+   * order, the objects in parallel.
+   */
+  void MapBuilder::observeBatch ()
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::observeBatch");
+
+    uint32_t count = _pending.size ();
+    std::vector<Transformation> inverses (count);
+    std::vector<Eigen::AlignedBox2d,Eigen::aligned_allocator<Eigen::AlignedBox2d>> ranges (count);
+    Eigen::AlignedBox2d batch_range;
+    for (uint32_t k=0; k < count; ++k)
+      {
+        const PendingScan & pending = _pending[k];
+        Position origin = pending.pose.getTranslation ();
+        inverses[k] = pending.pose.inverse ();
+        ranges[k] = Eigen::AlignedBox2d (origin - Eigen::Vector2d::Constant (pending.scan.max_range),
+                                         origin + Eigen::Vector2d::Constant (pending.scan.max_range));
+        batch_range.extend (ranges[k]);
+      }
+
+    // The objects are touched (Map::getObject) before going parallel
+    std::vector<std::pair<MapObject *, const Eigen::AlignedBox2d *>> objects;
+    for (uint32_t i=0; i < _boxes.size (); ++i)
+      if (batch_range.intersects (_boxes[i]))
+        objects.push_back (std::make_pair (&_map.getObject (i), &_boxes[i]));
+    for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+      objects.push_back (std::make_pair (&_map.getDynamicObject (i), nullptr));
+
+    parallelFor (objects.size (), getThreadCount (),
+                 [&] (uint32_t i)
+                 {
+                   for (uint32_t k=0; k < count; ++k)
+                     if (!objects[i].second || ranges[k].intersects (*objects[i].second))
+                       observeObject (_pending[k].time, _pending[k].scan, inverses[k], *objects[i].first);
+                 });
+  }
+
+  /* Association of the chains of all pending scans, see the parallel mode. The chains left by
+   * the shards get a second chance in shards shifted by half their size, which contain most
+   * chains crossing the borders of the first ones. changed and changed_dynamic get the indices
+   * of the objects joined with or added, possibly duplicates.
+   */
+  void MapBuilder::associateBatch ()
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::associateBatch");
+
+    std::vector<MapObject *> chains;
+    for (std::vector<MapObject> & scan_chains: _batch_chains)
+      for (MapObject & chain: scan_chains)
+        chains.push_back (&chain);
+
+    std::vector<uint32_t> changed;
+    for (uint32_t pass=0; pass < 2 && !chains.empty (); ++pass)
+      {
+        for (uint32_t i=_boxes.size (); i < _map.getObjectCount (); ++i)
+          _boxes.push_back (_map.getObjects ()[i].getBoundingBox ());
+
+        // Objects in more than one square, and dynamic objects, can only be joined when reconciling
+        double size = _parameters.shard_size;
+        double offset = pass * size / 2.0;
+        std::map<uint64_t, uint32_t> shard_keys;
+        std::vector<uint64_t> object_keys (_boxes.size ());
+        std::vector<bool> inside (_boxes.size ());
+        std::vector<Eigen::AlignedBox2d,Eigen::aligned_allocator<Eigen::AlignedBox2d>> blocking;
+        for (uint32_t i=0; i < _boxes.size (); ++i)
+          if (!_map.getObjects ()[i].isFrozen ())
+            {
+              inside[i] = mapBuilderShard (_boxes[i], size, offset, object_keys[i]);
+              if (!inside[i])
+                blocking.push_back (_boxes[i]);
+            }
+        for (const MapObject & obj: _map.getDynamicObjects ())
+          blocking.push_back (obj.getBoundingBox ());
+
+        // Chains in one square, away from those objects, go to the shard of the square
+        std::vector<MapObject *> left;
+        std::vector<std::pair<uint64_t, MapObject *>> sharded;
+        for (MapObject * chain: chains)
+          {
+            Eigen::AlignedBox2d box = chain->getBoundingBox ();
+            Eigen::AlignedBox2d search (box.min () - Eigen::Vector2d::Constant (_parameters.max_dist),
+                                        box.max () + Eigen::Vector2d::Constant (_parameters.max_dist));
+            uint64_t key;
+            bool shardable = mapBuilderShard (search, size, offset, key);
+            for (uint32_t b=0; b < blocking.size () && shardable; ++b)
+              shardable = !search.intersects (blocking[b]);
+
+            if (shardable)
+              {
+                shard_keys[key] = 0;
+                sharded.push_back (std::make_pair (key, chain));
+              }
+            else
+              left.push_back (chain);
+          }
+        chains.swap (left);
+
+        // Shards in the order of their squares, so neighbors are processed by the same thread
+        uint32_t next = 0;
+        for (auto & entry: shard_keys)
+          entry.second = next++;
+        _shards.clear ();
+        _shards.resize (shard_keys.size ());
+        for (const auto & entry: sharded)
+          _shards[shard_keys[entry.first]].chains.push_back (entry.second);
+        for (uint32_t i=0; i < _boxes.size (); ++i)
+          if (inside[i])
+            {
+              auto found = shard_keys.find (object_keys[i]);
+              if (found == shard_keys.end ())
+                continue;
+
+              Shard & shard = _shards[found->second];
+              shard.objects.push_back (i);
+              shard.pointers.push_back (&_map.getObject (i));
+            }
+
+        parallelForStealing (_shards.size (), getThreadCount (), [&] (uint32_t s) { associateShard (_shards[s]); });
+
+        // Reconcile: The new objects of the shards are added by shard
+        for (Shard & shard: _shards)
+          {
+            for (uint32_t o: shard.changed)
+              changed.push_back (shard.objects[o]);
+            for (MapObject & obj: shard.added)
+              {
+                changed.push_back (_map.getObjectCount ());
+                _boxes.push_back (obj.getBoundingBox ());
+                _map.addObject (std::move (obj));
+              }
+          }
+      }
+
+    // The chains left are associated with the whole map
+    std::vector<MapObject> deferred;
+    for (MapObject * chain: chains)
+      deferred.push_back (std::move (*chain));
+    associate (deferred, _changed, _changed_dynamic);
+    _changed.insert (_changed.end (), changed.begin (), changed.end ());
+  }
+
+  /* Join the chains of a shard with its objects, or add them as new objects of the shard, like
+   * associate.
+   */
+  void MapBuilder::associateShard (Shard & shard)
+  {
+    std::vector<bool> changed (shard.objects.size ());
+    for (MapObject * c: shard.chains)
+      {
+        MapObject & chain = *c;
+        Eigen::AlignedBox2d box = chain.getBoundingBox ();
+        Eigen::AlignedBox2d search (box.min () - Eigen::Vector2d::Constant (_parameters.max_dist),
+                                    box.max () + Eigen::Vector2d::Constant (_parameters.max_dist));
+
+        bool joined = false;
+        for (uint32_t o=0; o < shard.objects.size () && !joined; ++o)
+          {
+            uint32_t i = shard.objects[o];
+            if (!search.intersects (_boxes[i]) || !shard.pointers[o]->join (chain, _parameters.max_dist))
+              continue;
+
+            _boxes[i] = shard.pointers[o]->getBoundingBox ();
+            changed[o] = true;
+            joined = true;
+          }
+
+        for (uint32_t a=0; a < shard.added.size () && !joined; ++a)
+          joined = search.intersects (shard.added[a].getBoundingBox ())
+            && shard.added[a].join (chain, _parameters.max_dist);
+
+        if (!joined)
+          shard.added.push_back (std::move (chain));
+      }
+
+    for (uint32_t o=0; o < changed.size (); ++o)
+      if (changed[o])
+        shard.changed.push_back (o);
+  }
+
+  /* Convert the valid beams of scan into points in map coordinates.
+   */
+  void MapBuilder::scanToPoints (const RangeScan & scan, const Transformation & pose,
+                                 std::vector<Position,Eigen::aligned_allocator<Position>> & points) const
+  {
+    points.clear ();
+    points.reserve (scan.ranges.size ());
+
+    // The beams are turned by the pose in KernelScalar precision, the position of the pose is
+    // added in double precision, so single precision kernels keep the absolute coordinates.
+    KernelTransformation turn (pose.cast<KernelScalar> ());
+    Position translation = pose.getTranslation ();
+    for (uint32_t i=0; i < scan.ranges.size (); ++i)
+      {
+        float r = scan.ranges[i];
+        if (!std::isfinite (r) || r <= 0.0f || r >= scan.max_range)
+          continue;
+
+        KernelScalar a = scan.angle_min + i * KernelScalar (scan.angle_increment);
+        KernelPosition beam = turn.rotatePosition (KernelPosition (std::cos (a) * r, std::sin (a) * r));
+        points.push_back (Position (translation + beam.cast<double> ()));
+      }
+  }
+
+  /* Split the points into chains of neighboring points, not more than max_gap apart.
+   * Chains with less than min_points points are dropped.
+   */
+  void MapBuilder::segment (const std::vector<Position,Eigen::aligned_allocator<Position>> & points,
+                            std::vector<MapObject> & chains) const
+  {
+    chains.clear ();
+
+    MapObject chain (_parameters.min_point_distance);
+    std::vector<Position,Eigen::aligned_allocator<Position>> chain_points;
+
+    for (uint32_t i=0; i <= points.size (); ++i)
+      {
+        if (i < points.size ()
+            && (chain_points.empty () || chain_points.back ().distance (points[i]) <= _parameters.max_gap))
+          {
+            // Points closer than min_point_distance add nothing to the shape
+            if (chain_points.empty ()
+                || chain_points.back ().distance (points[i]) >= _parameters.min_point_distance)
+              chain_points.push_back (points[i]);
+            continue;
+          }
+
+        if (chain_points.size () >= _parameters.min_points)
+          {
+            chain.setPolygon (chain_points);
+            chains.push_back (chain);
+          }
+
+        chain_points.clear ();
+        if (i < points.size ())
+          chain_points.push_back (points[i]);
+      }
+  }
+
+  /* Join every chain with the first object close enough to it, or add it as new object.
+   *
+   * Dynamic objects are tried first, as they are expected to have moved. Frozen objects
+   * are never joined.
+   *
+   * changed gets the indices of all static layer objects joined with or added, changed_dynamic
+   * the indices of the dynamic objects joined with, both without duplicates.
+   */
+  void MapBuilder::associate (std::vector<MapObject> & chains, std::vector<uint32_t> & changed,
+                              std::vector<uint32_t> & changed_dynamic)
+  {
+    changed.clear ();
+    changed_dynamic.clear ();
+
+    for (uint32_t i=_boxes.size (); i < _map.getObjectCount (); ++i)
+      _boxes.push_back (_map.getObjects ()[i].getBoundingBox ());
+
+    // The objects are only taken for modification (Map::getObject) to join with them
+    for (MapObject & chain: chains)
+      {
+        Eigen::AlignedBox2d box = chain.getBoundingBox ();
+        Eigen::AlignedBox2d search (box.min () - Eigen::Vector2d::Constant (_parameters.max_dist),
+                                    box.max () + Eigen::Vector2d::Constant (_parameters.max_dist));
+
+        bool joined = false;
+        for (uint32_t i=0; i < _map.getDynamicObjectCount () && !joined; ++i)
+          {
+            if (!search.intersects (_map.getDynamicObjects ()[i].getBoundingBox ())
+                || !_map.getDynamicObject (i).join (chain, _parameters.max_dist))
+              continue;
+
+            if (std::find (changed_dynamic.begin (), changed_dynamic.end (), i) == changed_dynamic.end ())
+              changed_dynamic.push_back (i);
+            joined = true;
+          }
+
+        for (uint32_t i=0; i < _boxes.size () && !joined; ++i)
+          {
+            if (!search.intersects (_boxes[i]) || _map.getObjects ()[i].isFrozen ())
+              continue;
+
+            MapObject & obj = _map.getObject (i);
+            if (!obj.join (chain, _parameters.max_dist))
+              continue;
+
+            _boxes[i] = obj.getBoundingBox ();
+            if (std::find (changed.begin (), changed.end (), i) == changed.end ())
+              changed.push_back (i);
+            joined = true;
+          }
+
+        if (joined)
+          continue;
+
+        changed.push_back (_map.getObjectCount ());
+        _boxes.push_back (box);
+        _map.addObject (std::move (chain));
+      }
+  }
+
+  /* Check the points of all objects in range of the scan against its beams.
+   */
+  void MapBuilder::observe (double time, const RangeScan & scan, const Transformation & pose)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::observe");
+
+    Transformation inverse (pose.inverse ());
+    Position origin = pose.getTranslation ();
+    Eigen::AlignedBox2d range (origin - Eigen::Vector2d::Constant (scan.max_range),
+                               origin + Eigen::Vector2d::Constant (scan.max_range));
+
+    for (uint32_t i=0; i < _boxes.size (); ++i)
+      if (range.intersects (_boxes[i]))
+        observeObject (time, scan, inverse, _map.getObject (i));
+
+    for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+      observeObject (time, scan, inverse, _map.getDynamicObject (i));
+  }
+
+  /* A point is hit, if the beam in its direction ends at it (within the hit tolerance, plus the
+   * distance to the next beam), and missed, if the beam passes it. Points behind the end of
+   * the beam are occluded and don't count, neither do points on surfaces seen at a flat angle,
+   * where the beams can't tell.
+   * Large objects are sampled, to keep the costs per object bounded.
+   */
+  void MapBuilder::observeObject (double time, const RangeScan & scan, const Transformation & inverse,
+                                  MapObject & obj) const
+  {
+    static const uint32_t max_samples = 256;
+    static const double max_flatness = 0.95;     // cos of the angle between beam and surface
+
+    uint32_t count = obj.getPointCount ();
+    uint32_t stride = std::max (1u, count / max_samples);
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+
+    for (uint32_t i=0; i < count; i += stride)
+      {
+        Position local = inverse.transformPosition (obj.getPoint (i));
+        double r = local.norm ();
+        if (r <= 0.0 || r >= scan.max_range)
+          continue;
+
+        if (count > 1)
+          {
+            Position tangent = inverse.rotatePosition (Position (obj.getPoint (std::min (i + 1, count - 1))
+                                                                 - obj.getPoint (i > 0 ? i - 1 : 0)));
+            double length = tangent.norm ();
+            if (length > 0.0 && std::fabs (tangent.dot (local)) > max_flatness * length * r)
+              continue;
+          }
+
+        double beam = (std::atan2 (local.y (), local.x ()) - scan.angle_min) / scan.angle_increment;
+        int64_t idx = std::lround (beam);
+        if (idx < 0 || idx >= int64_t (scan.ranges.size ()))
+          continue;
+
+        // Beams without reflection are free up to the max. range
+        double measured = scan.ranges[idx];
+        if (!std::isfinite (measured) || measured <= 0.0)
+          measured = scan.max_range;
+
+        double tolerance = _parameters.hit_tolerance + 2.0 * r * std::fabs (scan.angle_increment);
+        if (std::fabs (measured - r) <= tolerance)
+          ++hits;
+        else if (measured > r)
+          ++misses;
+      }
+
+    obj.observe (time, hits, misses);
+  }
+
+  /* Classify the objects by their observation history.
+   *
+   * Objects of the static layer, which are missed too often recently or drift, are moved to the
+   * dynamic layer, even frozen ones (when something parked for long leaves). Static ones
+   * observed long enough are frozen. Dynamic objects not hit anymore are dropped.
+   */
+  void MapBuilder::classify (double time)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapBuilder::classify");
+
+    // Backwards, so moving an object doesn't change the indices still to check
+    for (uint32_t i=_boxes.size (); i-- > 0;)
+      {
+        const MapObject & obj = _map.getObjects ()[i];
+        const MapObject::Observation & observation = obj.getObservation ();
+        if (observation.scans < _parameters.classify_min_scans)
+          continue;
+
+        double miss_ratio = observation.recent_miss_ratio;
+        if (miss_ratio > _parameters.dynamic_miss_ratio || observation.drift > _parameters.max_drift)
+          {
+            _map.moveToDynamic (i);
+            _boxes.erase (_boxes.begin () + i);
+            continue;
+          }
+
+        if (obj.isFrozen ())
+          continue;
+
+        // Only taken for modification if the motion changes
+        MapObject::Motion motion = miss_ratio > _parameters.static_miss_ratio ? MapObject::MOTION_UNKNOWN
+                                                                             : MapObject::MOTION_STATIC;
+        if (obj.getMotion () != motion)
+          _map.getObject (i).setMotion (motion);
+        if (motion == MapObject::MOTION_UNKNOWN)
+          continue;
+
+        if (observation.scans >= _parameters.freeze_min_scans)
+          _map.freezeObject (i);
+      }
+
+    for (uint32_t i=_map.getDynamicObjectCount (); i-- > 0;)
+      if (time - _map.getDynamicObjects ()[i].getObservation ().last_seen > _parameters.dynamic_timeout)
+        _map.removeDynamicObject (i);
+
+    // Frozen objects may be compacted or simplified, which changes their boxes a little
+    if (_map.getMemoryBudget ().max_bytes > 0 && _scans - _memory_check >= _parameters.memory_check_scans)
+      {
+        _memory_check = _scans;
+        Map::BudgetResult result = _map.enforceMemoryBudget ();
+        if (result.compacted + result.simplified > 0)
+          for (uint32_t i=0; i < _boxes.size (); ++i)
+            _boxes[i] = _map.getObjects ()[i].getBoundingBox ();
+      }
+  }
+
+  const MapBuilder::Parameters & MapBuilder::getParameters () const
+  {
+    return _parameters;
+  }
+
+  uint64_t MapBuilder::getScanCount () const
+  {
+    return _scans;
+  }
+
+  uint64_t MapBuilder::getPoseCount () const
+  {
+    return _poses;
+  }
+
+  /* Number of valid scan points processed.
+   */
+  uint64_t MapBuilder::getPointCount () const
+  {
+    return _points;
+  }
+
+  MapBuilder::StageStats MapBuilder::getStageStats (Stage stage) const
+  {
+    const StageTimes & times = _stage_times[stage];
+    StageStats stats;
+    stats.calls = times.calls;
+    stats.mean_us = 0.0;
+    stats.p50_us = 0.0;
+    stats.p99_us = 0.0;
+    stats.max_us = 0.0;
+    if (times.calls == 0)
+      return stats;
+
+    std::vector<uint64_t> ns = times.recent_ns;
+    std::sort (ns.begin (), ns.end ());
+    stats.mean_us = times.total_ns / 1000.0 / times.calls;
+    stats.p50_us = ns[ns.size () / 2] / 1000.0;
+    stats.p99_us = ns[ns.size () * 99 / 100] / 1000.0;
+    stats.max_us = times.max_ns / 1000.0;
+    return stats;
+  }
+
+  /* Count a call of stage, the last map_builder_stage_window durations are kept.
+   */
+  void MapBuilder::addStageTime (Stage stage, uint64_t ns)
+  {
+    StageTimes & times = _stage_times[stage];
+    if (times.recent_ns.size () < map_builder_stage_window)
+      times.recent_ns.push_back (ns);
+    else
+      times.recent_ns[times.calls % map_builder_stage_window] = ns;
+    ++times.calls;
+    times.total_ns += ns;
+    times.max_ns = std::max (times.max_ns, ns);
+  }
+
+  const char * MapBuilder::getStageName (Stage stage)
+  {
+    static const char * names[STAGE_COUNT] = { "transform", "observe", "segment", "associate", "smooth",
+                                               "classify" };
+    return names[stage];
+  }
+}
@@ -0,0 +1,188 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPBUILDER_H
+#define ROBOT_MAPBUILDER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-sensorlog.h"
+
+namespace Pathfinder
+{
+  /* The mapping pipeline: Turns poses and range scans into MapObjects of a Map.
+   *
+   * Every scan is processed in stages:
+   *   transform:  the valid beams are converted to points and transformed with the latest pose
+   *   observe:    the points of the objects in range are checked against the beams (hit or miss)
+   *   segment:    points explained by frozen objects are dropped, the rest is split into chains
+   *               where neighboring points are far apart
+   *   associate:  every chain is joined to an existing object close to it, or added as new object
+   *   smooth:     the objects changed by the scan are smoothed, their self-crossings repaired
+   *   classify:   objects are classified as static or dynamic by their observation history;
+   *               dynamic objects are moved to the dynamic layer, stable static objects are frozen;
+   *               every memory_check_scans scans, the memory budget of the map is enforced
+   *
+   * Frozen objects are not changed anymore, but still observed.
+   *
+   * The time spent in each stage is recorded per scan.
+   *
+   * Parallel mode (batch_scans > 1): The scans are collected and processed in batches, by threads.
+   * transform and segment run per scan, observe per object (over the scans of the batch in
+   * order). For association, the map is split into squares of shard_size: A chain belongs to a
+   * shard, if it and the objects it could be joined with are inside its square. The shards join
+   * their chains with their objects, in the order of the scans, on a work stealing pool, and
+   * the objects new in the shards are added to the map (by shard). A second pass with the
+   * squares shifted by half their size takes most of the chains crossing the borders. The
+   * chains left (still crossing borders, or close to objects which do, or to dynamic objects)
+   * are associated with the whole map, in order. Each changed object is
+   * smoothed once per batch, and the objects are classified at the end of it. The map only
+   * depends on the batches and the shard size, not on the number of threads. Scans are kept
+   * until a batch is full; flush processes the rest.
+   *
+   * The time spent in each stage is recorded per batch then.
+   */
+  class MapBuilder : public ObservationSink
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double min_point_distance;    // for new objects
+          double max_dist;              // max. distance for joining a chain with an object
+          double max_gap;               // max. distance of neighboring points in a chain
+          uint32_t min_points;          // chains with less points are dropped
+          double smooth_deviation;
+          uint32_t smooth_filter_size;
+          double max_loop_length;       // self-crossing loops up to this length are cut out
+
+          double hit_tolerance;         // max. difference of beam range and point distance for a hit
+          uint32_t classify_min_scans;  // observations needed before classifying
+          double dynamic_miss_ratio;    // objects missed more often are dynamic
+          double static_miss_ratio;     // objects missed less often are static
+          double max_drift;             // objects drifting further are dynamic
+          uint32_t freeze_min_scans;    // static objects observed that often are frozen
+          double dynamic_timeout;       // dynamic objects not hit for that long (s) are dropped
+
+          uint32_t batch_scans;         // scans processed together in parallel mode, 1: every scan on its own
+          double shard_size;            // size of the squares associated in parallel (m)
+          uint32_t threads;             // 0: one per core
+
+          uint32_t memory_check_scans;  // scans between checks of the memory budget of the map
+      };
+
+      enum Stage
+      {
+        STAGE_TRANSFORM,
+        STAGE_OBSERVE,
+        STAGE_SEGMENT,
+        STAGE_ASSOCIATE,
+        STAGE_SMOOTH,
+        STAGE_CLASSIFY,
+        STAGE_COUNT
+      };
+
+      // calls, mean and max over all calls, the percentiles over the last ones
+      struct StageStats
+      {
+          uint64_t calls;
+          double mean_us;
+          double p50_us;
+          double p99_us;
+          double max_us;
+      };
+
+      MapBuilder (Map & map, const Parameters & parameters);
+      virtual ~MapBuilder ();
+
+      virtual void pushPose (double time, const Transformation & pose);
+      virtual void pushScan (double time, const RangeScan & scan);
+      void pushPoints (double time, const RangeScan & scan, const Transformation & pose,
+                       std::vector<Position,Eigen::aligned_allocator<Position>> & points);
+
+      void scanToPoints (const RangeScan & scan, const Transformation & pose,
+                         std::vector<Position,Eigen::aligned_allocator<Position>> & points) const;
+      void segment (const std::vector<Position,Eigen::aligned_allocator<Position>> & points,
+                    std::vector<MapObject> & chains) const;
+      void associate (std::vector<MapObject> & chains, std::vector<uint32_t> & changed,
+                      std::vector<uint32_t> & changed_dynamic);
+      void observe (double time, const RangeScan & scan, const Transformation & pose);
+      void classify (double time);
+      void flush ();
+
+      const Parameters & getParameters () const;
+      uint64_t getScanCount () const;
+      uint64_t getPoseCount () const;
+      uint64_t getPointCount () const;
+      StageStats getStageStats (Stage stage) const;
+      static const char * getStageName (Stage stage);
+
+    private:
+      struct PendingScan
+      {
+          double time;
+          Transformation pose;
+          RangeScan scan;
+      };
+
+      struct Shard
+      {
+          std::vector<uint32_t> objects;                          // indices of the static objects inside
+          std::vector<MapObject *> pointers;                      // to them
+          std::vector<MapObject *> chains;                        // in the order of the scans
+          std::vector<MapObject> added;                           // new objects, from chains
+          std::vector<uint32_t> changed;                          // of objects
+      };
+
+      void observeObject (double time, const RangeScan & scan, const Transformation & inverse,
+                          MapObject & obj) const;
+      void smoothObject (MapObject & obj) const;
+      uint32_t getThreadCount () const;
+      void processBatch ();
+      void observeBatch ();
+      void associateBatch ();
+      void associateShard (Shard & shard);
+      void addStageTime (Stage stage, uint64_t ns);
+
+      Map & _map;
+      Parameters _parameters;
+      Transformation _pose;
+      bool _has_pose;
+
+      uint64_t _scans;
+      uint64_t _poses;
+      uint64_t _points;
+      uint64_t _memory_check;       // scan count at the last check of the memory budget
+
+      // Durations of the stages: totals and the last ones (ring buffer)
+      struct StageTimes
+      {
+          uint64_t calls;
+          uint64_t total_ns;
+          uint64_t max_ns;
+          std::vector<uint64_t> recent_ns;
+      };
+      StageTimes _stage_times[STAGE_COUNT];
+
+      // Bounding boxes of the objects of the map, to quickly skip objects too far away
+      std::vector<Eigen::AlignedBox2d,Eigen::aligned_allocator<Eigen::AlignedBox2d>> _boxes;
+
+      // Buffers reused for every scan
+      std::vector<Position,Eigen::aligned_allocator<Position>> _scan_points;
+      std::vector<MapObject> _chains;
+      std::vector<uint32_t> _changed;
+      std::vector<uint32_t> _changed_dynamic;
+
+      // Parallel mode
+      std::vector<PendingScan> _pending;
+      std::vector<std::vector<Position,Eigen::aligned_allocator<Position>>> _batch_points;
+      std::vector<std::vector<MapObject>> _batch_chains;
+      std::vector<Shard> _shards;
+  };
+}
+
+#endif
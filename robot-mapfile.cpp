@@ -0,0 +1,396 @@
+/*
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "robot-mapfile.h"
+
+namespace Pathfinder
+{
+  static const char map_file_magic[4] = { 'P', 'F', 'M', 'P' };
+  static const uint32_t map_file_version = 1;
+
+  // Versions of the sections, increased with the layout of the section (or of the image of
+  // the index), so older sections are rebuilt instead of misread
+  static const uint32_t map_file_objects_version = 2;
+  static const uint32_t map_file_static_index_version = 1;
+  static const uint32_t map_file_closed_index_version = 1;
+
+  static const size_t map_file_alignment = 64;
+
+  struct MapFileHeader
+  {
+      char magic[4];
+      uint32_t version;
+      uint32_t section_count;
+      uint32_t reserved;
+  };
+
+  struct MapFileSection
+  {
+      uint32_t type;
+      uint32_t version;
+      uint64_t offset;
+      uint64_t size;
+      uint64_t source;
+      uint64_t checksum;
+  };
+
+  struct MapFileObjects
+  {
+      uint32_t static_count;
+      uint32_t dynamic_count;
+  };
+
+  struct MapFileObject
+  {
+      uint32_t point_count;
+      uint8_t frozen;
+      uint8_t motion;
+      uint16_t reserved;
+      double min_point_distance;
+      double compact_resolution;
+      uint32_t curve_count;
+      uint8_t curves_closed;
+      uint8_t reserved2[3];
+      double curve_deviation;
+  };
+
+  struct MapFileCurve
+  {
+      uint32_t samples;
+      uint32_t reserved;
+      double coefficients[6];           // x, y of the coefficients of t^0, t^1, t^2
+  };
+
+  /* Checksum of a section: 64 bit words mixed into four independent lanes, so it runs at
+   * memory speed on large sections.
+   */
+  static uint64_t mapFileChecksum (const char * data, size_t size)
+  {
+    auto mix = [] (uint64_t h, uint64_t w)
+      {
+        h ^= w;
+        h = (h << 29) | (h >> 35);
+        return h * 0x9e3779b97f4a7c15ull;
+      };
+
+    uint64_t lanes[4] = { 0x243f6a8885a308d3ull, 0x13198a2e03707344ull, 0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull };
+    size_t words = size / 8;
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4)
+      for (uint32_t k=0; k < 4; ++k)
+        {
+          uint64_t w;
+          memcpy (&w, data + (i + k) * 8, 8);
+          lanes[k] = mix (lanes[k], w);
+        }
+    for (; i < words; ++i)
+      {
+        uint64_t w;
+        memcpy (&w, data + i * 8, 8);
+        lanes[0] = mix (lanes[0], w);
+      }
+
+    uint64_t tail = 0;
+    memcpy (&tail, data + words * 8, size - words * 8);
+    uint64_t h = mix (mix (lanes[0], tail), size);
+    for (uint32_t k=1; k < 4; ++k)
+      h = mix (h, lanes[k]);
+    return h ^ (h >> 31);
+  }
+
+  /* Append the record of obj, followed by its points or, if curved, by its curves.
+   */
+  static void mapFileWriteObject (const MapObject & obj, std::vector<char> & out)
+  {
+    const CurveChain & chain = obj.getCurves ();
+    MapFileObject record;
+    memset (&record, 0, sizeof (record));
+    record.point_count = obj.isCurved () ? 0 : obj.getPointCount ();
+    record.frozen = obj.isFrozen () ? 1 : 0;
+    record.motion = obj.getMotion ();
+    record.min_point_distance = obj.getMinPointDistance ();
+    record.compact_resolution = obj.isCompact () ? obj.getCompactResolution () : 0.0;
+    record.curve_count = chain.getCurveCount ();
+    record.curves_closed = chain.isClosed () ? 1 : 0;
+    record.curve_deviation = chain.getMaxDeviation ();
+
+    size_t pos = out.size ();
+    out.resize (pos + sizeof (record) + record.point_count * 2 * sizeof (double)
+                + record.curve_count * sizeof (MapFileCurve));
+    memcpy (out.data () + pos, &record, sizeof (record));
+    pos += sizeof (record);
+
+    double * xy = reinterpret_cast<double *> (out.data () + pos);
+    for (uint32_t i=0; i < record.point_count; ++i)
+      {
+        Position p = obj.getPoint (i);
+        xy[2*i] = p.x ();
+        xy[2*i+1] = p.y ();
+      }
+    pos += record.point_count * 2 * sizeof (double);
+
+    for (uint32_t k=0; k < record.curve_count; ++k)
+      {
+        MapFileCurve curve;
+        curve.samples = chain.getSampleCount (k);
+        curve.reserved = 0;
+        for (uint32_t c=0; c < 3; ++c)
+          {
+            curve.coefficients[2*c] = chain.getCurve (k).getCoefficient (c).x ();
+            curve.coefficients[2*c+1] = chain.getCurve (k).getCoefficient (c).y ();
+          }
+        memcpy (out.data () + pos + k * sizeof (curve), &curve, sizeof (curve));
+      }
+  }
+
+  /* Write the map with its indexes, to a temporary file renamed when complete. Builds the
+   * index of the closed objects, if it isn't up to date.
+   */
+  bool MapFile::save (const Map & map, const std::string & file_name)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapFile::save");
+
+    std::vector<char> objects;
+    MapFileObjects counts;
+    counts.static_count = map.getObjectCount ();
+    counts.dynamic_count = map.getDynamicObjectCount ();
+    objects.resize (sizeof (counts));
+    memcpy (objects.data (), &counts, sizeof (counts));
+    for (const MapObject & obj: map.getObjects ())
+      mapFileWriteObject (obj, objects);
+    for (const MapObject & obj: map.getDynamicObjects ())
+      mapFileWriteObject (obj, objects);
+
+    std::vector<char> static_index;
+    std::vector<char> closed_index;
+    map.getStaticIndex ().writeImage (static_index);
+    map.getClosedIndex ().writeImage (closed_index);
+
+    const std::vector<char> * contents[3] = { &objects, &static_index, &closed_index };
+    MapFileSection sections[3];
+    sections[0].type = SECTION_OBJECTS;
+    sections[0].version = map_file_objects_version;
+    sections[1].type = SECTION_STATIC_INDEX;
+    sections[1].version = map_file_static_index_version;
+    sections[2].type = SECTION_CLOSED_INDEX;
+    sections[2].version = map_file_closed_index_version;
+
+    uint64_t offset = sizeof (MapFileHeader) + sizeof (sections);
+    for (uint32_t i=0; i < 3; ++i)
+      {
+        offset = (offset + map_file_alignment - 1) & ~uint64_t (map_file_alignment - 1);
+        sections[i].offset = offset;
+        sections[i].size = contents[i]->size ();
+        sections[i].checksum = mapFileChecksum (contents[i]->data (), contents[i]->size ());
+        offset += sections[i].size;
+      }
+    for (uint32_t i=0; i < 3; ++i)
+      sections[i].source = i == 0 ? 0 : sections[0].checksum;
+
+    std::string tmp_name = file_name + ".tmp";
+    FILE * f = fopen (tmp_name.c_str (), "wb");
+    if (f == nullptr)
+      return false;
+
+    MapFileHeader header;
+    memcpy (header.magic, map_file_magic, sizeof (header.magic));
+    header.version = map_file_version;
+    header.section_count = 3;
+    header.reserved = 0;
+    bool ok = fwrite (&header, sizeof (header), 1, f) == 1
+              && fwrite (sections, sizeof (sections), 1, f) == 1;
+
+    static const char padding[map_file_alignment] = { 0 };
+    uint64_t pos = sizeof (MapFileHeader) + sizeof (sections);
+    for (uint32_t i=0; ok && i < 3; ++i)
+      {
+        ok = fwrite (padding, 1, sections[i].offset - pos, f) == sections[i].offset - pos
+             && fwrite (contents[i]->data (), 1, contents[i]->size (), f) == contents[i]->size ();
+        pos = sections[i].offset + sections[i].size;
+      }
+
+    if (fclose (f) != 0)
+      ok = false;
+
+    if (!ok || rename (tmp_name.c_str (), file_name.c_str ()) != 0)
+      {
+        remove (tmp_name.c_str ());
+        return false;
+      }
+
+    return true;
+  }
+
+  /* Load a map file into map, which must be empty. Fails if the file or its objects are
+   * damaged, the map stays empty then; the indexes are rebuilt if they are damaged.
+   */
+  bool MapFile::load (Map & map, const std::string & file_name, LoadStats * stats)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapFile::load");
+
+    auto start = std::chrono::steady_clock::now ();
+    if (map.getObjectCount () != 0 || map.getDynamicObjectCount () != 0)
+      return false;
+
+    int fd = open (file_name.c_str (), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (MapFileHeader))
+      {
+        close (fd);
+        return false;
+      }
+
+    size_t size = st.st_size;
+    void * mapped = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (mapped == MAP_FAILED)
+      return false;
+
+    // Unmapped when neither the indexes nor this function use it anymore
+    std::shared_ptr<const char> data (static_cast<const char *> (mapped),
+                                      [size] (const char * p) { munmap (const_cast<char *> (p), size); });
+
+    const MapFileHeader * header = reinterpret_cast<const MapFileHeader *> (data.get ());
+    if (memcmp (header->magic, map_file_magic, sizeof (map_file_magic)) != 0 || header->version != map_file_version
+        || sizeof (MapFileHeader) + uint64_t (header->section_count) * sizeof (MapFileSection) > size)
+      return false;
+
+    const MapFileSection * found[4] = { nullptr, nullptr, nullptr, nullptr };
+    const MapFileSection * sections = reinterpret_cast<const MapFileSection *> (data.get () + sizeof (MapFileHeader));
+    for (uint32_t i=0; i < header->section_count; ++i)
+      {
+        const MapFileSection & section = sections[i];
+        if (section.offset % 8 != 0 || section.offset > size || section.size > size - section.offset)
+          return false;
+        if (section.type >= SECTION_OBJECTS && section.type <= SECTION_CLOSED_INDEX)
+          found[section.type] = &section;
+      }
+
+    const MapFileSection * objects = found[SECTION_OBJECTS];
+    if (objects == nullptr || objects->version != map_file_objects_version || objects->size < sizeof (MapFileObjects)
+        || mapFileChecksum (data.get () + objects->offset, objects->size) != objects->checksum)
+      return false;
+
+    const char * cur = data.get () + objects->offset;
+    const char * end = cur + objects->size;
+    MapFileObjects counts;
+    memcpy (&counts, cur, sizeof (counts));
+    cur += sizeof (counts);
+
+    // All objects are read before the map gets any of them
+    std::vector<MapObject> loaded;
+    PositionVector poly;
+    std::vector<CurveChain::Curve,Eigen::aligned_allocator<CurveChain::Curve>> curves;
+    std::vector<uint32_t> samples;
+    for (uint32_t i=0; i < counts.static_count + counts.dynamic_count; ++i)
+      {
+        if (size_t (end - cur) < sizeof (MapFileObject))
+          return false;
+
+        const MapFileObject * record = reinterpret_cast<const MapFileObject *> (cur);
+        cur += sizeof (MapFileObject);
+        if (size_t (end - cur) / (2 * sizeof (double)) < record->point_count)
+          return false;
+
+        const double * xy = reinterpret_cast<const double *> (cur);
+        cur += record->point_count * 2 * sizeof (double);
+        if (size_t (end - cur) / sizeof (MapFileCurve) < record->curve_count)
+          return false;
+
+        const char * curve_data = cur;
+        cur += record->curve_count * sizeof (MapFileCurve);
+
+        poly.resize (record->point_count);
+        for (uint32_t j=0; j < record->point_count; ++j)
+          poly[j] = Position (xy[2*j], xy[2*j+1]);
+
+        MapObject obj (record->min_point_distance);
+        obj.setPolygon (poly);
+        if (record->curve_count > 0)
+          {
+            curves.resize (record->curve_count);
+            samples.resize (record->curve_count);
+            for (uint32_t k=0; k < record->curve_count; ++k)
+              {
+                MapFileCurve curve;
+                memcpy (&curve, curve_data + k * sizeof (curve), sizeof (curve));
+                samples[k] = curve.samples;
+                for (uint32_t c=0; c < 3; ++c)
+                  curves[k].setCoefficient (c, Position (curve.coefficients[2*c], curve.coefficients[2*c+1]));
+              }
+
+            CurveChain chain;
+            if (!chain.assign (curves.data (), samples.data (), record->curve_count, record->curve_deviation,
+                               record->curves_closed != 0))
+              return false;
+            obj.setCurves (chain);
+          }
+
+        if (record->frozen)
+          obj.freeze ();
+        obj.setMotion (MapObject::Motion (record->motion));
+        if (record->compact_resolution > 0.0)
+          obj.compact (record->compact_resolution);
+
+        loaded.push_back (std::move (obj));
+      }
+
+    for (uint32_t i=0; i < loaded.size (); ++i)
+      if (i < counts.static_count)
+        map.addObject (std::move (loaded[i]));
+      else
+        map.addDynamicObject (std::move (loaded[i]));
+
+    // An index section is used if it was built from these objects by this version
+    auto usable = [&] (SectionType type, uint32_t version)
+      {
+        const MapFileSection * section = found[type];
+        return section != nullptr && section->version == version && section->source == objects->checksum
+               && mapFileChecksum (data.get () + section->offset, section->size) == section->checksum;
+      };
+
+    LoadStats result;
+    result.objects = counts.static_count + counts.dynamic_count;
+    result.attached = 0;
+    result.rebuilt = 0;
+
+    const MapFileSection * section = found[SECTION_STATIC_INDEX];
+    if (usable (SECTION_STATIC_INDEX, map_file_static_index_version)
+        && map.attachStaticIndex (data.get () + section->offset, section->size, data))
+      ++result.attached;
+    else
+      {
+        map.rebuildStaticIndexAsync ();
+        ++result.rebuilt;
+      }
+
+    section = found[SECTION_CLOSED_INDEX];
+    if (usable (SECTION_CLOSED_INDEX, map_file_closed_index_version)
+        && map.attachClosedIndex (data.get () + section->offset, section->size, data))
+      ++result.attached;
+    else
+      {
+        map.rebuildClosedIndexAsync ();
+        ++result.rebuilt;
+      }
+
+    result.load_us = std::chrono::duration<double, std::micro> (std::chrono::steady_clock::now () - start).count ();
+    if (stats)
+      *stats = result;
+    return true;
+  }
+}
@@ -0,0 +1,67 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPFILE_H
+#define ROBOT_MAPFILE_H
+
+#include <cstdint>
+#include <string>
+
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* Map files: The objects of a map together with the structures derived from them (the
+   * static and closed object indexes), so a large map is ready for queries right after
+   * loading, without rebuilding anything.
+   *
+   * The file starts with the header (char magic[4] = "PFMP", uint32 version, uint32 section
+   * count, uint32 reserved), followed by the table of sections:
+   *
+   *   uint32 type, uint32 version, uint64 offset, uint64 size, uint64 source, uint64 checksum
+   *
+   * Each section starts at a multiple of 64 bytes. The source of a derived section is the
+   * checksum of the objects section it was built from. All in native byte order:
+   *
+   *   objects:        uint32 static count, uint32 dynamic count, then per object (static
+   *                   ones first): uint32 point count, uint8 frozen, uint8 motion, uint16 0,
+   *                   double min point distance, double compact resolution (0: not compact),
+   *                   uint32 curve count, uint8 curves closed, uint8 0[3], double curve
+   *                   deviation, double points[2 * point count], then per curve (curved
+   *                   objects have no points): uint32 samples, uint32 0, double
+   *                   coefficients[6] (x, y of t^0, t^1, t^2)
+   *   static index:   MapIndex::writeImage of the frozen objects
+   *   closed index:   PolygonIndex::writeImage of the closed objects
+   *
+   * load memory maps the file and checks the checksums, which reads every section once (at
+   * the speed of the disk, unless the file is cached). The objects are copied into the map,
+   * the indexes are attached to their sections and used in place, without copying or
+   * rebuilding them. An index section written by a different version, for other objects or
+   * damaged is stale: the map rebuilds it on a background thread instead (see Map). The
+   * observation history of the objects is not kept.
+   */
+  class MapFile
+  {
+    public:
+      enum SectionType
+      {
+        SECTION_OBJECTS = 1,
+        SECTION_STATIC_INDEX = 2,
+        SECTION_CLOSED_INDEX = 3
+      };
+
+      struct LoadStats
+      {
+          uint32_t objects;
+          uint32_t attached;            // index sections used from the file
+          uint32_t rebuilt;             // stale index sections, rebuilt in the background
+          double load_us;
+      };
+
+      static bool save (const Map & map, const std::string & file_name);
+      static bool load (Map & map, const std::string & file_name, LoadStats * stats = nullptr);
+  };
+}
+
+#endif
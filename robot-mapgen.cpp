@@ -0,0 +1,170 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "robot-mapgen.h"
+
+namespace Pathfinder
+{
+  MapGenerator::MapGenerator (uint32_t seed)
+  : _rng (seed)
+  {
+  }
+
+  /* A wall as seen by a range scanner: An open polyline of points with about point_distance
+   * between them, with gaussian noise. The direction changes by a random angle of up to
+   * curvature (radian) per point, 0.0 gives a straight line.
+   */
+  MapObject MapGenerator::noisyContour (uint32_t points, double point_distance, double noise, double curvature)
+  {
+    MapObject obj (point_distance / 2.0);
+    std::uniform_real_distribution<double> turn (-curvature, curvature);
+
+    Position p (0, 0);
+    double dir = 0.0;
+    for (uint32_t i=0; i < points; ++i)
+      {
+        obj.appendPoint (jitter (p, noise));
+
+        dir += turn (_rng);
+        p.x () += std::cos (dir) * point_distance;
+        p.y () += std::sin (dir) * point_distance;
+      }
+
+    return obj;
+  }
+
+  /* A closed, noisy circle with the given number of distinct points.
+   */
+  MapObject MapGenerator::noisyCircle (const Position & center, double radius, uint32_t points, double noise)
+  {
+    static const double pi = std::acos (-1);
+    MapObject obj (radius * pi / points / 2.0);
+
+    for (uint32_t i=0; i < points; ++i)
+      {
+        double a = 2.0 * pi * i / points;
+        obj.appendPoint (jitter (Position (center.x () + std::cos (a) * radius,
+                                           center.y () + std::sin (a) * radius), noise));
+      }
+
+    if (points >= 3)
+      obj.setClosed (true);
+
+    return obj;
+  }
+
+  /* A straight wall from from to to.
+   */
+  MapObject MapGenerator::wall (const Position & from, const Position & to, double point_distance, double noise)
+  {
+    MapObject obj (point_distance / 2.0);
+    uint32_t steps = std::max (1.0, std::ceil (from.distance (to) / point_distance));
+
+    for (uint32_t i=0; i <= steps; ++i)
+      {
+        Position p (from + (to - from) * (double (i) / steps));
+        obj.appendPoint (jitter (p, noise));
+      }
+
+    return obj;
+  }
+
+  /* A grid of rooms_x * rooms_y square rooms. Every inner wall has a door in the middle.
+   */
+  void MapGenerator::addRooms (Map & map, uint32_t rooms_x, uint32_t rooms_y, double room_size,
+                               double door_width, double point_distance, double noise)
+  {
+    double width = rooms_x * room_size;
+    double height = rooms_y * room_size;
+    double half_door = door_width / 2.0;
+
+    // Vertical walls, the outer ones without doors
+    for (uint32_t i=0; i <= rooms_x; ++i)
+      {
+        double x = i * room_size;
+        if (i == 0 || i == rooms_x)
+          {
+            map.addObject (wall (Position (x, 0), Position (x, height), point_distance, noise));
+            continue;
+          }
+
+        for (uint32_t j=0; j < rooms_y; ++j)
+          {
+            double y0 = j * room_size;
+            double ym = y0 + room_size / 2.0;
+            map.addObject (wall (Position (x, y0), Position (x, ym - half_door), point_distance, noise));
+            map.addObject (wall (Position (x, ym + half_door), Position (x, y0 + room_size), point_distance, noise));
+          }
+      }
+
+    // Horizontal walls
+    for (uint32_t j=0; j <= rooms_y; ++j)
+      {
+        double y = j * room_size;
+        if (j == 0 || j == rooms_y)
+          {
+            map.addObject (wall (Position (0, y), Position (width, y), point_distance, noise));
+            continue;
+          }
+
+        for (uint32_t i=0; i < rooms_x; ++i)
+          {
+            double x0 = i * room_size;
+            double xm = x0 + room_size / 2.0;
+            map.addObject (wall (Position (x0, y), Position (xm - half_door, y), point_distance, noise));
+            map.addObject (wall (Position (xm + half_door, y), Position (x0 + room_size, y), point_distance, noise));
+          }
+      }
+  }
+
+  /* Parallel corridors of the given length and width, stacked in y direction.
+   */
+  void MapGenerator::addCorridors (Map & map, uint32_t corridors, double length, double width,
+                                   double point_distance, double noise)
+  {
+    for (uint32_t i=0; i <= corridors; ++i)
+      {
+        double y = i * width;
+        map.addObject (wall (Position (0, y), Position (length, y), point_distance, noise));
+      }
+  }
+
+  /* Small closed objects (noisy circles) at random positions in the box min..max.
+   */
+  void MapGenerator::addClutter (Map & map, uint32_t objects, const Position & min, const Position & max,
+                                 double radius, uint32_t points_per_object, double noise)
+  {
+    for (uint32_t i=0; i < objects; ++i)
+      map.addObject (noisyCircle (randomPosition (min, max), radius, points_per_object, noise));
+  }
+
+  Position MapGenerator::randomPosition (const Position & min, const Position & max)
+  {
+    std::uniform_real_distribution<double> ux (min.x (), max.x ());
+    std::uniform_real_distribution<double> uy (min.y (), max.y ());
+    double x = ux (_rng);
+    return Position (x, uy (_rng));
+  }
+
+  /* Move p by gaussian noise in x and y.
+   */
+  Position MapGenerator::jitter (const Position & p, double noise)
+  {
+    double dx = gaussian (noise);
+    double dy = gaussian (noise);
+    return Position (p.x () + dx, p.y () + dy);
+  }
+
+  double MapGenerator::gaussian (double sigma)
+  {
+    if (sigma <= 0.0)
+      return 0.0;
+
+    std::normal_distribution<double> dist (0.0, sigma);
+    return dist (_rng);
+  }
+}
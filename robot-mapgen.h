@@ -0,0 +1,44 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPGEN_H
+#define ROBOT_MAPGEN_H
+
+#include <cstdint>
+#include <random>
+
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* Generator of synthetic maps and objects, for benchmarks and simulations.
+   *
+   * All results only depend on the seed, so runs are reproducible.
+   */
+  class MapGenerator
+  {
+    public:
+      MapGenerator (uint32_t seed);
+
+      MapObject noisyContour (uint32_t points, double point_distance, double noise, double curvature);
+      MapObject noisyCircle (const Position & center, double radius, uint32_t points, double noise);
+      MapObject wall (const Position & from, const Position & to, double point_distance, double noise);
+
+      void addRooms (Map & map, uint32_t rooms_x, uint32_t rooms_y, double room_size,
+                     double door_width, double point_distance, double noise);
+      void addCorridors (Map & map, uint32_t corridors, double length, double width,
+                         double point_distance, double noise);
+      void addClutter (Map & map, uint32_t objects, const Position & min, const Position & max,
+                       double radius, uint32_t points_per_object, double noise);
+
+      Position randomPosition (const Position & min, const Position & max);
+      Position jitter (const Position & p, double noise);
+      double gaussian (double sigma);
+
+    private:
+      std::mt19937 _rng;
+  };
+}
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "robot-map.h"
+#include "robot-mapindex.h"
+
+namespace Pathfinder
+{
+  /* memcpy, for data of vectors which may be empty (and nullptr then).
+   */
+  static void mapIndexCopy (char * out, const void * data, size_t size)
+  {
+    if (size > 0)
+      memcpy (out, data, size);
+  }
+
+  /* Distance of pos to the segment, without the virtual calls of LineSegment::distance.
+   */
+  static inline double mapIndexDistance (const Position & p1, const Position & p2, const Position & pos)
+  {
+    Eigen::Vector2d dir = p2 - p1;
+    Eigen::Vector2d r = pos - p1;
+    double t = std::min (1.0, std::max (0.0, r.dot (dir) / dir.squaredNorm ()));
+    return (r - dir * t).norm ();
+  }
+
+  MapIndex::MapIndex (double cell_size)
+  : _cell_size (cell_size),
+    _segments (),
+    _segment_objects (),
+    _cells (),
+    _image_owner (),
+    _image (nullptr),
+    _image_size (0),
+    _image_segments (nullptr),
+    _image_cells (nullptr),
+    _image_cell_segments (nullptr)
+  {
+  }
+
+  /* Call visit for the segments of a cell, those of the image first, until it returns false.
+   */
+  template <typename Visit>
+  void MapIndex::visitCell (uint64_t key, Visit visit) const
+  {
+    if (_image)
+      {
+        uint32_t mask = (1u << _image->cell_bits) - 1;
+        for (uint32_t slot=imageSlot (key, _image->cell_bits); _image_cells[slot].count != 0; slot = (slot + 1) & mask)
+          if (_image_cells[slot].key == key)
+            {
+              const ImageCell & c = _image_cells[slot];
+              for (uint32_t i=c.first; i < c.first + c.count; ++i)
+                if (!visit (_image_cell_segments[i]))
+                  return;
+              break;
+            }
+      }
+
+    auto it = _cells.find (key);
+    if (it != _cells.end ())
+      for (uint32_t s: it->second)
+        if (!visit (s))
+          return;
+  }
+
+  /* Add the segments of obj. A segment is added to every cell its bounding box touches.
+   *
+   * object_id is returned with the segments found, e.g. the index of obj in its map.
+   */
+  void MapIndex::insert (const MapObject & obj, uint32_t object_id)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapIndex::insert");
+
+    uint32_t count = obj.getPointCount ();
+    for (uint32_t i=1; i < count; ++i)
+      {
+        Position p1 = obj.getPoint (i-1);
+        Position p2 = obj.getPoint (i);
+        if (p1 == p2)
+          continue;
+
+        uint32_t s = getSegmentCount ();
+        _segments.push_back (LineSegment (p1, p2));
+        _segment_objects.push_back (object_id);
+
+        int32_t x0 = cell (std::min (p1.x (), p2.x ()));
+        int32_t x1 = cell (std::max (p1.x (), p2.x ()));
+        int32_t y0 = cell (std::min (p1.y (), p2.y ()));
+        int32_t y1 = cell (std::max (p1.y (), p2.y ()));
+        for (int32_t cy=y0; cy <= y1; ++cy)
+          for (int32_t cx=x0; cx <= x1; ++cx)
+            _cells[cellKey (cx, cy)].push_back (s);
+      }
+  }
+
+  void MapIndex::clear ()
+  {
+    _segments.clear ();
+    _segment_objects.clear ();
+    _cells.clear ();
+    _image_owner.reset ();
+    _image = nullptr;
+    _image_size = 0;
+    _image_segments = nullptr;
+    _image_cells = nullptr;
+    _image_cell_segments = nullptr;
+  }
+
+  bool MapIndex::isEmpty () const
+  {
+    return getSegmentCount () == 0;
+  }
+
+  uint32_t MapIndex::getSegmentCount () const
+  {
+    return (_image ? _image->segment_count : 0) + _segments.size ();
+  }
+
+  double MapIndex::getCellSize () const
+  {
+    return _cell_size;
+  }
+
+  LineSegment MapIndex::getSegment (uint32_t idx) const
+  {
+    Position p1, p2;
+    getPoints (idx, p1, p2);
+    return LineSegment (p1, p2);
+  }
+
+  uint32_t MapIndex::getSegmentObject (uint32_t idx) const
+  {
+    if (_image && idx < _image->segment_count)
+      return _image_segments[idx].object_id;
+    return _segment_objects[idx - (_image ? _image->segment_count : 0)];
+  }
+
+  /* Write the index (with an attached image) as an image, to be attached by attachImage:
+   *
+   *   header:         cell size, segment count, cell table bits, number of cell entries
+   *   segments:       x1, y1, x2, y2, object id (per segment)
+   *   cell table:     key, first entry, entry count (per slot, linear probing)
+   *   cell entries:   segment indices, ascending per cell
+   *
+   * All in native byte order, 8 byte aligned.
+   */
+  void MapIndex::writeImage (std::vector<char> & image) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapIndex::writeImage");
+
+    // The segments of each cell, those of the attached image first
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    if (_image)
+      for (uint32_t i=0; i < (1u << _image->cell_bits); ++i)
+        {
+          const ImageCell & c = _image_cells[i];
+          if (c.count != 0)
+            cells[c.key].assign (_image_cell_segments + c.first, _image_cell_segments + c.first + c.count);
+        }
+    for (const auto & it: _cells)
+      {
+        std::vector<uint32_t> & segments = cells[it.first];
+        segments.insert (segments.end (), it.second.begin (), it.second.end ());
+      }
+
+    ImageHeader header;
+    header.cell_size = _cell_size;
+    header.segment_count = getSegmentCount ();
+    header.cell_bits = 1;
+    while ((1u << header.cell_bits) < 2 * cells.size ())
+      ++header.cell_bits;
+    header.cell_segment_count = 0;
+    header.reserved = 0;
+    for (const auto & it: cells)
+      header.cell_segment_count += it.second.size ();
+
+    std::vector<ImageSegment> segments (header.segment_count);
+    for (uint32_t s=0; s < header.segment_count; ++s)
+      {
+        Position p1, p2;
+        getPoints (s, p1, p2);
+        ImageSegment & segment = segments[s];
+        segment.x1 = p1.x ();
+        segment.y1 = p1.y ();
+        segment.x2 = p2.x ();
+        segment.y2 = p2.y ();
+        segment.object_id = getSegmentObject (s);
+        segment.reserved = 0;
+      }
+
+    // In the order of the keys, so the same index always gives the same image
+    std::vector<uint64_t> keys;
+    keys.reserve (cells.size ());
+    for (const auto & it: cells)
+      keys.push_back (it.first);
+    std::sort (keys.begin (), keys.end ());
+
+    uint32_t mask = (1u << header.cell_bits) - 1;
+    std::vector<ImageCell> table (mask + 1, ImageCell { 0, 0, 0 });
+    std::vector<uint32_t> cell_segments;
+    cell_segments.reserve (header.cell_segment_count);
+    for (uint64_t key: keys)
+      {
+        const std::vector<uint32_t> & segments = cells[key];
+        uint32_t slot = imageSlot (key, header.cell_bits);
+        while (table[slot].count != 0)
+          slot = (slot + 1) & mask;
+
+        table[slot].key = key;
+        table[slot].first = cell_segments.size ();
+        table[slot].count = segments.size ();
+        cell_segments.insert (cell_segments.end (), segments.begin (), segments.end ());
+      }
+
+    size_t cells_bytes = table.size () * sizeof (ImageCell);
+    size_t segments_bytes = segments.size () * sizeof (ImageSegment);
+    size_t entries_bytes = cell_segments.size () * sizeof (uint32_t);
+    image.resize (sizeof (ImageHeader) + segments_bytes + cells_bytes + entries_bytes);
+    char * out = image.data ();
+    memcpy (out, &header, sizeof (ImageHeader));
+    out += sizeof (ImageHeader);
+    mapIndexCopy (out, segments.data (), segments_bytes);
+    out += segments_bytes;
+    mapIndexCopy (out, table.data (), cells_bytes);
+    out += cells_bytes;
+    mapIndexCopy (out, cell_segments.data (), entries_bytes);
+  }
+
+  /* Use an image written by writeImage instead of the current contents. data must be 8 byte
+   * aligned and stay valid as long as owner is referenced (by this index).
+   */
+  bool MapIndex::attachImage (const char * data, size_t size, const std::shared_ptr<const void> & owner)
+  {
+    if (size < sizeof (ImageHeader) || reinterpret_cast<uintptr_t> (data) % 8 != 0)
+      return false;
+
+    const ImageHeader * header = reinterpret_cast<const ImageHeader *> (data);
+    if (header->cell_bits == 0 || header->cell_bits > 31 || !(header->cell_size > 0.0))
+      return false;
+
+    size_t segments_bytes = size_t (header->segment_count) * sizeof (ImageSegment);
+    size_t cells_bytes = (size_t (1) << header->cell_bits) * sizeof (ImageCell);
+    size_t entries_bytes = size_t (header->cell_segment_count) * sizeof (uint32_t);
+    if (sizeof (ImageHeader) + segments_bytes + cells_bytes + entries_bytes > size)
+      return false;
+
+    clear ();
+    _cell_size = header->cell_size;
+    _image_owner = owner;
+    _image = header;
+    _image_size = size;
+    _image_segments = reinterpret_cast<const ImageSegment *> (data + sizeof (ImageHeader));
+    _image_cells = reinterpret_cast<const ImageCell *> (data + sizeof (ImageHeader) + segments_bytes);
+    _image_cell_segments = reinterpret_cast<const uint32_t *> (data + sizeof (ImageHeader) + segments_bytes + cells_bytes);
+    return true;
+  }
+
+  bool MapIndex::isAttached () const
+  {
+    return _image != nullptr;
+  }
+
+  /* Memory used by the index. The nodes of the hash table are estimated, the image is
+   * counted as mapped, whether its pages are resident or not.
+   */
+  MapIndex::MemoryUsage MapIndex::getMemoryUsage () const
+  {
+    MemoryUsage usage;
+    usage.heap = _segments.capacity () * sizeof (LineSegment)
+                 + _segment_objects.capacity () * sizeof (uint32_t)
+                 + _cells.bucket_count () * sizeof (void *)
+                 + _cells.size () * (sizeof (decltype (_cells)::value_type) + 2 * sizeof (void *));
+    for (const auto & c: _cells)
+      usage.heap += c.second.capacity () * sizeof (uint32_t);
+    usage.mapped = _image_size;
+    return usage;
+  }
+
+  /* Find the segment closest to pos, not further away than max_dist.
+   *
+   * The cells are searched in rings around the cell of pos, until the next ring can't have
+   * anything closer.
+   */
+  std::optional<MapIndex::FindResult> MapIndex::findClosest (const Position & pos, double max_dist) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapIndex::findClosest");
+
+    std::optional<FindResult> result;
+    int32_t x = cell (pos.x ());
+    int32_t y = cell (pos.y ());
+    int32_t rings = static_cast<int32_t> (std::ceil (max_dist / _cell_size));
+
+    double best = max_dist;
+    for (int32_t ring=0; ring <= rings; ++ring)
+      {
+        // Everything in this ring is at least (ring - 1) cells away
+        if (ring > 0 && result.has_value () && best <= (ring - 1) * _cell_size)
+          break;
+
+        for (int32_t cy=y-ring; cy <= y+ring; ++cy)
+          for (int32_t cx=x-ring; cx <= x+ring; ++cx)
+            {
+              // Only the border of the square
+              if (cy != y-ring && cy != y+ring && cx != x-ring && cx != x+ring)
+                continue;
+
+              visitCell (cellKey (cx, cy), [&] (uint32_t s)
+                {
+                  Position p1, p2;
+                  getPoints (s, p1, p2);
+                  double d = mapIndexDistance (p1, p2, pos);
+                  if (d > best)
+                    return true;
+
+                  best = d;
+                  FindResult & r = result.emplace ();
+                  r.distance = d;
+                  r.segment = s;
+                  r.object_id = getSegmentObject (s);
+                  return true;
+                });
+            }
+      }
+
+    return result;
+  }
+
+  /* Is any segment within max_dist of pos.
+   */
+  bool MapIndex::isNear (const Position & pos, double max_dist) const
+  {
+    int32_t x0 = cell (pos.x () - max_dist);
+    int32_t x1 = cell (pos.x () + max_dist);
+    int32_t y0 = cell (pos.y () - max_dist);
+    int32_t y1 = cell (pos.y () + max_dist);
+
+    bool near = false;
+    for (int32_t cy=y0; cy <= y1 && !near; ++cy)
+      for (int32_t cx=x0; cx <= x1 && !near; ++cx)
+        visitCell (cellKey (cx, cy), [&] (uint32_t s)
+          {
+            Position p1, p2;
+            getPoints (s, p1, p2);
+            near = mapIndexDistance (p1, p2, pos) <= max_dist;
+            return !near;
+          });
+
+    return near;
+  }
+
+  /* Get the segments of all cells touched by box, without duplicates (ordered by index).
+   * The segments may be outside of box themselves.
+   */
+  void MapIndex::findSegments (const Eigen::AlignedBox2d & box, std::vector<uint32_t> & segments) const
+  {
+    segments.clear ();
+    if (box.isEmpty ())
+      return;
+
+    int32_t x0 = cell (box.min ().x ());
+    int32_t x1 = cell (box.max ().x ());
+    int32_t y0 = cell (box.min ().y ());
+    int32_t y1 = cell (box.max ().y ());
+    for (int32_t cy=y0; cy <= y1; ++cy)
+      for (int32_t cx=x0; cx <= x1; ++cx)
+        visitCell (cellKey (cx, cy), [&] (uint32_t s)
+          {
+            segments.push_back (s);
+            return true;
+          });
+
+    std::sort (segments.begin (), segments.end ());
+    segments.erase (std::unique (segments.begin (), segments.end ()), segments.end ());
+  }
+
+  int32_t MapIndex::cell (double v) const
+  {
+    return static_cast<int32_t> (std::floor (v / _cell_size));
+  }
+
+  uint64_t MapIndex::cellKey (int32_t x, int32_t y)
+  {
+    return (uint64_t (uint32_t (x)) << 32) | uint32_t (y);
+  }
+
+  uint32_t MapIndex::imageSlot (uint64_t key, uint32_t bits)
+  {
+    return uint32_t ((key * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+  }
+
+  void MapIndex::getPoints (uint32_t s, Position & p1, Position & p2) const
+  {
+    if (_image && s < _image->segment_count)
+      {
+        const ImageSegment & segment = _image_segments[s];
+        p1 = Position (segment.x1, segment.y1);
+        p2 = Position (segment.x2, segment.y2);
+      }
+    else
+      {
+        const LineSegment & segment = _segments[s - (_image ? _image->segment_count : 0)];
+        p1 = segment.getPosition1 ();
+        p2 = segment.getPosition2 ();
+      }
+  }
+}
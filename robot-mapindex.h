@@ -0,0 +1,111 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPINDEX_H
+#define ROBOT_MAPINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "robot-geometry.h"
+
+namespace Pathfinder
+{
+  class MapObject;
+
+  /* Spatial index over the segments of map objects, for closest position queries.
+   *
+   * The segments are copied into a uniform grid of cell_size cells (hashed, so the map may
+   * grow in any direction). Objects can be inserted at any time, but not removed: the index
+   * is meant for geometry which doesn't change anymore, e.g. frozen static objects.
+   *
+   * The index can be written to an image (flat arrays, cells in an open addressing table)
+   * and attached to one, e.g. memory mapped from a file, which is then used without copying
+   * or rebuilding anything. Segments inserted afterwards are added to the index as usual,
+   * numbered after those of the image.
+   */
+  class MapIndex
+  {
+    public:
+      MapIndex (double cell_size);
+
+      void insert (const MapObject & obj, uint32_t object_id = 0);
+      void clear ();
+      bool isEmpty () const;
+      uint32_t getSegmentCount () const;
+      double getCellSize () const;
+      LineSegment getSegment (uint32_t idx) const;
+      uint32_t getSegmentObject (uint32_t idx) const;
+
+      void writeImage (std::vector<char> & image) const;
+      bool attachImage (const char * data, size_t size, const std::shared_ptr<const void> & owner);
+      bool isAttached () const;
+
+      struct MemoryUsage
+      {
+          size_t heap;                  // allocated by the index (estimated for the hash table)
+          size_t mapped;                // of the attached image
+      };
+      MemoryUsage getMemoryUsage () const;
+
+      struct FindResult
+      {
+          double distance;
+          uint32_t segment;
+          uint32_t object_id;
+      };
+      std::optional<FindResult> findClosest (const Position & pos, double max_dist) const;
+      bool isNear (const Position & pos, double max_dist) const;
+      void findSegments (const Eigen::AlignedBox2d & box, std::vector<uint32_t> & segments) const;
+
+    private:
+      struct ImageHeader
+      {
+          double cell_size;
+          uint32_t segment_count;
+          uint32_t cell_bits;           // the table has 1 << cell_bits entries
+          uint32_t cell_segment_count;
+          uint32_t reserved;
+      };
+
+      struct ImageSegment
+      {
+          double x1;
+          double y1;
+          double x2;
+          double y2;
+          uint32_t object_id;
+          uint32_t reserved;
+      };
+
+      struct ImageCell                // count == 0: free entry
+      {
+          uint64_t key;
+          uint32_t first;               // into the segments of the cells
+          uint32_t count;
+      };
+
+      int32_t cell (double v) const;
+      static uint64_t cellKey (int32_t x, int32_t y);
+      static uint32_t imageSlot (uint64_t key, uint32_t bits);
+      void getPoints (uint32_t s, Position & p1, Position & p2) const;
+      template <typename Visit> void visitCell (uint64_t key, Visit visit) const;
+
+      double _cell_size;
+      std::vector<LineSegment,Eigen::aligned_allocator<LineSegment>> _segments;    // after the image
+      std::vector<uint32_t> _segment_objects;
+      std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+
+      std::shared_ptr<const void> _image_owner;   // keeps the image alive
+      const ImageHeader * _image;                 // nullptr if none attached
+      size_t _image_size;
+      const ImageSegment * _image_segments;
+      const ImageCell * _image_cells;
+      const uint32_t * _image_cell_segments;
+  };
+}
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "robot-mapjournal.h"
+#include "robot-trace.h"
+
+namespace Pathfinder
+{
+  enum MapJournalType
+  {
+    MAPJOURNAL_DELTA = 1,
+    MAPJOURNAL_SNAPSHOT = 2
+  };
+
+  enum MapJournalKind
+  {
+    MAPJOURNAL_ADDED = 0,
+    MAPJOURNAL_MODIFIED = 1,
+    MAPJOURNAL_REMOVED = 2,
+    MAPJOURNAL_DYNAMIC = 4
+  };
+
+  static void mapJournalWrite (uint64_t v, std::vector<uint8_t> & out)
+  {
+    while (v >= 0x80)
+      {
+        out.push_back (uint8_t (v) | 0x80);
+        v >>= 7;
+      }
+    out.push_back (uint8_t (v));
+  }
+
+  static void mapJournalWriteSigned (int64_t v, std::vector<uint8_t> & out)
+  {
+    mapJournalWrite ((uint64_t (v) << 1) ^ uint64_t (v >> 63), out);
+  }
+
+  /* Points as differences to the one before, starting at x, y.
+   */
+  static void mapJournalWritePoints (const int32_t * points, uint32_t count, int64_t x, int64_t y,
+                                     std::vector<uint8_t> & out)
+  {
+    for (uint32_t i=0; i < count; ++i)
+      {
+        mapJournalWriteSigned (points[2*i] - x, out);
+        mapJournalWriteSigned (points[2*i+1] - y, out);
+        x = points[2*i];
+        y = points[2*i+1];
+      }
+  }
+
+  static bool mapJournalRead (const uint8_t *& p, const uint8_t * end, uint64_t & v)
+  {
+    v = 0;
+    for (uint32_t shift=0; p < end && shift < 64; shift += 7)
+      {
+        uint8_t byte = *p++;
+        v |= uint64_t (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          return true;
+      }
+    return false;
+  }
+
+  static bool mapJournalReadPoints (const uint8_t *& p, const uint8_t * end, uint64_t count, int64_t x, int64_t y,
+                                    std::vector<int32_t> & points)
+  {
+    // each point takes at least two bytes, so a corrupt count can't allocate much
+    if (count > uint64_t (end - p) / 2)
+      return false;
+
+    points.resize (2 * count);
+    for (uint64_t i=0; i < count; ++i)
+      {
+        uint64_t dx;
+        uint64_t dy;
+        if (!mapJournalRead (p, end, dx) || !mapJournalRead (p, end, dy))
+          return false;
+        x += int64_t (dx >> 1) ^ -int64_t (dx & 1);
+        y += int64_t (dy >> 1) ^ -int64_t (dy & 1);
+        points[2*i] = x;
+        points[2*i+1] = y;
+      }
+    return true;
+  }
+
+  MapJournal::Parameters::Parameters ()
+  : resolution (0.001),
+    max_log_size (4 << 20)
+  {
+  }
+
+  MapJournal::MapJournal (const Map & map, const Parameters & parameters)
+  : _map (map),
+    _parameters (parameters),
+    _stats (),
+    _version (0),
+    _log_start (0),
+    _mirror (),
+    _log (),
+    _log_size (0)
+  {
+  }
+
+  /* Log the changes of the map since the last sync. Returns the version of the map now
+   * logged.
+   */
+  uint64_t MapJournal::sync ()
+  {
+    PATHFINDER_TRACE_SCOPE ("MapJournal::sync");
+
+    ++_stats.syncs;
+    Batch batch;
+    batch.version = _map.getVersion ();
+    batch.records = 0;
+    if (batch.version == _version)
+      return _version;
+
+    std::vector<uint32_t> ids;
+    Map::ChangeVector changes;
+    if (_map.getChanges (_version, changes))
+      for (const Map::Change & change: changes)
+        ids.push_back (change.object_id);
+    else
+      {
+        // Compare everything
+        ++_stats.full_syncs;
+        for (const std::pair<const uint32_t, Mirror> & m: _mirror)
+          ids.push_back (m.first);
+        for (uint32_t i=0; i < _map.getObjectCount (); ++i)
+          ids.push_back (_map.getObjectId (i));
+        for (uint32_t i=0; i < _map.getDynamicObjectCount (); ++i)
+          ids.push_back (_map.getDynamicObjectId (i));
+      }
+
+    std::sort (ids.begin (), ids.end ());
+    ids.erase (std::unique (ids.begin (), ids.end ()), ids.end ());
+    for (uint32_t id: ids)
+      syncObject (id, batch);
+
+    _version = batch.version;
+    if (batch.records > 0)
+      {
+        _stats.records += batch.records;
+        _log_size += batch.data.size ();
+        _log.push_back (std::move (batch));
+      }
+
+    while (_log_size > _parameters.max_log_size && !_log.empty ())
+      {
+        _log_start = _log.front ().version;
+        _log_size -= _log.front ().data.size ();
+        _log.pop_front ();
+      }
+
+    return _version;
+  }
+
+  /* The message bringing a replica at version since to getVersion ().
+   */
+  void MapJournal::encode (uint64_t since, std::vector<uint8_t> & message) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapJournal::encode");
+
+    message.clear ();
+    if (since >= _log_start && since <= _version)
+      {
+        auto first = std::upper_bound (_log.begin (), _log.end (), since,
+                                       [] (uint64_t v, const Batch & b) { return v < b.version; });
+        uint32_t records = 0;
+        for (auto it=first; it != _log.end (); ++it)
+          records += it->records;
+
+        encodeHeader (MAPJOURNAL_DELTA, since, records, message);
+        for (auto it=first; it != _log.end (); ++it)
+          message.insert (message.end (), it->data.begin (), it->data.end ());
+        return;
+      }
+
+    std::vector<uint32_t> ids;
+    for (const std::pair<const uint32_t, Mirror> & m: _mirror)
+      ids.push_back (m.first);
+    std::sort (ids.begin (), ids.end ());
+
+    encodeHeader (MAPJOURNAL_SNAPSHOT, 0, ids.size (), message);
+    for (uint32_t id: ids)
+      {
+        const Mirror & m = _mirror.at (id);
+        uint32_t count = m.points.size () / 2;
+        message.push_back (MAPJOURNAL_ADDED | (m.dynamic ? MAPJOURNAL_DYNAMIC : 0));
+        mapJournalWrite (id, message);
+        mapJournalWrite (count, message);
+        mapJournalWritePoints (m.points.data (), count, 0, 0, message);
+      }
+  }
+
+  /* The version of the map of the last sync.
+   */
+  uint64_t MapJournal::getVersion () const
+  {
+    return _version;
+  }
+
+  size_t MapJournal::getLogSize () const
+  {
+    return _log_size;
+  }
+
+  const MapJournal::Parameters & MapJournal::getParameters () const
+  {
+    return _parameters;
+  }
+
+  const MapJournal::Stats & MapJournal::getStats () const
+  {
+    return _stats;
+  }
+
+  void MapJournal::quantize (const MapObject & obj, std::vector<int32_t> & points) const
+  {
+    uint32_t count = obj.getPointCount ();
+    points.resize (2 * count);
+    for (uint32_t i=0; i < count; ++i)
+      {
+        Position p = obj.getPoint (i);
+        points[2*i] = std::lround (p.x () / _parameters.resolution);
+        points[2*i+1] = std::lround (p.y () / _parameters.resolution);
+      }
+  }
+
+  /* Compare an object with its copy and add the record of the difference to the batch.
+   */
+  void MapJournal::syncObject (uint32_t id, Batch & batch)
+  {
+    bool dynamic = false;
+    const MapObject * obj = _map.findObject (id, &dynamic);
+    auto found = _mirror.find (id);
+    std::vector<uint8_t> & out = batch.data;
+
+    if (!obj)
+      {
+        // Added and removed again between two syncs, if there is no copy
+        if (found == _mirror.end ())
+          return;
+
+        out.push_back (MAPJOURNAL_REMOVED | (found->second.dynamic ? MAPJOURNAL_DYNAMIC : 0));
+        mapJournalWrite (id, out);
+        _mirror.erase (found);
+        ++batch.records;
+        return;
+      }
+
+    std::vector<int32_t> points;
+    quantize (*obj, points);
+    uint32_t count = points.size () / 2;
+    uint32_t flags = dynamic ? MAPJOURNAL_DYNAMIC : 0;
+
+    if (found == _mirror.end ())
+      {
+        out.push_back (MAPJOURNAL_ADDED | flags);
+        mapJournalWrite (id, out);
+        mapJournalWrite (count, out);
+        mapJournalWritePoints (points.data (), count, 0, 0, out);
+        _stats.points += count;
+
+        Mirror & m = _mirror[id];
+        m.dynamic = dynamic;
+        m.points.swap (points);
+        ++batch.records;
+        return;
+      }
+
+    // The points before and after the modified range are the same
+    Mirror & m = found->second;
+    uint32_t old_count = m.points.size () / 2;
+    uint32_t prefix = 0;
+    while (prefix < old_count && prefix < count
+           && m.points[2*prefix] == points[2*prefix] && m.points[2*prefix+1] == points[2*prefix+1])
+      ++prefix;
+    uint32_t suffix = 0;
+    while (suffix < old_count - prefix && suffix < count - prefix
+           && m.points[2*(old_count-1-suffix)] == points[2*(count-1-suffix)]
+           && m.points[2*(old_count-1-suffix)+1] == points[2*(count-1-suffix)+1])
+      ++suffix;
+
+    if (prefix == old_count && prefix == count && m.dynamic == dynamic)
+      return;
+
+    uint32_t inserted = count - prefix - suffix;
+    out.push_back (MAPJOURNAL_MODIFIED | flags);
+    mapJournalWrite (id, out);
+    mapJournalWrite (prefix, out);
+    mapJournalWrite (old_count - prefix - suffix, out);
+    mapJournalWrite (inserted, out);
+    mapJournalWritePoints (points.data () + 2 * prefix, inserted,
+                           prefix > 0 ? points[2*prefix-2] : 0, prefix > 0 ? points[2*prefix-1] : 0, out);
+    _stats.points += inserted;
+
+    m.dynamic = dynamic;
+    m.points.swap (points);
+    ++batch.records;
+  }
+
+  void MapJournal::encodeHeader (uint32_t type, uint64_t from, uint32_t records, std::vector<uint8_t> & message) const
+  {
+    mapJournalWrite (type, message);
+    mapJournalWrite (from, message);
+    mapJournalWrite (_version, message);
+    mapJournalWrite (std::llround (_parameters.resolution * 1e9), message);
+    mapJournalWrite (records, message);
+  }
+
+  MapReplica::MapReplica ()
+  : _objects (),
+    _version (0),
+    _resolution (0.0)
+  {
+  }
+
+  /* Apply a message of a MapJournal. Returns false, without any change, if the message is
+   * corrupt or is a delta from another version.
+   */
+  bool MapReplica::apply (const uint8_t * data, size_t size)
+  {
+    PATHFINDER_TRACE_SCOPE ("MapReplica::apply");
+
+    const uint8_t * p = data;
+    const uint8_t * end = data + size;
+    uint64_t type, from, to, resolution, records;
+    if (!mapJournalRead (p, end, type) || !mapJournalRead (p, end, from) || !mapJournalRead (p, end, to)
+        || !mapJournalRead (p, end, resolution) || !mapJournalRead (p, end, records))
+      return false;
+    if ((type != MAPJOURNAL_DELTA && type != MAPJOURNAL_SNAPSHOT) || resolution == 0
+        || (type == MAPJOURNAL_DELTA && (from != _version || (_resolution != 0.0 && resolution * 1e-9 != _resolution))))
+      return false;
+
+    // The changed objects are staged, and applied when the whole message was read
+    bool snapshot = type == MAPJOURNAL_SNAPSHOT;
+    std::unordered_map<uint32_t, std::pair<bool, Object>> staged;       // exists, object
+    std::vector<int32_t> points;
+    for (uint64_t r=0; r < records; ++r)
+      {
+        uint64_t id;
+        if (p >= end)
+          return false;
+        uint8_t kind = *p++;
+        if (!mapJournalRead (p, end, id) || id > 0xffffffff)
+          return false;
+
+        auto s = staged.find (id);
+        if (s == staged.end ())
+          {
+            auto existing = snapshot ? _objects.end () : _objects.find (id);
+            bool exists = existing != _objects.end ();
+            s = staged.emplace (id, std::make_pair (exists, exists ? existing->second : Object ())).first;
+          }
+        std::pair<bool, Object> & staged_object = s->second;
+        Object & obj = staged_object.second;
+
+        switch (kind & ~MAPJOURNAL_DYNAMIC)
+          {
+          case MAPJOURNAL_ADDED:
+            {
+              uint64_t count;
+              if (staged_object.first || !mapJournalRead (p, end, count)
+                  || !mapJournalReadPoints (p, end, count, 0, 0, obj.points))
+                return false;
+              break;
+            }
+          case MAPJOURNAL_MODIFIED:
+            {
+              uint64_t first, replaced, count;
+              if (!staged_object.first || !mapJournalRead (p, end, first) || !mapJournalRead (p, end, replaced)
+                  || !mapJournalRead (p, end, count) || first + replaced > obj.points.size () / 2
+                  || !mapJournalReadPoints (p, end, count, first > 0 ? obj.points[2*first-2] : 0,
+                                            first > 0 ? obj.points[2*first-1] : 0, points))
+                return false;
+              obj.points.erase (obj.points.begin () + 2 * first, obj.points.begin () + 2 * (first + replaced));
+              obj.points.insert (obj.points.begin () + 2 * first, points.begin (), points.end ());
+              break;
+            }
+          case MAPJOURNAL_REMOVED:
+            if (!staged_object.first)
+              return false;
+            break;
+          default:
+            return false;
+          }
+
+        staged_object.first = (kind & ~MAPJOURNAL_DYNAMIC) != MAPJOURNAL_REMOVED;
+        obj.dynamic = kind & MAPJOURNAL_DYNAMIC;
+      }
+    if (p != end)
+      return false;
+
+    if (snapshot)
+      _objects.clear ();
+    for (std::pair<const uint32_t, std::pair<bool, Object>> & s: staged)
+      if (s.second.first)
+        _objects[s.first] = std::move (s.second.second);
+      else
+        _objects.erase (s.first);
+
+    _version = to;
+    _resolution = resolution * 1e-9;
+    return true;
+  }
+
+  uint64_t MapReplica::getVersion () const
+  {
+    return _version;
+  }
+
+  uint32_t MapReplica::getObjectCount () const
+  {
+    return _objects.size ();
+  }
+
+  bool MapReplica::getObject (uint32_t id, PositionVector & points, bool * dynamic) const
+  {
+    auto found = _objects.find (id);
+    if (found == _objects.end ())
+      return false;
+
+    const std::vector<int32_t> & q = found->second.points;
+    points.resize (q.size () / 2);
+    for (uint32_t i=0; i < points.size (); ++i)
+      points[i] = Position (q[2*i] * _resolution, q[2*i+1] * _resolution);
+    if (dynamic)
+      *dynamic = found->second.dynamic;
+    return true;
+  }
+
+  /* The ids of all objects, ascending.
+   */
+  void MapReplica::getIds (std::vector<uint32_t> & ids) const
+  {
+    ids.clear ();
+    for (const std::pair<const uint32_t, Object> & obj: _objects)
+      ids.push_back (obj.first);
+    std::sort (ids.begin (), ids.end ());
+  }
+
+  /* Fill a map with the objects (ordered by id), e.g. to show them.
+   */
+  void MapReplica::buildMap (Map & map) const
+  {
+    map = Map ();
+    std::vector<uint32_t> ids;
+    getIds (ids);
+
+    PositionVector points;
+    bool dynamic;
+    for (uint32_t id: ids)
+      {
+        getObject (id, points, &dynamic);
+        MapObject obj (_resolution);
+        obj.setPolygon (points);
+        if (dynamic)
+          map.addDynamicObject (std::move (obj));
+        else
+          map.addObject (std::move (obj));
+      }
+  }
+}
@@ -0,0 +1,127 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPJOURNAL_H
+#define ROBOT_MAPJOURNAL_H
+
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* The changes of a map as compact messages, for viewers behind a slow link (server side).
+   *
+   * sync takes the changes of the map since the last sync (Map::getChanges) and compares the
+   * changed objects with a copy of their points, quantized to resolution. Each object gets one
+   * record: added (all points), removed, or modified, as the range of points replaced (the
+   * points before and after it are unchanged), so appending or joining at an end costs a few
+   * points, not the object. The records of each sync are kept in a log, tagged with the
+   * version of the map, up to max_log_size bytes.
+   *
+   * encode writes the message bringing a replica from version since up to date: the records
+   * logged after it, or a snapshot of all objects if the log doesn't reach back that far. All
+   * numbers are varints (7 bit groups, low first), signed ones zigzag encoded:
+   *
+   *   message:  type (1: delta, 2: snapshot), from version (0 for snapshots), to version,
+   *             resolution in nm, record count, records
+   *   record:   kind (0: added, 1: modified, 2: removed) + 4 if dynamic, object id, then
+   *     added:    point count, points
+   *     modified: first point replaced, number of points replaced, point count, points
+   *   points:   x, y in resolution, each as difference to the point before (the point before
+   *             the range for modified, 0, 0 for the first one)
+   *
+   * The sizes of sync and encode depend on the changes, not on the size of the map (except
+   * for snapshots). Messages are applied by a MapReplica.
+   */
+  class MapJournal
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double resolution;            // of the points in the messages
+          size_t max_log_size;          // bytes of records kept for deltas
+      };
+
+      struct Stats
+      {
+          uint64_t syncs;
+          uint64_t records;
+          uint64_t points;              // sent with the records
+          uint64_t full_syncs;          // the map had no changes back to the last sync
+      };
+
+      MapJournal (const Map & map, const Parameters & parameters);
+
+      uint64_t sync ();
+      void encode (uint64_t since, std::vector<uint8_t> & message) const;
+
+      uint64_t getVersion () const;
+      size_t getLogSize () const;
+      const Parameters & getParameters () const;
+      const Stats & getStats () const;
+
+    private:
+      struct Mirror
+      {
+          bool dynamic;
+          std::vector<int32_t> points;  // x, y interleaved
+      };
+
+      struct Batch
+      {
+          uint64_t version;
+          uint32_t records;
+          std::vector<uint8_t> data;
+      };
+
+      void quantize (const MapObject & obj, std::vector<int32_t> & points) const;
+      void syncObject (uint32_t id, Batch & batch);
+      void encodeHeader (uint32_t type, uint64_t from, uint32_t records, std::vector<uint8_t> & message) const;
+
+      const Map & _map;
+      Parameters _parameters;
+      Stats _stats;
+      uint64_t _version;
+      uint64_t _log_start;              // the log holds all records after this version
+
+      std::unordered_map<uint32_t, Mirror> _mirror;
+      std::deque<Batch> _log;
+      size_t _log_size;
+  };
+
+  /* The client side of a MapJournal: A copy of the map, kept up to date by its messages.
+   */
+  class MapReplica
+  {
+    public:
+      MapReplica ();
+
+      bool apply (const uint8_t * data, size_t size);
+
+      uint64_t getVersion () const;
+      uint32_t getObjectCount () const;
+      bool getObject (uint32_t id, PositionVector & points, bool * dynamic = nullptr) const;
+      void getIds (std::vector<uint32_t> & ids) const;
+      void buildMap (Map & map) const;
+
+    private:
+      struct Object
+      {
+          bool dynamic;
+          std::vector<int32_t> points;  // x, y interleaved
+      };
+
+      std::unordered_map<uint32_t, Object> _objects;
+      uint64_t _version;
+      double _resolution;
+  };
+}
+
+#endif
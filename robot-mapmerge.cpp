@@ -0,0 +1,442 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "robot-mapmerge.h"
+#include "robot-parallel.h"
+
+namespace Pathfinder
+{
+  /* Orientation (modulo 90 degrees) of the minimum area rectangle around a convex hull.
+   */
+  static double mapMergeMinAreaAngle (const MapObject & hull)
+  {
+    double best_area = std::numeric_limits<double>::infinity ();
+    double angle = 0.0;
+
+    uint32_t count = hull.getPointCount ();
+    for (uint32_t i=1; i < count; ++i)
+      {
+        Position edge (hull.getPoint (i) - hull.getPoint (i-1));
+        if (edge.norm () == 0.0)
+          continue;
+
+        // The rectangle has one side on a hull edge.
+        double a = std::atan2 (edge.y (), edge.x ());
+        Transformation rot (Position (0.0, 0.0), -a, 1.0);
+        Eigen::AlignedBox2d box;
+        for (uint32_t j=0; j < count; ++j)
+          box.extend (rot.rotatePosition (hull.getPoint (j)));
+
+        if (box.volume () < best_area)
+          {
+            best_area = box.volume ();
+            angle = a;
+          }
+      }
+
+    return angle;
+  }
+
+  /* Bounding box of the hull, after transforming it with trafo.
+   */
+  static Eigen::AlignedBox2d mapMergeBox (const MapObject & hull, const Transformation & trafo)
+  {
+    Eigen::AlignedBox2d box;
+    for (uint32_t i=0; i < hull.getPointCount (); ++i)
+      box.extend (trafo.transformPosition (hull.getPoint (i)));
+
+    return box;
+  }
+
+  MapMerger::Parameters::Parameters ()
+  : max_dist (0.2),
+    min_points (3),
+    cell_size (0.5),
+    threads (0),
+    icp_samples (2000),
+    icp_iterations (50),
+    icp_start_dist (2.0),
+    icp_max_dist (0.3)
+  {
+  }
+
+  MapMerger::MapMerger (const Parameters & parameters)
+  : _parameters (parameters)
+  {
+  }
+
+  const MapMerger::Parameters & MapMerger::getParameters () const
+  {
+    return _parameters;
+  }
+
+  /* Estimate the transformation of other into reference, without a guess.
+   */
+  MapMerger::Alignment MapMerger::align (const Map & reference, const Map & other) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapMerger::align");
+
+    MapIndex index (_parameters.cell_size);
+    for (const MapObject & obj: reference.getObjects ())
+      index.insert (obj);
+
+    PositionVector samples = samplePoints (other, _parameters.icp_samples);
+
+    MapObject ref_hull (0.0);
+    ref_hull.setPolygon (samplePoints (reference, _parameters.icp_samples));
+    ref_hull.convexHull ();
+    MapObject other_hull (0.0);
+    other_hull.setPolygon (samples);
+    other_hull.convexHull ();
+
+    double ref_angle = mapMergeMinAreaAngle (ref_hull);
+    double other_angle = mapMergeMinAreaAngle (other_hull);
+
+    // In the frame of the reference rectangle, both rectangles are axis aligned for the four
+    // rotations (the orientation is only known modulo 90 degrees). For each rotation, the
+    // centers or one of the corners are matched (a partial map shares a corner with the whole).
+    static const uint32_t matches = 5;
+    Transformation to_ref_frame (Position (0.0, 0.0), -ref_angle, 1.0);
+    Eigen::AlignedBox2d ref_box = mapMergeBox (ref_hull, to_ref_frame);
+
+    std::vector<Transformation> guesses;
+    for (uint32_t k=0; k < 4; ++k)
+      {
+        double rotation = ref_angle - other_angle + k * M_PI / 2.0;
+        Transformation rotated (Transformation (to_ref_frame * Transformation (Position (0.0, 0.0), rotation, 1.0)));
+        Eigen::AlignedBox2d other_box = mapMergeBox (other_hull, rotated);
+
+        for (uint32_t m=0; m < matches; ++m)
+          {
+            Eigen::Vector2d offset;
+            if (m == 0)
+              offset = ref_box.center () - other_box.center ();
+            else
+              {
+                Eigen::AlignedBox2d::CornerType corner = static_cast<Eigen::AlignedBox2d::CornerType> (m - 1);
+                offset = ref_box.corner (corner) - other_box.corner (corner);
+              }
+
+            Position translation = Transformation (Position (0.0, 0.0), ref_angle, 1.0).rotatePosition (Position (offset));
+            guesses.push_back (Transformation (translation, rotation, 1.0));
+          }
+      }
+
+    // All guesses are refined with a quarter of the samples, the best one with all.
+    PositionVector coarse_samples;
+    for (uint32_t i=0; i < samples.size (); i += 4)
+      coarse_samples.push_back (samples[i]);
+
+    std::vector<Alignment> hypotheses (guesses.size ());
+    parallelFor (guesses.size (), getThreadCount (),
+                 [&] (uint32_t k)
+                 {
+                   hypotheses[k] = refine (index, coarse_samples, guesses[k]);
+                 });
+
+    uint32_t best = 0;
+    for (uint32_t k=1; k < hypotheses.size (); ++k)
+      if (hypotheses[k].inlier_ratio > hypotheses[best].inlier_ratio
+          || (hypotheses[k].inlier_ratio == hypotheses[best].inlier_ratio
+              && hypotheses[k].residual < hypotheses[best].residual))
+        best = k;
+
+    return refine (index, samples, hypotheses[best].trafo);
+  }
+
+  /* Refine the guess of the transformation of other into reference by ICP.
+   */
+  MapMerger::Alignment MapMerger::refine (const Map & reference, const Map & other, const Transformation & guess) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapMerger::refine");
+
+    MapIndex index (_parameters.cell_size);
+    for (const MapObject & obj: reference.getObjects ())
+      index.insert (obj);
+
+    return refine (index, samplePoints (other, _parameters.icp_samples), guess);
+  }
+
+  /* Point to segment ICP: Every sample is matched with the closest position on a segment of
+   * the reference, the rigid transformation minimizing the squared distances is applied, with
+   * the matching distance shrinking from icp_start_dist to icp_max_dist.
+   */
+  MapMerger::Alignment MapMerger::refine (const MapIndex & reference, const PositionVector & samples,
+                                          const Transformation & guess) const
+  {
+    Alignment result;
+    result.trafo = guess;
+    result.residual = std::numeric_limits<double>::infinity ();
+    result.inlier_ratio = 0.0;
+    result.iterations = 0;
+
+    PositionVector from;
+    PositionVector to;
+    double dist = std::max (_parameters.icp_start_dist, _parameters.icp_max_dist);
+
+    for (uint32_t it=0; it < _parameters.icp_iterations; ++it)
+      {
+        from.clear ();
+        to.clear ();
+        double total = 0.0;
+        for (const Position & sample: samples)
+          {
+            Position p = result.trafo.transformPosition (sample);
+            std::optional<MapIndex::FindResult> found = reference.findClosest (p, dist);
+            if (!found.has_value ())
+              continue;
+
+            double t;
+            from.push_back (p);
+            to.push_back (reference.getSegment (found->segment).perpend (p, &t));
+            total += found->distance;
+          }
+
+        result.iterations = it + 1;
+        if (from.size () < 3)
+          break;
+
+        result.residual = total / from.size ();
+        if (dist <= _parameters.icp_max_dist)
+          result.inlier_ratio = double (from.size ()) / samples.size ();
+
+        // Closed form of the best rotation and translation of from onto to
+        Eigen::Vector2d mean_from (0.0, 0.0);
+        Eigen::Vector2d mean_to (0.0, 0.0);
+        for (uint32_t i=0; i < from.size (); ++i)
+          {
+            mean_from += from[i];
+            mean_to += to[i];
+          }
+        mean_from /= from.size ();
+        mean_to /= from.size ();
+
+        double cross = 0.0;
+        double dot = 0.0;
+        for (uint32_t i=0; i < from.size (); ++i)
+          {
+            Eigen::Vector2d a = from[i] - mean_from;
+            Eigen::Vector2d b = to[i] - mean_to;
+            cross += a.x () * b.y () - a.y () * b.x ();
+            dot += a.dot (b);
+          }
+
+        double rotation = std::atan2 (cross, dot);
+        Transformation rot (Position (0.0, 0.0), rotation, 1.0);
+        Position translation (mean_to - rot.rotatePosition (Position (mean_from)));
+        result.trafo = Transformation (Transformation (translation, rotation, 1.0) * result.trafo);
+
+        bool converged = std::fabs (rotation) < 1e-6 && translation.norm () < 1e-6;
+        if (converged && dist <= _parameters.icp_max_dist)
+          break;
+
+        dist = std::max (_parameters.icp_max_dist, dist * 0.7);
+      }
+
+    return result;
+  }
+
+  /* Merge source into target, after transforming it with trafo.
+   */
+  MapMerger::MergeStats MapMerger::merge (Map & target, const Map & source, const Transformation & trafo) const
+  {
+    PATHFINDER_TRACE_SCOPE ("MapMerger::merge");
+
+    uint32_t threads = getThreadCount ();
+    MergeStats stats;
+    stats.duplicate_objects = 0;
+    stats.added_objects = 0;
+    stats.joined_runs = 0;
+    stats.dropped_points = 0;
+
+    // Transform all source objects in bulk
+    const std::vector<MapObject> & source_objects = source.getObjects ();
+    std::vector<MapObject> objects (source_objects.size (), MapObject (0.0));
+    parallelFor (objects.size (), threads,
+                 [&] (uint32_t i)
+                 {
+                   // Point by point, so compact or curved objects aren't decoded into their caches
+                   PositionVector poly (source_objects[i].getPointCount ());
+                   for (uint32_t k=0; k < poly.size (); ++k)
+                     poly[k] = source_objects[i].getPoint (k);
+                   trafo.transformBatch (poly);
+                   objects[i] = source_objects[i];
+                   objects[i].setPolygon (poly);
+                 });
+
+    MapIndex index (_parameters.cell_size);
+    const std::vector<MapObject> & target_objects = target.getObjects ();
+    for (uint32_t i=0; i < target_objects.size (); ++i)
+      index.insert (target_objects[i], i);
+
+    // Split every source object into runs of points not explained by the target. A run touching
+    // a target object (its neighbor point is explained by it) is joined with it.
+    struct Run
+    {
+        uint32_t object;
+        uint32_t first;         // including the touching points
+        uint32_t last;
+        bool whole;
+    };
+    static const uint32_t no_target = 0xffffffff;
+
+    std::vector<std::vector<Run>> runs (objects.size ());
+    std::vector<std::vector<uint32_t>> touching (objects.size ());
+    std::vector<uint64_t> dropped (objects.size (), 0);
+    parallelFor (objects.size (), threads,
+                 [&] (uint32_t k)
+                 {
+                   const MapObject & obj = objects[k];
+                   uint32_t count = obj.getPointCount ();
+                   if (count == 0)
+                     return;
+
+                   std::vector<uint32_t> owner (count, no_target);
+                   for (uint32_t i=0; i < count; ++i)
+                     {
+                       std::optional<MapIndex::FindResult> found = index.findClosest (obj.getPoint (i), _parameters.max_dist);
+                       if (found.has_value ())
+                         {
+                           owner[i] = found->object_id;
+                           ++dropped[k];
+                         }
+                     }
+
+                   if (dropped[k] == 0)
+                     {
+                       runs[k].push_back (Run { no_target, 0, count - 1, true });
+                       return;
+                     }
+
+                   for (uint32_t i=0; i < count;)
+                     {
+                       if (owner[i] != no_target)
+                         {
+                           ++i;
+                           continue;
+                         }
+
+                       uint32_t end = i;
+                       while (end + 1 < count && owner[end + 1] == no_target)
+                         ++end;
+
+                       if (end - i + 1 >= _parameters.min_points)
+                         {
+                           Run run { no_target, i, end, false };
+                           if (i > 0)
+                             {
+                               run.object = owner[i - 1];
+                               run.first = i - 1;
+                             }
+                           if (end + 1 < count)
+                             {
+                               if (run.object == no_target)
+                                 run.object = owner[end + 1];
+                               run.last = end + 1;
+                             }
+                           runs[k].push_back (run);
+                         }
+                       i = end + 1;
+                     }
+                 });
+
+    // Group the runs by the target object they touch, so every target object is changed by
+    // one thread only. Frozen objects are not changed, runs touching them are added.
+    std::vector<std::vector<MapObject>> joins (target.getObjectCount ());
+    std::vector<MapObject> added;
+    for (uint32_t k=0; k < objects.size (); ++k)
+      {
+        stats.dropped_points += dropped[k];
+        if (runs[k].empty ())
+          ++stats.duplicate_objects;
+
+        for (const Run & run: runs[k])
+          {
+            if (run.whole)
+              {
+                added.push_back (std::move (objects[k]));
+                break;
+              }
+
+            PositionVector points;
+            for (uint32_t i=run.first; i <= run.last; ++i)
+              points.push_back (objects[k].getPoint (i));
+            MapObject piece (objects[k].getMinPointDistance ());
+            piece.setPolygon (points);
+
+            if (run.object == no_target || target_objects[run.object].isFrozen ())
+              added.push_back (std::move (piece));
+            else
+              joins[run.object].push_back (std::move (piece));
+          }
+      }
+
+    // The objects joined with are touched (Map::getObject) before going parallel
+    std::vector<MapObject *> join_targets (joins.size (), nullptr);
+    for (uint32_t i=0; i < joins.size (); ++i)
+      if (!joins[i].empty ())
+        join_targets[i] = &target.getObject (i);
+
+    std::vector<uint32_t> joined (joins.size (), 0);
+    std::vector<std::vector<MapObject>> not_joined (joins.size ());
+    parallelFor (joins.size (), threads,
+                 [&] (uint32_t i)
+                 {
+                   for (MapObject & piece: joins[i])
+                     {
+                       if (join_targets[i]->join (piece, _parameters.max_dist))
+                         ++joined[i];
+                       else
+                         not_joined[i].push_back (std::move (piece));
+                     }
+                 });
+
+    for (uint32_t i=0; i < joins.size (); ++i)
+      {
+        stats.joined_runs += joined[i];
+        for (MapObject & piece: not_joined[i])
+          added.push_back (std::move (piece));
+      }
+
+    for (MapObject & obj: added)
+      target.addObject (std::move (obj));
+    stats.added_objects = added.size ();
+
+    return stats;
+  }
+
+  /* Up to max_points points of all objects of map, evenly distributed.
+   */
+  PositionVector MapMerger::samplePoints (const Map & map, uint32_t max_points) const
+  {
+    uint64_t total = 0;
+    for (const MapObject & obj: map.getObjects ())
+      total += obj.getPointCount ();
+
+    PositionVector samples;
+    uint64_t stride = std::max<uint64_t> (1, total / std::max (1u, max_points));
+    uint64_t pos = 0;
+    for (const MapObject & obj: map.getObjects ())
+      {
+        uint32_t count = obj.getPointCount ();
+        for (; pos < count; pos += stride)
+          samples.push_back (obj.getPoint (pos));
+        pos -= count;
+      }
+
+    return samples;
+  }
+
+  uint32_t MapMerger::getThreadCount () const
+  {
+    if (_parameters.threads > 0)
+      return _parameters.threads;
+
+    return defaultThreadCount ();
+  }
+}
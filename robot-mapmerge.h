@@ -0,0 +1,80 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPMERGE_H
+#define ROBOT_MAPMERGE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-mapindex.h"
+
+namespace Pathfinder
+{
+  /* Merges maps of several robots of the same site.
+   *
+   * align estimates the transformation from the coordinates of one map into the other:
+   * Hypotheses from the minimum area rectangles of the convex hulls (the orientation is only
+   * known modulo 90 degrees) are refined by ICP and the best one is taken. The hull hypotheses
+   * need a large overlap of the maps, otherwise a guess (e.g. the known start poses) should
+   * be refined.
+   *
+   * merge transforms all objects of the source map and consolidates them with the target map:
+   * Points of the source explained by target objects are dropped, the remaining runs are joined
+   * with the target object they touch, or added as new objects. Both steps run in parallel.
+   */
+  class MapMerger
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double max_dist;            // max. distance of points considered the same
+          uint32_t min_points;        // runs of new points with less points are dropped
+          double cell_size;           // of the spatial index of the target map
+          uint32_t threads;           // 0: number of cores
+
+          uint32_t icp_samples;       // max. number of points of the map to align used by ICP
+          uint32_t icp_iterations;
+          double icp_start_dist;      // max. distance of matching points in the first iteration
+          double icp_max_dist;        // max. distance of matching points in the end
+      };
+
+      struct Alignment
+      {
+          Transformation trafo;       // from the coordinates of the other map into the reference map
+          double residual;            // mean distance of the matched points
+          double inlier_ratio;        // ratio of the samples matched within icp_max_dist
+          uint32_t iterations;
+      };
+
+      struct MergeStats
+      {
+          uint32_t duplicate_objects;   // source objects completely explained by the target
+          uint32_t added_objects;       // source objects or runs added as new objects
+          uint32_t joined_runs;         // runs joined with target objects
+          uint64_t dropped_points;      // source points explained by the target
+      };
+
+      MapMerger (const Parameters & parameters);
+
+      Alignment align (const Map & reference, const Map & other) const;
+      Alignment refine (const Map & reference, const Map & other, const Transformation & guess) const;
+      MergeStats merge (Map & target, const Map & source, const Transformation & trafo) const;
+
+      const Parameters & getParameters () const;
+
+    private:
+      Alignment refine (const MapIndex & reference, const PositionVector & samples,
+                        const Transformation & guess) const;
+      PositionVector samplePoints (const Map & map, uint32_t max_points) const;
+      uint32_t getThreadCount () const;
+
+      Parameters _parameters;
+  };
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ *
+ */
+
+#include "robot-mappipeline.h"
+
+namespace Pathfinder
+{
+  MappingPipeline::Parameters::Parameters ()
+  : builder (),
+    journal (),
+    threads (0),
+    scan_capacity (64),
+    scan_policy (QUEUE_BLOCK),
+    publish_capacity (1)
+  {
+  }
+
+  MappingPipeline::MappingPipeline (Map & map, const Parameters & parameters, const Subscriber & subscriber)
+  : _parameters (parameters),
+    _builder (map, parameters.builder),
+    _journal (map, parameters.journal),
+    _subscriber (subscriber),
+    _pose (),
+    _has_pose (false),
+    _poses (0),
+    _published (0),
+    _executor (parameters.threads),
+    _decode ("decode", _executor, parameters.scan_capacity, parameters.scan_policy,
+             [this] (SensorLogReader::Record & record, PosedScan & scan) { return decode (record, scan); }),
+    _transform ("transform", _executor, parameters.scan_capacity, parameters.scan_policy,
+                [this] (PosedScan & scan, ScanPoints & points) { return transform (scan, points); }),
+    _map ("map", _executor, parameters.scan_capacity, parameters.scan_policy,
+          [this] (ScanPoints & points, Update & update) { return this->update (points, update); }),
+    _publish ("publish", _executor, parameters.publish_capacity, QUEUE_COALESCE,
+              [this] (Update & update) { _subscriber (update); })
+  {
+    _pose.setIdentity ();
+    _decode.connect (_transform);
+    _transform.connect (_map);
+    _map.connect (_publish);
+    _publish.setCoalesce ([] (Update & queued, Update && update)
+                          {
+                            for (std::vector<uint8_t> & message: update.messages)
+                              queued.messages.push_back (std::move (message));
+                            queued.version = update.version;
+                          });
+  }
+
+  MappingPipeline::~MappingPipeline ()
+  {
+    flush ();
+  }
+
+  void MappingPipeline::pushPose (double time, const Transformation & pose)
+  {
+    SensorLogReader::Record record;
+    record.type = SensorLogReader::POSE;
+    record.time = time;
+    record.pose = pose;
+    _decode.push (std::move (record));
+  }
+
+  void MappingPipeline::pushScan (double time, const RangeScan & scan)
+  {
+    SensorLogReader::Record record;
+    record.type = SensorLogReader::SCAN;
+    record.time = time;
+    record.scan = scan;
+    _decode.push (std::move (record));
+  }
+
+  /* Wait until everything pushed is mapped and published.
+   */
+  void MappingPipeline::flush ()
+  {
+    PipelineStageBase::waitAllIdle ({ &_decode, &_transform, &_map, &_publish });
+  }
+
+  const MapBuilder & MappingPipeline::getBuilder () const
+  {
+    return _builder;
+  }
+
+  /* Number of poses decoded, the builder doesn't get them.
+   */
+  uint64_t MappingPipeline::getPoseCount () const
+  {
+    return _poses;
+  }
+
+  uint32_t MappingPipeline::getStageCount () const
+  {
+    return 4;
+  }
+
+  const PipelineStageBase & MappingPipeline::getStage (uint32_t idx) const
+  {
+    const PipelineStageBase * stages[] = { &_decode, &_transform, &_map, &_publish };
+    return *stages[idx];
+  }
+
+  /* The scans get the latest pose, scans before the first pose are dropped.
+   */
+  bool MappingPipeline::decode (SensorLogReader::Record & record, PosedScan & scan)
+  {
+    if (record.type == SensorLogReader::POSE)
+      {
+        _pose = record.pose;
+        _has_pose = true;
+        ++_poses;
+        return false;
+      }
+
+    if (record.type != SensorLogReader::SCAN || !_has_pose)
+      return false;
+
+    scan.time = record.time;
+    scan.pose = _pose;
+    scan.scan = std::move (record.scan);
+    return true;
+  }
+
+  bool MappingPipeline::transform (PosedScan & scan, ScanPoints & points)
+  {
+    _builder.scanToPoints (scan.scan, scan.pose, points.points);
+    points.time = scan.time;
+    points.pose = scan.pose;
+    points.scan = std::move (scan.scan);
+    return true;
+  }
+
+  bool MappingPipeline::update (ScanPoints & points, Update & update)
+  {
+    _builder.pushPoints (points.time, points.scan, points.pose, points.points);
+
+    uint64_t version = _journal.sync ();
+    if (version == _published)
+      return false;
+
+    update.version = version;
+    update.messages.resize (1);
+    _journal.encode (_published, update.messages[0]);
+    _published = version;
+    return true;
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MAPPIPELINE_H
+#define ROBOT_MAPPIPELINE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "robot-mapbuilder.h"
+#include "robot-mapjournal.h"
+#include "robot-pipeline.h"
+#include "robot-sensorlog.h"
+
+namespace Pathfinder
+{
+  /* The mapping as a pipeline of stages running in parallel, fed with poses and scans, publishing
+   * the changes of the map:
+   *
+   *   decode:    pose and scan records to scans with the latest pose
+   *   transform: the scans to points in map coordinates (MapBuilder::scanToPoints)
+   *   map:       observe, segment, associate, smooth and classify (MapBuilder::pushPoints); the
+   *              changes are synced to a MapJournal and encoded as delta to the last one
+   *   publish:   the deltas are passed to the subscriber (a viewer, or the link to one)
+   *
+   * The queues of the first three stages block by default, so a replay loses nothing; a live
+   * robot would rather drop the oldest scans to keep up. The publish queue coalesces: While the
+   * subscriber is busy, the deltas collect in one update, so a slow subscriber never holds up
+   * the mapping, nor the scans coming in.
+   *
+   * The map and the builder are only to be used by others after flush.
+   */
+  class MappingPipeline : public ObservationSink
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          MapBuilder::Parameters builder;
+          MapJournal::Parameters journal;
+          uint32_t threads;             // 0: one per core
+          uint32_t scan_capacity;       // of the queues of decode, transform and map
+          QueuePolicy scan_policy;
+          uint32_t publish_capacity;
+      };
+
+      struct Update
+      {
+          uint64_t version;                               // of the map after the messages
+          std::vector<std::vector<uint8_t>> messages;     // MapJournal deltas, in order
+      };
+
+      typedef std::function<void (const Update & update)> Subscriber;
+
+      MappingPipeline (Map & map, const Parameters & parameters, const Subscriber & subscriber);
+      virtual ~MappingPipeline ();
+
+      virtual void pushPose (double time, const Transformation & pose);
+      virtual void pushScan (double time, const RangeScan & scan);
+      void flush ();
+
+      const MapBuilder & getBuilder () const;
+      uint64_t getPoseCount () const;
+      uint32_t getStageCount () const;
+      const PipelineStageBase & getStage (uint32_t idx) const;
+
+    private:
+      struct PosedScan
+      {
+          double time;
+          Transformation pose;
+          RangeScan scan;
+      };
+
+      struct ScanPoints
+      {
+          double time;
+          Transformation pose;
+          RangeScan scan;
+          std::vector<Position,Eigen::aligned_allocator<Position>> points;
+      };
+
+      bool decode (SensorLogReader::Record & record, PosedScan & scan);
+      bool transform (PosedScan & scan, ScanPoints & points);
+      bool update (ScanPoints & points, Update & update);
+
+      Parameters _parameters;
+      MapBuilder _builder;
+      MapJournal _journal;
+      Subscriber _subscriber;
+      Transformation _pose;             // of the decode stage
+      bool _has_pose;
+      uint64_t _poses;
+      uint64_t _published;              // version of the last delta (map stage)
+
+      PipelineExecutor _executor;
+      PipelineStage<SensorLogReader::Record, PosedScan> _decode;
+      PipelineStage<PosedScan, ScanPoints> _transform;
+      PipelineStage<ScanPoints, Update> _map;
+      PipelineSink<Update> _publish;
+  };
+}
+
+#endif
@@ -2,6 +2,8 @@
  *
  */
 
+#include <QPainterPath>
+
 #include "robot-mapwidget.h"
 
 namespace Pathfinder
@@ -15,14 +17,48 @@ namespace Pathfinder
 
   void MapScene::updateScene ()
   {
-    const std::vector<MapObject> & objects = _map->getObjects ();
+    PATHFINDER_TRACE_SCOPE ("MapScene::updateScene");
 
-    for (uint32_t i=0; i < objects.size (); ++i)
+    // The dynamic layer in red, above the static one
+    for (uint32_t layer=0; layer < 2; ++layer)
       {
-	const std::vector<Position,Eigen::aligned_allocator<Position>>& poly = objects[i].getPolygon ();
+	const std::vector<MapObject> & objects = layer == 0 ? _map->getObjects () : _map->getDynamicObjects ();
+	QPen pen (layer == 0 ? Qt::black : Qt::red);
+
+	for (uint32_t i=0; i < objects.size (); ++i)
+	  {
+	    // Curved objects are drawn as their curves, not as the polyline read from them.
+	    if (objects[i].isCurved ())
+	      {
+		const CurveChain & curves = objects[i].getCurves ();
+		QPainterPath path;
+		for (uint32_t k=0; k < curves.getCurveCount (); ++k)
+		  {
+		    Position start;
+		    Position control;
+		    Position end;
+		    curves.getBezier (k, start, control, end);
+		    if (k == 0)
+		      path.moveTo (start.x (), -start.y ());
+		    path.quadTo (control.x (), -control.y (), end.x (), -end.y ());
+		  }
+		addPath (path, pen);
+		continue;
+	      }
+
+	    // Use getPoint, so compact objects are decoded on the fly without a temporary polygon.
+	    uint32_t count = objects[i].getPointCount ();
+	    if (count == 0)
+	      continue;
 
-	for (uint32_t j=1; j < poly.size (); ++j)
-	  addLine (poly[j-1].x (), -poly[j-1].y (), poly[j].x (), -poly[j].y (), QPen (Qt::black));
+	    Position prev = objects[i].getPoint (0);
+	    for (uint32_t j=1; j < count; ++j)
+	      {
+		Position cur = objects[i].getPoint (j);
+		addLine (prev.x (), -prev.y (), cur.x (), -cur.y (), pen);
+		prev = cur;
+	      }
+	  }
       }
   }
 }
@@ -2,6 +2,9 @@
  *
  */
 
+#ifndef ROBOT_MAPWIDGET_H
+#define ROBOT_MAPWIDGET_H
+
 #include <vector>
 #include <cstdint>
 
@@ -22,3 +25,5 @@ namespace Pathfinder
       Map * _map;
   };
 }
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ *
+ */
+
+#include <atomic>
+
+#include "robot-memory.h"
+
+namespace Pathfinder
+{
+  struct MemoryTrackerCounters
+  {
+      std::atomic<size_t> bytes;
+      std::atomic<size_t> peak_bytes;
+      std::atomic<uint64_t> allocations;
+      std::atomic<uint64_t> deallocations;
+  };
+
+  static MemoryTrackerCounters memory_tracker_counters[MEMORY_CATEGORY_COUNT];
+
+  void MemoryTracker::allocated (MemoryCategory category, size_t bytes)
+  {
+    MemoryTrackerCounters & c = memory_tracker_counters[category];
+    size_t now = c.bytes.fetch_add (bytes, std::memory_order_relaxed) + bytes;
+    c.allocations.fetch_add (1, std::memory_order_relaxed);
+
+    size_t peak = c.peak_bytes.load (std::memory_order_relaxed);
+    while (now > peak && !c.peak_bytes.compare_exchange_weak (peak, now, std::memory_order_relaxed))
+      ;
+  }
+
+  void MemoryTracker::deallocated (MemoryCategory category, size_t bytes)
+  {
+    MemoryTrackerCounters & c = memory_tracker_counters[category];
+    c.bytes.fetch_sub (bytes, std::memory_order_relaxed);
+    c.deallocations.fetch_add (1, std::memory_order_relaxed);
+  }
+
+  MemoryTracker::Counters MemoryTracker::getCounters (MemoryCategory category)
+  {
+    const MemoryTrackerCounters & c = memory_tracker_counters[category];
+    Counters counters;
+    counters.bytes = c.bytes.load (std::memory_order_relaxed);
+    counters.peak_bytes = c.peak_bytes.load (std::memory_order_relaxed);
+    counters.allocations = c.allocations.load (std::memory_order_relaxed);
+    counters.deallocations = c.deallocations.load (std::memory_order_relaxed);
+    return counters;
+  }
+
+  const char * MemoryTracker::getName (MemoryCategory category)
+  {
+    static const char * const names[MEMORY_CATEGORY_COUNT] = { "points", "compact points", "curves" };
+    return names[category];
+  }
+
+  void MemoryTracker::resetPeak ()
+  {
+    for (MemoryTrackerCounters & c: memory_tracker_counters)
+      c.peak_bytes.store (c.bytes.load (std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
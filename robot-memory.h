@@ -0,0 +1,98 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_MEMORY_H
+#define ROBOT_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Pathfinder
+{
+  /* What memory allocated through a TrackingAllocator is used for.
+   */
+  enum MemoryCategory
+  {
+    MEMORY_POINTS,                      // vertices of map objects (also decoded from compact ones)
+    MEMORY_COMPACT_POINTS,              // fixed point vertices of compact map objects
+    MEMORY_CURVES,                      // curves of curved map objects
+    MEMORY_CATEGORY_COUNT
+  };
+
+  /* Process wide counters of the memory allocated by TrackingAllocators, per category. The
+   * counters are atomic, so containers may allocate on any thread.
+   */
+  class MemoryTracker
+  {
+    public:
+      struct Counters
+      {
+          size_t bytes;                 // allocated now
+          size_t peak_bytes;            // since the start or resetPeak
+          uint64_t allocations;
+          uint64_t deallocations;
+      };
+
+      static void allocated (MemoryCategory category, size_t bytes);
+      static void deallocated (MemoryCategory category, size_t bytes);
+      static Counters getCounters (MemoryCategory category);
+      static const char * getName (MemoryCategory category);
+      static void resetPeak ();
+  };
+
+  /* Allocator counting its allocations in the MemoryTracker, otherwise like Base (e.g. the
+   * aligned allocator of Eigen). Stateless, all instances are equal.
+   */
+  template <typename T, MemoryCategory category, typename Base = std::allocator<T>>
+  class TrackingAllocator : public Base
+  {
+    public:
+      typedef T value_type;
+
+      template <typename U>
+      struct rebind
+      {
+          typedef TrackingAllocator<U, category, typename std::allocator_traits<Base>::template rebind_alloc<U>> other;
+      };
+
+      TrackingAllocator () noexcept
+      : Base ()
+      {
+      }
+
+      template <typename U, typename UBase>
+      TrackingAllocator (const TrackingAllocator<U, category, UBase> & other) noexcept
+      : Base (other)
+      {
+      }
+
+      T * allocate (size_t n)
+      {
+        T * p = Base::allocate (n);
+        MemoryTracker::allocated (category, n * sizeof (T));
+        return p;
+      }
+
+      void deallocate (T * p, size_t n)
+      {
+        MemoryTracker::deallocated (category, n * sizeof (T));
+        Base::deallocate (p, n);
+      }
+  };
+
+  template <typename T, typename U, MemoryCategory category, typename TBase, typename UBase>
+  bool operator== (const TrackingAllocator<T, category, TBase> &, const TrackingAllocator<U, category, UBase> &)
+  {
+    return true;
+  }
+
+  template <typename T, typename U, MemoryCategory category, typename TBase, typename UBase>
+  bool operator!= (const TrackingAllocator<T, category, TBase> &, const TrackingAllocator<U, category, UBase> &)
+  {
+    return false;
+  }
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "robot-parallel.h"
+#include "robot-pipeline.h"
+
+namespace Pathfinder
+{
+  // The workers of one parallel loop running on the pool
+  struct ParallelRun
+  {
+      std::mutex mutex;
+      std::condition_variable done;
+      bool closed;                      // the caller is done, workers starting now don't run
+      uint32_t running;
+  };
+
+  /* The threads helping the callers of the parallel loops. They are started when first needed
+   * and kept, so e.g. the loops of every batch of scans don't start threads.
+   */
+  static PipelineExecutor & parallelPool (uint32_t threads)
+  {
+    static PipelineExecutor pool (1);
+    pool.reserve (threads);
+    return pool;
+  }
+
+  /* Call worker (0) on the calling thread and worker (1) to worker (helpers) on the pool, and
+   * wait until they are done. A worker the pool only starts after the caller is done doesn't
+   * run, so loops started within loops never wait for queued workers.
+   */
+  static void parallelRun (uint32_t helpers, const std::function<void (uint32_t)> & worker)
+  {
+    std::shared_ptr<ParallelRun> run = std::make_shared<ParallelRun> ();
+    run->closed = false;
+    run->running = 0;
+    if (helpers > 0)
+      {
+        PipelineExecutor & pool = parallelPool (helpers);
+        for (uint32_t t=1; t <= helpers; ++t)
+          pool.post ([run, &worker, t] ()
+                     {
+                       {
+                         std::lock_guard<std::mutex> lock (run->mutex);
+                         if (run->closed)
+                           return;
+                         ++run->running;
+                       }
+
+                       worker (t);
+
+                       {
+                         std::lock_guard<std::mutex> lock (run->mutex);
+                         --run->running;
+                       }
+                       run->done.notify_all ();
+                     });
+      }
+
+    worker (0);
+
+    std::unique_lock<std::mutex> lock (run->mutex);
+    run->closed = true;
+    run->done.wait (lock, [&] () { return run->running == 0; });
+  }
+
+  /* Number of threads to use, if not configured: the number of cores.
+   */
+  uint32_t defaultThreadCount ()
+  {
+    return std::max (1u, std::thread::hardware_concurrency ());
+  }
+
+  /* Call body (i) for all i < count, distributed over threads (including the calling one, the
+   * others from a pool kept for all loops).
+   *
+   * Every thread takes the next index, until all are done, so bodies of different costs
+   * are balanced.
+   */
+  void parallelFor (uint32_t count, uint32_t threads, const std::function<void (uint32_t)> & body)
+  {
+    std::atomic<uint32_t> next (0);
+    auto worker = [&] (uint32_t)
+      {
+        uint32_t i;
+        while ((i = next++) < count)
+          body (i);
+      };
+
+    parallelRun (std::max (1u, std::min (threads, count)) - 1, worker);
+  }
+
+  /* Call body (i) for all i < count, distributed over threads (including the calling one, the
+   * others from the pool of parallelFor), with work stealing.
+   *
+   * Every thread starts with its own contiguous range of indices, so neighboring items (e.g.
+   * neighboring regions of a map) are processed by the same thread, and takes the indices from
+   * the front of it. A thread out of work steals the upper half of the remaining range of
+   * another one. The ranges (begin in the low, end in the high 32 bits) are changed by compare
+   * and swap only, so neither taking nor stealing blocks.
+   */
+  void parallelForStealing (uint32_t count, uint32_t threads, const std::function<void (uint32_t)> & body)
+  {
+    threads = std::max (1u, std::min (threads, count));
+
+    auto pack = [] (uint32_t begin, uint32_t end) { return uint64_t (end) << 32 | begin; };
+    std::vector<std::atomic<uint64_t>> ranges (threads);
+    for (uint32_t t=0; t < threads; ++t)
+      ranges[t] = pack (uint64_t (count) * t / threads, uint64_t (count) * (t + 1) / threads);
+
+    auto worker = [&] (uint32_t self)
+      {
+        for (;;)
+          {
+            uint64_t range = ranges[self].load ();
+            while (uint32_t (range) < (range >> 32))
+              if (ranges[self].compare_exchange_weak (range, range + 1))
+                {
+                  body (uint32_t (range));
+                  range = ranges[self].load ();
+                }
+
+            bool stolen = false;
+            for (uint32_t v=1; v < threads && !stolen; ++v)
+              {
+                std::atomic<uint64_t> & victim = ranges[(self + v) % threads];
+                range = victim.load ();
+                while (uint32_t (range) < (range >> 32))
+                  {
+                    uint32_t begin = range;
+                    uint32_t end = range >> 32;
+                    uint32_t middle = begin + (end - begin) / 2;
+                    if (victim.compare_exchange_weak (range, pack (begin, middle)))
+                      {
+                        ranges[self] = pack (middle, end);
+                        stolen = true;
+                        break;
+                      }
+                  }
+              }
+
+            if (!stolen)
+              return;
+          }
+      };
+
+    parallelRun (threads - 1, worker);
+  }
+}
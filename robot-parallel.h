@@ -0,0 +1,18 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_PARALLEL_H
+#define ROBOT_PARALLEL_H
+
+#include <cstdint>
+#include <functional>
+
+namespace Pathfinder
+{
+  uint32_t defaultThreadCount ();
+  void parallelFor (uint32_t count, uint32_t threads, const std::function<void (uint32_t)> & body);
+  void parallelForStealing (uint32_t count, uint32_t threads, const std::function<void (uint32_t)> & body);
+}
+
+#endif
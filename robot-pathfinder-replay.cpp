@@ -0,0 +1,208 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "robot-mapbuilder.h"
+#include "robot-mapfile.h"
+#include "robot-mappipeline.h"
+
+static void usage (const char * name)
+{
+  std::cerr << "Usage: " << name << " [options] <log file>" << std::endl
+            << "  --speed <x>       replay with x times real time (default: as fast as possible)" << std::endl
+            << "  --max-dist <d>    max. distance for joining scan points with objects (default 0.2)" << std::endl
+            << "  --max-gap <d>     max. distance of neighboring scan points in an object (default 0.5)" << std::endl
+            << "  --batch <n>       process n scans at a time in parallel, sharded by region (default 1: one by one)" << std::endl
+            << "  --threads <n>     number of threads for batches or the pipeline (default: number of cores)" << std::endl
+            << "  --pipeline        run the mapping as pipeline of stages, publishing to a viewer" << std::endl
+            << "  --publish-delay <ms>  time the viewer takes per update, with --pipeline (default 0)" << std::endl
+            << "  --memory-budget <MB>  keep the map within that memory, compacting and simplifying frozen objects" << std::endl
+            << "  --save <file>     save the map with its indexes (see MapFile)" << std::endl
+            << "  --trace <file>    write a Chrome trace (needs a build with PATHFINDER_TRACE)" << std::endl;
+}
+
+int main (int argc, char** argv)
+{
+  Pathfinder::MapBuilder::Parameters parameters;
+  std::string log_file;
+  std::string trace_file;
+  std::string map_file;
+  double speed = 0.0;
+  bool use_pipeline = false;
+  double publish_delay = 0.0;
+  double memory_budget = 0.0;
+
+  for (int i=1; i < argc; ++i)
+    {
+      if (i + 1 < argc && strcmp (argv[i], "--speed") == 0)
+        speed = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--max-dist") == 0)
+        parameters.max_dist = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--max-gap") == 0)
+        parameters.max_gap = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--batch") == 0)
+        parameters.batch_scans = std::max (1ul, strtoul (argv[++i], nullptr, 10));
+      else if (i + 1 < argc && strcmp (argv[i], "--threads") == 0)
+        parameters.threads = std::max (1ul, strtoul (argv[++i], nullptr, 10));
+      else if (strcmp (argv[i], "--pipeline") == 0)
+        use_pipeline = true;
+      else if (i + 1 < argc && strcmp (argv[i], "--publish-delay") == 0)
+        publish_delay = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--memory-budget") == 0)
+        memory_budget = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--save") == 0)
+        map_file = argv[++i];
+      else if (i + 1 < argc && strcmp (argv[i], "--trace") == 0)
+        trace_file = argv[++i];
+      else if (argv[i][0] != '-' && log_file.empty ())
+        log_file = argv[i];
+      else
+        {
+          usage (argv[0]);
+          return 1;
+        }
+    }
+
+  if (log_file.empty ())
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  Pathfinder::SensorLogReader reader;
+  if (!reader.open (log_file))
+    {
+      std::cerr << "Could not open " << log_file << std::endl;
+      return 1;
+    }
+
+  // With the pipeline, a replica of the map stands in for a viewer
+  Pathfinder::Map map;
+  Pathfinder::MapReplica viewer;
+  if (memory_budget > 0.0)
+    {
+      Pathfinder::Map::MemoryBudget budget;
+      budget.max_bytes = static_cast<size_t> (memory_budget * 1024 * 1024);
+      map.setMemoryBudget (budget);
+    }
+  std::unique_ptr<Pathfinder::MapBuilder> own_builder;
+  std::unique_ptr<Pathfinder::MappingPipeline> pipeline;
+  if (use_pipeline)
+    {
+      Pathfinder::MappingPipeline::Parameters pipeline_parameters;
+      pipeline_parameters.builder = parameters;
+      pipeline_parameters.threads = parameters.threads;
+      pipeline.reset (new Pathfinder::MappingPipeline (map, pipeline_parameters,
+                                                       [&] (const Pathfinder::MappingPipeline::Update & update)
+                                                       {
+                                                         std::this_thread::sleep_for (std::chrono::duration<double, std::milli> (publish_delay));
+                                                         for (const std::vector<uint8_t> & message: update.messages)
+                                                           viewer.apply (message.data (), message.size ());
+                                                       }));
+    }
+  else
+    own_builder.reset (new Pathfinder::MapBuilder (map, parameters));
+  const Pathfinder::MapBuilder & builder = pipeline ? pipeline->getBuilder () : *own_builder;
+
+  auto start = std::chrono::steady_clock::now ();
+  uint64_t records;
+  if (pipeline)
+    {
+      records = reader.replay (*pipeline, speed);
+      pipeline->flush ();
+    }
+  else
+    {
+      records = reader.replay (*own_builder, speed);
+      own_builder->flush ();
+    }
+  double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+  if (reader.getPosition () < reader.getFileSize ())
+    std::cerr << "Warning: log truncated after " << reader.getPosition () << " bytes" << std::endl;
+
+  std::cout << "records:      " << records << " (" << (pipeline ? pipeline->getPoseCount () : builder.getPoseCount ()) << " poses, "
+            << builder.getScanCount () << " scans)" << std::endl;
+  std::cout << "wall time:    " << seconds << " s" << std::endl;
+  std::cout << "throughput:   " << builder.getScanCount () / seconds << " scans/s, "
+            << builder.getPointCount () / seconds << " points/s" << std::endl;
+
+  for (uint32_t s=0; s < Pathfinder::MapBuilder::STAGE_COUNT; ++s)
+    {
+      Pathfinder::MapBuilder::Stage stage = static_cast<Pathfinder::MapBuilder::Stage> (s);
+      Pathfinder::MapBuilder::StageStats stats = builder.getStageStats (stage);
+      std::cout << "stage " << Pathfinder::MapBuilder::getStageName (stage) << ": mean "
+                << stats.mean_us << " us, p50 " << stats.p50_us << " us, p99 " << stats.p99_us
+                << " us, max " << stats.max_us << " us" << std::endl;
+    }
+
+  for (uint32_t s=0; pipeline && s < pipeline->getStageCount (); ++s)
+    {
+      const Pathfinder::PipelineStageBase & stage = pipeline->getStage (s);
+      Pathfinder::PipelineStageBase::Stats stats = stage.getStats ();
+      std::cout << "pipeline " << stage.getName () << ": " << stats.processed << " items, max depth "
+                << stats.max_depth << "/" << stage.getCapacity () << ", latency mean " << stats.mean_latency_us
+                << " us, max " << stats.max_latency_us << " us, busy " << stats.busy_us / 1e6 << " s, "
+                << stats.stalls << " stalls, " << stats.dropped << " dropped, " << stats.coalesced
+                << " coalesced" << std::endl;
+    }
+
+  uint64_t vertices = 0;
+  uint32_t closed = 0;
+  uint32_t static_objects = 0;
+  uint32_t frozen = 0;
+  for (const Pathfinder::MapObject & obj: map.getObjects ())
+    {
+      vertices += obj.getPointCount ();
+      if (obj.isClosed ())
+        ++closed;
+      if (obj.getMotion () == Pathfinder::MapObject::MOTION_STATIC)
+        ++static_objects;
+      if (obj.isFrozen ())
+        ++frozen;
+    }
+
+  std::cout << "map:          " << map.getObjectCount () << " objects (" << closed << " closed, "
+            << static_objects << " static, " << frozen << " frozen), " << vertices << " vertices" << std::endl;
+  std::cout << "dynamic:      " << map.getDynamicObjectCount () << " objects" << std::endl;
+
+  Pathfinder::Map::MemoryStats memory = map.getMemoryStats ();
+  std::cout << "memory:       " << memory.total / 1024 << " kB (objects " << memory.objects / 1024 << " kB, points "
+            << memory.points / 1024 << " kB, compact " << memory.compact_points / 1024 << " kB, curves "
+            << memory.curves / 1024 << " kB, decoded "
+            << memory.decoded_points / 1024 << " kB, static index " << memory.static_index / 1024 << " kB, closed index "
+            << memory.closed_index / 1024 << " kB, changes " << memory.change_tracking / 1024 << " kB)" << std::endl;
+  for (uint32_t c=0; c < Pathfinder::MEMORY_CATEGORY_COUNT; ++c)
+    {
+      Pathfinder::MemoryCategory category = static_cast<Pathfinder::MemoryCategory> (c);
+      Pathfinder::MemoryTracker::Counters counters = Pathfinder::MemoryTracker::getCounters (category);
+      std::cout << "allocated " << Pathfinder::MemoryTracker::getName (category) << ": " << counters.bytes / 1024
+                << " kB, peak " << counters.peak_bytes / 1024 << " kB, " << counters.allocations << " allocations" << std::endl;
+    }
+
+  if (pipeline)
+    std::cout << "viewer:       " << viewer.getObjectCount () << " objects, version " << viewer.getVersion () << std::endl;
+
+  if (!map_file.empty () && !Pathfinder::MapFile::save (map, map_file))
+    {
+      std::cerr << "Could not write " << map_file << std::endl;
+      return 1;
+    }
+
+  if (!trace_file.empty () && !Pathfinder::Trace::writeChromeTrace (trace_file))
+    {
+      std::cerr << "Could not write " << trace_file << std::endl;
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "robot-exploration.h"
+#include "robot-mapbuilder.h"
+#include "robot-mapgen.h"
+#include "robot-simulator.h"
+
+namespace Pathfinder
+{
+  /* Passes the observations to two sinks, e.g. the mapping and a log writer.
+   */
+  class ObservationTee : public ObservationSink
+  {
+    public:
+      ObservationTee (ObservationSink & first, ObservationSink & second)
+      : _first (first), _second (second) {}
+
+      virtual void pushPose (double time, const Transformation & pose)
+      {
+        _first.pushPose (time, pose);
+        _second.pushPose (time, pose);
+      }
+
+      virtual void pushScan (double time, const RangeScan & scan)
+      {
+        _first.pushScan (time, scan);
+        _second.pushScan (time, scan);
+      }
+
+    private:
+      ObservationSink & _first;
+      ObservationSink & _second;
+  };
+
+  /* A simulated robot with its own map and exploration grid, built from its observations.
+   */
+  struct FleetMember
+  {
+      FleetMember (const RayCaster & terrain, const std::vector<Position,Eigen::aligned_allocator<Position>> & route,
+                   double start_offset, uint32_t seed)
+      : map (),
+        builder (map, MapBuilder::Parameters ()),
+        explorer (ExplorationGrid::Parameters ()),
+        observers (builder, explorer),
+        robot (terrain, route, start_offset, SimulatedRobot::Parameters (), seed),
+        wall_time (0.0)
+      {
+      }
+
+      Map map;
+      MapBuilder builder;
+      ExplorationGrid explorer;
+      ObservationTee observers;
+      SimulatedRobot robot;
+      double wall_time;
+  };
+
+  /* Route through the centers of a grid of rooms, row by row and back again, which passes
+   * the doors in the middle of the walls (see MapGenerator::addRooms).
+   */
+  std::vector<Position,Eigen::aligned_allocator<Position>> roomRoute (uint32_t rooms, double room_size)
+  {
+    std::vector<Position,Eigen::aligned_allocator<Position>> route;
+    for (uint32_t j=0; j < rooms; ++j)
+      for (uint32_t k=0; k < rooms; ++k)
+        {
+          uint32_t i = j % 2 == 0 ? k : rooms - 1 - k;
+          route.push_back (Position ((i + 0.5) * room_size, (j + 0.5) * room_size));
+        }
+
+    for (uint32_t i=route.size () - 1; i > 1; --i)
+      route.push_back (route[i-1]);
+
+    return route;
+  }
+}
+
+static void usage (const char * name)
+{
+  std::cerr << "Usage: " << name << " [options]" << std::endl
+            << "  --robots <n>      number of simulated robots (default 1)" << std::endl
+            << "  --threads <n>     number of threads (default: number of cores)" << std::endl
+            << "  --duration <s>    simulated time per robot in seconds (default 60)" << std::endl
+            << "  --rooms <n>       the terrain has n x n rooms (default 3)" << std::endl
+            << "  --seed <n>        seed of the terrain and the noise (default 1)" << std::endl
+            << "  --record <file>   write the observations of the first robot as sensor log" << std::endl;
+}
+
+int main (int argc, char** argv)
+{
+  uint32_t robots = 1;
+  uint32_t threads = std::max (1u, std::thread::hardware_concurrency ());
+  double duration = 60.0;
+  uint32_t rooms = 3;
+  uint32_t seed = 1;
+  std::string record_file;
+
+  for (int i=1; i < argc; ++i)
+    {
+      if (i + 1 < argc && strcmp (argv[i], "--robots") == 0)
+        robots = std::max (1ul, strtoul (argv[++i], nullptr, 10));
+      else if (i + 1 < argc && strcmp (argv[i], "--threads") == 0)
+        threads = std::max (1ul, strtoul (argv[++i], nullptr, 10));
+      else if (i + 1 < argc && strcmp (argv[i], "--duration") == 0)
+        duration = atof (argv[++i]);
+      else if (i + 1 < argc && strcmp (argv[i], "--rooms") == 0)
+        rooms = std::max (1ul, strtoul (argv[++i], nullptr, 10));
+      else if (i + 1 < argc && strcmp (argv[i], "--seed") == 0)
+        seed = strtoul (argv[++i], nullptr, 10);
+      else if (i + 1 < argc && strcmp (argv[i], "--record") == 0)
+        record_file = argv[++i];
+      else
+        {
+          usage (argv[0]);
+          return 1;
+        }
+    }
+
+  // Ground truth: rooms with some clutter away from the route
+  const double room_size = 8.0;
+  Pathfinder::Map truth;
+  Pathfinder::MapGenerator gen (seed);
+  gen.addRooms (truth, rooms, rooms, room_size, 1.2, 1.0, 0.0);
+
+  std::vector<Pathfinder::Position,Eigen::aligned_allocator<Pathfinder::Position>> route
+    = Pathfinder::roomRoute (rooms, room_size);
+  for (uint32_t i=0; i < rooms * rooms * 2; ++i)
+    {
+      Pathfinder::Position center = gen.randomPosition (Pathfinder::Position (0.5, 0.5),
+                                                        Pathfinder::Position (rooms * room_size - 0.5, rooms * room_size - 0.5));
+      bool near_route = false;
+      for (uint32_t j=1; j < route.size (); ++j)
+        if (Pathfinder::LineSegment (route[j-1], route[j]).distance (center) < 1.5)
+          near_route = true;
+
+      if (!near_route)
+        truth.addObject (gen.noisyCircle (center, 0.3, 16, 0.0));
+    }
+
+  Pathfinder::RayCaster terrain (truth, 2.0);
+
+  std::vector<std::unique_ptr<Pathfinder::FleetMember>> fleet;
+  double route_length = 0.0;
+  for (uint32_t i=1; i < route.size (); ++i)
+    route_length += route[i-1].distance (route[i]);
+  for (uint32_t i=0; i < robots; ++i)
+    fleet.emplace_back (new Pathfinder::FleetMember (terrain, route, route_length * i / robots, seed + i));
+
+  Pathfinder::SensorLogWriter recorder;
+  if (!record_file.empty () && !recorder.open (record_file))
+    {
+      std::cerr << "Could not open " << record_file << std::endl;
+      return 1;
+    }
+
+  // Every thread takes the next robot, until all are done.
+  std::atomic<uint32_t> next_robot (0);
+  auto worker = [&] ()
+    {
+      uint32_t idx;
+      while ((idx = next_robot++) < fleet.size ())
+        {
+          Pathfinder::FleetMember & member = *fleet[idx];
+          auto start = std::chrono::steady_clock::now ();
+          if (idx == 0 && recorder.isOpen ())
+            {
+              Pathfinder::ObservationTee tee (member.observers, recorder);
+              member.robot.run (tee, duration);
+            }
+          else
+            member.robot.run (member.observers, duration);
+          member.wall_time = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+        }
+    };
+
+  auto start = std::chrono::steady_clock::now ();
+  std::vector<std::thread> pool;
+  for (uint32_t i=0; i < std::min<uint32_t> (threads, robots); ++i)
+    pool.emplace_back (worker);
+  for (std::thread & t: pool)
+    t.join ();
+  double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+  recorder.close ();
+  if (!recorder.ok ())
+    {
+      std::cerr << "Could not write " << record_file << std::endl;
+      return 1;
+    }
+
+  uint64_t scans = 0;
+  uint64_t points = 0;
+  for (uint32_t i=0; i < fleet.size (); ++i)
+    {
+      Pathfinder::FleetMember & member = *fleet[i];
+      Pathfinder::MapQuality quality = Pathfinder::MapQuality::compare (member.map, terrain, 0.5);
+      const Pathfinder::ExplorationGrid::Stats & exploration = member.explorer.getStats ();
+      scans += member.builder.getScanCount ();
+      points += member.builder.getPointCount ();
+
+      std::cout << "robot " << i << ": " << member.builder.getScanCount () << " scans in "
+                << member.wall_time << " s (" << duration / member.wall_time << "x real time), "
+                << member.map.getObjectCount () << " objects, " << quality.vertices << " vertices, error mean "
+                << quality.mean_error << " p95 " << quality.p95_error << " max " << quality.max_error
+                << ", " << quality.outliers << " outliers, " << member.explorer.getClusterCount ()
+                << " frontiers (update mean " << exploration.frontier_us / std::max<uint64_t> (1, exploration.scans)
+                << " us, max " << exploration.max_frontier_us << " us)" << std::endl;
+    }
+
+  std::cout << "fleet: " << robots << " robots on " << pool.size () << " threads, " << seconds << " s, "
+            << scans / seconds << " scans/s, " << points / seconds << " points/s" << std::endl;
+  return 0;
+}
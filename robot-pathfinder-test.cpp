@@ -0,0 +1,930 @@
+/*
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "robot-anytimeplanner.h"
+#include "robot-collision.h"
+#include "robot-costmap.h"
+#include "robot-hierarchicalplanner.h"
+#include "robot-map.h"
+#include "robot-mapbuilder.h"
+#include "robot-mapfile.h"
+#include "robot-mapgen.h"
+#include "robot-mapjournal.h"
+#include "robot-posegraph.h"
+#include "robot-sensorlog.h"
+#include "robot-simulator.h"
+#include "robot-sweep.h"
+
+namespace Pathfinder
+{
+  /* Compacted vertices stay within the resolution of the original ones, the object keeps
+   * its point count and whether it is closed.
+   */
+  static bool testCompact ()
+  {
+    MapObject obj (0.01);
+    for (uint32_t i=0; i < 1000; ++i)
+      {
+        double angle = i * 2.0 * M_PI / 1000.0;
+        double radius = 10.0 + 0.003 * std::sin (37.0 * angle);
+        obj.appendPoint (Position (3.0 + radius * std::cos (angle), 4.0 + radius * std::sin (angle)));
+      }
+    obj.setClosed (true);
+    MapObject compact (obj);
+    if (!compact.compact (0.001) || !compact.isCompact () || compact.getPointCount () != obj.getPointCount ()
+        || compact.isClosed () != obj.isClosed ())
+      {
+        std::cerr << "compacting failed or changed the object" << std::endl;
+        return false;
+      }
+
+    for (uint32_t i=0; i < obj.getPointCount (); ++i)
+      if (compact.getPoint (i).distance (obj.getPoint (i)) > 0.001)
+        {
+          std::cerr << "point " << i << " moved by " << compact.getPoint (i).distance (obj.getPoint (i)) << std::endl;
+          return false;
+        }
+
+    compact.expand ();
+    if (compact.isCompact () || compact.getPointCount () != obj.getPointCount ())
+      {
+        std::cerr << "expanding failed" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* Poses and scans written to a sensor log are read back unchanged and in order.
+   */
+  static bool testSensorLog ()
+  {
+    const char * file_name = "robot-pathfinder-test.pfsl";
+    SensorLogWriter writer;
+    if (!writer.open (file_name))
+      {
+        std::cerr << "could not open " << file_name << std::endl;
+        return false;
+      }
+
+    RangeScan scan;
+    scan.angle_min = -1.5f;
+    scan.angle_increment = 0.01f;
+    scan.max_range = 10.0f;
+    for (uint32_t i=0; i < 300; ++i)
+      scan.ranges.push_back (0.5f + 0.01f * i);
+    for (uint32_t i=0; i < 10; ++i)
+      {
+        writer.pushPose (0.1 * i, Transformation (Position (0.1 * i, 2.0), 0.05 * i, 1.0));
+        writer.pushScan (0.1 * i + 0.05, scan);
+      }
+    writer.close ();
+
+    SensorLogReader reader;
+    bool read = reader.open (file_name);
+    SensorLogReader::Record record;
+    for (uint32_t i=0; read && i < 20; ++i)
+      {
+        read = reader.next (record) && record.type == (i % 2 == 0 ? SensorLogReader::POSE : SensorLogReader::SCAN)
+               && std::abs (record.time - (0.1 * (i / 2) + (i % 2) * 0.05)) < 1e-12;
+        if (read && record.type == SensorLogReader::POSE)
+          read = (record.pose.getTranslation () - Position (0.1 * (i / 2), 2.0)).norm () < 1e-12;
+        else if (read)
+          read = record.scan.angle_min == scan.angle_min && record.scan.angle_increment == scan.angle_increment
+                 && record.scan.max_range == scan.max_range && record.scan.ranges == scan.ranges;
+      }
+    read = read && !reader.next (record);
+    reader.close ();
+    std::remove (file_name);
+
+    if (!read)
+      std::cerr << "records differ from those written" << std::endl;
+    return read;
+  }
+
+  /* A circle driven straight at a wall touches it when its center is a radius away, a
+   * circle passing the end of the wall keeps its distance.
+   */
+  static bool testCollision ()
+  {
+    Map map;
+    MapGenerator gen (3);
+    map.addObject (gen.wall (Position (2.0, -1.0), Position (2.0, 1.0), 0.25, 0.0));
+    CollisionChecker checker (map, CollisionChecker::Parameters ());
+    Footprint footprint = Footprint::circle (0.5);
+
+    Trajectory towards;
+    towards.times = {0.0, 4.0};
+    towards.poses = {Transformation (Position (0.0, 0.0), 0.0, 1.0), Transformation (Position (4.0, 0.0), 0.0, 1.0)};
+    CollisionChecker::Result result = checker.check (footprint, towards);
+    // The contact is bisected within the step, to 1/1024 of it
+    if (!result.collision || std::abs (result.time - 1.5) > 4.0 / 1024.0)
+      {
+        std::cerr << "first contact at " << result.time << " (collision " << result.collision << "), expected 1.5"
+                  << std::endl;
+        return false;
+      }
+
+    Trajectory passing;
+    passing.times = {0.0, 4.0};
+    passing.poses = {Transformation (Position (0.0, 2.0), 0.0, 1.0), Transformation (Position (4.0, 2.0), 0.0, 1.0)};
+    result = checker.check (footprint, passing);
+    if (result.collision || std::abs (result.clearance - 0.5) > 1e-6)
+      {
+        std::cerr << "passing with clearance " << result.clearance << " (collision " << result.collision
+                  << "), expected 0.5" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* The sweep finds the same intersecting pairs as testing all pairs, also for segments on
+   * a coarse grid (shared end points, collinear overlaps, vertical segments). A polyline
+   * with a small loop is repaired to have no crossings.
+   */
+  static bool testSweep ()
+  {
+    std::mt19937 rng (5);
+    std::uniform_real_distribution<double> coordinate (0.0, 10.0);
+    std::uniform_int_distribution<int> grid (0, 6);
+    for (uint32_t trial=0; trial < 200; ++trial)
+      {
+        SegmentSweep sweep;
+        std::vector<std::pair<Position, Position>, Eigen::aligned_allocator<std::pair<Position, Position>>> segments;
+        uint32_t count = 2 + rng () % 40;
+        for (uint32_t i=0; i < count; ++i)
+          {
+            Position a = trial % 2 ? Position (grid (rng), grid (rng)) : Position (coordinate (rng), coordinate (rng));
+            Position b = trial % 2 ? Position (grid (rng), grid (rng)) : Position (coordinate (rng), coordinate (rng));
+            if (trial % 4 == 3)
+              b.x () = a.x ();
+            segments.push_back (std::make_pair (a, b));
+            sweep.addSegment (a, b);
+          }
+
+        SegmentSweep::CrossingVector crossings;
+        sweep.findCrossings (crossings);
+        std::set<std::pair<uint32_t, uint32_t>> found, expected;
+        for (const SegmentSweep::Crossing & crossing: crossings)
+          found.insert (std::make_pair (crossing.segment1, crossing.segment2));
+        Position position;
+        for (uint32_t i=0; i < count; ++i)
+          for (uint32_t j=i+1; j < count; ++j)
+            if (SegmentSweep::intersect (segments[i].first, segments[i].second, segments[j].first, segments[j].second,
+                                         &position))
+              expected.insert (std::make_pair (i, j));
+
+        if (found != expected)
+          {
+            std::cerr << "trial " << trial << ": " << found.size () << " intersections, expected "
+                      << expected.size () << std::endl;
+            return false;
+          }
+      }
+
+    MapObject obj (0.0);
+    obj.setPolygon ({Position (0.0, 0.0), Position (2.0, 0.0), Position (2.2, 0.2), Position (2.1, 0.3),
+                     Position (1.9, -0.1), Position (4.0, 0.0)});
+    SegmentSweep::CrossingVector crossings;
+    obj.findCrossings (crossings);
+    if (crossings.size () != 1 || obj.removeCrossings (1.0) != 1)
+      {
+        std::cerr << crossings.size () << " self-crossings, expected 1, or not repaired" << std::endl;
+        return false;
+      }
+
+    obj.findCrossings (crossings);
+    if (!crossings.empty ())
+      {
+        std::cerr << crossings.size () << " self-crossings left after the repair" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* The closed objects found for each point by classifyPoints are those whose contains ()
+   * tells so, for both layers.
+   */
+  static bool testClassify ()
+  {
+    Map map;
+    MapGenerator gen (6);
+    gen.addRooms (map, 2, 2, 5.0, 1.0, 0.5, 0.02);
+    gen.addClutter (map, 20, Position (0.5, 0.5), Position (9.5, 9.5), 0.8, 12, 0.05);
+    map.moveToDynamic (map.getObjectCount () - 1);
+
+    std::vector<Position, Eigen::aligned_allocator<Position>> points;
+    for (uint32_t i=0; i < 2000; ++i)
+      points.push_back (gen.randomPosition (Position (-1.0, -1.0), Position (11.0, 11.0)));
+    std::vector<uint32_t> offsets, objects;
+    map.classifyPoints (points.data (), points.size (), offsets, objects, 2);
+
+    for (uint32_t i=0; i < points.size (); ++i)
+      {
+        std::vector<uint32_t> expected;
+        for (uint32_t j=0; j < map.getObjectCount (); ++j)
+          if (map.getObjects ()[j].isClosed () && map.getObjects ()[j].contains (points[i]))
+            expected.push_back (j);
+        for (uint32_t j=0; j < map.getDynamicObjectCount (); ++j)
+          if (map.getDynamicObjects ()[j].isClosed () && map.getDynamicObjects ()[j].contains (points[i]))
+            expected.push_back (map.getObjectCount () + j);
+
+        if (std::vector<uint32_t> (objects.begin () + offsets[i], objects.begin () + offsets[i+1]) != expected)
+          {
+            std::cerr << "point " << i << " is in " << offsets[i+1] - offsets[i] << " objects, expected "
+                      << expected.size () << std::endl;
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  /* Planning in short slices, the anytime planner keeps its paths within the bound of the
+   * optimal cost and ends with the optimal path.
+   */
+  static bool testAnytime ()
+  {
+    Map map;
+    MapGenerator gen (7);
+    gen.addRooms (map, 3, 3, 6.0, 1.0, 0.1, 0.01);
+    gen.addClutter (map, 20, Position (1.0, 1.0), Position (17.0, 17.0), 0.3, 12, 0.01);
+    Position from (1.3, 1.1), to (16.2, 16.6);
+
+    AnytimePlanner::Parameters parameters;
+    parameters.initial_epsilon = 1.0;
+    AnytimePlanner optimal (map, parameters);
+    optimal.start (from, to);
+    if (optimal.plan (std::chrono::steady_clock::time_point::max ()) != AnytimePlanner::STATUS_OPTIMAL)
+      {
+        std::cerr << "no optimal path" << std::endl;
+        return false;
+      }
+
+    AnytimePlanner planner (map, AnytimePlanner::Parameters ());
+    AnytimePlanner::Status status = planner.start (from, to);
+    for (uint32_t i=0; i < 10000 && status != AnytimePlanner::STATUS_OPTIMAL; ++i)
+      {
+        status = planner.plan (std::chrono::steady_clock::now () + std::chrono::milliseconds (1));
+        if (status == AnytimePlanner::STATUS_IMPROVING
+            && planner.getPathCost () > planner.getBound () * optimal.getPathCost () + 1e-9)
+          {
+            std::cerr << "cost " << planner.getPathCost () << " above the bound " << planner.getBound () << std::endl;
+            return false;
+          }
+      }
+
+    if (status != AnytimePlanner::STATUS_OPTIMAL || std::abs (planner.getPathCost () - optimal.getPathCost ()) > 1e-9)
+      {
+        std::cerr << "ended with status " << status << ", cost " << planner.getPathCost () << ", optimal "
+                  << optimal.getPathCost () << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* The hierarchical planner finds a path whenever the optimal planner does, not shorter and
+   * at most a quarter longer than the optimal one.
+   */
+  static bool testHierarchical ()
+  {
+    Map map;
+    MapGenerator gen (8);
+    gen.addRooms (map, 4, 4, 6.0, 1.0, 0.1, 0.01);
+    gen.addClutter (map, 30, Position (1.0, 1.0), Position (23.0, 23.0), 0.3, 12, 0.01);
+    HierarchicalPlanner planner (map, HierarchicalPlanner::Parameters ());
+    AnytimePlanner::Parameters parameters;
+    parameters.initial_epsilon = 1.0;
+    AnytimePlanner optimal (map, parameters);
+
+    for (uint32_t i=0; i < 10; ++i)
+      {
+        Position from = gen.randomPosition (Position (1.0, 1.0), Position (23.0, 23.0));
+        Position to = gen.randomPosition (Position (1.0, 1.0), Position (23.0, 23.0));
+        PositionVector path;
+        HierarchicalPlanner::Result result = planner.findPath (from, to, path);
+        optimal.start (from, to);
+        bool found = optimal.plan (std::chrono::steady_clock::time_point::max ()) == AnytimePlanner::STATUS_OPTIMAL;
+        if (result.found != found
+            || (found && (result.cost < optimal.getPathCost () - 1e-6 || result.cost > 1.25 * optimal.getPathCost ())))
+          {
+            std::cerr << "query " << i << ": found " << result.found << ", cost " << result.cost << ", optimal found "
+                      << found << ", cost " << optimal.getPathCost () << std::endl;
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  /* Costs updated after edits within the map equal those of a costmap built from scratch.
+   */
+  static bool testCostmap ()
+  {
+    Map map;
+    MapGenerator gen (2);
+    gen.addRooms (map, 2, 2, 5.0, 1.0, 0.5, 0.02);
+
+    Costmap costmap (map, Costmap::Parameters ());
+    Costmap::Stats before = costmap.getStats ();
+
+    // Within the bounding box of the map, so the extent of the costmap stays the same
+    MapObject & wall = map.getObject (0);
+    wall.appendPoint (wall.getPoint (wall.getPointCount () - 1) + Position (0.3, -0.2));
+    gen.addClutter (map, 3, Position (1.0, 1.0), Position (9.0, 9.0), 0.3, 8, 0.01);
+    costmap.update ();
+
+    if (costmap.getStats ().rebuilds != before.rebuilds || costmap.getStats ().regions == before.regions)
+      {
+        std::cerr << "update rebuilt the costmap or updated no region" << std::endl;
+        return false;
+      }
+
+    Costmap fresh (map, Costmap::Parameters ());
+    if (costmap.getWidth () != fresh.getWidth () || costmap.getHeight () != fresh.getHeight ()
+        || costmap.getOrigin () != fresh.getOrigin ())
+      {
+        std::cerr << "update changed the extent of the costmap" << std::endl;
+        return false;
+      }
+
+    for (uint32_t y=0; y < costmap.getHeight (); ++y)
+      if (memcmp (costmap.getCosts () + y * costmap.getStride (), fresh.getCosts () + y * fresh.getStride (),
+                  costmap.getWidth ()) != 0)
+        {
+          std::cerr << "costs of row " << y << " differ from a rebuild" << std::endl;
+          return false;
+        }
+
+    return true;
+  }
+
+  /* Compare the replica with the map, both layers, the points quantized as the journal does.
+   */
+  static bool testReplicaMatches (const Map & map, const MapReplica & replica, double resolution)
+  {
+    if (replica.getObjectCount () != map.getObjectCount () + map.getDynamicObjectCount ())
+      {
+        std::cerr << "replica has " << replica.getObjectCount () << " objects, map "
+                  << map.getObjectCount () + map.getDynamicObjectCount () << std::endl;
+        return false;
+      }
+
+    std::vector<uint32_t> ids;
+    replica.getIds (ids);
+    for (uint32_t id: ids)
+      {
+        bool map_dynamic = false;
+        const MapObject * obj = map.findObject (id, &map_dynamic);
+        PositionVector points;
+        bool dynamic = false;
+        if (!obj || !replica.getObject (id, points, &dynamic))
+          {
+            std::cerr << "object " << id << " missing" << std::endl;
+            return false;
+          }
+
+        if (dynamic != map_dynamic || points.size () != obj->getPointCount ())
+          {
+            std::cerr << "object " << id << " differs: " << points.size () << " points, map "
+                      << obj->getPointCount () << std::endl;
+            return false;
+          }
+
+        for (uint32_t i=0; i < points.size (); ++i)
+          {
+            Position p = obj->getPoint (i);
+            Position q (std::lround (p.x () / resolution) * resolution, std::lround (p.y () / resolution) * resolution);
+            if (points[i].distance (q) > 1e-9)
+              {
+                std::cerr << "object " << id << " point " << i << " differs" << std::endl;
+                return false;
+              }
+          }
+      }
+
+    return true;
+  }
+
+  /* A replica kept up to date with deltas of the journal equals the map after each sync:
+   * points appended, objects added, moved to the dynamic layer and removed.
+   */
+  static bool testJournal ()
+  {
+    Map map;
+    MapGenerator gen (1);
+    gen.addRooms (map, 2, 2, 5.0, 1.0, 0.5, 0.02);
+
+    MapJournal journal (map, MapJournal::Parameters ());
+    MapReplica replica;
+    std::vector<uint8_t> message;
+
+    auto send = [&] (const char * step)
+      {
+        journal.sync ();
+        journal.encode (replica.getVersion (), message);
+        if (!replica.apply (message.data (), message.size ()) || replica.getVersion () != journal.getVersion ())
+          {
+            std::cerr << step << ": message not applied" << std::endl;
+            return false;
+          }
+
+        if (!testReplicaMatches (map, replica, journal.getParameters ().resolution))
+          {
+            std::cerr << step << ": replica differs" << std::endl;
+            return false;
+          }
+
+        return true;
+      };
+
+    if (!send ("snapshot"))
+      return false;
+
+    MapObject & wall = map.getObject (0);
+    wall.appendPoint (wall.getPoint (wall.getPointCount () - 1) + Position (0.1, 0.05));
+    map.addObject (gen.wall (Position (2.0, 2.0), Position (3.0, 2.5), 0.25, 0.01));
+    map.moveToDynamic (1);
+    map.addDynamicObject (gen.noisyCircle (Position (7.0, 7.0), 0.3, 8, 0.01));
+    if (!send ("edits"))
+      return false;
+
+    map.removeDynamicObject (0);
+    map.getObject (2).appendPoint (Position (0.5, 0.5));
+    return send ("removal");
+  }
+
+  /* A square driven with drifting odometry: Closing the loop lowers the error and brings
+   * the last pose back to the start.
+   */
+  static bool testPoseGraph ()
+  {
+    PoseGraph::Parameters parameters;
+    PoseGraph graph (parameters);
+    std::mt19937 rng (1);
+    std::normal_distribution<double> noise (0.0, 0.02);
+    Eigen::Matrix3d information = Eigen::Matrix3d::Identity () * 100.0;
+
+    Transformation pose (Position (0.0, 0.0), 0.0, 1.0);
+    graph.addNode (pose);
+    for (uint32_t i=1; i <= 40; ++i)
+      {
+        double rotation = i % 10 == 0 ? M_PI / 2.0 : 0.0;
+        Transformation odometry (Position (1.0 + noise (rng), noise (rng)), rotation + noise (rng), 1.0);
+        pose = pose * odometry;
+        pose.update ();
+        graph.addNode (pose);
+        graph.addEdge (i - 1, i, Transformation (Position (1.0, 0.0), rotation, 1.0), information,
+                       PoseGraph::EDGE_ODOMETRY);
+      }
+
+    double before = graph.optimize ();
+    double drift = graph.getPose (40).getTranslation ().norm ();
+    graph.addEdge (0, 40, Transformation (Position (0.0, 0.0), 0.0, 1.0), information * 10.0, PoseGraph::EDGE_SCAN_MATCH);
+    double after = graph.optimize ();
+    double closed = graph.getPose (40).getTranslation ().norm ();
+    if (after > before + 1e-9 || closed > 0.05 || closed > drift)
+      {
+        std::cerr << "error " << before << " -> " << after << ", distance of the last pose to the start " << drift
+                  << " -> " << closed << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* The map built from a simulated drive in batch mode is the same for one and for several
+   * threads.
+   */
+  static bool testParallelBuilder ()
+  {
+    Map terrain;
+    MapGenerator gen (9);
+    gen.addRooms (terrain, 2, 2, 8.0, 1.2, 0.5, 0.0);
+    gen.addClutter (terrain, 6, Position (1.0, 1.0), Position (15.0, 15.0), 0.4, 16, 0.0);
+    RayCaster caster (terrain, 2.0);
+    std::vector<Position, Eigen::aligned_allocator<Position>> route {Position (4.0, 4.0), Position (12.0, 4.0),
+                                                                     Position (12.0, 12.0), Position (4.0, 12.0)};
+
+    std::vector<Position, Eigen::aligned_allocator<Position>> points[2];
+    for (uint32_t run=0; run < 2; ++run)
+      {
+        Map map;
+        MapBuilder::Parameters parameters;
+        parameters.batch_scans = 8;
+        parameters.threads = run == 0 ? 1 : 3;
+        MapBuilder builder (map, parameters);
+        SimulatedRobot robot (caster, route, 0.0, SimulatedRobot::Parameters (), 3);
+        robot.run (builder, 20.0);
+        builder.flush ();
+
+        for (const std::vector<MapObject> * layer: {&map.getObjects (), &map.getDynamicObjects ()})
+          for (const MapObject & obj: *layer)
+            {
+              for (uint32_t i=0; i < obj.getPointCount (); ++i)
+                points[run].push_back (obj.getPoint (i));
+              points[run].push_back (Position (obj.isFrozen (), obj.getMotion ()));
+            }
+      }
+
+    if (points[0].size () < 100 || points[0] != points[1])
+      {
+        std::cerr << points[0].size () << " vertices with one thread, " << points[1].size () << " with three"
+                  << (points[0].size () == points[1].size () ? ", differing" : "") << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* Fills the map with rooms, clutter, a compact and a dynamic object, as saved by the map
+   * file tests.
+   */
+  static void testFillMap (Map & map)
+  {
+    MapGenerator gen (10);
+    gen.addRooms (map, 3, 3, 5.0, 1.0, 0.2, 0.02);
+    gen.addClutter (map, 10, Position (1.0, 1.0), Position (14.0, 14.0), 0.3, 12, 0.01);
+    map.getObject (2).compact (0.001);
+    map.freezeObject (3);
+    map.moveToDynamic (map.getObjectCount () - 1);
+  }
+
+  /* Both layers are loaded back from a map file with the same points, compact and frozen
+   * objects stay so.
+   */
+  static bool testMapFile ()
+  {
+    const char * file_name = "robot-pathfinder-test.pfmp";
+    Map map;
+    testFillMap (map);
+    Map loaded;
+    bool done = MapFile::save (map, file_name) && MapFile::load (loaded, file_name);
+    std::remove (file_name);
+    if (!done || loaded.getObjectCount () != map.getObjectCount ()
+        || loaded.getDynamicObjectCount () != map.getDynamicObjectCount ())
+      {
+        std::cerr << "map not saved or loaded" << std::endl;
+        return false;
+      }
+
+    for (bool dynamic: {false, true})
+      {
+        const std::vector<MapObject> & objects = dynamic ? map.getDynamicObjects () : map.getObjects ();
+        const std::vector<MapObject> & loaded_objects = dynamic ? loaded.getDynamicObjects () : loaded.getObjects ();
+        for (uint32_t i=0; i < objects.size (); ++i)
+          {
+            const MapObject & a = objects[i];
+            const MapObject & b = loaded_objects[i];
+            bool same = a.getPointCount () == b.getPointCount () && a.isClosed () == b.isClosed ()
+                        && a.isCompact () == b.isCompact () && a.isFrozen () == b.isFrozen ();
+            for (uint32_t j=0; same && j < a.getPointCount (); ++j)
+              same = a.getPoint (j) == b.getPoint (j);
+            if (!same)
+              {
+                std::cerr << (dynamic ? "dynamic" : "static") << " object " << i << " differs" << std::endl;
+                return false;
+              }
+          }
+      }
+
+    return true;
+  }
+
+  /* Enforcing a budget frees memory by compacting the frozen objects until the map fits.
+   */
+  static bool testMemoryBudget ()
+  {
+    Map map;
+    MapGenerator gen (11);
+    gen.addRooms (map, 3, 3, 5.0, 1.0, 0.05, 0.01);
+    for (uint32_t i=0; i < map.getObjectCount (); ++i)
+      map.freezeObject (i);
+
+    size_t bytes = map.getMemoryStats ().total;
+    Map::MemoryBudget budget;
+    budget.max_bytes = bytes * 9 / 10;
+    budget.compact_resolution = 0.001;
+    map.setMemoryBudget (budget);
+    Map::BudgetResult result = map.enforceMemoryBudget ();
+    if (!result.within_budget || result.compacted == 0 || map.getMemoryStats ().total > budget.max_bytes)
+      {
+        std::cerr << "map of " << bytes << " bytes has " << map.getMemoryStats ().total << " after enforcing "
+                  << budget.max_bytes << ", " << result.compacted << " objects compacted" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* The vertices of an object stored as curves stay within the max. deviation of the
+   * original points, the closest positions found on the curves, too.
+   */
+  static bool testCurves ()
+  {
+    MapGenerator gen (12);
+    MapObject obj = gen.noisyCircle (Position (3.0, 4.0), 10.0, 1000, 0.001);
+    MapObject curved (obj);
+    if (!curved.fitCurves (0.01) || !curved.isCurved () || curved.isClosed () != obj.isClosed ()
+        || curved.getCurves ().getCurveCount () >= obj.getPointCount () / 4)
+      {
+        std::cerr << "curves not fitted" << std::endl;
+        return false;
+      }
+
+    for (uint32_t i=0; i < obj.getPointCount (); ++i)
+      {
+        std::optional<MapObject::FindResult> closest = curved.findClosestPosition (obj.getPoint (i));
+        if (!closest.has_value () || closest->distance > 0.01 + 1e-9)
+          {
+            std::cerr << "point " << i << " is " << (closest.has_value () ? closest->distance : -1.0) << " from the curves"
+                      << std::endl;
+            return false;
+          }
+      }
+
+    for (uint32_t i=0; i < curved.getPointCount (); ++i)
+      {
+        std::optional<MapObject::FindResult> closest = obj.findClosestPosition (curved.getPoint (i));
+        if (!closest.has_value () || closest->distance > 0.01 + 1e-9)
+          {
+            std::cerr << "vertex " << i << " of the curves is " << (closest.has_value () ? closest->distance : -1.0)
+                      << " from the points" << std::endl;
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  /* Curved objects are loaded back from a map file as the same curves.
+   */
+  static bool testMapFileCurves ()
+  {
+    const char * file_name = "robot-pathfinder-test-curves.pfmp";
+    Map map;
+    MapGenerator gen (16);
+    MapObject obj = gen.noisyCircle (Position (3.0, 4.0), 5.0, 500, 0.001);
+    obj.fitCurves (0.01);
+    map.addObject (obj);
+    Map loaded;
+    bool done = MapFile::save (map, file_name) && MapFile::load (loaded, file_name);
+    std::remove (file_name);
+    if (!done || loaded.getObjectCount () != 1 || !loaded.getObjects ()[0].isCurved ()
+        || loaded.getObjects ()[0].getCurves ().getCurveCount () != obj.getCurves ().getCurveCount ())
+      {
+        std::cerr << "curves not saved or loaded" << std::endl;
+        return false;
+      }
+
+    for (uint32_t i=0; i < obj.getPointCount (); ++i)
+      if (loaded.getObjects ()[0].getPoint (i) != obj.getPoint (i))
+        {
+          std::cerr << "vertex " << i << " differs" << std::endl;
+          return false;
+        }
+
+    return true;
+  }
+
+  /* A goal enclosed by a wall ends the search with no path.
+   */
+  static bool testAnytimeNoPath ()
+  {
+    Map map;
+    MapGenerator gen (14);
+    gen.addRooms (map, 2, 2, 5.0, 1.0, 0.1, 0.01);
+    MapObject box (0.01);
+    box.setPolygon ({Position (7.0, 7.0), Position (8.0, 7.0), Position (8.0, 8.0), Position (7.0, 8.0),
+                     Position (7.0, 7.0)});
+    map.addObject (box);
+
+    AnytimePlanner planner (map, AnytimePlanner::Parameters ());
+    planner.start (Position (1.5, 1.5), Position (7.5, 7.5));
+    AnytimePlanner::Status status = planner.plan (std::chrono::steady_clock::now () + std::chrono::seconds (10));
+    if (status != AnytimePlanner::STATUS_NO_PATH)
+      {
+        std::cerr << "ended with status " << status << " after " << planner.getExpansions () << " expansions"
+                  << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* A single point object joined with another one keeps its observations.
+   */
+  static bool testJoinHistory ()
+  {
+    MapObject point (0.01);
+    point.appendPoint (Position (1.0, 0.0));
+    point.observe (1.0, 3, 0);
+    point.observe (2.0, 2, 1);
+    MapObject line (0.01);
+    line.setPolygon ({Position (1.05, 0.0), Position (2.0, 0.0)});
+
+    if (!point.join (line, 0.2) || point.getPointCount () != 3 || point.getObservation ().scans != 2
+        || point.getObservation ().hits != 5)
+      {
+        std::cerr << "joined into " << point.getPointCount () << " points, " << point.getObservation ().scans
+                  << " scans observed" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* Finding crossings in a map of compact objects leaves them without a decoded cache.
+   */
+  static bool testCompactCrossings ()
+  {
+    Map map;
+    MapGenerator gen (13);
+    gen.addRooms (map, 2, 2, 5.0, 1.0, 0.2, 0.02);
+    for (uint32_t i=0; i < map.getObjectCount (); ++i)
+      map.getObject (i).compact (0.001);
+
+    Map::CrossingVector crossings;
+    map.findCrossings (crossings);
+    SegmentSweep::CrossingVector self_crossings;
+    map.getObjects ()[0].findCrossings (self_crossings);
+    if (map.getMemoryStats ().decoded_points != 0)
+      {
+        std::cerr << map.getMemoryStats ().decoded_points << " bytes of decoded points cached" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* A planner updated in the region of a new wall finds the same paths as one built for the
+   * changed map.
+   */
+  static bool testHierarchicalUpdate ()
+  {
+    Map map;
+    MapGenerator gen (15);
+    gen.addRooms (map, 4, 4, 6.0, 1.0, 0.1, 0.01);
+    HierarchicalPlanner planner (map, HierarchicalPlanner::Parameters ());
+
+    MapObject wall = gen.wall (Position (12.05, 0.5), Position (12.05, 17.5), 0.1, 0.0);
+    map.addObject (wall);
+    planner.update (wall.getBoundingBox ());
+    HierarchicalPlanner fresh (map, HierarchicalPlanner::Parameters ());
+
+    for (uint32_t i=0; i < 10; ++i)
+      {
+        Position from = gen.randomPosition (Position (1.0, 1.0), Position (23.0, 23.0));
+        Position to = gen.randomPosition (Position (1.0, 1.0), Position (23.0, 23.0));
+        PositionVector path, fresh_path;
+        HierarchicalPlanner::Result result = planner.findPath (from, to, path);
+        HierarchicalPlanner::Result fresh_result = fresh.findPath (from, to, fresh_path);
+        if (result.found != fresh_result.found || std::abs (result.cost - fresh_result.cost) > 1e-9)
+          {
+            std::cerr << "query " << i << ": found " << result.found << ", cost " << result.cost
+                      << ", after a rebuild found " << fresh_result.found << ", cost " << fresh_result.cost << std::endl;
+            return false;
+          }
+      }
+
+    return true;
+  }
+
+  /* Loading a map file damaged in the middle fails and leaves the map empty.
+   */
+  static bool testMapFileDamaged ()
+  {
+    const char * file_name = "robot-pathfinder-test-damaged.pfmp";
+    Map map;
+    testFillMap (map);
+    bool saved = MapFile::save (map, file_name);
+    if (FILE * file = saved ? fopen (file_name, "r+b") : nullptr)
+      {
+        fseek (file, 0, SEEK_END);
+        fseek (file, ftell (file) / 2, SEEK_SET);
+        int c = fgetc (file);
+        fseek (file, -1, SEEK_CUR);
+        fputc (c ^ 0xff, file);
+        fclose (file);
+      }
+
+    Map loaded;
+    bool load = MapFile::load (loaded, file_name);
+    std::remove (file_name);
+    if (!saved || load || loaded.getObjectCount () != 0 || loaded.getDynamicObjectCount () != 0)
+      {
+        std::cerr << "damaged file loaded (" << load << "), " << loaded.getObjectCount () << " objects in the map"
+                  << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+
+  /* Writing a sensor log to a full device is reported by close and ok.
+   */
+  static bool testSensorLogFailed ()
+  {
+    SensorLogWriter writer;
+    if (!writer.open ("/dev/full"))
+      return true;
+
+    RangeScan scan;
+    scan.angle_min = 0.0f;
+    scan.angle_increment = 0.01f;
+    scan.max_range = 10.0f;
+    scan.ranges.resize (100000, 1.0f);
+    writer.pushScan (0.0, scan);
+    writer.pushPose (0.1, Transformation (Position (0.0, 0.0), 0.0, 1.0));
+    if (writer.close () || writer.ok ())
+      {
+        std::cerr << "writing to a full device succeeded" << std::endl;
+        return false;
+      }
+
+    return true;
+  }
+}
+
+struct TestCase
+{
+  const char * name;
+  bool (*run) ();
+};
+
+static const TestCase test_cases[] =
+{
+  {"compact", Pathfinder::testCompact},
+  {"sensorlog", Pathfinder::testSensorLog},
+  {"collision", Pathfinder::testCollision},
+  {"sweep", Pathfinder::testSweep},
+  {"classify", Pathfinder::testClassify},
+  {"anytime", Pathfinder::testAnytime},
+  {"hierarchical", Pathfinder::testHierarchical},
+  {"costmap", Pathfinder::testCostmap},
+  {"journal", Pathfinder::testJournal},
+  {"posegraph", Pathfinder::testPoseGraph},
+  {"parallel", Pathfinder::testParallelBuilder},
+  {"mapfile", Pathfinder::testMapFile},
+  {"budget", Pathfinder::testMemoryBudget},
+  {"curves", Pathfinder::testCurves},
+  {"mapfile-curves", Pathfinder::testMapFileCurves},
+  {"anytime-no-path", Pathfinder::testAnytimeNoPath},
+  {"join-history", Pathfinder::testJoinHistory},
+  {"compact-crossings", Pathfinder::testCompactCrossings},
+  {"hierarchical-update", Pathfinder::testHierarchicalUpdate},
+  {"mapfile-damaged", Pathfinder::testMapFileDamaged},
+  {"sensorlog-failed", Pathfinder::testSensorLogFailed}
+};
+
+static void usage (const char * name)
+{
+  std::cerr << "Usage: " << name << " [test]" << std::endl
+            << "  runs the named test, or all of them:";
+  for (const TestCase & test: test_cases)
+    std::cerr << " " << test.name;
+  std::cerr << std::endl;
+}
+
+int main (int argc, char** argv)
+{
+  if (argc > 2)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  bool found = false;
+  int failed = 0;
+  for (const TestCase & test: test_cases)
+    {
+      if (argc == 2 && strcmp (argv[1], test.name) != 0)
+        continue;
+
+      found = true;
+      bool passed = test.run ();
+      std::cout << test.name << ": " << (passed ? "passed" : "FAILED") << std::endl;
+      failed += passed ? 0 : 1;
+    }
+
+  if (!found)
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  return failed == 0 ? 0 : 1;
+}
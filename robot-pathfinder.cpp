@@ -27,6 +27,8 @@ namespace Pathfinder
 	map_obj.appendPoint (p);
       }
 
+    // Round, so stored as curves (within its min. point distance)
+    map_obj.fitCurves (0.2);
     _map.addObject (map_obj);
 
     map_obj.clear ();
@@ -2,6 +2,9 @@
  *
  */
 
+#ifndef ROBOT_PATHFINDER_H
+#define ROBOT_PATHFINDER_H
+
 #include <QtWidgets>
 
 #include "robot-mapwidget.h"
@@ -49,3 +52,5 @@ namespace Pathfinder
       Map _map;
   };
 }
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+
+#include "robot-pathsmoother.h"
+
+namespace Pathfinder
+{
+  /* Position at the arc length s of the path, length[i] is the arc length of path[i].
+   */
+  static Position pathSmootherAt (const PositionVector & path, const std::vector<double> & length, double s)
+  {
+    uint32_t i = std::upper_bound (length.begin (), length.end (), s) - length.begin ();
+    if (i == 0)
+      return path.front ();
+    if (i >= path.size ())
+      return path.back ();
+
+    double l = length[i] - length[i-1];
+    if (l <= 0.0)
+      return path[i];
+
+    return Position (path[i-1] + (path[i] - path[i-1]) * ((s - length[i-1]) / l));
+  }
+
+  /* The robot heads along the path, in the direction of the neighbour samples.
+   */
+  static void pathSmootherHeadings (const PositionVector & samples, std::vector<double> & heading)
+  {
+    uint32_t count = samples.size ();
+    heading.assign (count, 0.0);
+    for (uint32_t i=0; i < count; ++i)
+      {
+        Position d (samples[std::min (i + 1, count - 1)] - samples[i > 0 ? i - 1 : 0]);
+        if (d.squaredNorm () > 0.0)
+          heading[i] = std::atan2 (d.y (), d.x ());
+        else if (i > 0)
+          heading[i] = heading[i-1];
+      }
+  }
+
+  PathSmoother::Parameters::Parameters ()
+  : min_clearance (0.05),
+    max_deviation (0.1),
+    shortcut_rounds (4),
+    shortcut_candidates (32),
+    sample_distance (0.05),
+    filter_size (8),
+    max_speed (0.5),
+    max_acceleration (0.5),
+    max_lateral_acceleration (0.3),
+    seed (1)
+  {
+  }
+
+  PathSmoother::PathSmoother (const CollisionChecker & checker, const Footprint & footprint,
+                              const Parameters & parameters)
+  : _checker (checker),
+    _footprint (footprint),
+    _parameters (parameters)
+  {
+  }
+
+  const PathSmoother::Parameters & PathSmoother::getParameters () const
+  {
+    return _parameters;
+  }
+
+  /* Shortcut and smooth the path.
+   */
+  Trajectory PathSmoother::process (const PositionVector & path) const
+  {
+    PATHFINDER_TRACE_SCOPE ("PathSmoother::process");
+
+    PositionVector shortened = path;
+    shortcut (shortened);
+    return smooth (shortened);
+  }
+
+  /* Replace parts of the path by straight lines, where these are free.
+   * Returns by how much the path got shorter.
+   */
+  double PathSmoother::shortcut (PositionVector & path) const
+  {
+    PATHFINDER_TRACE_SCOPE ("PathSmoother::shortcut");
+
+    if (path.size () < 3)
+      return 0.0;
+
+    double before = 0.0;
+    for (uint32_t i=1; i < path.size (); ++i)
+      before += path[i].distance (path[i-1]);
+
+    PositionVector from;
+    PositionVector to;
+    std::vector<bool> free;
+
+    // Greedy: Connect each waypoint with the farthest following one it sees. Only exponentially
+    // growing steps (and the goal) are tried, all of them in one batch.
+    PositionVector result;
+    std::vector<uint32_t> targets;
+    result.push_back (path[0]);
+    for (uint32_t i=0; i + 1 < path.size ();)
+      {
+        targets.clear ();
+        for (uint32_t step=2; i + step < path.size (); step += (step + 1) / 2)
+          targets.push_back (i + step);
+        if (i + 2 < path.size () && targets.back () != path.size () - 1)
+          targets.push_back (path.size () - 1);
+
+        from.assign (targets.size (), path[i]);
+        to.clear ();
+        for (uint32_t t: targets)
+          to.push_back (path[t]);
+        checkStraight (from, to, free);
+
+        uint32_t next = i + 1;
+        for (uint32_t k=0; k < targets.size (); ++k)
+          if (free[k])
+            next = targets[k];
+
+        result.push_back (path[next]);
+        i = next;
+      }
+    path.swap (result);
+
+    // Random: Connect two positions anywhere on the path, several non-overlapping shortcuts
+    // of the free candidates are taken per round, the best first.
+    std::mt19937 rng (_parameters.seed);
+    std::vector<double> length;
+    std::vector<std::pair<double, double>> candidates;
+    std::vector<std::pair<double, double>> accepted;
+    std::vector<std::pair<double, uint32_t>> gains;
+
+    for (uint32_t round=0; round < _parameters.shortcut_rounds && path.size () >= 3; ++round)
+      {
+        length.assign (1, 0.0);
+        for (uint32_t i=1; i < path.size (); ++i)
+          length.push_back (length.back () + path[i].distance (path[i-1]));
+
+        std::uniform_real_distribution<double> dist (0.0, length.back ());
+        candidates.clear ();
+        from.clear ();
+        to.clear ();
+        for (uint32_t k=0; k < _parameters.shortcut_candidates; ++k)
+          {
+            double a = dist (rng);
+            double b = dist (rng);
+            if (a > b)
+              std::swap (a, b);
+
+            // On the same line, nothing to gain
+            if (std::upper_bound (length.begin (), length.end (), a) == std::lower_bound (length.begin (), length.end (), b))
+              continue;
+
+            candidates.push_back (std::make_pair (a, b));
+            from.push_back (pathSmootherAt (path, length, a));
+            to.push_back (pathSmootherAt (path, length, b));
+          }
+        checkStraight (from, to, free);
+
+        gains.clear ();
+        for (uint32_t k=0; k < candidates.size (); ++k)
+          {
+            double gain = candidates[k].second - candidates[k].first - from[k].distance (to[k]);
+            if (free[k] && gain > 1e-6)
+              gains.push_back (std::make_pair (gain, k));
+          }
+        std::sort (gains.begin (), gains.end (), std::greater<std::pair<double, uint32_t>> ());
+
+        accepted.clear ();
+        for (const std::pair<double, uint32_t> & gain: gains)
+          {
+            const std::pair<double, double> & c = candidates[gain.second];
+            bool overlaps = false;
+            for (const std::pair<double, double> & a: accepted)
+              overlaps |= c.first <= a.second && a.first <= c.second;
+            if (!overlaps)
+              accepted.push_back (c);
+          }
+        if (accepted.empty ())
+          continue;
+
+        std::sort (accepted.begin (), accepted.end ());
+        result.clear ();
+        uint32_t i = 0;
+        for (const std::pair<double, double> & a: accepted)
+          {
+            for (; i < path.size () && length[i] < a.first; ++i)
+              result.push_back (path[i]);
+            result.push_back (pathSmootherAt (path, length, a.first));
+            result.push_back (pathSmootherAt (path, length, a.second));
+            for (; i < path.size () && length[i] <= a.second; ++i)
+              ;
+          }
+        for (; i < path.size (); ++i)
+          result.push_back (path[i]);
+        path.swap (result);
+      }
+
+    double after = 0.0;
+    for (uint32_t i=1; i < path.size (); ++i)
+      after += path[i].distance (path[i-1]);
+
+    return before - after;
+  }
+
+  /* Resample the path every sample_distance and move the samples onto curves fitted to their
+   * neighbours. The samples near objects are left on the path.
+   */
+  Trajectory PathSmoother::smooth (const PositionVector & path) const
+  {
+    PATHFINDER_TRACE_SCOPE ("PathSmoother::smooth");
+
+    Trajectory trajectory;
+    if (path.empty ())
+      return trajectory;
+
+    PositionVector samples;
+    samples.push_back (path[0]);
+    for (uint32_t i=1; i < path.size (); ++i)
+      {
+        double l = path[i].distance (path[i-1]);
+        uint32_t n = std::ceil (l / _parameters.sample_distance);
+        for (uint32_t k=1; k <= n; ++k)
+          samples.push_back (Position (path[i-1] + (path[i] - path[i-1]) * (double (k) / n)));
+      }
+
+    PositionVector smoothed = samples;
+    PositionVector window;
+    PolynomCurve<2> curve;
+    uint32_t filter_size = _parameters.filter_size;
+
+    for (uint32_t i=1; i + 1 < samples.size (); ++i)
+      {
+        // Symmetric window, smaller near the start and goal which are kept
+        uint32_t k = std::min (filter_size, std::min (i, uint32_t (samples.size ()) - 1 - i));
+        window.assign (samples.begin () + (i - k), samples.begin () + (i + k + 1));
+
+        std::optional<double> residual = curve.adjust (window);
+        if (residual.has_value () && *residual <= _parameters.max_deviation)
+          {
+            Position pnew = curve.projectOnCurve (samples[i]);
+            if (pnew.distance (samples[i]) <= _parameters.max_deviation)
+              smoothed[i] = pnew;
+          }
+      }
+
+    // Reset the samples around steps too close to objects, until all are clear.
+    std::vector<double> heading;
+    std::vector<Trajectory> steps (smoothed.size () - 1);
+    std::vector<bool> free;
+    for (uint32_t iteration=0; iteration < 4; ++iteration)
+      {
+        pathSmootherHeadings (smoothed, heading);
+        for (uint32_t i=0; i < steps.size (); ++i)
+          {
+            steps[i].times = {0.0, 1.0};
+            steps[i].poses = {Transformation (smoothed[i], heading[i], 1.0),
+                              Transformation (smoothed[i+1], heading[i+1], 1.0)};
+          }
+        check (steps, free);
+
+        bool changed = false;
+        for (uint32_t i=0; i < free.size (); ++i)
+          if (!free[i])
+            for (uint32_t j=i > filter_size ? i - filter_size : 0; j <= i + 1 + filter_size && j < smoothed.size (); ++j)
+              if (smoothed[j] != samples[j])
+                {
+                  smoothed[j] = samples[j];
+                  changed = true;
+                }
+
+        if (!changed)
+          break;
+      }
+
+    parameterize (smoothed, trajectory);
+    return trajectory;
+  }
+
+  /* The robot moves straight from one position to the other, heading towards it.
+   */
+  Trajectory PathSmoother::straight (const Position & from, const Position & to) const
+  {
+    Position d (to - from);
+    double heading = d.squaredNorm () > 0.0 ? std::atan2 (d.y (), d.x ()) : 0.0;
+
+    Trajectory trajectory;
+    trajectory.times = {0.0, 1.0};
+    trajectory.poses.push_back (Transformation (from, heading, 1.0));
+    trajectory.poses.push_back (Transformation (to, heading, 1.0));
+    return trajectory;
+  }
+
+  /* free[i] is whether the straight way from from[i] to to[i] keeps min_clearance.
+   */
+  void PathSmoother::checkStraight (const PositionVector & from, const PositionVector & to,
+                                    std::vector<bool> & free) const
+  {
+    std::vector<Trajectory> trajectories;
+    trajectories.reserve (from.size ());
+    for (uint32_t i=0; i < from.size (); ++i)
+      trajectories.push_back (straight (from[i], to[i]));
+
+    check (trajectories, free);
+  }
+
+  /* free[i] is whether trajectories[i] keeps min_clearance.
+   */
+  void PathSmoother::check (const std::vector<Trajectory> & trajectories, std::vector<bool> & free) const
+  {
+    std::vector<CollisionChecker::Result> results;
+    _checker.checkBatch (_footprint, trajectories, results);
+
+    free.resize (trajectories.size ());
+    for (uint32_t i=0; i < results.size (); ++i)
+      free[i] = !results[i].collision && results[i].clearance >= _parameters.min_clearance;
+  }
+
+  /* Times of the samples: As fast as possible, starting and stopping at rest, slowing down
+   * in curves for the lateral acceleration.
+   */
+  void PathSmoother::parameterize (const PositionVector & samples, Trajectory & trajectory) const
+  {
+    uint32_t count = samples.size ();
+    std::vector<double> heading;
+    std::vector<double> speed (count, _parameters.max_speed);
+    pathSmootherHeadings (samples, heading);
+
+    for (uint32_t i=1; i + 1 < count; ++i)
+      {
+        Position d0 (samples[i] - samples[i-1]);
+        Position d1 (samples[i+1] - samples[i]);
+        double l = (d0.norm () + d1.norm ()) / 2.0;
+        if (l <= 0.0)
+          continue;
+
+        double curvature = std::fabs (std::remainder (std::atan2 (d1.y (), d1.x ()) - std::atan2 (d0.y (), d0.x ()), 2.0 * M_PI)) / l;
+        if (curvature > 0.0)
+          speed[i] = std::min (speed[i], std::sqrt (_parameters.max_lateral_acceleration / curvature));
+      }
+
+    speed.front () = 0.0;
+    speed.back () = 0.0;
+    for (uint32_t i=1; i < count; ++i)
+      speed[i] = std::min (speed[i], std::sqrt (speed[i-1] * speed[i-1]
+                                                + 2.0 * _parameters.max_acceleration * samples[i].distance (samples[i-1])));
+    for (uint32_t i=count - 1; i > 0; --i)
+      speed[i-1] = std::min (speed[i-1], std::sqrt (speed[i] * speed[i]
+                                                    + 2.0 * _parameters.max_acceleration * samples[i].distance (samples[i-1])));
+
+    trajectory.times.assign (1, 0.0);
+    trajectory.poses.assign (1, Transformation (samples[0], heading[0], 1.0));
+    for (uint32_t i=1; i < count; ++i)
+      {
+        double l = samples[i].distance (samples[i-1]);
+        double v = speed[i-1] + speed[i];
+        double dt = v > 0.0 ? 2.0 * l / v : 2.0 * std::sqrt (l / _parameters.max_acceleration);
+
+        trajectory.times.push_back (trajectory.times.back () + dt);
+        trajectory.poses.push_back (Transformation (samples[i], heading[i], 1.0));
+      }
+  }
+}
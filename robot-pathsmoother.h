@@ -0,0 +1,69 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_PATHSMOOTHER_H
+#define ROBOT_PATHSMOOTHER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "robot-collision.h"
+
+namespace Pathfinder
+{
+  /* Post-processing of planned paths (polylines of grid or graph waypoints).
+   *
+   * shortcut removes detours: Greedily, each waypoint is connected with the farthest following
+   * one reachable on a straight line, then random pairs of positions along the path are tried.
+   * The candidates of each round are checked together with CollisionChecker::checkBatch.
+   *
+   * smooth resamples the path and moves each sample onto a PolynomCurve fitted to its
+   * neighbours, like MapObject::smooth, by at most max_deviation. Where the smoothed path gets
+   * closer to an object than min_clearance, the samples around it are reset. The result is
+   * parameterized by time with the speed and acceleration limits, the robot heading along the
+   * path.
+   *
+   * Shortcuts are checked with the robot heading along them, turning at their corners is not
+   * checked. A polygon footprint can therefore come a bit closer than min_clearance there.
+   */
+  class PathSmoother
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double min_clearance;               // of the footprint to any object, up to the max_clearance of the checker
+          double max_deviation;               // of the smoothed path from the shortcut path
+          uint32_t shortcut_rounds;           // of random shortcuts
+          uint32_t shortcut_candidates;       // random shortcuts checked per round
+          double sample_distance;             // of the smoothed path
+          uint32_t filter_size;               // samples on each side fitted to a curve
+          double max_speed;
+          double max_acceleration;
+          double max_lateral_acceleration;
+          uint32_t seed;                      // of the random shortcuts
+      };
+
+      PathSmoother (const CollisionChecker & checker, const Footprint & footprint, const Parameters & parameters);
+
+      double shortcut (PositionVector & path) const;
+      Trajectory smooth (const PositionVector & path) const;
+      Trajectory process (const PositionVector & path) const;
+
+      const Parameters & getParameters () const;
+
+    private:
+      Trajectory straight (const Position & from, const Position & to) const;
+      void checkStraight (const PositionVector & from, const PositionVector & to, std::vector<bool> & free) const;
+      void check (const std::vector<Trajectory> & trajectories, std::vector<bool> & free) const;
+      void parameterize (const PositionVector & samples, Trajectory & trajectory) const;
+
+      const CollisionChecker & _checker;
+      Footprint _footprint;
+      Parameters _parameters;
+  };
+}
+
+#endif
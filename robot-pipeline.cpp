@@ -0,0 +1,241 @@
+/*
+ *
+ */
+
+#include <chrono>
+
+#include "robot-parallel.h"
+#include "robot-pipeline.h"
+
+namespace Pathfinder
+{
+  // Items processed by a stage before it gives the thread to the next task
+  static const uint32_t pipeline_max_steps = 16;
+
+  /* Start the threads (0: one per core).
+   */
+  PipelineExecutor::PipelineExecutor (uint32_t threads)
+  : _mutex (),
+    _cond (),
+    _tasks (),
+    _stopping (false),
+    _threads ()
+  {
+    if (threads == 0)
+      threads = defaultThreadCount ();
+    for (uint32_t t=0; t < threads; ++t)
+      _threads.emplace_back (&PipelineExecutor::run, this);
+  }
+
+  /* Runs the tasks posted so far, then stops the threads.
+   */
+  PipelineExecutor::~PipelineExecutor ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (_mutex);
+      _stopping = true;
+    }
+    _cond.notify_all ();
+    for (std::thread & t: _threads)
+      t.join ();
+  }
+
+  void PipelineExecutor::post (const std::function<void ()> & task)
+  {
+    {
+      std::lock_guard<std::mutex> lock (_mutex);
+      _tasks.push_back (task);
+    }
+    _cond.notify_one ();
+  }
+
+  /* Start more threads, until there are at least threads of them.
+   */
+  void PipelineExecutor::reserve (uint32_t threads)
+  {
+    std::lock_guard<std::mutex> lock (_mutex);
+    while (_threads.size () < threads)
+      _threads.emplace_back (&PipelineExecutor::run, this);
+  }
+
+  uint32_t PipelineExecutor::getThreadCount () const
+  {
+    std::lock_guard<std::mutex> lock (_mutex);
+    return _threads.size ();
+  }
+
+  void PipelineExecutor::run ()
+  {
+    for (;;)
+      {
+        std::function<void ()> task;
+        {
+          std::unique_lock<std::mutex> lock (_mutex);
+          _cond.wait (lock, [&] () { return _stopping || !_tasks.empty (); });
+          if (_tasks.empty ())
+            return;
+
+          task = std::move (_tasks.front ());
+          _tasks.pop_front ();
+        }
+        task ();
+      }
+  }
+
+  PipelineStageBase::PipelineStageBase (const std::string & name, PipelineExecutor & executor,
+                                        uint32_t capacity, QueuePolicy policy)
+  : _mutex (),
+    _space (),
+    _idle (),
+    _name (name),
+    _executor (executor),
+    _capacity (std::max (1u, capacity)),
+    _policy (policy),
+    _stats (),
+    _latency_sum_us (0.0),
+    _upstream (nullptr),
+    _scheduled (false),
+    _wakeup (false),
+    _activations (0)
+  {
+  }
+
+  PipelineStageBase::~PipelineStageBase ()
+  {
+  }
+
+  /* Wait until all items pushed so far are processed and passed on.
+   */
+  void PipelineStageBase::waitIdle ()
+  {
+    std::unique_lock<std::mutex> lock (_mutex);
+    _idle.wait (lock, [&] () { return !_scheduled && isIdle (); });
+  }
+
+  /* Wait until all stages are idle at the same time: A stage taking an item schedules the stage
+   * before it (which may have a stalled output), so the stages are waited for again until none
+   * of them was scheduled meanwhile.
+   */
+  void PipelineStageBase::waitAllIdle (const std::vector<PipelineStageBase *> & stages)
+  {
+    auto activations = [&] ()
+      {
+        uint64_t sum = 0;
+        for (PipelineStageBase * stage: stages)
+          {
+            std::lock_guard<std::mutex> lock (stage->_mutex);
+            sum += stage->_activations;
+          }
+        return sum;
+      };
+
+    for (;;)
+      {
+        uint64_t before = activations ();
+        for (PipelineStageBase * stage: stages)
+          stage->waitIdle ();
+        if (activations () == before)
+          return;
+      }
+  }
+
+  const std::string & PipelineStageBase::getName () const
+  {
+    return _name;
+  }
+
+  uint32_t PipelineStageBase::getCapacity () const
+  {
+    return _capacity;
+  }
+
+  QueuePolicy PipelineStageBase::getPolicy () const
+  {
+    return _policy;
+  }
+
+  PipelineStageBase::Stats PipelineStageBase::getStats () const
+  {
+    std::lock_guard<std::mutex> lock (_mutex);
+    Stats stats = _stats;
+    stats.mean_latency_us = _stats.processed > 0 ? _latency_sum_us / _stats.processed : 0.0;
+    return stats;
+  }
+
+  /* Run the stage on the executor, if it isn't already. If it is, it looks for items again
+   * before stopping.
+   */
+  void PipelineStageBase::schedule ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (_mutex);
+      _wakeup = true;
+      if (_scheduled)
+        return;
+      _scheduled = true;
+      ++_activations;
+    }
+    _executor.post ([this] () { drain (); });
+  }
+
+  /* An item was taken from the queue: Producers waiting for space go on.
+   */
+  void PipelineStageBase::popped ()
+  {
+    _space.notify_all ();
+    if (_upstream)
+      _upstream->schedule ();
+  }
+
+  void PipelineStageBase::link (PipelineStageBase & upstream, PipelineStageBase & downstream)
+  {
+    downstream._upstream = &upstream;
+  }
+
+  void PipelineStageBase::processed (uint64_t pushed_ns, uint64_t start_ns)
+  {
+    uint64_t end = now ();
+    std::lock_guard<std::mutex> lock (_mutex);
+    double latency_us = (end - pushed_ns) / 1000.0;
+    ++_stats.processed;
+    _stats.busy_us += (end - start_ns) / 1000.0;
+    _latency_sum_us += latency_us;
+    _stats.max_latency_us = std::max (_stats.max_latency_us, latency_us);
+  }
+
+  uint64_t PipelineStageBase::now ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  /* Process items until there are none (or the output stalls), but at most a few before
+   * posting the rest, so stages sharing the threads take turns.
+   */
+  void PipelineStageBase::drain ()
+  {
+    for (uint32_t steps=0;; ++steps)
+      {
+        if (steps == pipeline_max_steps)
+          {
+            _executor.post ([this] () { drain (); });
+            return;
+          }
+
+        {
+          std::lock_guard<std::mutex> lock (_mutex);
+          _wakeup = false;
+        }
+
+        if (step ())
+          continue;
+
+        std::lock_guard<std::mutex> lock (_mutex);
+        if (_wakeup)
+          continue;
+
+        _scheduled = false;
+        _idle.notify_all ();
+        return;
+      }
+  }
+}
@@ -0,0 +1,342 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_PIPELINE_H
+#define ROBOT_PIPELINE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Pathfinder
+{
+  /* Threads running the stages of pipelines. Tasks are taken in the order they are posted.
+   */
+  class PipelineExecutor
+  {
+    public:
+      PipelineExecutor (uint32_t threads);
+      ~PipelineExecutor ();
+
+      void post (const std::function<void ()> & task);
+      void reserve (uint32_t threads);
+      uint32_t getThreadCount () const;
+
+    private:
+      void run ();
+
+      mutable std::mutex _mutex;
+      std::condition_variable _cond;
+      std::deque<std::function<void ()>> _tasks;
+      bool _stopping;
+      std::vector<std::thread> _threads;
+  };
+
+  /* What a stage does with an item pushed while its queue is full:
+   *   block:       the producer waits (stages upstream stop taking items, without holding a thread)
+   *   drop oldest: the oldest queued item is dropped
+   *   coalesce:    the item is merged into the newest queued one (by default, it replaces it)
+   */
+  enum QueuePolicy
+  {
+    QUEUE_BLOCK,
+    QUEUE_DROP_OLDEST,
+    QUEUE_COALESCE
+  };
+
+  /* A stage of a pipeline: A bounded queue of items and the function processing them, one at a
+   * time, in order, on the threads of an executor. Different stages run in parallel.
+   *
+   * A stage is only scheduled on the executor while it has items, and gives the thread back
+   * after a few of them, so any number of stages share a few threads. A stage whose output
+   * doesn't fit into a blocking queue keeps it and stops (without waiting on the thread) until
+   * the next stage took an item.
+   *
+   * The statistics count the items, the current and max. queue depth and the latency of the
+   * items from being pushed until processed.
+   *
+   * Stages must be idle (waitAllIdle) when they are destroyed.
+   */
+  class PipelineStageBase
+  {
+    public:
+      struct Stats
+      {
+          uint64_t pushed;
+          uint64_t processed;
+          uint64_t dropped;             // by drop oldest
+          uint64_t coalesced;
+          uint64_t stalls;              // pushes by the stage before refused while full (block)
+          uint32_t depth;
+          uint32_t max_depth;
+          double mean_latency_us;
+          double max_latency_us;
+          double busy_us;               // time spent processing
+      };
+
+      PipelineStageBase (const std::string & name, PipelineExecutor & executor, uint32_t capacity,
+                         QueuePolicy policy);
+      virtual ~PipelineStageBase ();
+
+      void waitIdle ();
+      static void waitAllIdle (const std::vector<PipelineStageBase *> & stages);
+
+      const std::string & getName () const;
+      uint32_t getCapacity () const;
+      QueuePolicy getPolicy () const;
+      Stats getStats () const;
+
+    protected:
+      // Take the next item and process it, false if there is none or the output is stalled.
+      virtual bool step () = 0;
+      virtual bool isIdle () const = 0;
+
+      void schedule ();
+      void popped ();
+      static void link (PipelineStageBase & upstream, PipelineStageBase & downstream);
+      void processed (uint64_t pushed_ns, uint64_t start_ns);
+      static uint64_t now ();
+
+      mutable std::mutex _mutex;        // protects the queue of the derived stage and the stats
+      std::condition_variable _space;   // for blocking pushes
+      std::condition_variable _idle;
+
+      std::string _name;
+      PipelineExecutor & _executor;
+      uint32_t _capacity;
+      QueuePolicy _policy;
+      Stats _stats;
+      double _latency_sum_us;
+
+    private:
+      void drain ();
+
+      PipelineStageBase * _upstream;
+      bool _scheduled;
+      bool _wakeup;
+      uint64_t _activations;            // times scheduled while it wasn't
+  };
+
+  /* The input side of a stage, with its queue of items of type In.
+   */
+  template <typename In>
+  class PipelineInput : public PipelineStageBase
+  {
+    public:
+      typedef std::function<void (In & queued, In && item)> Coalesce;
+
+      PipelineInput (const std::string & name, PipelineExecutor & executor, uint32_t capacity,
+                     QueuePolicy policy)
+      : PipelineStageBase (name, executor, capacity, policy),
+        _queue (),
+        _coalesce ()
+      {
+      }
+
+      void setCoalesce (const Coalesce & coalesce)
+      {
+        _coalesce = coalesce;
+      }
+
+      /* Push an item from outside of the pipeline. Waits while the queue is full with block, so
+       * must not be called from a stage.
+       */
+      void push (In item)
+      {
+        std::unique_lock<std::mutex> lock (_mutex);
+        if (_policy == QUEUE_BLOCK)
+          _space.wait (lock, [&] () { return _queue.size () < _capacity; });
+        enqueue (item);
+        lock.unlock ();
+        schedule ();
+      }
+
+      /* Push an item from a stage: false (item unchanged) if the queue is full with block.
+       */
+      bool tryPush (In & item)
+      {
+        std::unique_lock<std::mutex> lock (_mutex);
+        if (_policy == QUEUE_BLOCK && _queue.size () >= _capacity)
+          {
+            ++_stats.stalls;
+            return false;
+          }
+        enqueue (item);
+        lock.unlock ();
+        schedule ();
+        return true;
+      }
+
+    protected:
+      struct Entry
+      {
+          In item;
+          uint64_t pushed_ns;
+      };
+
+      bool pop (Entry & entry)
+      {
+        {
+          std::lock_guard<std::mutex> lock (_mutex);
+          if (_queue.empty ())
+            return false;
+
+          entry.item = std::move (_queue.front ().item);
+          entry.pushed_ns = _queue.front ().pushed_ns;
+          _queue.pop_front ();
+          _stats.depth = _queue.size ();
+        }
+        popped ();
+        return true;
+      }
+
+      bool queueEmpty () const
+      {
+        return _queue.empty ();
+      }
+
+    private:
+      // Called locked
+      void enqueue (In & item)
+      {
+        ++_stats.pushed;
+        if (_queue.size () >= _capacity && !_queue.empty ())
+          {
+            if (_policy == QUEUE_COALESCE)
+              {
+                if (_coalesce)
+                  _coalesce (_queue.back ().item, std::move (item));
+                else
+                  _queue.back ().item = std::move (item);
+                ++_stats.coalesced;
+                return;
+              }
+
+            if (_policy == QUEUE_DROP_OLDEST)
+              {
+                _queue.pop_front ();
+                ++_stats.dropped;
+              }
+          }
+
+        Entry entry;
+        entry.item = std::move (item);
+        entry.pushed_ns = now ();
+        _queue.push_back (std::move (entry));
+        _stats.depth = _queue.size ();
+        _stats.max_depth = std::max (_stats.max_depth, _stats.depth);
+      }
+
+      std::deque<Entry> _queue;
+      Coalesce _coalesce;
+  };
+
+  /* A stage turning items of type In into items of type Out for the next stage: body returns
+   * false if the item has no output.
+   */
+  template <typename In, typename Out>
+  class PipelineStage : public PipelineInput<In>
+  {
+    public:
+      typedef std::function<bool (In & in, Out & out)> Body;
+
+      PipelineStage (const std::string & name, PipelineExecutor & executor, uint32_t capacity,
+                     QueuePolicy policy, const Body & body)
+      : PipelineInput<In> (name, executor, capacity, policy),
+        _body (body),
+        _next (nullptr),
+        _output (),
+        _stalled (false)
+      {
+      }
+
+      void connect (PipelineInput<Out> & next)
+      {
+        _next = &next;
+        PipelineStageBase::link (*this, next);
+      }
+
+    protected:
+      virtual bool step ()
+      {
+        if (_stalled)
+          {
+            if (!_next->tryPush (_output))
+              return false;
+            std::lock_guard<std::mutex> lock (this->_mutex);
+            _stalled = false;
+          }
+
+        typename PipelineInput<In>::Entry entry;
+        if (!this->pop (entry))
+          return false;
+
+        uint64_t start = this->now ();
+        bool emit = _body (entry.item, _output);
+        this->processed (entry.pushed_ns, start);
+        if (emit && _next && !_next->tryPush (_output))
+          {
+            std::lock_guard<std::mutex> lock (this->_mutex);
+            _stalled = true;
+          }
+        return true;
+      }
+
+      virtual bool isIdle () const
+      {
+        return this->queueEmpty () && !_stalled;
+      }
+
+    private:
+      Body _body;
+      PipelineInput<Out> * _next;
+      Out _output;
+      bool _stalled;                    // _output is waiting for space in the next stage (set locked)
+  };
+
+  /* The last stage of a pipeline, consuming items of type In.
+   */
+  template <typename In>
+  class PipelineSink : public PipelineInput<In>
+  {
+    public:
+      typedef std::function<void (In & in)> Body;
+
+      PipelineSink (const std::string & name, PipelineExecutor & executor, uint32_t capacity,
+                    QueuePolicy policy, const Body & body)
+      : PipelineInput<In> (name, executor, capacity, policy),
+        _body (body)
+      {
+      }
+
+    protected:
+      virtual bool step ()
+      {
+        typename PipelineInput<In>::Entry entry;
+        if (!this->pop (entry))
+          return false;
+
+        uint64_t start = this->now ();
+        _body (entry.item);
+        this->processed (entry.pushed_ns, start);
+        return true;
+      }
+
+      virtual bool isIdle () const
+      {
+        return this->queueEmpty ();
+      }
+
+    private:
+      Body _body;
+  };
+}
+
+#endif
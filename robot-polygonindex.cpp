@@ -0,0 +1,435 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "robot-map.h"
+#include "robot-polygonindex.h"
+
+namespace Pathfinder
+{
+  /* memcpy, for data of vectors which may be empty (and nullptr then).
+   */
+  static void polygonIndexCopy (char * out, const void * data, size_t size)
+  {
+    if (size > 0)
+      memcpy (out, data, size);
+  }
+
+  PolygonIndex::PolygonIndex (double cell_size)
+  : _cell_size (cell_size),
+    _polygons (),
+    _slab_offsets (1, 0),
+    _slab_edges (),
+    _cells (),
+    _image_owner (),
+    _image (nullptr),
+    _image_size (0),
+    _image_polygons (nullptr),
+    _image_slab_offsets (nullptr),
+    _image_slab_edges (nullptr),
+    _image_cells (nullptr),
+    _image_candidates (nullptr)
+  {
+  }
+
+  /* Add obj, if it is closed and encloses an area. object_id is returned by classify for the
+   * points inside it, e.g. the index of obj in its map.
+   */
+  bool PolygonIndex::insert (const MapObject & obj, uint32_t object_id)
+  {
+    PATHFINDER_TRACE_SCOPE ("PolygonIndex::insert");
+
+    uint32_t count = obj.getPointCount ();
+    if (!obj.isClosed () || count < 3)
+      return false;
+
+    Eigen::AlignedBox2d box = obj.getBoundingBox ();
+    if (box.sizes ().y () <= 0.0 || box.sizes ().x () <= 0.0)
+      return false;
+
+    if (_image)
+      detach ();
+
+    // Edges of the ring, horizontal ones never cross a horizontal ray. The repeated first
+    // point gives a zero length edge, which is left out, too.
+    std::vector<Edge> edges;
+    edges.reserve (count);
+    Position prev = obj.getPoint (count - 1);
+    for (uint32_t i=0; i < count; ++i)
+      {
+        Position p = obj.getPoint (i);
+        if (p.y () != prev.y ())
+          {
+            const Position & a = p.y () < prev.y () ? p : prev;
+            const Position & b = p.y () < prev.y () ? prev : p;
+            Edge e;
+            e.y0 = a.y ();
+            e.y1 = b.y ();
+            e.x0 = a.x ();
+            e.dxdy = (b.x () - a.x ()) / (b.y () - a.y ());
+            edges.push_back (e);
+          }
+        prev = p;
+      }
+
+    Polygon polygon;
+    polygon.min_x = box.min ().x ();
+    polygon.min_y = box.min ().y ();
+    polygon.max_x = box.max ().x ();
+    polygon.max_y = box.max ().y ();
+    polygon.slab_count = std::max<uint32_t> (1, std::min<uint32_t> (edges.size () / 2, 1024));
+    polygon.slab_scale = polygon.slab_count / box.sizes ().y ();
+    polygon.first_slab = _slab_offsets.size () - 1;
+    polygon.object_id = object_id;
+
+    // Count the edges per slab, then fill them in
+    uint32_t base = _slab_offsets.back ();
+    std::vector<uint32_t> fill (polygon.slab_count + 1, 0);
+    auto slab = [&] (double y)
+      {
+        double s = std::floor ((y - polygon.min_y) * polygon.slab_scale);
+        return uint32_t (std::min (double (polygon.slab_count - 1), std::max (0.0, s)));
+      };
+
+    for (const Edge & e: edges)
+      for (uint32_t k=slab (e.y0); k <= slab (e.y1); ++k)
+        ++fill[k+1];
+    for (uint32_t k=0; k < polygon.slab_count; ++k)
+      {
+        fill[k+1] += fill[k];
+        _slab_offsets.push_back (base + fill[k+1]);
+      }
+
+    _slab_edges.resize (base + fill.back ());
+    for (const Edge & e: edges)
+      for (uint32_t k=slab (e.y0); k <= slab (e.y1); ++k)
+        _slab_edges[base + fill[k]++] = e;
+
+    // The float box is rounded outwards, contains checks the exact one
+    Candidate candidate;
+    candidate.min_x = std::nextafter (float (polygon.min_x), -HUGE_VALF);
+    candidate.min_y = std::nextafter (float (polygon.min_y), -HUGE_VALF);
+    candidate.max_x = std::nextafter (float (polygon.max_x), HUGE_VALF);
+    candidate.max_y = std::nextafter (float (polygon.max_y), HUGE_VALF);
+    candidate.polygon = _polygons.size ();
+    _polygons.push_back (polygon);
+
+    for (int32_t cy=cell (polygon.min_y); cy <= cell (polygon.max_y); ++cy)
+      for (int32_t cx=cell (polygon.min_x); cx <= cell (polygon.max_x); ++cx)
+        _cells[cellKey (cx, cy)].push_back (candidate);
+
+    return true;
+  }
+
+  void PolygonIndex::clear ()
+  {
+    _polygons.clear ();
+    _slab_offsets.assign (1, 0);
+    _slab_edges.clear ();
+    _cells.clear ();
+    _image_owner.reset ();
+    _image = nullptr;
+    _image_size = 0;
+    _image_polygons = nullptr;
+    _image_slab_offsets = nullptr;
+    _image_slab_edges = nullptr;
+    _image_cells = nullptr;
+    _image_candidates = nullptr;
+  }
+
+  bool PolygonIndex::isEmpty () const
+  {
+    return getPolygonCount () == 0;
+  }
+
+  uint32_t PolygonIndex::getPolygonCount () const
+  {
+    return _image ? _image->polygon_count : _polygons.size ();
+  }
+
+  double PolygonIndex::getCellSize () const
+  {
+    return _cell_size;
+  }
+
+  /* Is pos inside the polygon with the given index (in the order inserted).
+   */
+  bool PolygonIndex::contains (uint32_t polygon, const Position & pos) const
+  {
+    const Polygon & p = _image ? _image_polygons[polygon] : _polygons[polygon];
+    double x = pos.x ();
+    double y = pos.y ();
+    if (x < p.min_x || x > p.max_x || y < p.min_y || y >= p.max_y)
+      return false;
+
+    const uint32_t * slab_offsets = _image ? _image_slab_offsets : _slab_offsets.data ();
+    const Edge * slab_edges = _image ? _image_slab_edges : _slab_edges.data ();
+    uint32_t k = std::min<uint32_t> (p.slab_count - 1, uint32_t ((y - p.min_y) * p.slab_scale));
+    uint32_t end = slab_offsets[p.first_slab + k + 1];
+    bool inside = false;
+    for (uint32_t i=slab_offsets[p.first_slab + k]; i < end; ++i)
+      {
+        const Edge & e = slab_edges[i];
+        if (e.y0 <= y && y < e.y1 && x < e.x0 + (y - e.y0) * e.dxdy)
+          inside = !inside;
+      }
+
+    return inside;
+  }
+
+  /* The polygons containing each point: Those of points[i] are
+   * objects[offsets[i]] .. objects[offsets[i+1]-1], in the order inserted.
+   */
+  void PolygonIndex::classify (const Position * points, uint32_t count,
+                               std::vector<uint32_t> & offsets, std::vector<uint32_t> & objects) const
+  {
+    PATHFINDER_TRACE_SCOPE ("PolygonIndex::classify");
+
+    offsets.resize (count + 1);
+    offsets[0] = 0;
+    objects.clear ();
+
+    // Consecutive points are usually in the same cell, e.g. those of a raster
+    const Polygon * polygons = _image ? _image_polygons : _polygons.data ();
+    const Candidate * candidates = nullptr;
+    uint32_t candidate_count = 0;
+    uint64_t last_key = 0;
+    bool have_key = false;
+
+    for (uint32_t i=0; i < count; ++i)
+      {
+        uint64_t key = cellKey (cell (points[i].x ()), cell (points[i].y ()));
+        if (!have_key || key != last_key)
+          {
+            getCandidates (key, candidates, candidate_count);
+            last_key = key;
+            have_key = true;
+          }
+
+        float x = points[i].x ();
+        float y = points[i].y ();
+        for (uint32_t j=0; j < candidate_count; ++j)
+          {
+            const Candidate & c = candidates[j];
+            if (x >= c.min_x && x <= c.max_x && y >= c.min_y && y <= c.max_y && contains (c.polygon, points[i]))
+              objects.push_back (polygons[c.polygon].object_id);
+          }
+
+        offsets[i+1] = objects.size ();
+      }
+  }
+
+  /* Write the index as an image, to be attached by attachImage:
+   *
+   *   header:         cell size, numbers of polygons, slabs, slab edges, cell table bits and
+   *                   candidates
+   *   polygons, slab offsets (padded to 8 bytes), slab edges
+   *   cell table:     key, first candidate, candidate count (per slot, linear probing)
+   *   candidates
+   *
+   * All in native byte order, 8 byte aligned.
+   */
+  void PolygonIndex::writeImage (std::vector<char> & image) const
+  {
+    PATHFINDER_TRACE_SCOPE ("PolygonIndex::writeImage");
+
+    std::unordered_map<uint64_t, std::vector<Candidate>> cells;
+    const std::unordered_map<uint64_t, std::vector<Candidate>> * source = &_cells;
+    if (_image)
+      {
+        for (uint32_t i=0; i < (1u << _image->cell_bits); ++i)
+          {
+            const ImageCell & c = _image_cells[i];
+            if (c.count != 0)
+              cells[c.key].assign (_image_candidates + c.first, _image_candidates + c.first + c.count);
+          }
+        source = &cells;
+      }
+
+    ImageHeader header;
+    header.cell_size = _cell_size;
+    header.polygon_count = getPolygonCount ();
+    header.slab_count = (_image ? _image->slab_count : _slab_offsets.size () - 1);
+    header.slab_edge_count = (_image ? _image->slab_edge_count : _slab_edges.size ());
+    header.cell_bits = 1;
+    while ((1u << header.cell_bits) < 2 * source->size ())
+      ++header.cell_bits;
+    header.candidate_count = 0;
+    header.reserved = 0;
+    for (const auto & it: *source)
+      header.candidate_count += it.second.size ();
+
+    // In the order of the keys, so the same index always gives the same image
+    std::vector<uint64_t> keys;
+    keys.reserve (source->size ());
+    for (const auto & it: *source)
+      keys.push_back (it.first);
+    std::sort (keys.begin (), keys.end ());
+
+    uint32_t mask = (1u << header.cell_bits) - 1;
+    std::vector<ImageCell> table (mask + 1, ImageCell { 0, 0, 0 });
+    std::vector<Candidate> candidates;
+    candidates.reserve (header.candidate_count);
+    for (uint64_t key: keys)
+      {
+        const std::vector<Candidate> & cell_candidates = source->at (key);
+        uint32_t slot = imageSlot (key, header.cell_bits);
+        while (table[slot].count != 0)
+          slot = (slot + 1) & mask;
+
+        table[slot].key = key;
+        table[slot].first = candidates.size ();
+        table[slot].count = cell_candidates.size ();
+        candidates.insert (candidates.end (), cell_candidates.begin (), cell_candidates.end ());
+      }
+
+    size_t polygons_bytes = header.polygon_count * sizeof (Polygon);
+    size_t offsets_bytes = (header.slab_count + 1) * sizeof (uint32_t);
+    size_t offsets_padded = (offsets_bytes + 7) & ~size_t (7);
+    size_t edges_bytes = header.slab_edge_count * sizeof (Edge);
+    size_t cells_bytes = table.size () * sizeof (ImageCell);
+    size_t candidates_bytes = candidates.size () * sizeof (Candidate);
+    image.assign (sizeof (ImageHeader) + polygons_bytes + offsets_padded + edges_bytes + cells_bytes
+                  + candidates_bytes, 0);
+
+    char * out = image.data ();
+    memcpy (out, &header, sizeof (ImageHeader));
+    out += sizeof (ImageHeader);
+    polygonIndexCopy (out, _image ? _image_polygons : _polygons.data (), polygons_bytes);
+    out += polygons_bytes;
+    polygonIndexCopy (out, _image ? _image_slab_offsets : _slab_offsets.data (), offsets_bytes);
+    out += offsets_padded;
+    polygonIndexCopy (out, _image ? _image_slab_edges : _slab_edges.data (), edges_bytes);
+    out += edges_bytes;
+    polygonIndexCopy (out, table.data (), cells_bytes);
+    out += cells_bytes;
+    polygonIndexCopy (out, candidates.data (), candidates_bytes);
+  }
+
+  /* Use an image written by writeImage instead of the current contents. data must be 8 byte
+   * aligned and stay valid as long as owner is referenced (by this index).
+   */
+  bool PolygonIndex::attachImage (const char * data, size_t size, const std::shared_ptr<const void> & owner)
+  {
+    if (size < sizeof (ImageHeader) || reinterpret_cast<uintptr_t> (data) % 8 != 0)
+      return false;
+
+    const ImageHeader * header = reinterpret_cast<const ImageHeader *> (data);
+    if (header->cell_bits == 0 || header->cell_bits > 31 || !(header->cell_size > 0.0))
+      return false;
+
+    size_t polygons_bytes = size_t (header->polygon_count) * sizeof (Polygon);
+    size_t offsets_bytes = ((size_t (header->slab_count) + 1) * sizeof (uint32_t) + 7) & ~size_t (7);
+    size_t edges_bytes = size_t (header->slab_edge_count) * sizeof (Edge);
+    size_t cells_bytes = (size_t (1) << header->cell_bits) * sizeof (ImageCell);
+    size_t candidates_bytes = size_t (header->candidate_count) * sizeof (Candidate);
+    if (sizeof (ImageHeader) + polygons_bytes + offsets_bytes + edges_bytes + cells_bytes + candidates_bytes > size)
+      return false;
+
+    clear ();
+    const char * cur = data + sizeof (ImageHeader);
+    _cell_size = header->cell_size;
+    _image_owner = owner;
+    _image = header;
+    _image_size = size;
+    _image_polygons = reinterpret_cast<const Polygon *> (cur);
+    cur += polygons_bytes;
+    _image_slab_offsets = reinterpret_cast<const uint32_t *> (cur);
+    cur += offsets_bytes;
+    _image_slab_edges = reinterpret_cast<const Edge *> (cur);
+    cur += edges_bytes;
+    _image_cells = reinterpret_cast<const ImageCell *> (cur);
+    cur += cells_bytes;
+    _image_candidates = reinterpret_cast<const Candidate *> (cur);
+    return true;
+  }
+
+  bool PolygonIndex::isAttached () const
+  {
+    return _image != nullptr;
+  }
+
+  /* Memory used by the index, like MapIndex::getMemoryUsage.
+   */
+  PolygonIndex::MemoryUsage PolygonIndex::getMemoryUsage () const
+  {
+    MemoryUsage usage;
+    usage.heap = _polygons.capacity () * sizeof (Polygon)
+                 + _slab_offsets.capacity () * sizeof (uint32_t)
+                 + _slab_edges.capacity () * sizeof (Edge)
+                 + _cells.bucket_count () * sizeof (void *)
+                 + _cells.size () * (sizeof (decltype (_cells)::value_type) + 2 * sizeof (void *));
+    for (const auto & c: _cells)
+      usage.heap += c.second.capacity () * sizeof (Candidate);
+    usage.mapped = _image_size;
+    return usage;
+  }
+
+  void PolygonIndex::getCandidates (uint64_t key, const Candidate *& candidates, uint32_t & count) const
+  {
+    candidates = nullptr;
+    count = 0;
+    if (_image)
+      {
+        uint32_t mask = (1u << _image->cell_bits) - 1;
+        for (uint32_t slot=imageSlot (key, _image->cell_bits); _image_cells[slot].count != 0; slot = (slot + 1) & mask)
+          if (_image_cells[slot].key == key)
+            {
+              candidates = _image_candidates + _image_cells[slot].first;
+              count = _image_cells[slot].count;
+              return;
+            }
+        return;
+      }
+
+    auto found = _cells.find (key);
+    if (found != _cells.end ())
+      {
+        candidates = found->second.data ();
+        count = found->second.size ();
+      }
+  }
+
+  /* Copy the attached image, to insert into it.
+   */
+  void PolygonIndex::detach ()
+  {
+    const ImageHeader header = *_image;
+    std::vector<Polygon> polygons (_image_polygons, _image_polygons + header.polygon_count);
+    std::vector<uint32_t> slab_offsets (_image_slab_offsets, _image_slab_offsets + header.slab_count + 1);
+    std::vector<Edge> slab_edges (_image_slab_edges, _image_slab_edges + header.slab_edge_count);
+    std::unordered_map<uint64_t, std::vector<Candidate>> cells;
+    for (uint32_t i=0; i < (1u << header.cell_bits); ++i)
+      {
+        const ImageCell & c = _image_cells[i];
+        if (c.count != 0)
+          cells[c.key].assign (_image_candidates + c.first, _image_candidates + c.first + c.count);
+      }
+
+    clear ();
+    _cell_size = header.cell_size;
+    _polygons.swap (polygons);
+    _slab_offsets.swap (slab_offsets);
+    _slab_edges.swap (slab_edges);
+    _cells.swap (cells);
+  }
+
+  int32_t PolygonIndex::cell (double v) const
+  {
+    return static_cast<int32_t> (std::floor (v / _cell_size));
+  }
+
+  uint64_t PolygonIndex::cellKey (int32_t x, int32_t y)
+  {
+    return (uint64_t (uint32_t (x)) << 32) | uint32_t (y);
+  }
+
+  uint32_t PolygonIndex::imageSlot (uint64_t key, uint32_t bits)
+  {
+    return uint32_t ((key * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+  }
+}
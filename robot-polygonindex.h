@@ -0,0 +1,130 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_POLYGONINDEX_H
+#define ROBOT_POLYGONINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "robot-geometry.h"
+
+namespace Pathfinder
+{
+  class MapObject;
+
+  /* Inside / outside tests of many points against closed map objects.
+   *
+   * Each polygon is cut into horizontal slabs of equal height, a slab lists the edges crossing
+   * it. A point is tested by counting the edges of its slab left of it (crossing number, even
+   * odd rule), so a test costs a few edges instead of the whole polygon. The polygons are
+   * found by a uniform grid of cell_size cells (hashed, like MapIndex) over their bounding boxes.
+   *
+   * Points exactly on an edge may be classified either way. Like MapIndex, polygons can be
+   * inserted but not removed.
+   *
+   * Like MapIndex, the index can be written to an image and attached to one (e.g. memory
+   * mapped) without rebuilding it. Inserting into an attached index copies the image first.
+   */
+  class PolygonIndex
+  {
+    public:
+      PolygonIndex (double cell_size);
+
+      bool insert (const MapObject & obj, uint32_t object_id = 0);
+      void clear ();
+      bool isEmpty () const;
+      uint32_t getPolygonCount () const;
+      double getCellSize () const;
+
+      bool contains (uint32_t polygon, const Position & pos) const;
+      void classify (const Position * points, uint32_t count,
+                     std::vector<uint32_t> & offsets, std::vector<uint32_t> & objects) const;
+
+      void writeImage (std::vector<char> & image) const;
+      bool attachImage (const char * data, size_t size, const std::shared_ptr<const void> & owner);
+      bool isAttached () const;
+
+      struct MemoryUsage
+      {
+          size_t heap;                  // allocated by the index (estimated for the hash table)
+          size_t mapped;                // of the attached image
+      };
+      MemoryUsage getMemoryUsage () const;
+
+    private:
+      struct Edge
+      {
+          double y0;                // y0 < y1, the edge holds y0 <= y < y1
+          double y1;
+          double x0;                // x at y0
+          double dxdy;
+      };
+
+      struct Polygon
+      {
+          double min_x;
+          double min_y;
+          double max_x;
+          double max_y;
+          double slab_scale;        // slabs per unit of y
+          uint32_t slab_count;
+          uint32_t first_slab;      // into _slab_offsets
+          uint32_t object_id;
+      };
+
+      struct Candidate              // copied into the cells, to save a memory access per polygon
+      {
+          float min_x;              // bounding box, rounded outwards
+          float min_y;
+          float max_x;
+          float max_y;
+          uint32_t polygon;
+      };
+
+      struct ImageHeader
+      {
+          double cell_size;
+          uint32_t polygon_count;
+          uint32_t slab_count;          // of all polygons, there is one more slab offset
+          uint32_t slab_edge_count;
+          uint32_t cell_bits;           // the table has 1 << cell_bits entries
+          uint32_t candidate_count;
+          uint32_t reserved;
+      };
+
+      struct ImageCell                  // count == 0: free entry
+      {
+          uint64_t key;
+          uint32_t first;               // into the candidates
+          uint32_t count;
+      };
+
+      int32_t cell (double v) const;
+      static uint64_t cellKey (int32_t x, int32_t y);
+      static uint32_t imageSlot (uint64_t key, uint32_t bits);
+      void getCandidates (uint64_t key, const Candidate *& candidates, uint32_t & count) const;
+      void detach ();
+
+      double _cell_size;
+      std::vector<Polygon> _polygons;
+      std::vector<uint32_t> _slab_offsets;    // edges of slab k: _slab_offsets[k] .. _slab_offsets[k+1]
+      std::vector<Edge> _slab_edges;
+      std::unordered_map<uint64_t, std::vector<Candidate>> _cells;
+
+      // Attached image, used instead of the above
+      std::shared_ptr<const void> _image_owner;
+      const ImageHeader * _image;
+      size_t _image_size;
+      const Polygon * _image_polygons;
+      const uint32_t * _image_slab_offsets;
+      const Edge * _image_slab_edges;
+      const ImageCell * _image_cells;
+      const Candidate * _image_candidates;
+  };
+}
+
+#endif
@@ -0,0 +1,528 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "robot-posegraph.h"
+#include "robot-trace.h"
+
+namespace Pathfinder
+{
+  static uint64_t poseGraphNow ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  static double poseGraphAngle (double a)
+  {
+    return std::atan2 (std::sin (a), std::cos (a));
+  }
+
+  static Eigen::Vector3d poseGraphVector (const Transformation & t)
+  {
+    Position p = t.getTranslation ();
+    return Eigen::Vector3d (p.x (), p.y (), t.getRotation ());
+  }
+
+  static Transformation poseGraphTransformation (const Eigen::Vector3d & v)
+  {
+    return Transformation (Position (v.x (), v.y ()), v.z (), 1.0);
+  }
+
+  /* Difference of two poses, with the angle normalized.
+   */
+  static Eigen::Vector3d poseGraphDifference (const Eigen::Vector3d & a, const Eigen::Vector3d & b)
+  {
+    return Eigen::Vector3d (a.x () - b.x (), a.y () - b.y (), poseGraphAngle (a.z () - b.z ()));
+  }
+
+  PoseGraph::Parameters::Parameters ()
+  : max_iterations (20),
+    convergence (1e-6),
+    relinearize_threshold (0.01),
+    initial_lambda (1e-6),
+    anchor_cell_size (2.0)
+  {
+  }
+
+  PoseGraph::PoseGraph (const Parameters & parameters)
+  : _parameters (parameters),
+    _stats (),
+    _nodes (),
+    _edges (),
+    _h (),
+    _solver (),
+    _variables (0),
+    _structure_changed (true),
+    _factorized (false),
+    _lambda (parameters.initial_lambda),
+    _grid_min (0, 0),
+    _grid_max (-1, -1),
+    _grid_start (),
+    _grid_nodes (),
+    _anchors ()
+  {
+  }
+
+  /* Add a pose, as estimated so far. The map is assumed to be built with this pose, until
+   * correct is called. The first node is fixed.
+   */
+  uint32_t PoseGraph::addNode (const Transformation & pose)
+  {
+    Node node;
+    node.pose = poseGraphVector (pose);
+    node.linearized = node.pose;
+    node.mapped = node.pose;
+    node.variable = -1;
+    node.fixed = _nodes.empty ();
+    _nodes.push_back (node);
+    _structure_changed = true;
+    return _nodes.size () - 1;
+  }
+
+  /* Add a measurement of the pose of to in the frame of from.
+   */
+  uint32_t PoseGraph::addEdge (uint32_t from, uint32_t to, const Transformation & measurement,
+                               const Eigen::Matrix3d & information, EdgeType type)
+  {
+    Edge edge;
+    edge.from = from;
+    edge.to = to;
+    edge.measurement = poseGraphVector (measurement);
+    edge.information = information;
+    edge.type = type;
+    edge.linearized = false;
+    edge.error.setZero ();
+    edge.a.setZero ();
+    edge.b.setZero ();
+    _edges.push_back (edge);
+    _structure_changed = true;
+    return _edges.size () - 1;
+  }
+
+  void PoseGraph::setFixed (uint32_t node, bool fixed)
+  {
+    if (_nodes[node].fixed == fixed)
+      return;
+
+    _nodes[node].fixed = fixed;
+    _structure_changed = true;
+  }
+
+  /* Optimize the poses, returns the remaining error (sum of the weighted squared errors).
+   */
+  double PoseGraph::optimize ()
+  {
+    PATHFINDER_TRACE_SCOPE ("PoseGraph::optimize");
+
+    uint64_t t0 = poseGraphNow ();
+    ++_stats.optimizations;
+
+    if (_structure_changed)
+      {
+        _variables = 0;
+        for (Node & node: _nodes)
+          {
+            node.variable = node.fixed ? -1 : int32_t (_variables);
+            if (!node.fixed)
+              _variables += 3;
+          }
+        _factorized = false;
+      }
+
+    double current = chi2 ();
+    std::vector<bool> moved (_nodes.size ());
+    Eigen::VectorXd b (_variables);
+    std::vector<Eigen::Vector3d> previous (_nodes.size ());
+
+    for (uint32_t iteration=0; iteration < _parameters.max_iterations && _variables > 0; ++iteration)
+      {
+        ++_stats.iterations;
+
+        // Linearize the edges of the nodes which moved too far, and the new edges
+        for (uint32_t i=0; i < _nodes.size (); ++i)
+          {
+            Node & node = _nodes[i];
+            moved[i] = poseGraphDifference (node.pose, node.linearized).cwiseAbs ().maxCoeff ()
+              > _parameters.relinearize_threshold;
+            if (moved[i])
+              node.linearized = node.pose;
+          }
+        for (Edge & edge: _edges)
+          if (!edge.linearized || moved[edge.from] || moved[edge.to])
+            {
+              linearize (edge);
+              _factorized = false;
+            }
+
+        if (!_factorized)
+          {
+            std::vector<Eigen::Triplet<double>> triplets;
+            triplets.reserve (_edges.size () * 36 + _variables);
+            for (const Edge & edge: _edges)
+              {
+                const Eigen::Matrix3d * jacobians[2] = { &edge.a, &edge.b };
+                int32_t variables[2] = { _nodes[edge.from].variable, _nodes[edge.to].variable };
+                for (int i=0; i < 2; ++i)
+                  for (int j=0; j < 2; ++j)
+                    {
+                      if (variables[i] < 0 || variables[j] < 0)
+                        continue;
+                      Eigen::Matrix3d block = jacobians[i]->transpose () * edge.information * *jacobians[j];
+                      for (int r=0; r < 3; ++r)
+                        for (int c=0; c < 3; ++c)
+                          triplets.push_back (Eigen::Triplet<double> (variables[i] + r, variables[j] + c, block (r, c)));
+                    }
+              }
+            for (uint32_t v=0; v < _variables; ++v)
+              triplets.push_back (Eigen::Triplet<double> (v, v, _lambda));
+
+            _h.resize (_variables, _variables);
+            _h.setFromTriplets (triplets.begin (), triplets.end ());
+            if (_structure_changed)
+              {
+                _solver.analyzePattern (_h);
+                ++_stats.analyses;
+                _structure_changed = false;
+              }
+            _solver.factorize (_h);
+            ++_stats.factorizations;
+            if (_solver.info () != Eigen::Success)
+              break;
+            _factorized = true;
+          }
+
+        b.setZero ();
+        for (const Edge & edge: _edges)
+          {
+            Eigen::Vector3d weighted = edge.information * linearError (edge);
+            if (_nodes[edge.from].variable >= 0)
+              b.segment<3> (_nodes[edge.from].variable) += edge.a.transpose () * weighted;
+            if (_nodes[edge.to].variable >= 0)
+              b.segment<3> (_nodes[edge.to].variable) += edge.b.transpose () * weighted;
+          }
+        Eigen::VectorXd delta = _solver.solve (-b);
+        if (delta.cwiseAbs ().maxCoeff () < _parameters.convergence)
+          break;
+
+        for (uint32_t i=0; i < _nodes.size (); ++i)
+          {
+            Node & node = _nodes[i];
+            previous[i] = node.pose;
+            if (node.variable < 0)
+              continue;
+            node.pose += delta.segment<3> (node.variable);
+            node.pose.z () = poseGraphAngle (node.pose.z ());
+          }
+
+        // Levenberg: Smaller steps while the error doesn't decrease
+        double next = chi2 ();
+        if (next > current)
+          {
+            for (uint32_t i=0; i < _nodes.size (); ++i)
+              _nodes[i].pose = previous[i];
+            _lambda *= 10.0;
+            _factorized = false;
+            continue;
+          }
+
+        current = next;
+        if (_lambda > _parameters.initial_lambda)
+          {
+            _lambda = std::max (_parameters.initial_lambda, _lambda / 10.0);
+            _factorized = false;
+          }
+      }
+
+    _stats.solve_us += (poseGraphNow () - t0) / 1000.0;
+    return current;
+  }
+
+  Transformation PoseGraph::getPose (uint32_t node) const
+  {
+    return poseGraphTransformation (_nodes[node].pose);
+  }
+
+  uint32_t PoseGraph::getNodeCount () const
+  {
+    return _nodes.size ();
+  }
+
+  uint32_t PoseGraph::getEdgeCount () const
+  {
+    return _edges.size ();
+  }
+
+  /* Sum of the weighted squared errors of all edges.
+   */
+  double PoseGraph::getError () const
+  {
+    return chi2 ();
+  }
+
+  /* Assign the vertices of all objects to their closest node.
+   */
+  void PoseGraph::anchor (const Map & map)
+  {
+    PATHFINDER_TRACE_SCOPE ("PoseGraph::anchor");
+
+    if (_nodes.empty ())
+      return;
+
+    buildGrid ();
+    for (uint32_t i=0; i < map.getObjectCount (); ++i)
+      anchorObject (map.getObjectId (i), map.getObjects ()[i]);
+    for (uint32_t i=0; i < map.getDynamicObjectCount (); ++i)
+      anchorObject (map.getDynamicObjectId (i), map.getDynamicObjects ()[i]);
+  }
+
+  /* Move the vertices of the map with the corrections of their nodes. Returns the number of
+   * objects moved.
+   */
+  uint32_t PoseGraph::correct (Map & map)
+  {
+    PATHFINDER_TRACE_SCOPE ("PoseGraph::correct");
+
+    if (_nodes.empty ())
+      return 0;
+
+    std::vector<Transformation> corrections (_nodes.size ());
+    for (uint32_t i=0; i < _nodes.size (); ++i)
+      {
+        Transformation correction (poseGraphTransformation (_nodes[i].pose) * poseGraphTransformation (_nodes[i].mapped).inverse ());
+        correction.update ();
+        corrections[i] = correction;
+      }
+
+    buildGrid ();
+    uint32_t moved = 0;
+    bool frozen_moved = false;
+    for (uint32_t i=0; i < map.getObjectCount (); ++i)
+      if (correctObject (map.getObjectId (i), map.getObject (i), corrections))
+        {
+          ++moved;
+          frozen_moved |= map.getObjects ()[i].isFrozen ();
+        }
+    for (uint32_t i=0; i < map.getDynamicObjectCount (); ++i)
+      if (correctObject (map.getDynamicObjectId (i), map.getDynamicObject (i), corrections))
+        ++moved;
+
+    if (frozen_moved)
+      map.rebuildStaticIndex ();
+
+    for (Node & node: _nodes)
+      node.mapped = node.pose;
+    _grid_start.clear ();
+    _grid_nodes.clear ();
+    return moved;
+  }
+
+  const PoseGraph::Parameters & PoseGraph::getParameters () const
+  {
+    return _parameters;
+  }
+
+  const PoseGraph::Stats & PoseGraph::getStats () const
+  {
+    return _stats;
+  }
+
+  /* Error of an edge: The measured pose of to in the frame of from, against the one of the
+   * estimates, in the frame of the measurement.
+   */
+  Eigen::Vector3d PoseGraph::error (const Edge & edge, const Eigen::Vector3d & from, const Eigen::Vector3d & to) const
+  {
+    Eigen::Rotation2Dd ri (from.z ());
+    Eigen::Rotation2Dd rz (edge.measurement.z ());
+    Eigen::Vector2d local = ri.inverse () * (to.head<2> () - from.head<2> ());
+    Eigen::Vector2d e = rz.inverse () * (local - edge.measurement.head<2> ());
+    return Eigen::Vector3d (e.x (), e.y (), poseGraphAngle (to.z () - from.z () - edge.measurement.z ()));
+  }
+
+  /* Error and Jacobians at the linearization points of the nodes.
+   */
+  void PoseGraph::linearize (Edge & edge)
+  {
+    const Eigen::Vector3d & from = _nodes[edge.from].linearized;
+    const Eigen::Vector3d & to = _nodes[edge.to].linearized;
+    double ci = std::cos (from.z ());
+    double si = std::sin (from.z ());
+    Eigen::Matrix2d ri_t;
+    ri_t << ci, si, -si, ci;
+    Eigen::Matrix2d dri_t;
+    dri_t << -si, ci, -ci, -si;
+    Eigen::Matrix2d rz_t = Eigen::Rotation2Dd (edge.measurement.z ()).toRotationMatrix ().transpose ();
+    Eigen::Vector2d dt = to.head<2> () - from.head<2> ();
+
+    edge.a.setZero ();
+    edge.a.block<2, 2> (0, 0) = -rz_t * ri_t;
+    edge.a.block<2, 1> (0, 2) = rz_t * dri_t * dt;
+    edge.a (2, 2) = -1.0;
+
+    edge.b.setZero ();
+    edge.b.block<2, 2> (0, 0) = rz_t * ri_t;
+    edge.b (2, 2) = 1.0;
+
+    edge.error = error (edge, from, to);
+    edge.linearized = true;
+    ++_stats.linearizations;
+  }
+
+  /* Error of an edge at the current estimates, to first order from its linearization point.
+   */
+  Eigen::Vector3d PoseGraph::linearError (const Edge & edge) const
+  {
+    const Node & from = _nodes[edge.from];
+    const Node & to = _nodes[edge.to];
+    return edge.error + edge.a * poseGraphDifference (from.pose, from.linearized)
+      + edge.b * poseGraphDifference (to.pose, to.linearized);
+  }
+
+  double PoseGraph::chi2 () const
+  {
+    double sum = 0.0;
+    for (const Edge & edge: _edges)
+      {
+        Eigen::Vector3d e = error (edge, _nodes[edge.from].pose, _nodes[edge.to].pose);
+        sum += e.dot (edge.information * e);
+      }
+    return sum;
+  }
+
+  /* Grid of the nodes, at the poses the map is in the frame of: The nodes sorted by cell, and
+   * the start of each cell within the bounds of the nodes.
+   */
+  void PoseGraph::buildGrid ()
+  {
+    std::vector<Eigen::Vector2i, Eigen::aligned_allocator<Eigen::Vector2i>> cells (_nodes.size ());
+    _grid_min.setConstant (std::numeric_limits<int32_t>::max ());
+    _grid_max.setConstant (std::numeric_limits<int32_t>::min ());
+    for (uint32_t i=0; i < _nodes.size (); ++i)
+      {
+        cells[i] = (_nodes[i].mapped.head<2> () / _parameters.anchor_cell_size).array ().floor ().cast<int32_t> ();
+        _grid_min = _grid_min.cwiseMin (cells[i]);
+        _grid_max = _grid_max.cwiseMax (cells[i]);
+      }
+
+    int32_t width = _grid_max[0] - _grid_min[0] + 1;
+    _grid_start.assign (_nodes.empty () ? 1 : size_t (width) * (_grid_max[1] - _grid_min[1] + 1) + 1, 0);
+    for (const Eigen::Vector2i & cell: cells)
+      ++_grid_start[(cell[1] - _grid_min[1]) * width + cell[0] - _grid_min[0] + 1];
+    for (size_t c=1; c < _grid_start.size (); ++c)
+      _grid_start[c] += _grid_start[c - 1];
+
+    std::vector<uint32_t> next (_grid_start.begin (), _grid_start.end () - 1);
+    _grid_nodes.resize (_nodes.size ());
+    for (uint32_t i=0; i < _nodes.size (); ++i)
+      _grid_nodes[next[(cells[i][1] - _grid_min[1]) * width + cells[i][0] - _grid_min[0]]++] = i;
+  }
+
+  /* The node closest to pos: The rings of grid cells around it are searched until no closer
+   * node can be found, far away from all nodes by going through all of them.
+   */
+  uint32_t PoseGraph::closestNode (const Position & pos) const
+  {
+    static const int32_t max_rings = 16;
+    double cell = _parameters.anchor_cell_size;
+    int32_t cx = std::floor (pos.x () / cell);
+    int32_t cy = std::floor (pos.y () / cell);
+    uint32_t best = 0;
+    double best_d2 = std::numeric_limits<double>::infinity ();
+
+    auto check = [&] (uint32_t i)
+      {
+        double d2 = (_nodes[i].mapped.head<2> () - pos).squaredNorm ();
+        if (d2 < best_d2)
+          {
+            best_d2 = d2;
+            best = i;
+          }
+      };
+
+    // The cells of a row or column, clipped to the bounds of the grid
+    int32_t width = _grid_max[0] - _grid_min[0] + 1;
+    auto checkRow = [&] (int32_t y, int32_t x0, int32_t x1)
+      {
+        if (y < _grid_min[1] || y > _grid_max[1])
+          return;
+        size_t row = size_t (y - _grid_min[1]) * width;
+        for (int32_t x=std::max (x0, _grid_min[0]); x <= std::min (x1, _grid_max[0]); ++x)
+          for (uint32_t i=_grid_start[row + x - _grid_min[0]]; i < _grid_start[row + x - _grid_min[0] + 1]; ++i)
+            check (_grid_nodes[i]);
+      };
+    auto checkColumn = [&] (int32_t x, int32_t y0, int32_t y1)
+      {
+        if (x < _grid_min[0] || x > _grid_max[0])
+          return;
+        for (int32_t y=std::max (y0, _grid_min[1]); y <= std::min (y1, _grid_max[1]); ++y)
+          {
+            size_t c = size_t (y - _grid_min[1]) * width + x - _grid_min[0];
+            for (uint32_t i=_grid_start[c]; i < _grid_start[c + 1]; ++i)
+              check (_grid_nodes[i]);
+          }
+      };
+
+    // Going through the nodes is cheaper than looking at more cells than there are nodes. The
+    // rings closer than the bounds of the grid are empty.
+    int32_t rings = std::min<int64_t> (max_rings, std::sqrt (double (_nodes.size ())) / 2.0);
+    int32_t first = std::max ({ 0, _grid_min[0] - cx, _grid_min[1] - cy, cx - _grid_max[0], cy - _grid_max[1] });
+    for (int32_t ring=first; ring <= first + rings; ++ring)
+      {
+        checkRow (cy - ring, cx - ring, cx + ring);
+        if (ring > 0)
+          {
+            checkRow (cy + ring, cx - ring, cx + ring);
+            checkColumn (cx - ring, cy - ring + 1, cy + ring - 1);
+            checkColumn (cx + ring, cy - ring + 1, cy + ring - 1);
+          }
+
+        // All nodes outside of the rings searched are further away than ring cells
+        if (best_d2 <= ring * cell * ring * cell)
+          return best;
+      }
+
+    for (uint32_t i=0; i < _nodes.size (); ++i)
+      check (i);
+    return best;
+  }
+
+  void PoseGraph::anchorObject (uint32_t id, const MapObject & obj)
+  {
+    Anchors & anchors = _anchors[id];
+    anchors.revision = obj.getRevision ();
+    anchors.nodes.resize (obj.getPointCount ());
+    for (uint32_t i=0; i < anchors.nodes.size (); ++i)
+      anchors.nodes[i] = closestNode (obj.getPoint (i));
+  }
+
+  /* Move the vertices of an object, anchoring it first if it changed since. Returns false if
+   * it didn't move.
+   */
+  bool PoseGraph::correctObject (uint32_t id, MapObject & obj, const std::vector<Transformation> & corrections)
+  {
+    auto found = _anchors.find (id);
+    if (found == _anchors.end () || found->second.revision != obj.getRevision ()
+        || found->second.nodes.size () != obj.getPointCount ())
+      anchorObject (id, obj);
+    Anchors & anchors = _anchors[id];
+
+    PositionVector points (obj.getPointCount ());
+    bool moved = false;
+    for (uint32_t i=0; i < points.size (); ++i)
+      {
+        Position p = obj.getPoint (i);
+        points[i] = corrections[anchors.nodes[i]].transformPosition (p);
+        moved |= (points[i] - p).squaredNorm () > 1e-18;
+      }
+    if (!moved)
+      return false;
+
+    obj.setPolygon (points);
+    anchors.revision = obj.getRevision ();
+    return true;
+  }
+}
@@ -0,0 +1,149 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_POSEGRAPH_H
+#define ROBOT_POSEGRAPH_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+
+#include "robot-geometry.h"
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* Pose graph for loop closure: The nodes are robot poses (x, y, rotation), the edges relative
+   * measurements between two of them (odometry, scan matches), with an information matrix
+   * (inverse covariance, in the frame of the first pose).
+   *
+   * optimize minimizes the weighted squared errors of all edges by Gauss-Newton steps, with
+   * Levenberg damping, solving the sparse normal equations by a sparse Cholesky (LDLT)
+   * decomposition. The first node is fixed (setFixed). The optimization is incremental:
+   *
+   *  - Each node keeps the estimate its edges were linearized at. Only the edges of nodes which
+   *    moved more than relinearize_threshold away from it are linearized again, the others use
+   *    their Jacobians (and the first order change of their error).
+   *  - The symbolic analysis of the sparse matrix is kept until nodes or edges are added, and
+   *    the numeric factorization is kept while no edge is linearized again, so a step only
+   *    solves the system for the new right hand side.
+   *
+   * Correcting the map: Each vertex of a map object belongs to the node closest to it when
+   * anchored (anchor, or correct for objects changed since). The map is in the frame of the
+   * poses as added (addNode); correct moves each vertex with the correction of its node (the
+   * optimized pose relative to the pose the map was built with), without any search for
+   * anchored objects, and makes the optimized poses the frame of the map.
+   */
+  class PoseGraph
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          uint32_t max_iterations;
+          double convergence;           // max. change of a pose (m, rad) to stop iterating
+          double relinearize_threshold; // max. change of a pose (m, rad) before its edges are linearized again
+          double initial_lambda;        // damping
+          double anchor_cell_size;      // grid of the nodes, for finding the closest node of a vertex
+      };
+
+      enum EdgeType
+      {
+        EDGE_ODOMETRY,
+        EDGE_SCAN_MATCH
+      };
+
+      struct Stats
+      {
+          uint64_t optimizations;
+          uint64_t iterations;
+          uint64_t linearizations;      // of edges
+          uint64_t analyses;            // symbolic, of the sparsity pattern
+          uint64_t factorizations;
+          double solve_us;              // total time spent optimizing
+      };
+
+      PoseGraph (const Parameters & parameters);
+
+      uint32_t addNode (const Transformation & pose);
+      uint32_t addEdge (uint32_t from, uint32_t to, const Transformation & measurement,
+                        const Eigen::Matrix3d & information, EdgeType type);
+      void setFixed (uint32_t node, bool fixed);
+      double optimize ();
+
+      Transformation getPose (uint32_t node) const;
+      uint32_t getNodeCount () const;
+      uint32_t getEdgeCount () const;
+      double getError () const;
+
+      void anchor (const Map & map);
+      uint32_t correct (Map & map);
+
+      const Parameters & getParameters () const;
+      const Stats & getStats () const;
+
+    private:
+      struct Node
+      {
+          Eigen::Vector3d pose;
+          Eigen::Vector3d linearized;   // estimate the edges were linearized at
+          Eigen::Vector3d mapped;       // pose the map is in the frame of
+          int32_t variable;             // first row in the system, -1 if fixed
+          bool fixed;
+      };
+
+      struct Edge
+      {
+          uint32_t from;
+          uint32_t to;
+          Eigen::Vector3d measurement;
+          Eigen::Matrix3d information;
+          EdgeType type;
+
+          bool linearized;
+          Eigen::Vector3d error;        // at the linearization point
+          Eigen::Matrix3d a;            // d error / d from
+          Eigen::Matrix3d b;            // d error / d to
+      };
+
+      struct Anchors
+      {
+          uint32_t revision;            // of the object when anchored
+          std::vector<uint32_t> nodes;  // per vertex
+      };
+
+      Eigen::Vector3d error (const Edge & edge, const Eigen::Vector3d & from, const Eigen::Vector3d & to) const;
+      void linearize (Edge & edge);
+      Eigen::Vector3d linearError (const Edge & edge) const;
+      double chi2 () const;
+      void buildGrid ();
+      uint32_t closestNode (const Position & pos) const;
+      void anchorObject (uint32_t id, const MapObject & obj);
+      bool correctObject (uint32_t id, MapObject & obj, const std::vector<Transformation> & corrections);
+
+      Parameters _parameters;
+      Stats _stats;
+      std::vector<Node> _nodes;
+      std::vector<Edge> _edges;
+
+      Eigen::SparseMatrix<double> _h;
+      Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> _solver;
+      uint32_t _variables;
+      bool _structure_changed;          // nodes or edges added, fixed changed
+      bool _factorized;                 // _solver holds the factorization of the current linearization
+      double _lambda;
+
+      Eigen::Vector2i _grid_min;        // bounds of the cells with nodes, by their mapped pose
+      Eigen::Vector2i _grid_max;
+      std::vector<uint32_t> _grid_start;                           // per cell, into _grid_nodes
+      std::vector<uint32_t> _grid_nodes;
+      std::unordered_map<uint32_t, Anchors> _anchors;              // by object id
+  };
+}
+
+#endif
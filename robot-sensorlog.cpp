@@ -0,0 +1,329 @@
+/*
+ *
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "robot-sensorlog.h"
+
+namespace Pathfinder
+{
+  static const char log_magic[4] = { 'P', 'F', 'S', 'L' };
+  static const uint32_t log_version = 1;
+
+  struct LogFileHeader
+  {
+      char magic[4];
+      uint32_t version;
+  };
+
+  struct LogRecordHeader
+  {
+      uint32_t type;
+      uint32_t payload_size;
+      double time;
+  };
+
+  struct LogScanHeader
+  {
+      float angle_min;
+      float angle_increment;
+      float max_range;
+      uint32_t count;
+  };
+
+  static uint32_t paddedSize (uint32_t size)
+  {
+    return (size + 7) & ~7u;
+  }
+
+  ObservationSink::~ObservationSink ()
+  {
+  }
+
+  SensorLogWriter::SensorLogWriter ()
+  : _file (nullptr),
+    _failed (false),
+    _buffer ()
+  {
+  }
+
+  SensorLogWriter::~SensorLogWriter ()
+  {
+    close ();
+  }
+
+  /* Open a log for appending. A new file gets the header, an existing one is checked.
+   */
+  bool SensorLogWriter::open (const std::string & file_name)
+  {
+    close ();
+    _failed = false;
+
+    _file = fopen (file_name.c_str (), "ab+");
+    if (_file == nullptr)
+      return false;
+
+    fseek (_file, 0, SEEK_END);
+    if (ftell (_file) == 0)
+      {
+        LogFileHeader header;
+        memcpy (header.magic, log_magic, sizeof (log_magic));
+        header.version = log_version;
+        if (fwrite (&header, sizeof (header), 1, _file) == 1)
+          return true;
+      }
+    else
+      {
+        LogFileHeader header;
+        fseek (_file, 0, SEEK_SET);
+        if (fread (&header, sizeof (header), 1, _file) == 1
+            && memcmp (header.magic, log_magic, sizeof (log_magic)) == 0
+            && header.version == log_version)
+          {
+            fseek (_file, 0, SEEK_END);
+            return true;
+          }
+      }
+
+    fclose (_file);
+    _file = nullptr;
+    return false;
+  }
+
+  bool SensorLogWriter::close ()
+  {
+    if (_file == nullptr)
+      return true;
+
+    if (fclose (_file) != 0)
+      _failed = true;
+    _file = nullptr;
+    return !_failed;
+  }
+
+  bool SensorLogWriter::isOpen () const
+  {
+    return _file != nullptr;
+  }
+
+  /* False if writing a record (or closing the log) failed since it was opened. The records
+   * are buffered, so close reports the failures of the last ones.
+   */
+  bool SensorLogWriter::ok () const
+  {
+    return !_failed;
+  }
+
+  void SensorLogWriter::pushPose (double time, const Transformation & pose)
+  {
+    double matrix[6];
+    for (uint32_t r=0; r < 2; ++r)
+      for (uint32_t c=0; c < 3; ++c)
+        matrix[r*3 + c] = pose (r, c);
+
+    writeRecord (SensorLogReader::POSE, time, matrix, sizeof (matrix));
+  }
+
+  void SensorLogWriter::pushScan (double time, const RangeScan & scan)
+  {
+    LogScanHeader header;
+    header.angle_min = scan.angle_min;
+    header.angle_increment = scan.angle_increment;
+    header.max_range = scan.max_range;
+    header.count = scan.ranges.size ();
+
+    uint32_t size = sizeof (header) + header.count * sizeof (float);
+    _buffer.resize (size);
+    memcpy (_buffer.data (), &header, sizeof (header));
+    if (header.count > 0)
+      memcpy (_buffer.data () + sizeof (header), scan.ranges.data (), header.count * sizeof (float));
+
+    writeRecord (SensorLogReader::SCAN, time, _buffer.data (), size);
+  }
+
+  /* Write a record, unless an earlier one failed: After a partial write, records written
+   * behind it couldn't be read anyway.
+   */
+  bool SensorLogWriter::writeRecord (uint32_t type, double time, const void * payload, uint32_t size)
+  {
+    if (_file == nullptr || _failed)
+      return false;
+
+    static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    LogRecordHeader header;
+    header.type = type;
+    header.payload_size = size;
+    header.time = time;
+
+    _failed = !(fwrite (&header, sizeof (header), 1, _file) == 1
+                && (size == 0 || fwrite (payload, size, 1, _file) == 1)
+                && (paddedSize (size) == size || fwrite (padding, paddedSize (size) - size, 1, _file) == 1));
+    return !_failed;
+  }
+
+  SensorLogReader::SensorLogReader ()
+  : _data (nullptr),
+    _size (0),
+    _pos (0)
+  {
+  }
+
+  SensorLogReader::~SensorLogReader ()
+  {
+    close ();
+  }
+
+  bool SensorLogReader::open (const std::string & file_name)
+  {
+    close ();
+
+    int fd = ::open (file_name.c_str (), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (LogFileHeader))
+      {
+        ::close (fd);
+        return false;
+      }
+
+    void * data = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close (fd);
+    if (data == MAP_FAILED)
+      return false;
+
+    madvise (data, st.st_size, MADV_SEQUENTIAL);
+
+    const LogFileHeader * header = static_cast<const LogFileHeader *> (data);
+    if (memcmp (header->magic, log_magic, sizeof (log_magic)) != 0 || header->version != log_version)
+      {
+        munmap (data, st.st_size);
+        return false;
+      }
+
+    _data = static_cast<const char *> (data);
+    _size = st.st_size;
+    _pos = sizeof (LogFileHeader);
+    return true;
+  }
+
+  void SensorLogReader::close ()
+  {
+    if (_data != nullptr)
+      munmap (const_cast<char *> (_data), _size);
+
+    _data = nullptr;
+    _size = 0;
+    _pos = 0;
+  }
+
+  /* Read the next record. Returns false at the end of the log or at a truncated record
+   * (e.g. the recording was interrupted). Unknown record types are skipped.
+   */
+  bool SensorLogReader::next (Record & record)
+  {
+    while (_data != nullptr && _pos + sizeof (LogRecordHeader) <= _size)
+      {
+        const LogRecordHeader * header = reinterpret_cast<const LogRecordHeader *> (_data + _pos);
+        size_t payload_pos = _pos + sizeof (LogRecordHeader);
+        if (payload_pos + header->payload_size > _size)
+          return false;
+
+        const char * payload = _data + payload_pos;
+        _pos = payload_pos + paddedSize (header->payload_size);
+        record.time = header->time;
+
+        if (header->type == POSE && header->payload_size == 6 * sizeof (double))
+          {
+            const double * matrix = reinterpret_cast<const double *> (payload);
+            record.type = POSE;
+            record.pose.setIdentity ();
+            for (uint32_t r=0; r < 2; ++r)
+              for (uint32_t c=0; c < 3; ++c)
+                record.pose (r, c) = matrix[r*3 + c];
+            record.pose.update ();
+            return true;
+          }
+
+        if (header->type == SCAN && header->payload_size >= sizeof (LogScanHeader))
+          {
+            const LogScanHeader * scan = reinterpret_cast<const LogScanHeader *> (payload);
+            if (sizeof (LogScanHeader) + scan->count * sizeof (float) > header->payload_size)
+              return false;
+
+            const float * ranges = reinterpret_cast<const float *> (payload + sizeof (LogScanHeader));
+            record.type = SCAN;
+            record.scan.angle_min = scan->angle_min;
+            record.scan.angle_increment = scan->angle_increment;
+            record.scan.max_range = scan->max_range;
+            record.scan.ranges.assign (ranges, ranges + scan->count);
+            return true;
+          }
+      }
+
+    return false;
+  }
+
+  void SensorLogReader::rewind ()
+  {
+    if (_data != nullptr)
+      _pos = sizeof (LogFileHeader);
+  }
+
+  size_t SensorLogReader::getFileSize () const
+  {
+    return _size;
+  }
+
+  size_t SensorLogReader::getPosition () const
+  {
+    return _pos;
+  }
+
+  /* Feed all remaining records into sink.
+   *
+   * With speed <= 0.0 as fast as possible, otherwise the time stamps are followed,
+   * speed 1.0 is real time. Returns the number of records.
+   */
+  uint64_t SensorLogReader::replay (ObservationSink & sink, double speed)
+  {
+    Record record;
+    uint64_t count = 0;
+    bool first = true;
+    double first_time = 0.0;
+    auto start = std::chrono::steady_clock::now ();
+
+    while (next (record))
+      {
+        if (speed > 0.0)
+          {
+            if (first)
+              first_time = record.time;
+
+            std::chrono::duration<double> offset ((record.time - first_time) / speed);
+            std::this_thread::sleep_until (start + std::chrono::duration_cast<std::chrono::steady_clock::duration> (offset));
+          }
+        first = false;
+
+        if (record.type == POSE)
+          sink.pushPose (record.time, record.pose);
+        else
+          sink.pushScan (record.time, record.scan);
+
+        ++count;
+      }
+
+    return count;
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_SENSORLOG_H
+#define ROBOT_SENSORLOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "robot-geometry.h"
+
+namespace Pathfinder
+{
+  /* A scan of a range sensor, in the coordinate system of the robot.
+   *
+   * Beam i points to angle_min + i * angle_increment (radian, 0 is the x axis of the robot).
+   * Ranges >= max_range (or not finite) are invalid, nothing was hit.
+   */
+  struct RangeScan
+  {
+      float angle_min;
+      float angle_increment;
+      float max_range;
+      std::vector<float> ranges;
+  };
+
+  /* Receiver of the sensor data of a robot.
+   *
+   * Everything producing observations (the connection to the robot, log replay, simulation)
+   * feeds them through this interface.
+   */
+  class ObservationSink
+  {
+    public:
+      virtual ~ObservationSink ();
+
+      virtual void pushPose (double time, const Transformation & pose) = 0;
+      virtual void pushScan (double time, const RangeScan & scan) = 0;
+  };
+
+  /* Writer of sensor logs.
+   *
+   * A log is append only. It starts with the header (char magic[4] = "PFSL", uint32 version)
+   * followed by records, all in native byte order and 8 byte aligned:
+   *
+   *   uint32 type, uint32 payload_size, double time, payload (padded to 8 bytes)
+   *
+   *   pose:  double matrix[6] (the first two rows of the affine transformation, row major)
+   *   scan:  float angle_min, float angle_increment, float max_range, uint32 count,
+   *          float ranges[count]
+   *
+   * The writer is also an ObservationSink, so it can record anything fed into the mapping.
+   * Nothing is written after a write failed, so the log stays readable up to the record that
+   * failed; ok () tells whether that happened.
+   */
+  class SensorLogWriter : public ObservationSink
+  {
+    public:
+      SensorLogWriter ();
+      virtual ~SensorLogWriter ();
+
+      bool open (const std::string & file_name);
+      bool close ();
+      bool isOpen () const;
+      bool ok () const;
+
+      virtual void pushPose (double time, const Transformation & pose);
+      virtual void pushScan (double time, const RangeScan & scan);
+
+    private:
+      bool writeRecord (uint32_t type, double time, const void * payload, uint32_t size);
+
+      FILE * _file;
+      bool _failed;
+      std::vector<char> _buffer;
+  };
+
+  /* Reader of sensor logs.
+   *
+   * The file is memory mapped and read sequentially, so only the pages in use are loaded,
+   * even for hour long recordings.
+   */
+  class SensorLogReader
+  {
+    public:
+      enum RecordType
+      {
+        POSE = 1,
+        SCAN = 2
+      };
+
+      struct Record
+      {
+          RecordType type;
+          double time;
+          Transformation pose;
+          RangeScan scan;
+      };
+
+      SensorLogReader ();
+      ~SensorLogReader ();
+
+      bool open (const std::string & file_name);
+      void close ();
+
+      bool next (Record & record);
+      void rewind ();
+      size_t getFileSize () const;
+      size_t getPosition () const;
+
+      uint64_t replay (ObservationSink & sink, double speed);
+
+    private:
+      const char * _data;
+      size_t _size;
+      size_t _pos;
+  };
+}
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "robot-simulator.h"
+
+namespace Pathfinder
+{
+  /* Sort the segments of all objects of map into a grid with cells of cell_size.
+   */
+  RayCaster::RayCaster (const Map & map, double cell_size)
+  : _cell_size (cell_size),
+    _origin_x (0.0),
+    _origin_y (0.0),
+    _cells_x (0),
+    _cells_y (0),
+    _segments (),
+    _cell_start (),
+    _cell_segments ()
+  {
+    Eigen::AlignedBox2d box;
+    for (const MapObject & obj: map.getObjects ())
+      {
+        uint32_t count = obj.getPointCount ();
+        for (uint32_t i=1; i < count; ++i)
+          _segments.push_back (LineSegment (obj.getPoint (i-1), obj.getPoint (i)));
+        box.extend (obj.getBoundingBox ());
+      }
+
+    if (box.isEmpty ())
+      return;
+
+    _origin_x = box.min ().x () - cell_size;
+    _origin_y = box.min ().y () - cell_size;
+    _cells_x = static_cast<int32_t> (std::ceil (box.sizes ().x () / cell_size)) + 2;
+    _cells_y = static_cast<int32_t> (std::ceil (box.sizes ().y () / cell_size)) + 2;
+
+    // Two passes: count the segments per cell, then fill them in.
+    _cell_start.assign (_cells_x * _cells_y + 1, 0);
+    for (uint32_t pass=0; pass < 2; ++pass)
+      {
+        std::vector<uint32_t> fill;
+        if (pass == 1)
+          {
+            for (uint32_t i=1; i < _cell_start.size (); ++i)
+              _cell_start[i] += _cell_start[i-1];
+            _cell_segments.resize (_cell_start.back ());
+            fill.assign (_cell_start.begin (), _cell_start.end () - 1);
+          }
+
+        for (uint32_t s=0; s < _segments.size (); ++s)
+          {
+            const Position & p1 = _segments[s].getPosition1 ();
+            const Position & p2 = _segments[s].getPosition2 ();
+            int32_t x0 = cellX (std::min (p1.x (), p2.x ()));
+            int32_t x1 = cellX (std::max (p1.x (), p2.x ()));
+            int32_t y0 = cellY (std::min (p1.y (), p2.y ()));
+            int32_t y1 = cellY (std::max (p1.y (), p2.y ()));
+
+            for (int32_t cy=y0; cy <= y1; ++cy)
+              for (int32_t cx=x0; cx <= x1; ++cx)
+                {
+                  uint32_t cell = cy * _cells_x + cx;
+                  if (pass == 0)
+                    ++_cell_start[cell + 1];
+                  else
+                    _cell_segments[fill[cell]++] = s;
+                }
+          }
+      }
+  }
+
+  /* Cast a ray from origin in direction angle (radian).
+   *
+   * Returns false if nothing is hit within max_range, otherwise distance is set to the
+   * distance of the first hit.
+   */
+  bool RayCaster::cast (const Position & origin, double angle, double max_range, double * distance) const
+  {
+    if (_cells_x == 0)
+      return false;
+
+    Position dir (std::cos (angle), std::sin (angle));
+    static const double inf = std::numeric_limits<double>::infinity ();
+
+    int32_t cx = static_cast<int32_t> (std::floor ((origin.x () - _origin_x) / _cell_size));
+    int32_t cy = static_cast<int32_t> (std::floor ((origin.y () - _origin_y) / _cell_size));
+    int32_t step_x = dir.x () > 0 ? 1 : -1;
+    int32_t step_y = dir.y () > 0 ? 1 : -1;
+
+    // Ray parameters of the next cell border in x and y, and the distance between borders
+    double next_x = _origin_x + (cx + (step_x > 0 ? 1 : 0)) * _cell_size;
+    double next_y = _origin_y + (cy + (step_y > 0 ? 1 : 0)) * _cell_size;
+    double t_max_x = dir.x () != 0.0 ? (next_x - origin.x ()) / dir.x () : inf;
+    double t_max_y = dir.y () != 0.0 ? (next_y - origin.y ()) / dir.y () : inf;
+    double t_delta_x = dir.x () != 0.0 ? _cell_size / std::fabs (dir.x ()) : inf;
+    double t_delta_y = dir.y () != 0.0 ? _cell_size / std::fabs (dir.y ()) : inf;
+
+    // The segments are intersected in KernelScalar precision, relative to the origin of the
+    // ray, so single precision kernels don't lose the precision in the absolute coordinates.
+    Position local (0, 0);
+    if (!std::is_same<KernelScalar, double>::value)
+      local = origin;
+    KernelPosition korigin ((origin - local).cast<KernelScalar> ());
+    KernelPosition kdir (dir.cast<KernelScalar> ());
+
+    double best = inf;
+    while (true)
+      {
+        if (cx >= 0 && cx < _cells_x && cy >= 0 && cy < _cells_y)
+          {
+            uint32_t cell = cy * _cells_x + cx;
+            for (uint32_t i=_cell_start[cell]; i < _cell_start[cell + 1]; ++i)
+              {
+                const LineSegment & segment = _segments[_cell_segments[i]];
+                KernelPosition p1 ((segment.getPosition1 () - local).cast<KernelScalar> ());
+                KernelPosition p2 ((segment.getPosition2 () - local).cast<KernelScalar> ());
+                KernelScalar s;
+                if (KernelLineSegment (p1, p2).intersectRay (korigin, kdir, &s) && s < best)
+                  best = s;
+              }
+          }
+
+        // A hit before the exit of this cell can't be beaten by later cells.
+        double t_exit = std::min (t_max_x, t_max_y);
+        if (best <= t_exit || t_exit > max_range)
+          break;
+
+        if (t_max_x < t_max_y)
+          {
+            cx += step_x;
+            t_max_x += t_delta_x;
+          }
+        else
+          {
+            cy += step_y;
+            t_max_y += t_delta_y;
+          }
+      }
+
+    if (best > max_range)
+      return false;
+
+    *distance = best;
+    return true;
+  }
+
+  /* Distance of pos to the closest segment, infinity if there is none within max_dist.
+   */
+  double RayCaster::nearestDistance (const Position & pos, double max_dist) const
+  {
+    double best = std::numeric_limits<double>::infinity ();
+    if (_cells_x == 0)
+      return best;
+
+    int32_t x0 = cellX (pos.x () - max_dist);
+    int32_t x1 = cellX (pos.x () + max_dist);
+    int32_t y0 = cellY (pos.y () - max_dist);
+    int32_t y1 = cellY (pos.y () + max_dist);
+
+    for (int32_t cy=y0; cy <= y1; ++cy)
+      for (int32_t cx=x0; cx <= x1; ++cx)
+        {
+          uint32_t cell = cy * _cells_x + cx;
+          for (uint32_t i=_cell_start[cell]; i < _cell_start[cell + 1]; ++i)
+            best = std::min (best, _segments[_cell_segments[i]].distance (pos));
+        }
+
+    return best <= max_dist ? best : std::numeric_limits<double>::infinity ();
+  }
+
+  /* Cell column of x, clamped to the grid.
+   */
+  int32_t RayCaster::cellX (double x) const
+  {
+    int32_t c = static_cast<int32_t> (std::floor ((x - _origin_x) / _cell_size));
+    return std::max (0, std::min (_cells_x - 1, c));
+  }
+
+  int32_t RayCaster::cellY (double y) const
+  {
+    int32_t c = static_cast<int32_t> (std::floor ((y - _origin_y) / _cell_size));
+    return std::max (0, std::min (_cells_y - 1, c));
+  }
+
+  static double simulatorNoise (std::mt19937 & rng, double sigma)
+  {
+    if (sigma <= 0.0)
+      return 0.0;
+
+    std::normal_distribution<double> dist (0.0, sigma);
+    return dist (rng);
+  }
+
+  SimulatedRobot::Parameters::Parameters ()
+  : speed (1.0),
+    pose_rate (20.0),
+    scan_rate (10.0),
+    beams (360),
+    field_of_view (2.0 * std::acos (-1)),
+    max_range (10.0),
+    range_noise (0.01),
+    odometry_noise (0.002),
+    heading_noise (0.0005)
+  {
+  }
+
+  /* Create a robot, which starts start_offset meters along the route.
+   *
+   * The route is closed, after the last waypoint the robot drives to the first one again.
+   */
+  SimulatedRobot::SimulatedRobot (const RayCaster & terrain,
+                                  const std::vector<Position,Eigen::aligned_allocator<Position>> & route,
+                                  double start_offset, const Parameters & parameters, uint32_t seed)
+  : _terrain (terrain),
+    _route (route),
+    _parameters (parameters),
+    _rng (seed),
+    _time (0.0),
+    _segment (0),
+    _segment_pos (0.0),
+    _next_pose_time (0.0),
+    _next_scan_time (0.0),
+    _scans (0),
+    _drift_x (0.0),
+    _drift_y (0.0),
+    _heading_drift (0.0)
+  {
+    if (_route.size () >= 2)
+      {
+        double length = 0.0;
+        for (uint32_t i=0; i < _route.size (); ++i)
+          length += _route[i].distance (_route[(i + 1) % _route.size ()]);
+
+        if (length > 0.0)
+          _segment_pos = std::fmod (start_offset, length);
+        moveAlongRoute (0.0);
+      }
+  }
+
+  /* Drive for duration seconds (simulated time), as fast as possible.
+   */
+  void SimulatedRobot::run (ObservationSink & sink, double duration)
+  {
+    double end = _time + duration;
+    while (true)
+      {
+        double next = std::min (_next_pose_time, _next_scan_time);
+        if (next > end)
+          break;
+
+        step (sink, std::max (0.0, next - _time));
+      }
+
+    if (_time < end)
+      step (sink, end - _time);
+  }
+
+  /* Advance the time by dt and report the pose and the scan if they are due.
+   */
+  void SimulatedRobot::step (ObservationSink & sink, double dt)
+  {
+    double distance = _parameters.speed * dt;
+    moveAlongRoute (distance);
+    _time += dt;
+
+    if (distance > 0.0)
+      {
+        // The odometry error is a random walk, its variance grows with the distance.
+        double sigma = std::sqrt (distance);
+        _drift_x += simulatorNoise (_rng, _parameters.odometry_noise * sigma);
+        _drift_y += simulatorNoise (_rng, _parameters.odometry_noise * sigma);
+        _heading_drift += simulatorNoise (_rng, _parameters.heading_noise * sigma);
+      }
+
+    Position pos = getTruePosition ();
+    double heading = getTrueHeading ();
+
+    if (_time >= _next_pose_time)
+      {
+        Transformation odometry (Position (pos.x () + _drift_x, pos.y () + _drift_y),
+                                 heading + _heading_drift, 1.0);
+        sink.pushPose (_time, odometry);
+        _next_pose_time += 1.0 / _parameters.pose_rate;
+      }
+
+    if (_time >= _next_scan_time)
+      {
+        RangeScan scan;
+        uint32_t beams = std::max (2u, _parameters.beams);
+        scan.angle_min = -_parameters.field_of_view / 2.0;
+        scan.angle_increment = _parameters.field_of_view / (beams - 1);
+        scan.max_range = _parameters.max_range;
+        scan.ranges.resize (beams);
+
+        for (uint32_t i=0; i < beams; ++i)
+          {
+            double r;
+            double a = heading + scan.angle_min + i * double (scan.angle_increment);
+            if (_terrain.cast (pos, a, _parameters.max_range, &r))
+              scan.ranges[i] = r + simulatorNoise (_rng, _parameters.range_noise);
+            else
+              scan.ranges[i] = _parameters.max_range;
+          }
+
+        sink.pushScan (_time, scan);
+        _next_scan_time += 1.0 / _parameters.scan_rate;
+        ++_scans;
+      }
+  }
+
+  double SimulatedRobot::getTime () const
+  {
+    return _time;
+  }
+
+  Position SimulatedRobot::getTruePosition () const
+  {
+    if (_route.size () < 2)
+      return _route.empty () ? Position (0, 0) : _route[0];
+
+    const Position & a = _route[_segment];
+    const Position & b = _route[(_segment + 1) % _route.size ()];
+    double length = a.distance (b);
+    if (length <= 0.0)
+      return a;
+
+    return Position (a + (b - a) * (_segment_pos / length));
+  }
+
+  /* Heading in radian, the direction of the current route segment.
+   */
+  double SimulatedRobot::getTrueHeading () const
+  {
+    if (_route.size () < 2)
+      return 0.0;
+
+    Eigen::Vector2d d = _route[(_segment + 1) % _route.size ()] - _route[_segment];
+    return std::atan2 (d.y (), d.x ());
+  }
+
+  uint64_t SimulatedRobot::getScanCount () const
+  {
+    return _scans;
+  }
+
+  void SimulatedRobot::moveAlongRoute (double distance)
+  {
+    if (_route.size () < 2)
+      return;
+
+    _segment_pos += distance;
+    for (uint32_t i=0; i <= _route.size (); ++i)
+      {
+        double length = _route[_segment].distance (_route[(_segment + 1) % _route.size ()]);
+        if (_segment_pos < length)
+          return;
+
+        _segment_pos -= length;
+        _segment = (_segment + 1) % _route.size ();
+      }
+
+    // Only reached for a route of zero length
+    _segment_pos = 0.0;
+  }
+
+  MapQuality MapQuality::compare (const Map & built, const RayCaster & truth, double max_dist)
+  {
+    MapQuality quality;
+    quality.vertices = 0;
+    quality.outliers = 0;
+    quality.mean_error = 0.0;
+    quality.p95_error = 0.0;
+    quality.max_error = 0.0;
+
+    std::vector<double> errors;
+    for (const MapObject & obj: built.getObjects ())
+      {
+        uint32_t count = obj.getPointCount ();
+        quality.vertices += count;
+        for (uint32_t i=0; i < count; ++i)
+          {
+            double d = truth.nearestDistance (obj.getPoint (i), max_dist);
+            if (std::isinf (d))
+              ++quality.outliers;
+            else
+              errors.push_back (d);
+          }
+      }
+
+    if (errors.empty ())
+      return quality;
+
+    double sum = 0.0;
+    for (double e: errors)
+      sum += e;
+
+    std::sort (errors.begin (), errors.end ());
+    quality.mean_error = sum / errors.size ();
+    quality.p95_error = errors[errors.size () * 95 / 100];
+    quality.max_error = errors.back ();
+    return quality;
+  }
+}
@@ -0,0 +1,115 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_SIMULATOR_H
+#define ROBOT_SIMULATOR_H
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "robot-map.h"
+#include "robot-sensorlog.h"
+
+namespace Pathfinder
+{
+  /* Casts rays against the segments of a static map.
+   *
+   * The segments are sorted into a uniform grid, a ray only tests the segments of the cells it
+   * passes (in order of the distance), so the costs depend on the range, not the map size.
+   * The map must not change while the caster is used, it may be used from several threads.
+   */
+  class RayCaster
+  {
+    public:
+      RayCaster (const Map & map, double cell_size);
+
+      bool cast (const Position & origin, double angle, double max_range, double * distance) const;
+      double nearestDistance (const Position & pos, double max_dist) const;
+
+    private:
+      int32_t cellX (double x) const;
+      int32_t cellY (double y) const;
+
+      double _cell_size;
+      double _origin_x;
+      double _origin_y;
+      int32_t _cells_x;
+      int32_t _cells_y;
+      std::vector<LineSegment,Eigen::aligned_allocator<LineSegment>> _segments;
+      std::vector<uint32_t> _cell_start;      // Start of the segments of a cell in _cell_segments
+      std::vector<uint32_t> _cell_segments;
+  };
+
+  /* A virtual robot, driving along a closed route of waypoints in a known terrain.
+   *
+   * It reports its pose (with accumulating odometry noise) and range scans (ray casts
+   * against the terrain with range noise) to an ObservationSink, like the real robot would.
+   */
+  class SimulatedRobot
+  {
+    public:
+      struct Parameters
+      {
+          Parameters ();
+
+          double speed;               // m/s
+          double pose_rate;           // poses per second
+          double scan_rate;           // scans per second
+          uint32_t beams;
+          double field_of_view;       // radian, centered at the heading
+          double max_range;
+          double range_noise;         // sigma of the range noise
+          double odometry_noise;      // sigma of the position drift per meter
+          double heading_noise;       // sigma of the heading drift per meter
+      };
+
+      SimulatedRobot (const RayCaster & terrain, const std::vector<Position,Eigen::aligned_allocator<Position>> & route,
+                      double start_offset, const Parameters & parameters, uint32_t seed);
+
+      void run (ObservationSink & sink, double duration);
+      void step (ObservationSink & sink, double dt);
+
+      double getTime () const;
+      Position getTruePosition () const;
+      double getTrueHeading () const;
+      uint64_t getScanCount () const;
+
+    private:
+      void moveAlongRoute (double distance);
+
+      const RayCaster & _terrain;
+      std::vector<Position,Eigen::aligned_allocator<Position>> _route;
+      Parameters _parameters;
+      std::mt19937 _rng;
+
+      double _time;
+      uint32_t _segment;            // current segment of the route
+      double _segment_pos;          // driven distance on the current segment
+      double _next_pose_time;
+      double _next_scan_time;
+      uint64_t _scans;
+
+      // Error of the odometry, accumulated while driving
+      double _drift_x;
+      double _drift_y;
+      double _heading_drift;
+  };
+
+  /* Quality of a built map compared to the ground truth: The distances of the vertices of the
+   * built map to the closest truth segment.
+   */
+  struct MapQuality
+  {
+      static MapQuality compare (const Map & built, const RayCaster & truth, double max_dist);
+
+      uint64_t vertices;
+      uint64_t outliers;      // vertices further than max_dist away from the truth
+      double mean_error;
+      double p95_error;
+      double max_error;
+  };
+}
+
+#endif
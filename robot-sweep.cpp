@@ -0,0 +1,450 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "robot-sweep.h"
+
+namespace Pathfinder
+{
+  // Exact arithmetic with floating point expansions (Shewchuk): A value is the sum of
+  // non-overlapping doubles of increasing magnitude, its sign is the sign of the last one.
+
+  static inline void sweepTwoSum (double a, double b, double & x, double & y)
+  {
+    x = a + b;
+    double bv = x - a;
+    double av = x - bv;
+    y = (a - av) + (b - bv);
+  }
+
+  static inline void sweepTwoProduct (double a, double b, double & x, double & y)
+  {
+    x = a * b;
+    y = std::fma (a, b, -x);
+  }
+
+  /* Add b to the expansion e of n terms in place, zeros are dropped. Returns the new length.
+   */
+  static uint32_t sweepGrowExpansion (double * e, uint32_t n, double b)
+  {
+    double q = b;
+    uint32_t k = 0;
+    for (uint32_t i=0; i < n; ++i)
+      {
+        double x;
+        double y;
+        sweepTwoSum (q, e[i], x, y);
+        q = x;
+        if (y != 0.0)
+          e[k++] = y;
+      }
+    if (q != 0.0)
+      e[k++] = q;
+
+    return k;
+  }
+
+  int crossSign (const Position & a0, const Position & a1, const Position & b0, const Position & b1)
+  {
+    double dax = a1.x () - a0.x ();
+    double day = a1.y () - a0.y ();
+    double dbx = b1.x () - b0.x ();
+    double dby = b1.y () - b0.y ();
+    double l = dax * dby;
+    double r = day * dbx;
+    double det = l - r;
+
+    // Filter: The rounding error of det is below 4.5 epsilon of the magnitudes
+    double bound = 2e-15 * (std::fabs (l) + std::fabs (r));
+    if (det > bound)
+      return 1;
+    if (det < -bound)
+      return -1;
+
+    // Exact: The differences as two-term expansions, the products of all their terms summed up
+    double ax[2];
+    double ay[2];
+    double bx[2];
+    double by[2];
+    sweepTwoSum (a1.x (), -a0.x (), ax[0], ax[1]);
+    sweepTwoSum (a1.y (), -a0.y (), ay[0], ay[1]);
+    sweepTwoSum (b1.x (), -b0.x (), bx[0], bx[1]);
+    sweepTwoSum (b1.y (), -b0.y (), by[0], by[1]);
+
+    double e[40];
+    uint32_t n = 0;
+    for (uint32_t i=0; i < 2; ++i)
+      for (uint32_t j=0; j < 2; ++j)
+        {
+          double x;
+          double y;
+          sweepTwoProduct (ax[i], by[j], x, y);
+          n = sweepGrowExpansion (e, n, y);
+          n = sweepGrowExpansion (e, n, x);
+          sweepTwoProduct (ay[i], bx[j], x, y);
+          n = sweepGrowExpansion (e, n, -y);
+          n = sweepGrowExpansion (e, n, -x);
+        }
+
+    if (n == 0)
+      return 0;
+
+    return e[n-1] > 0.0 ? 1 : -1;
+  }
+
+  int orientation (const Position & a, const Position & b, const Position & c)
+  {
+    // Common with polylines, and expensive for the exact evaluation
+    if (c == a || c == b || a == b)
+      return 0;
+
+    return crossSign (a, b, a, c);
+  }
+
+  bool SegmentSweep::PositionLess::operator() (const Position & a, const Position & b) const
+  {
+    return a.x () < b.x () || (a.x () == b.x () && a.y () < b.y ());
+  }
+
+  bool SegmentSweep::StatusLess::operator() (uint32_t a, uint32_t b) const
+  {
+    return sweep->below (a, b);
+  }
+
+  SegmentSweep::SegmentSweep ()
+  : _segments (),
+    _sweep (0, 0),
+    _at_sweep (),
+    _events (),
+    _found (),
+    _crossings (nullptr)
+  {
+  }
+
+  void SegmentSweep::clear ()
+  {
+    _segments.clear ();
+  }
+
+  /* Add the segment from p1 to p2, returns its index.
+   */
+  uint32_t SegmentSweep::addSegment (const Position & p1, const Position & p2)
+  {
+    Segment segment;
+    segment.left = PositionLess () (p2, p1) ? p2 : p1;
+    segment.right = PositionLess () (p2, p1) ? p1 : p2;
+    _segments.push_back (segment);
+
+    return _segments.size () - 1;
+  }
+
+  uint32_t SegmentSweep::getSegmentCount () const
+  {
+    return _segments.size ();
+  }
+
+  /* Whether the segments from a0 to a1 and from b0 to b1 have a common point, position gets
+   * it (the lexicographically first of an overlap).
+   */
+  bool SegmentSweep::intersect (const Position & a0, const Position & a1, const Position & b0, const Position & b1,
+                                Position * position)
+  {
+    int o1 = orientation (a0, a1, b0);
+    int o2 = orientation (a0, a1, b1);
+    int o3 = orientation (b0, b1, a0);
+    int o4 = orientation (b0, b1, a1);
+
+    PositionLess less;
+    if (o1 == 0 && o2 == 0 && o3 == 0 && o4 == 0)
+      {
+        // Collinear: The ranges have to overlap
+        const Position & al = less (a1, a0) ? a1 : a0;
+        const Position & ar = less (a1, a0) ? a0 : a1;
+        const Position & bl = less (b1, b0) ? b1 : b0;
+        const Position & br = less (b1, b0) ? b0 : b1;
+        const Position & lo = less (al, bl) ? bl : al;
+        const Position & hi = less (ar, br) ? ar : br;
+        if (less (hi, lo))
+          return false;
+
+        *position = lo;
+        return true;
+      }
+
+    if (o1 * o2 > 0 || o3 * o4 > 0)
+      return false;
+
+    if (o1 == 0)
+      *position = b0;
+    else if (o2 == 0)
+      *position = b1;
+    else if (o3 == 0)
+      *position = a0;
+    else if (o4 == 0)
+      *position = a1;
+    else
+      {
+        Position d (a1 - a0);
+        Position e (b1 - b0);
+        Position f (b0 - a0);
+        double t = (f.x () * e.y () - f.y () * e.x ()) / (d.x () * e.y () - d.y () * e.x ());
+        Position p (a0 + d * t);
+
+        // Rounding must not move it out of the segments
+        p.x () = std::max (std::max (std::min (a0.x (), a1.x ()), std::min (b0.x (), b1.x ())), p.x ());
+        p.x () = std::min (std::min (std::max (a0.x (), a1.x ()), std::max (b0.x (), b1.x ())), p.x ());
+        p.y () = std::max (std::max (std::min (a0.y (), a1.y ()), std::min (b0.y (), b1.y ())), p.y ());
+        p.y () = std::min (std::min (std::max (a0.y (), a1.y ()), std::max (b0.y (), b1.y ())), p.y ());
+        *position = p;
+      }
+
+    return true;
+  }
+
+  /* All pairs of intersecting segments, ordered by the sweep (from left to right).
+   */
+  void SegmentSweep::findCrossings (CrossingVector & crossings)
+  {
+    PATHFINDER_TRACE_SCOPE ("SegmentSweep::findCrossings");
+
+    crossings.clear ();
+    _crossings = &crossings;
+    _found.clear ();
+    _events.clear ();
+
+    // The end points are sorted once, crossings are queued when found
+    uint32_t count = _segments.size ();
+    std::vector<std::pair<uint32_t, bool>> ends;
+    ends.reserve (count * 2);
+    for (uint32_t i=0; i < count; ++i)
+      {
+        ends.push_back (std::make_pair (i, false));
+        ends.push_back (std::make_pair (i, true));
+      }
+    auto endPosition = [this] (const std::pair<uint32_t, bool> & e) -> const Position &
+      {
+        return e.second ? _segments[e.first].right : _segments[e.first].left;
+      };
+    PositionLess less;
+    std::sort (ends.begin (), ends.end (),
+               [&] (const std::pair<uint32_t, bool> & a, const std::pair<uint32_t, bool> & b)
+               {
+                 return less (endPosition (a), endPosition (b));
+               });
+
+    _found.reserve (count);
+
+    // A point segment at the sweep position, to look up the neighbors of a gap
+    uint32_t probe = count;
+    _segments.push_back (Segment ());
+    _at_sweep.assign (count + 1, false);
+    _at_sweep[probe] = true;
+
+    Status status (StatusLess {this});
+    std::vector<Status::iterator> where (count);
+    std::vector<bool> active (count, false);
+    Event event;
+    std::vector<uint32_t> through;
+    std::vector<uint32_t> here;
+    std::vector<uint32_t> inserted;
+
+    for (uint32_t next=0; next < ends.size () || !_events.empty ();)
+      {
+        event.starts.clear ();
+        event.ends.clear ();
+        event.crossing.clear ();
+        if (next < ends.size () && (_events.empty () || !less (_events.begin ()->first, endPosition (ends[next]))))
+          _sweep = endPosition (ends[next]);
+        else
+          _sweep = _events.begin ()->first;
+
+        if (!_events.empty () && _events.begin ()->first == _sweep)
+          {
+            event.crossing.swap (_events.begin ()->second);
+            _events.erase (_events.begin ());
+          }
+        for (; next < ends.size () && endPosition (ends[next]) == _sweep; ++next)
+          (ends[next].second ? event.ends : event.starts).push_back (ends[next].first);
+        bool rounded = event.starts.empty () && event.ends.empty ();
+
+        // Segments containing the position are right below it. Crossing positions are rounded,
+        // so segments passing very close are taken as well: Otherwise three segments crossing
+        // in one point could be swapped inconsistently.
+        _segments[probe].left = _sweep;
+        _segments[probe].right = _sweep;
+        through.clear ();
+        Status::iterator above = status.lower_bound (probe);
+        for (Status::iterator it = above; it != status.end () && passes (*it, rounded); ++it)
+          through.push_back (*it);
+        for (Status::iterator it = above; it != status.begin ();)
+          {
+            --it;
+            if (!passes (*it, rounded))
+              break;
+            through.push_back (*it);
+          }
+
+        // All segments starting, ending, crossing or passing here touch each other
+        here.clear ();
+        here.insert (here.end (), event.starts.begin (), event.starts.end ());
+        here.insert (here.end (), event.ends.begin (), event.ends.end ());
+        here.insert (here.end (), through.begin (), through.end ());
+        for (uint32_t s: event.crossing)
+          if (active[s])
+            here.push_back (s);
+        std::sort (here.begin (), here.end ());
+        here.erase (std::unique (here.begin (), here.end ()), here.end ());
+        for (uint32_t i=0; i < here.size (); ++i)
+          for (uint32_t j=i+1; j < here.size (); ++j)
+            check (here[i], here[j]);
+
+        // Remove the ending segments and the ones passing or crossing here, insert the starting
+        // and passing ones in their order right after the sweep position.
+        inserted.clear ();
+        for (uint32_t s: event.ends)
+          if (active[s])
+            {
+              status.erase (where[s]);
+              active[s] = false;
+            }
+        through.insert (through.end (), event.crossing.begin (), event.crossing.end ());
+        for (uint32_t s: through)
+          if (active[s])
+            {
+              status.erase (where[s]);
+              active[s] = false;
+              inserted.push_back (s);
+            }
+        for (uint32_t s: event.starts)
+          if (_segments[s].left != _segments[s].right)
+            inserted.push_back (s);
+
+        for (uint32_t s: inserted)
+          _at_sweep[s] = true;
+        for (uint32_t s: inserted)
+          if (!active[s])
+            {
+              where[s] = status.insert (s).first;
+              active[s] = true;
+            }
+
+        if (inserted.empty ())
+          {
+            above = status.lower_bound (probe);
+            if (above != status.end () && above != status.begin ())
+              check (*std::prev (above), *above);
+          }
+        else
+          for (uint32_t s: inserted)
+            {
+              Status::iterator it = where[s];
+              if (it != status.begin () && !_at_sweep[*std::prev (it)])
+                check (*std::prev (it), s);
+              if (std::next (it) != status.end () && !_at_sweep[*std::next (it)])
+                check (s, *std::next (it));
+            }
+
+        for (uint32_t s: inserted)
+          _at_sweep[s] = false;
+      }
+
+    _segments.pop_back ();
+    _crossings = nullptr;
+  }
+
+  /* Whether a is below b on the sweep line. Segments through the sweep position are ordered as
+   * right after it.
+   */
+  bool SegmentSweep::below (uint32_t a, uint32_t b) const
+  {
+    if (a == b)
+      return false;
+
+    const Segment & sa = _segments[a];
+    const Segment & sb = _segments[b];
+    int side = 0;
+    if (_at_sweep[a] && !_at_sweep[b])
+      side = -orientation (sb.left, sb.right, _sweep);
+    else if (_at_sweep[b] && !_at_sweep[a])
+      side = orientation (sa.left, sa.right, _sweep);
+    else if (!_at_sweep[a] && !_at_sweep[b])
+      {
+        double ya = yAt (sa);
+        double yb = yAt (sb);
+        side = ya < yb ? 1 : (ya > yb ? -1 : 0);
+      }
+
+    // Both through the sweep position: the one turning left of the other is above
+    if (side == 0)
+      side = crossSign (sa.left, sa.right, sb.left, sb.right);
+
+    if (side == 0)
+      return a < b;
+
+    return side > 0;
+  }
+
+  /* Whether segment s contains the sweep position, or passes very close to a rounded crossing
+   * position.
+   */
+  bool SegmentSweep::passes (uint32_t s, bool rounded) const
+  {
+    const Segment & segment = _segments[s];
+    if (orientation (segment.left, segment.right, _sweep) == 0)
+      return true;
+    if (!rounded)
+      return false;
+
+    Position d (segment.right - segment.left);
+    Position v (_sweep - segment.left);
+    double f = std::min (1.0, std::max (0.0, v.dot (d) / d.squaredNorm ()));
+    double tolerance = 1e-9 * std::max (1.0, std::max (std::fabs (_sweep.x ()), std::fabs (_sweep.y ())));
+    return (v - d * f).squaredNorm () <= tolerance * tolerance;
+  }
+
+  double SegmentSweep::yAt (const Segment & s) const
+  {
+    if (s.left.x () == s.right.x ())
+      return std::min (std::max (_sweep.y (), s.left.y ()), s.right.y ());
+    if (_sweep.x () <= s.left.x ())
+      return s.left.y ();
+    if (_sweep.x () >= s.right.x ())
+      return s.right.y ();
+
+    return s.left.y () + (s.right.y () - s.left.y ()) * ((_sweep.x () - s.left.x ()) / (s.right.x () - s.left.x ()));
+  }
+
+  /* Report a and b if they intersect. If they cross in their interior, their order has to be
+   * swapped there.
+   */
+  void SegmentSweep::check (uint32_t a, uint32_t b)
+  {
+    std::pair<uint32_t, uint32_t> key = std::minmax (a, b);
+    uint64_t pair = (uint64_t (key.first) << 32) | key.second;
+    if (_found.count (pair) > 0)
+      return;
+
+    const Segment & sa = _segments[a];
+    const Segment & sb = _segments[b];
+    Crossing crossing;
+    if (!intersect (sa.left, sa.right, sb.left, sb.right, &crossing.position))
+      return;
+
+    crossing.segment1 = key.first;
+    crossing.segment2 = key.second;
+    _found.insert (pair);
+    _crossings->push_back (crossing);
+
+    const Position & p = crossing.position;
+    if (p == sa.left || p == sa.right || p == sb.left || p == sb.right)
+      return;
+
+    // Rounding may put the crossing behind the sweep, it is swapped right away then.
+    std::vector<uint32_t> & event = _events[PositionLess () (p, _sweep) ? _sweep : p];
+    event.push_back (a);
+    event.push_back (b);
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_SWEEP_H
+#define ROBOT_SWEEP_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "robot-geometry.h"
+
+namespace Pathfinder
+{
+  /* Sign of the cross product (a1 - a0) x (b1 - b0), exact for all double coordinates:
+   * 1 if b turns counterclockwise from a, -1 if clockwise, 0 if parallel.
+   */
+  int crossSign (const Position & a0, const Position & a1, const Position & b0, const Position & b1);
+
+  /* 1 if c is left of the line from a to b, -1 if right of it, 0 if on it (exact).
+   */
+  int orientation (const Position & a, const Position & b, const Position & c);
+
+  /* Finds all pairs of intersecting segments with the Bentley-Ottmann sweep in
+   * O((n + k) log n) for n segments and k intersections.
+   *
+   * Whether two segments intersect is decided with exact orientation predicates; touching
+   * segments (e.g. sharing an end point) and overlapping collinear segments intersect, too.
+   * Only the positions of crossings in the interior of both segments are rounded.
+   */
+  class SegmentSweep
+  {
+    public:
+      struct Crossing
+      {
+          uint32_t segment1;        // segment1 < segment2
+          uint32_t segment2;
+          Position position;        // the first common point of overlapping segments
+      };
+      typedef std::vector<Crossing, Eigen::aligned_allocator<Crossing>> CrossingVector;
+
+      SegmentSweep ();
+
+      void clear ();
+      uint32_t addSegment (const Position & p1, const Position & p2);
+      uint32_t getSegmentCount () const;
+      void findCrossings (CrossingVector & crossings);
+
+      static bool intersect (const Position & a0, const Position & a1, const Position & b0, const Position & b1,
+                             Position * position);
+
+    private:
+      struct Segment
+      {
+          Position left;            // lexicographically smaller end point
+          Position right;
+      };
+
+      struct Event
+      {
+          std::vector<uint32_t> starts;
+          std::vector<uint32_t> ends;
+          std::vector<uint32_t> crossing;   // segments found crossing others here
+      };
+
+      struct PositionLess
+      {
+          bool operator() (const Position & a, const Position & b) const;
+      };
+
+      struct StatusLess
+      {
+          const SegmentSweep * sweep;
+          bool operator() (uint32_t a, uint32_t b) const;
+      };
+
+      typedef std::set<uint32_t, StatusLess> Status;
+      typedef std::map<Position, std::vector<uint32_t>, PositionLess,
+                       Eigen::aligned_allocator<std::pair<const Position, std::vector<uint32_t>>>> EventQueue;
+
+      bool below (uint32_t a, uint32_t b) const;
+      bool passes (uint32_t s, bool rounded) const;
+      double yAt (const Segment & s) const;
+      void check (uint32_t a, uint32_t b);
+
+      std::vector<Segment, Eigen::aligned_allocator<Segment>> _segments;
+
+      // State of findCrossings
+      Position _sweep;
+      std::vector<bool> _at_sweep;  // segments through _sweep, ordered as just after it
+      EventQueue _events;           // crossings, by position
+      std::unordered_set<uint64_t> _found;
+      CrossingVector * _crossings;
+  };
+}
+
+#endif
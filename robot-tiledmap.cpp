@@ -0,0 +1,513 @@
+/*
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "robot-tiledmap.h"
+
+namespace Pathfinder
+{
+  /* File format of a tile (native byte order, all records 8 byte aligned, so the file can be
+   * used directly when memory mapped):
+   *
+   *   header:  char magic[4] = "PFTL", uint32 version, uint32 part_count, uint32 reserved
+   *   parts:   uint32 object_id, uint32 part_index, uint32 point_count, uint32 reserved,
+   *            double min_point_distance, point_count * (double x, double y)
+   */
+  static const char tile_magic[4] = { 'P', 'F', 'T', 'L' };
+  static const uint32_t tile_version = 1;
+
+  struct TileFileHeader
+  {
+      char magic[4];
+      uint32_t version;
+      uint32_t part_count;
+      uint32_t reserved;
+  };
+
+  struct TileFilePart
+  {
+      uint32_t object_id;
+      uint32_t part_index;
+      uint32_t point_count;
+      uint32_t reserved;
+      double min_point_distance;
+  };
+
+  TiledMap::ObjectPart::ObjectPart (uint32_t id, uint32_t part, const MapObject & obj)
+  : object_id (id),
+    part_index (part),
+    object (obj)
+  {
+  }
+
+  /* Create an empty tiled map.
+   *
+   * The tiles are tile_size x tile_size large. directory is used to store the cold tiles
+   * and has to exist. memory_budget is the number of bytes the resident tiles may use,
+   * tiles in the focus are never paged out, even if they exceed the budget.
+   */
+  TiledMap::TiledMap (double tile_size, const std::string & directory, size_t memory_budget)
+  : _tile_size (tile_size),
+    _directory (directory),
+    _memory_budget (memory_budget),
+    _resident_bytes (0),
+    _next_object_id (0),
+    _resident (),
+    _stored (),
+    _lru ()
+  {
+  }
+
+  /* The tile files are not removed, the directory is the paging area of this map.
+   * Call flush before, if the resident tiles should be on disk too.
+   */
+  TiledMap::~TiledMap ()
+  {
+  }
+
+  double TiledMap::getTileSize () const
+  {
+    return _tile_size;
+  }
+
+  TiledMap::TileKey TiledMap::getTileKey (const Position & pos) const
+  {
+    TileKey key;
+    key.x = static_cast<int32_t> (std::floor (pos.x () / _tile_size));
+    key.y = static_cast<int32_t> (std::floor (pos.y () / _tile_size));
+    return key;
+  }
+
+  /* Add an object, split at the tile borders.
+   *
+   * Each segment is cut where it crosses a grid line, consecutive pieces in the same tile
+   * form one part. Neighboring parts share the point on the border.
+   *
+   * Returns the id of the object, stored in all of its parts. Nothing is added, if a tile
+   * on disk the object reaches into could not be read.
+   */
+  std::optional<uint32_t> TiledMap::addObject (const MapObject & obj)
+  {
+    std::optional<uint32_t> id;
+    uint32_t count = obj.getPointCount ();
+    if (count == 0)
+      {
+        id = _next_object_id++;
+        return id;
+      }
+
+    std::vector<std::pair<TileKey, std::vector<Position,Eigen::aligned_allocator<Position>>>> parts;
+
+    Position first = obj.getPoint (0);
+    parts.emplace_back ();
+    parts.back ().first = getTileKey (first);
+    parts.back ().second.push_back (first);
+
+    std::vector<double> cuts;
+    for (uint32_t i=1; i < count; ++i)
+      {
+        Position a = obj.getPoint (i-1);
+        Position b = obj.getPoint (i);
+        Eigen::Vector2d d = b - a;
+
+        // Parameters where the segment crosses the grid lines
+        cuts.clear ();
+        for (uint32_t c=0; c < 2; ++c)
+          {
+            if (d[c] == 0.0)
+              continue;
+
+            double lo = std::min (a[c], b[c]) / _tile_size;
+            double hi = std::max (a[c], b[c]) / _tile_size;
+            for (double g=std::floor (lo) + 1.0; g < hi; g += 1.0)
+              cuts.push_back ((g * _tile_size - a[c]) / d[c]);
+          }
+        std::sort (cuts.begin (), cuts.end ());
+        cuts.push_back (1.0);
+
+        double t0 = 0.0;
+        for (double t1: cuts)
+          {
+            if (t1 <= t0)
+              continue;
+
+            Position q0 (a + d * t0);
+            Position q1 = t1 >= 1.0 ? b : Position (a + d * t1);
+            TileKey key = getTileKey (Position (a + d * ((t0 + t1) / 2.0)));
+
+            if (!(key == parts.back ().first))
+              {
+                parts.emplace_back ();
+                parts.back ().first = key;
+                parts.back ().second.push_back (q0);
+              }
+
+            parts.back ().second.push_back (q1);
+            t0 = t1;
+          }
+      }
+
+    // Load all tiles first, they stay resident until enforceBudget
+    std::vector<Tile *> tiles (parts.size ());
+    for (uint32_t i=0; i < parts.size (); ++i)
+      {
+        tiles[i] = residentTile (parts[i].first);
+        if (tiles[i] == nullptr)
+          {
+            enforceBudget ();
+            return id;
+          }
+      }
+
+    id = _next_object_id++;
+    MapObject part_obj (obj.getMinPointDistance ());
+    for (uint32_t i=0; i < parts.size (); ++i)
+      {
+        part_obj.setPolygon (parts[i].second);
+
+        Tile & tile = *tiles[i];
+        tile.parts.push_back (ObjectPart (*id, i, part_obj));
+        size_t bytes = partBytes (tile.parts.back ());
+        tile.bytes += bytes;
+        _resident_bytes += bytes;
+        tile.dirty = true;
+        touch (tile);
+      }
+
+    enforceBudget ();
+    return id;
+  }
+
+  /* Make the tiles within radius around the focus positions resident and keep them pinned
+   * until the next call. Other tiles are paged out (least recently used first) until the
+   * memory budget is met.
+   *
+   * Returns false if a tile on disk could not be read, it is not resident then.
+   */
+  bool TiledMap::setFocus (const std::vector<Position,Eigen::aligned_allocator<Position>> & focus, double radius)
+  {
+    PATHFINDER_TRACE_SCOPE ("TiledMap::setFocus");
+
+    bool ok = true;
+    for (auto & it: _resident)
+      it.second.pinned = false;
+
+    for (const Position & p: focus)
+      {
+        TileKey min_key = getTileKey (Position (p.x () - radius, p.y () - radius));
+        TileKey max_key = getTileKey (Position (p.x () + radius, p.y () + radius));
+
+        TileKey key;
+        for (key.y=min_key.y; key.y <= max_key.y; ++key.y)
+          for (key.x=min_key.x; key.x <= max_key.x; ++key.x)
+            {
+              if (_resident.count (key) == 0 && _stored.count (key) == 0)
+                continue;
+
+              Tile * tile = residentTile (key);
+              if (tile == nullptr)
+                {
+                  ok = false;
+                  continue;
+                }
+
+              tile->pinned = true;
+              touch (*tile);
+            }
+      }
+
+    enforceBudget ();
+    return ok;
+  }
+
+  /* Write all modified resident tiles to disk. They stay resident.
+   */
+  bool TiledMap::flush ()
+  {
+    bool ok = true;
+    for (auto & it: _resident)
+      {
+        if (!it.second.dirty)
+          continue;
+
+        if (!pageOut (it.first))
+          ok = false;
+      }
+
+    return ok;
+  }
+
+  bool TiledMap::isResident (const TileKey & key) const
+  {
+    return _resident.count (key) != 0;
+  }
+
+  /* Get the parts of a resident tile, nullptr if the tile is not resident.
+   */
+  const std::vector<TiledMap::ObjectPart> * TiledMap::getResidentTile (const TileKey & key) const
+  {
+    auto it = _resident.find (key);
+    if (it == _resident.end ())
+      return nullptr;
+
+    return &it->second.parts;
+  }
+
+  /* Find the closest position of all resident objects not further than max_dist away.
+   *
+   * Tiles that are not resident are ignored.
+   */
+  std::optional<TiledMap::FindResult> TiledMap::findClosestPosition (const Position & pos, double max_dist) const
+  {
+    PATHFINDER_TRACE_SCOPE ("TiledMap::findClosestPosition");
+
+    std::optional<FindResult> best;
+
+    TileKey min_key = getTileKey (Position (pos.x () - max_dist, pos.y () - max_dist));
+    TileKey max_key = getTileKey (Position (pos.x () + max_dist, pos.y () + max_dist));
+
+    TileKey key;
+    for (key.y=min_key.y; key.y <= max_key.y; ++key.y)
+      for (key.x=min_key.x; key.x <= max_key.x; ++key.x)
+        {
+          auto it = _resident.find (key);
+          if (it == _resident.end ())
+            continue;
+
+          for (const ObjectPart & part: it->second.parts)
+            {
+              std::optional<MapObject::FindResult> found = part.object.findClosestPosition (pos);
+              if (!found.has_value () || found->distance > max_dist)
+                continue;
+
+              if (best.has_value () && best->position.distance <= found->distance)
+                continue;
+
+              best.emplace ();
+              best->tile = key;
+              best->object_id = part.object_id;
+              best->part_index = part.part_index;
+              best->position = *found;
+            }
+        }
+
+    return best;
+  }
+
+  size_t TiledMap::getMemoryBudget () const
+  {
+    return _memory_budget;
+  }
+
+  /* Get the estimated number of bytes used by the resident tiles.
+   */
+  size_t TiledMap::getResidentBytes () const
+  {
+    return _resident_bytes;
+  }
+
+  uint32_t TiledMap::getResidentTileCount () const
+  {
+    return _resident.size ();
+  }
+
+  /* Get the number of tiles, resident or on disk.
+   */
+  uint32_t TiledMap::getTileCount () const
+  {
+    uint32_t count = _stored.size ();
+    for (const auto & it: _resident)
+      if (_stored.count (it.first) == 0)
+        ++count;
+
+    return count;
+  }
+
+  /* Get a tile, loading or creating it if necessary.
+   *
+   * Returns nullptr if its file could not be read. The tile doesn't become resident then, so
+   * it is neither used partly read nor written back over the file.
+   */
+  TiledMap::Tile * TiledMap::residentTile (const TileKey & key)
+  {
+    auto it = _resident.find (key);
+    if (it != _resident.end ())
+      return &it->second;
+
+    Tile & tile = _resident[key];
+    tile.bytes = 0;
+    tile.dirty = false;
+    tile.pinned = false;
+    _lru.push_front (key);
+    tile.lru_pos = _lru.begin ();
+
+    if (_stored.count (key) != 0 && !pageIn (key, tile))
+      {
+        _lru.erase (tile.lru_pos);
+        _resident.erase (key);
+        return nullptr;
+      }
+
+    _resident_bytes += tile.bytes;
+    return &tile;
+  }
+
+  void TiledMap::touch (Tile & tile)
+  {
+    _lru.splice (_lru.begin (), _lru, tile.lru_pos);
+  }
+
+  void TiledMap::enforceBudget ()
+  {
+    auto it = _lru.end ();
+    while (_resident_bytes > _memory_budget && it != _lru.begin ())
+      {
+        --it;
+        TileKey key = *it;
+        Tile & tile = _resident[key];
+        if (tile.pinned)
+          continue;
+
+        if (tile.dirty && !pageOut (key))
+          continue;
+
+        _resident_bytes -= tile.bytes;
+        it = _lru.erase (it);
+        _resident.erase (key);
+      }
+  }
+
+  /* Write a resident tile to its file. The tile stays resident.
+   */
+  bool TiledMap::pageOut (const TileKey & key)
+  {
+    Tile & tile = _resident[key];
+    std::string name = tileFileName (key);
+    std::string tmp_name = name + ".tmp";
+
+    FILE * f = fopen (tmp_name.c_str (), "wb");
+    if (f == nullptr)
+      return false;
+
+    TileFileHeader header;
+    memcpy (header.magic, tile_magic, sizeof (header.magic));
+    header.version = tile_version;
+    header.part_count = tile.parts.size ();
+    header.reserved = 0;
+    bool ok = fwrite (&header, sizeof (header), 1, f) == 1;
+
+    for (uint32_t i=0; ok && i < tile.parts.size (); ++i)
+      {
+        const ObjectPart & part = tile.parts[i];
+        TileFilePart record;
+        record.object_id = part.object_id;
+        record.part_index = part.part_index;
+        record.point_count = part.object.getPointCount ();
+        record.reserved = 0;
+        record.min_point_distance = part.object.getMinPointDistance ();
+        ok = fwrite (&record, sizeof (record), 1, f) == 1;
+
+        for (uint32_t j=0; ok && j < record.point_count; ++j)
+          {
+            Position p = part.object.getPoint (j);
+            double xy[2] = { p.x (), p.y () };
+            ok = fwrite (xy, sizeof (xy), 1, f) == 1;
+          }
+      }
+
+    if (fclose (f) != 0)
+      ok = false;
+
+    if (!ok || rename (tmp_name.c_str (), name.c_str ()) != 0)
+      {
+        remove (tmp_name.c_str ());
+        return false;
+      }
+
+    tile.dirty = false;
+    _stored.insert (key);
+    return true;
+  }
+
+  /* Read a tile from its memory mapped file.
+   */
+  bool TiledMap::pageIn (const TileKey & key, Tile & tile)
+  {
+    std::string name = tileFileName (key);
+    int fd = open (name.c_str (), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (TileFileHeader))
+      {
+        close (fd);
+        return false;
+      }
+
+    size_t size = st.st_size;
+    void * data = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED)
+      return false;
+
+    const char * cur = static_cast<const char *> (data);
+    const char * end = cur + size;
+    const TileFileHeader * header = reinterpret_cast<const TileFileHeader *> (cur);
+    bool ok = memcmp (header->magic, tile_magic, sizeof (tile_magic)) == 0 && header->version == tile_version;
+    cur += sizeof (TileFileHeader);
+
+    std::vector<Position,Eigen::aligned_allocator<Position>> poly;
+    for (uint32_t i=0; ok && i < header->part_count; ++i)
+      {
+        if (cur + sizeof (TileFilePart) > end)
+          {
+            ok = false;
+            break;
+          }
+
+        const TileFilePart * record = reinterpret_cast<const TileFilePart *> (cur);
+        cur += sizeof (TileFilePart);
+        if (cur + record->point_count * 2 * sizeof (double) > end)
+          {
+            ok = false;
+            break;
+          }
+
+        const double * xy = reinterpret_cast<const double *> (cur);
+        cur += record->point_count * 2 * sizeof (double);
+
+        poly.resize (record->point_count);
+        for (uint32_t j=0; j < record->point_count; ++j)
+          poly[j] = Position (xy[2*j], xy[2*j+1]);
+
+        MapObject obj (record->min_point_distance);
+        obj.setPolygon (poly);
+        tile.parts.push_back (ObjectPart (record->object_id, record->part_index, obj));
+        tile.bytes += partBytes (tile.parts.back ());
+      }
+
+    munmap (data, size);
+    return ok;
+  }
+
+  std::string TiledMap::tileFileName (const TileKey & key) const
+  {
+    return _directory + "/tile_" + std::to_string (key.x) + "_" + std::to_string (key.y) + ".pftl";
+  }
+
+  size_t TiledMap::partBytes (const ObjectPart & part)
+  {
+    return sizeof (ObjectPart) + part.object.getPointCount () * sizeof (Position);
+  }
+}
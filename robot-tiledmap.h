@@ -0,0 +1,120 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_TILEDMAP_H
+#define ROBOT_TILEDMAP_H
+
+#include <vector>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+
+#include "robot-map.h"
+
+namespace Pathfinder
+{
+  /* A map for areas larger than the available memory.
+   *
+   * The objects are partitioned into square tiles of a fixed size. Objects crossing tile
+   * borders are split at the borders, each part keeps the id of the original object and its
+   * part number, so the pieces can be related to each other again.
+   *
+   * Only the tiles near the focus (robot position, view) are kept in memory. Cold tiles are
+   * written to one file per tile in the directory given to the constructor and are
+   * read back by memory mapping the file. Loading and paging only happens in setFocus,
+   * addObject and flush, the queries only look at resident tiles and never do any I/O.
+   *
+   * It is a map of its own, not a storage mode of Map: The builder and the planners work on
+   * a Map, e.g. filled from the resident tiles.
+   */
+  class TiledMap
+  {
+    public:
+      struct TileKey
+      {
+          int32_t x;
+          int32_t y;
+
+          bool operator== (const TileKey & other) const { return x == other.x && y == other.y; }
+      };
+
+      struct TileKeyHash
+      {
+          size_t operator() (const TileKey & key) const
+          {
+            return (static_cast<size_t> (static_cast<uint32_t> (key.x)) * 0x9e3779b97f4a7c15ull)
+                   ^ static_cast<uint32_t> (key.y);
+          }
+      };
+
+      struct ObjectPart
+      {
+          ObjectPart (uint32_t id, uint32_t part, const MapObject & obj);
+
+          uint32_t object_id;
+          uint32_t part_index;
+          MapObject object;
+      };
+
+      struct FindResult
+      {
+          TileKey tile;
+          uint32_t object_id;
+          uint32_t part_index;
+          MapObject::FindResult position;
+      };
+
+      TiledMap (double tile_size, const std::string & directory, size_t memory_budget);
+      ~TiledMap ();
+
+      double getTileSize () const;
+      TileKey getTileKey (const Position & pos) const;
+
+      std::optional<uint32_t> addObject (const MapObject & obj);
+      bool setFocus (const std::vector<Position,Eigen::aligned_allocator<Position>> & focus, double radius);
+      bool flush ();
+
+      bool isResident (const TileKey & key) const;
+      const std::vector<ObjectPart> * getResidentTile (const TileKey & key) const;
+      std::optional<FindResult> findClosestPosition (const Position & pos, double max_dist) const;
+
+      size_t getMemoryBudget () const;
+      size_t getResidentBytes () const;
+      uint32_t getResidentTileCount () const;
+      uint32_t getTileCount () const;
+
+    private:
+      struct Tile
+      {
+          std::vector<ObjectPart> parts;
+          size_t bytes;
+          bool dirty;
+          bool pinned;
+          std::list<TileKey>::iterator lru_pos;
+      };
+
+      Tile * residentTile (const TileKey & key);
+      void touch (Tile & tile);
+      void enforceBudget ();
+      bool pageOut (const TileKey & key);
+      bool pageIn (const TileKey & key, Tile & tile);
+      std::string tileFileName (const TileKey & key) const;
+      static size_t partBytes (const ObjectPart & part);
+
+      double _tile_size;
+      std::string _directory;
+      size_t _memory_budget;
+      size_t _resident_bytes;
+      uint32_t _next_object_id;
+
+      std::unordered_map<TileKey, Tile, TileKeyHash> _resident;
+      std::unordered_set<TileKey, TileKeyHash> _stored;   // Tiles with a file on disk
+      std::list<TileKey> _lru;                            // Most recently used first
+  };
+}
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "robot-trace.h"
+
+namespace Pathfinder
+{
+  struct TraceEvent
+  {
+      const char * name;
+      uint64_t start;
+      int64_t value;          // duration in ns or counter increment
+      bool is_counter;
+  };
+
+  // Events are stored in chunks, so a buffer never moves events written before. The chunks
+  // are used as a ring: Event i is stored in chunk (i / trace_chunk_size) % trace_max_chunks,
+  // the chunks of events drained by a summary are written again.
+  static const uint32_t trace_chunk_size = 4096;
+  static const uint32_t trace_max_chunks = 256;
+
+  struct TraceBuffer
+  {
+      TraceBuffer (uint32_t index)
+      : thread_index (index),
+        size (0),
+        first (0),
+        dropped (0),
+        finished (false)
+      {
+        for (uint32_t i=0; i < trace_max_chunks; ++i)
+          chunks[i] = nullptr;
+      }
+
+      ~TraceBuffer ()
+      {
+        for (uint32_t i=0; i < trace_max_chunks; ++i)
+          delete[] chunks[i];
+      }
+
+      const TraceEvent & get (uint64_t idx) const
+      {
+        return chunks[idx / trace_chunk_size % trace_max_chunks][idx % trace_chunk_size];
+      }
+
+      uint32_t thread_index;
+      TraceEvent * chunks[trace_max_chunks];
+      std::atomic<uint64_t> size;       // Published events, written by the owning thread only
+      std::atomic<uint64_t> first;      // Oldest event kept, written under the registry mutex
+      std::atomic<uint64_t> dropped;
+      bool finished;                    // The thread exited, protected by the registry mutex
+  };
+
+  struct TraceRegistry
+  {
+      std::mutex mutex;
+      std::vector<std::unique_ptr<TraceBuffer>> buffers;
+      uint32_t next_thread_index = 0;
+
+      std::mutex periodic_mutex;
+      std::condition_variable periodic_cond;
+      std::thread periodic_thread;
+      bool periodic_stop = false;
+  };
+
+  static TraceRegistry & traceRegistry ()
+  {
+    // Never destroyed, threads may still record while the program exits.
+    static TraceRegistry * registry = new TraceRegistry;
+    return *registry;
+  }
+
+  /* Drop the buffers of exited threads, once all their events were drained. Called with the
+   * registry mutex held.
+   */
+  static void traceReleaseFinished (TraceRegistry & registry)
+  {
+    registry.buffers.erase (std::remove_if (registry.buffers.begin (), registry.buffers.end (),
+                                            [] (const std::unique_ptr<TraceBuffer> & buffer)
+                                            {
+                                              return buffer->finished && buffer->first.load () == buffer->size.load ();
+                                            }),
+                            registry.buffers.end ());
+  }
+
+  /* The buffer of a thread, registered with its first event and released when the thread
+   * exits (e.g. those started by std::async).
+   */
+  struct TraceThread
+  {
+      ~TraceThread ()
+      {
+        if (buffer == nullptr)
+          return;
+
+        TraceRegistry & registry = traceRegistry ();
+        std::lock_guard<std::mutex> lock (registry.mutex);
+        buffer->finished = true;
+        traceReleaseFinished (registry);
+      }
+
+      TraceBuffer * buffer = nullptr;
+  };
+
+  static thread_local TraceThread trace_thread;
+
+  static void traceAppend (const char * name, uint64_t start, int64_t value, bool is_counter)
+  {
+    TraceBuffer *& trace_buffer = trace_thread.buffer;
+    if (trace_buffer == nullptr)
+      {
+        TraceRegistry & registry = traceRegistry ();
+        std::lock_guard<std::mutex> lock (registry.mutex);
+        registry.buffers.emplace_back (new TraceBuffer (registry.next_thread_index++));
+        trace_buffer = registry.buffers.back ().get ();
+      }
+
+    // The chunk of the event may only be written again after its events were drained
+    uint64_t n = trace_buffer->size.load (std::memory_order_relaxed);
+    if (n - trace_buffer->first.load (std::memory_order_acquire) >= uint64_t (trace_chunk_size) * trace_max_chunks)
+      {
+        trace_buffer->dropped.fetch_add (1, std::memory_order_relaxed);
+        return;
+      }
+
+    TraceEvent *& chunk = trace_buffer->chunks[n / trace_chunk_size % trace_max_chunks];
+    if (chunk == nullptr)
+      chunk = new TraceEvent[trace_chunk_size];
+
+    TraceEvent & ev = chunk[n % trace_chunk_size];
+    ev.name = name;
+    ev.start = start;
+    ev.value = value;
+    ev.is_counter = is_counter;
+
+    trace_buffer->size.store (n + 1, std::memory_order_release);
+  }
+
+  /* Monotonic time stamp in ns.
+   */
+  uint64_t Trace::now ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  void Trace::record (const char * name, uint64_t start_ns, uint64_t duration_ns)
+  {
+    traceAppend (name, start_ns, duration_ns, false);
+  }
+
+  void Trace::count (const char * name, int64_t value)
+  {
+    traceAppend (name, now (), value, true);
+  }
+
+  /* Write all events kept (those not drained by a summary yet) in the Chrome trace event
+   * format (JSON), which can be loaded with chrome://tracing or Perfetto.
+   */
+  bool Trace::writeChromeTrace (const std::string & file_name)
+  {
+    FILE * f = fopen (file_name.c_str (), "w");
+    if (f == nullptr)
+      return false;
+
+    TraceRegistry & registry = traceRegistry ();
+    std::lock_guard<std::mutex> lock (registry.mutex);
+
+    uint64_t base = std::numeric_limits<uint64_t>::max ();
+    for (const auto & buffer: registry.buffers)
+      {
+        uint64_t first = buffer->first.load (std::memory_order_relaxed);
+        if (buffer->size.load (std::memory_order_acquire) > first)
+          base = std::min (base, buffer->get (first).start);
+      }
+
+    fprintf (f, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto & buffer: registry.buffers)
+      {
+        uint64_t size = buffer->size.load (std::memory_order_acquire);
+        std::map<const char *, int64_t> counters;
+
+        for (uint64_t i=buffer->first.load (std::memory_order_relaxed); i < size; ++i)
+          {
+            const TraceEvent & ev = buffer->get (i);
+            double ts = (ev.start - base) / 1000.0;
+
+            if (!first)
+              fprintf (f, ",\n");
+            first = false;
+
+            if (ev.is_counter)
+              {
+                int64_t & total = counters[ev.name];
+                total += ev.value;
+                fprintf (f, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+                         ev.name, ts, buffer->thread_index, static_cast<long long> (total));
+              }
+            else
+              fprintf (f, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                       ev.name, ts, ev.value / 1000.0, buffer->thread_index);
+          }
+      }
+    fprintf (f, "\n]}\n");
+
+    return fclose (f) == 0;
+  }
+
+  /* Write the number of calls, total time and the p50/p99 latencies of every timed scope and
+   * the sums of the counters, over the events kept.
+   *
+   * If since_last_summary is set, the events are drained: The next summary only uses the
+   * events recorded after this one, and their memory is used for new events.
+   */
+  void Trace::writeSummary (std::ostream & out, bool since_last_summary)
+  {
+    std::map<std::string, std::vector<int64_t>> durations;
+    std::map<std::string, int64_t> counters;
+
+    {
+      TraceRegistry & registry = traceRegistry ();
+      std::lock_guard<std::mutex> lock (registry.mutex);
+
+      for (const auto & buffer: registry.buffers)
+        {
+          uint64_t size = buffer->size.load (std::memory_order_acquire);
+          for (uint64_t i=buffer->first.load (std::memory_order_relaxed); i < size; ++i)
+            {
+              const TraceEvent & ev = buffer->get (i);
+              if (ev.is_counter)
+                counters[ev.name] += ev.value;
+              else
+                durations[ev.name].push_back (ev.value);
+            }
+
+          if (since_last_summary)
+            buffer->first.store (size, std::memory_order_release);
+        }
+
+      if (since_last_summary)
+        traceReleaseFinished (registry);
+    }
+
+    for (auto & it: durations)
+      {
+        std::vector<int64_t> & d = it.second;
+        int64_t total = 0;
+        for (int64_t v: d)
+          total += v;
+
+        std::nth_element (d.begin (), d.begin () + d.size () / 2, d.end ());
+        double p50 = d[d.size () / 2] / 1000.0;
+        std::nth_element (d.begin (), d.begin () + d.size () * 99 / 100, d.end ());
+        double p99 = d[d.size () * 99 / 100] / 1000.0;
+
+        out << it.first << ": " << d.size () << " calls, total " << total / 1e6 << " ms, p50 "
+            << p50 << " us, p99 " << p99 << " us" << std::endl;
+      }
+
+    for (auto & it: counters)
+      out << it.first << ": " << it.second << std::endl;
+
+    uint64_t dropped = getDroppedEvents ();
+    if (dropped > 0)
+      out << "dropped events: " << dropped << std::endl;
+  }
+
+  /* Write a summary of the events since the previous one every interval_ms milliseconds,
+   * from a background thread.
+   */
+  void Trace::startPeriodicSummary (std::ostream & out, uint32_t interval_ms)
+  {
+    stopPeriodicSummary ();
+
+    TraceRegistry & registry = traceRegistry ();
+    registry.periodic_stop = false;
+    registry.periodic_thread = std::thread ([&registry, &out, interval_ms] ()
+      {
+        std::unique_lock<std::mutex> lock (registry.periodic_mutex);
+        while (!registry.periodic_cond.wait_for (lock, std::chrono::milliseconds (interval_ms),
+                                                 [&registry] () { return registry.periodic_stop; }))
+          writeSummary (out, true);
+      });
+  }
+
+  void Trace::stopPeriodicSummary ()
+  {
+    TraceRegistry & registry = traceRegistry ();
+    if (!registry.periodic_thread.joinable ())
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock (registry.periodic_mutex);
+      registry.periodic_stop = true;
+    }
+    registry.periodic_cond.notify_all ();
+    registry.periodic_thread.join ();
+  }
+
+  /* Number of events which didn't fit into the buffers anymore.
+   */
+  uint64_t Trace::getDroppedEvents ()
+  {
+    TraceRegistry & registry = traceRegistry ();
+    std::lock_guard<std::mutex> lock (registry.mutex);
+
+    uint64_t dropped = 0;
+    for (const auto & buffer: registry.buffers)
+      dropped += buffer->dropped.load (std::memory_order_relaxed);
+
+    return dropped;
+  }
+}
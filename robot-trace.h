@@ -0,0 +1,70 @@
+/*
+ *
+ */
+
+#ifndef ROBOT_TRACE_H
+#define ROBOT_TRACE_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/* Instrumentation of the hot paths.
+ *
+ * Only active if PATHFINDER_TRACE is defined (CMake option PATHFINDER_TRACE), otherwise the
+ * macros expand to nothing:
+ *
+ *   PATHFINDER_TRACE_SCOPE ("join");           // time the rest of the enclosing block
+ *   PATHFINDER_TRACE_COUNT ("scan.points", n); // add n to a counter
+ */
+#ifdef PATHFINDER_TRACE
+#  define PATHFINDER_TRACE_CONCAT2(a, b) a##b
+#  define PATHFINDER_TRACE_CONCAT(a, b) PATHFINDER_TRACE_CONCAT2 (a, b)
+#  define PATHFINDER_TRACE_SCOPE(name) \
+     Pathfinder::TraceScope PATHFINDER_TRACE_CONCAT (pathfinder_trace_scope_, __LINE__) (name)
+#  define PATHFINDER_TRACE_COUNT(name, value) Pathfinder::Trace::count (name, value)
+#else
+#  define PATHFINDER_TRACE_SCOPE(name) ((void) 0)
+#  define PATHFINDER_TRACE_COUNT(name, value) ((void) 0)
+#endif
+
+namespace Pathfinder
+{
+  /* Collector of the trace events.
+   *
+   * Every thread writes into its own buffer, which is only appended to, so recording an event
+   * needs no lock. Only the first event of a thread registers its buffer under a mutex, it is
+   * released when the thread exits and its events were drained. A buffer holds up to 1M
+   * events not drained yet, further ones are dropped; writeSummary (out, true) drains them.
+   * Names must be string literals (or otherwise live as long as the program), only the
+   * pointers are stored.
+   */
+  class Trace
+  {
+    public:
+      static uint64_t now ();
+      static void record (const char * name, uint64_t start_ns, uint64_t duration_ns);
+      static void count (const char * name, int64_t value);
+
+      static bool writeChromeTrace (const std::string & file_name);
+      static void writeSummary (std::ostream & out, bool since_last_summary);
+      static void startPeriodicSummary (std::ostream & out, uint32_t interval_ms);
+      static void stopPeriodicSummary ();
+      static uint64_t getDroppedEvents ();
+  };
+
+  /* Times its own lifetime and records it under name.
+   */
+  class TraceScope
+  {
+    public:
+      TraceScope (const char * name) : _name (name), _start (Trace::now ()) {}
+      ~TraceScope () { Trace::record (_name, _start, Trace::now () - _start); }
+
+    private:
+      const char * _name;
+      uint64_t _start;
+  };
+}
+
+#endif